@@ -3,18 +3,23 @@
 #include "build.h"
 
 #define CC "gcc"
-#define CFALGS "-O2", "-g0", "-static"
+#define CFALGS "-O2", "-g0", "-static", "-pthread"
 
 const char *files[] = {
 	"kbd",
-	"test"
+	"test",
+	"bench",
+	"client"
 };
 
-void create_kernel_essentials(const char *path, const char *rootfs_out, const char *initramfs_out);
+void create_kernel_essentials(struct build_graph *g, const char *path, const char *rootfs_out, const char *initramfs_out);
 
 int main(int argc, char **argv)
 {
 	create_directories("bin out shared");
+
+	struct build_graph g;
+	build_graph_init(&g, build_parallelism(argc, argv));
 	
 	struct download_info d_infos[] = {
 		(struct download_info) {
@@ -35,33 +40,37 @@ int main(int argc, char **argv)
 		},
 	};
 
-	download(sizeof(d_infos) / sizeof(d_infos[0]), d_infos);
+	download_jobs(&g, sizeof(d_infos) / sizeof(d_infos[0]), d_infos);
 
 	size_t len = sizeof(files) / sizeof(files[0]);
 
+	/** headers are found by the compiler (-MD), only the source is listed **/
 	for (size_t i = 0; i < len; ++i)
 	{
-		if (needs_recompilation(writef("shared/%s", files[i]), (const char*[]){ writef("src/%s.c", files[i]) }, 1))
-			CMD(CC, CFALGS, writef("src/%s.c", files[i]), "-o", writef("shared/%s", files[i]));
+		JOB(&g, (const char*[]){ writef("src/%s.c", files[i]) }, 1, (const char*[]){ writef("shared/%s", files[i]) }, 1,
+				CC, CFALGS, writef("src/%s.c", files[i]), "-o", writef("shared/%s", files[i]));
 	}
 
-	if (needs_recompilation(writef("shared/card"), (const char*[]){ "src/card.c" }, 1))
-		CMD(CC, CFALGS, "-I/usr/include/libdrm/", "src/card.c", "-o", "shared/card", "-ldrm");
+	JOB(&g, (const char*[]){ "src/card.c" }, 1, (const char*[]){ "shared/card" }, 1,
+			CC, CFALGS, "-I/usr/include/libdrm/", "src/card.c", "-o", "shared/card", "-ldrm");
+
+	if (!is_file_exists("out/rootfs.ext4"))
+		create_kernel_essentials(&g, "rootfs", "out/rootfs.ext4", "out/initramfs.cpio");
 
-	char *test = run_command("test -f out/rootfs.ext4 && echo 0 || echo 1");
-	if (test[0] == '1')
-		create_kernel_essentials("rootfs", "out/rootfs.ext4", "out/initramfs.cpio");
+	build_run(&g);
 
 	return 0;
 }
 
-void create_kernel_essentials(const char *path, const char *rootfs_out, const char *initramfs_out)
+/*
+ * create_kernel_essentials(struct build_graph *, const char *, const char *, const char *)
+ * adds the jobs making the root filesystem image and initramfs from busybox.
+ * Jobs run side by side, so paths are given under `path` instead of changing into it.
+*/
+void create_kernel_essentials(struct build_graph *g, const char *path, const char *rootfs_out, const char *initramfs_out)
 {
 	if (path == NULL || rootfs_out == NULL || initramfs_out == NULL) ERROR("[!] PASSING NULL TO ARGUMENT CAN BE DANGEROUS.");
 
-	CMD("mkdir", "-p", path);
-	chdir(path);
-
 	const char *basic_linux_dirs[] = {
 		"bin",
 		"sbin",
@@ -81,15 +90,33 @@ void create_kernel_essentials(const char *path, const char *rootfs_out, const ch
 	};
 
 	size_t basic_linux_dirs_len = sizeof(basic_linux_dirs) / sizeof(basic_linux_dirs[0]);
+	const char *mkdir_argv[basic_linux_dirs_len + 2];
+	mkdir_argv[0] = "mkdir";
+	mkdir_argv[1] = "-p";
 	for (size_t i = 0; i < basic_linux_dirs_len; ++i)
-		CMD("mkdir", "-p", basic_linux_dirs[i]);
+		mkdir_argv[i + 2] = writef("%s/%s", path, basic_linux_dirs[i]);
+
+	struct build_job *dirs = build_job_argv(g, NULL, 0, NULL, 0, basic_linux_dirs_len + 2, mkdir_argv);
+
+	/** everything in the tree, the image and the initramfs are made after it **/
+	struct build_job *tree = PHONY(g);
+
+	/** sudo may ask for a password, one at a time on the terminal **/
+	struct build_job *devices[] = {
+		JOB(g, NULL, 0, NULL, 0, "sudo", "mknod", "-m", "666", writef("%s/dev/null", path), "c", "1", "3"),
+		JOB(g, NULL, 0, NULL, 0, "sudo", "mknod", "-m", "666", writef("%s/dev/zero", path), "c", "1", "5"),
+		JOB(g, NULL, 0, NULL, 0, "sudo", "mknod", "-m", "622", writef("%s/dev/console", path), "c", "5", "1"),
+	};
 
-	CMD("sudo", "mknod", "-m", "666", "dev/null", "c", "1", "3");
-	CMD("sudo", "mknod", "-m", "666", "dev/zero", "c", "1", "5");
-	CMD("sudo", "mknod", "-m", "622", "dev/console", "c", "5", "1");
+	for (size_t i = 0; i < sizeof(devices) / sizeof(devices[0]); ++i)
+	{
+		devices[i]->console = true;
+		build_after(devices[i], dirs);
+		build_after(tree, devices[i]);
+	}
 
-	char *busybox_path = run_command("which busybox");
-	size_t busybox_path_len = strlen(busybox_path);
+	char *busybox_path = RUN("which", "busybox");
+	size_t busybox_path_len = busybox_path ? strlen(busybox_path) : 0;
 
 	if (busybox_path_len <= 0)
 	{
@@ -97,33 +124,59 @@ void create_kernel_essentials(const char *path, const char *rootfs_out, const ch
 		ERROR("No busybox found, exiting.");
 	}
 
-	CMD("cp", substr(busybox_path, 0, strlen(busybox_path) - 1), "bin/");
+	struct build_job *job = JOB(g, NULL, 0, NULL, 0, "cp", substr(busybox_path, 0, strlen(busybox_path) - 1), writef("%s/bin/", path));
+	build_after(job, dirs);
+	build_after(tree, job);
 
-	char *busybox_items = run_command("busybox --list");
+	char *busybox_items = RUN("busybox", "--list");
 	size_t n; char **busybox_item_list = separate('\n', busybox_items, &n);
 
 	for (size_t i = 0; i < n; ++i)
-		if (!strcmp(busybox_item_list[i], "busybox")) continue;
-		else CMD("ln", "-s", "busybox", writef("bin/%s", busybox_item_list[i]));
+	{
+		if (!strcmp(busybox_item_list[i], "busybox") || !busybox_item_list[i][0]) continue;
 
-	CMD("cp ../script/init .");
-	CMD("chmod", "+x", "init");
-	chdir("..");
+		job = JOB(g, NULL, 0, NULL, 0, "ln", "-s", "busybox", writef("%s/bin/%s", path, busybox_item_list[i]));
+		build_after(job, dirs);
+		build_after(tree, job);
+	}
 
-	CMD("dd", "if=/dev/zero", writef("of=%s", rootfs_out), "bs=1M", "count=64");
-	CMD("mkfs.ext4", "-F", rootfs_out);
+	const char *init = writef("%s/init", path);
+	job = JOB(g, (const char*[]){ "script/init" }, 1, (const char*[]){ init }, 1, "cp", "script/init", (char*)init);
+	build_after(job, dirs);
+	build_after(tree, job);
+
+	job = JOB(g, (const char*[]){ init }, 1, NULL, 0, "chmod", "+x", (char*)init);
+	build_after(tree, job);
+
+	/** the empty image is made while the tree is put together **/
+	struct build_job *image = JOB(g, NULL, 0, (const char*[]){ rootfs_out }, 1, "dd", "if=/dev/zero", writef("of=%s", rootfs_out), "bs=1M", "count=64");
+	struct build_job *mkfs = JOB(g, (const char*[]){ rootfs_out }, 1, NULL, 0, "mkfs.ext4", "-F", (char*)rootfs_out);
+	build_after(mkfs, image);
+
+	struct build_job *mount_steps[] = {
+		JOB(g, NULL, 0, NULL, 0, "mkdir", "-p", "mnt"),
+		JOB(g, NULL, 0, NULL, 0, "sudo", "mount", "-o", "loop", (char*)rootfs_out, "mnt"),
+		JOB(g, NULL, 0, NULL, 0, "sudo", "cp", "-r", writef("%s/.", path), "mnt"),
+		JOB(g, NULL, 0, NULL, 0, "sudo", "umount", "mnt"),
+		JOB(g, NULL, 0, NULL, 0, "rmdir", "mnt"),
+	};
 
-	CMD("mkdir", "-p", "mnt");
-	CMD("sudo", "mount", "-o", "loop", rootfs_out, "mnt");
-	CMD("sudo", "cp", "-r", writef("%s/*", path), "mnt");
-	CMD("sudo", "umount", "mnt");
-	CMD("rmdir", "mnt");
+	build_after(mount_steps[0], mkfs);
+	build_after(mount_steps[0], tree);
+	for (size_t i = 1; i < sizeof(mount_steps) / sizeof(mount_steps[0]); ++i)
+	{
+		mount_steps[i]->console = !strcmp(mount_steps[i]->argv[0], "sudo");
+		build_after(mount_steps[i], mount_steps[i - 1]);
+	}
 
-	chdir(path);
-	CMD("find", ".", "|", "cpio", "-H", "newc", "-o", ">", writef("../%s", initramfs_out));
-	chdir("..");
+	struct build_job *cpio = JOB(g, NULL, 0, (const char*[]){ initramfs_out }, 1,
+			"cd", (char*)path, "&&", "find", ".", "|", "cpio", "-H", "newc", "-o", ">", writef("../%s", initramfs_out));
+	cpio->shell = true;
+	build_after(cpio, tree);
 
-	CMD("rm -r", path);
+	job = JOB(g, NULL, 0, NULL, 0, "rm", "-r", (char*)path);
+	build_after(job, cpio);
+	build_after(job, mount_steps[sizeof(mount_steps) / sizeof(mount_steps[0]) - 1]);
 
-	INFO("`%s` and `%s` have been created.", rootfs_out, initramfs_out);
+	INFO("`%s` and `%s` will be created.", rootfs_out, initramfs_out);
 }
@@ -30,8 +30,10 @@
 #include <dirent.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -41,7 +43,11 @@
 #endif
 
 #if __unix__
+	#include <errno.h>
+	#include <spawn.h>
 	#include <sys/wait.h>
+
+	extern char **environ;
 #endif
 
 // If user has not define file for auto compilation
@@ -57,6 +63,16 @@
 	#endif
 #endif // BUILD_OUTPUT_FILE
 
+// Where the hashes of inputs and built targets are kept between runs
+#ifndef BUILD_DB_FILE
+	#define BUILD_DB_FILE ".build.db"
+#endif // BUILD_DB_FILE
+
+// Where compilers write the headers they read, never next to outputs that get shipped
+#ifndef BUILD_DEPFILE_DIR
+	#define BUILD_DEPFILE_DIR ".build.deps"
+#endif // BUILD_DEPFILE_DIR
+
 #ifndef CMD_DEBUG_OUTPUT
 	#define CMD_DEBUG_OUTPUT true
 #endif // CMD_DEBUG_OUTPUT
@@ -93,10 +109,76 @@ struct download_info
 	const char *tar_command;
 };
 
+typedef enum {
+	JOB_WAITING = 0,
+	JOB_RUNNING,
+	JOB_DONE
+} BUILD_JOB_STATE;
+
+/*
+ * One step of a build graph: a command, the files it reads and the files
+ * it writes. A job whose input is another job's output runs after it.
+ */
+struct build_job
+{
+	const char **argv;			// NULL terminated, NULL for a phony job that only groups others
+	size_t argc;
+	const char **inputs;
+	size_t num_inputs;
+	const char **outputs;
+	size_t num_outputs;
+	bool console;						// runs alone with the terminal, for commands that may prompt (sudo)
+	bool shell;							// runs through /bin/sh, for pipes, redirections and globs
+	const char *depfile;		// headers the compiler found, inputs from the second build on
+
+	struct build_job **deps;
+	size_t num_deps;
+
+	BUILD_JOB_STATE state;
+	bool ran;								// it ran in this build, so everything after it runs too
+	uint64_t signature;			// hash of the command and the inputs it is built from
+	pid_t pid;
+	FILE *log;							// stdout and stderr of the job, printed once it exits
+};
+
+/*
+ * Build database: sorted fixed size records, mmap'd as they are.
+ * Files record their content hash with the stat it was taken at,
+ * targets the signature they were last built with.
+ */
+#define BUILD_DB_MAGIC 0x31424442u // "BDB1"
+
+struct build_db_record
+{
+	uint64_t key;						// hash of the path, seeded by the kind of record
+	uint64_t hash;
+	int64_t mtime_ns;
+	uint64_t size;
+	uint64_t ino;
+};
+
+struct build_db_header
+{
+	uint32_t magic;
+	uint32_t record_size;
+	uint64_t count;
+};
+
+struct build_graph
+{
+	struct build_job **jobs;
+	size_t num_jobs;
+	int max_jobs;
+};
+
 /********************************************
  * 						MACRO FUNCTIONS	
 ********************************************/
 #define CMD(...) cmd_execute(__VA_ARGS__, NULL)
+#define SHELL(...) cmd_execute("/bin/sh", "-c", join(' ', (const char*[]){ __VA_ARGS__ }, sizeof((const char*[]){ __VA_ARGS__ }) / sizeof(char*)), NULL)
+#define RUN(...) run_argv((const char*[]){ __VA_ARGS__, NULL })
+#define JOB(graph, inputs, num_inputs, outputs, num_outputs, ...) build_job_add(graph, inputs, num_inputs, outputs, num_outputs, __VA_ARGS__, NULL)
+#define PHONY(graph) build_job_argv(graph, NULL, 0, NULL, 0, 0, NULL)
 #define writef(...) ({  writef_function(__VA_ARGS__, NULL); })
 #define INFO(...) printf("%s[INFO]:%s %s\n", get_term_color(TEXT, GREEN), get_term_color(RESET, 0), writef(__VA_ARGS__))
 #define WARN(...) printf("%s[WARN]:%s %s\n", get_term_color(TEXT, YELLOW), get_term_color(RESET, 0), writef(__VA_ARGS__))
@@ -177,7 +259,9 @@ time_t get_last_modification_time(const char *filename);
  * Function: needs_recompilation(const char *binary, const char *sources[], size_t num_sources)
  * -----------------------
  *  Returns true if binary needs to be compiled,
- *  if any of the given source has been modified after the binary is created.
+ *  if the content of any of the given source changed since it was built
+ *  (see `build_db_stale`). The new state is saved by the next
+ *  `build_db_save`, call it once the binary is rebuilt.
  *
  * binary: Path to binary file (const char *)
  * sources: List of source files that needs to check for modification (const char *[])
@@ -217,21 +301,79 @@ char *join(unsigned char sep, const char **buffer, size_t n);
  */
 char **separate(unsigned char sep, const char *string, size_t *n);
 
+/*
+ * Function: process_spawn(const char *argv[], int out_fd, int err_fd, pid_t *pid)
+ * -----------------------
+ *  Starts `argv[0]`, looked up in PATH, with the arguments as they are:
+ *  there is no shell in between.
+ *
+ * argv: Program and arguments, NULL terminated (const char *[])
+ * out_fd: Where stdout goes, -1 to keep ours (int)
+ * err_fd: Where stderr goes, -1 to keep ours (int)
+ * pid: Set to the child (pid_t *)
+ *
+ * returns: 0, or the errno value of why it could not start (int)
+ */
+int process_spawn(const char *argv[], int out_fd, int err_fd, pid_t *pid);
+
+/*
+ * Function: process_wait(pid_t pid)
+ * -----------------------
+ *  Waits for a child started by `process_spawn`.
+ *
+ * pid: Child (pid_t)
+ *
+ * returns: Exit status, 128 + the signal if it was killed, -1 if waiting failed (int)
+ */
+int process_wait(pid_t pid);
+
+/*
+ * Function: process_run(const char *argv[], char **output, size_t *length)
+ * -----------------------
+ *  Runs a program and waits for it. With `output` its stdout is read through
+ *  a pipe in large blocks, stderr stays on the terminal.
+ *
+ * argv: Program and arguments, NULL terminated (const char *[])
+ * output: Set to the output, NUL terminated, may be NULL (char **)
+ * length: Set to the length of the output, may be NULL (size_t *)
+ *
+ * returns: Exit status like `process_wait`, -1 if it could not start (int)
+ *
+ * Note: Output is allocated in the heap, so it must be freed.
+ */
+int process_run(const char *argv[], char **output, size_t *length);
+
 /*
  * Function: cmd_execute(char *first, ...)
  * -----------------------
- *  Executes shell commands, using `system`.
+ *  Executes a program with arguments, without a shell; exits if it fails.
+ *  `SHELL` runs the joined arguments through /bin/sh instead, for pipes,
+ *  redirections and globs.
  *
- * first: First command (char *)
- * ...: Rest of the commands (char *)
+ * first: Program (char *)
+ * ...: Arguments (char *)
  *
  */
 void cmd_execute(char *first, ...);
 
+/*
+ * Function: run_argv(const char *argv[])
+ * -----------------------
+ *  Executes a program without a shell and returns its output, see `RUN`.
+ *
+ * argv: Program and arguments, NULL terminated (const char *[])
+ *
+ * returns: Returns output, NULL if it could not start (char *)
+ *
+ * Note: String is allocated in the heap, so it must be freed.
+ */
+char *run_argv(const char *argv[]);
+
 /*
  * Function: run_command(const char *command)
  * -----------------------
  *  Executes shell commands and returns output of the command.
+ *  It costs a shell, `RUN` does not.
  *
  * command: Command (const char *)
  *
@@ -279,6 +421,119 @@ bool is_directory_exists(const char *path);
  */
 bool is_file_exists(const char *path);
 
+/*
+ * Function: fs_stat(const char *path)
+ * -----------------------
+ *  `stat` through a cache kept for the whole run, so checking the same
+ *  file again costs a lookup. Missing files are cached too.
+ *
+ * path: Path (const char *)
+ *
+ * returns: The status, NULL if the path does not exist (const struct stat *)
+ */
+const struct stat *fs_stat(const char *path);
+
+/*
+ * Function: fs_forget(const char *path)
+ * -----------------------
+ *  Stats `path` again if the stat cache has it, after something wrote to it.
+ *
+ * path: Path (const char *)
+ *
+ */
+void fs_forget(const char *path);
+
+/*
+ * Function: fs_mkdirs(const char *path)
+ * -----------------------
+ *  `mkdir -p`: creates every missing directory of `path` in one walk,
+ *  each one relative to the one before it.
+ *
+ * path: Path (const char *)
+ *
+ * returns: 0, or the errno value of the step that failed (int)
+ */
+int fs_mkdirs(const char *path);
+
+/*
+ * Function: build_hash(const void *data, size_t len, uint64_t seed)
+ * -----------------------
+ *  XXH64 of `data`.
+ *
+ * data: Bytes (const void *)
+ * len: Length (size_t)
+ * seed: Seed, chain hashes by passing the previous one (uint64_t)
+ *
+ * returns: Hash (uint64_t)
+ */
+uint64_t build_hash(const void *data, size_t len, uint64_t seed);
+
+/*
+ * Function: build_db_file_hash(const char *path, uint64_t *hash)
+ * -----------------------
+ *  Hash of the content of a file. It is only read again when its
+ *  mtime, size or inode differ from what the database has.
+ *
+ * path: Path (const char *)
+ * hash: Set to the hash (uint64_t *)
+ *
+ * returns: False if the file does not exist (bool)
+ */
+bool build_db_file_hash(const char *path, uint64_t *hash);
+
+/*
+ * Function: build_db_stale(const char *target, const char *inputs[], size_t num_inputs, const char *argv[], size_t argc, uint64_t *signature)
+ * -----------------------
+ *  Whether `target` has to be built again: it is missing, its last build
+ *  failed, or the command, the content of an input or the compiler running
+ *  the command changed since it was last built. Before there is a database
+ *  at all, targets are judged by timestamps once.
+ *
+ * target: Path of the target (const char *)
+ * inputs: Files it is built from (const char *[])
+ * num_inputs: Length of the list (size_t)
+ * argv: Command building it, may be NULL (const char *[])
+ * argc: Length of the command (size_t)
+ * signature: Set to what to record once it is built (uint64_t *)
+ *
+ * returns: True if it has to be built (bool)
+ */
+bool build_db_stale(const char *target, const char *inputs[], size_t num_inputs, const char *argv[], size_t argc, uint64_t *signature);
+
+/*
+ * Function: build_db_record(const char *target, uint64_t signature)
+ * -----------------------
+ *  Records that `target` was built, saved by `build_db_save`.
+ *
+ * target: Path of the target (const char *)
+ * signature: From `build_db_stale` (uint64_t)
+ *
+ */
+void build_db_record(const char *target, uint64_t signature);
+
+/*
+ * Function: build_depfile_read(const char *path, size_t *n)
+ * -----------------------
+ *  Reads the prerequisites of the first rule of a Makefile style
+ *  dependency file, as written by `gcc -MD -MF path`.
+ *
+ * path: Path of the depfile (const char *)
+ * n: Set to the number of prerequisites (size_t *)
+ *
+ * returns: The prerequisites, NULL if there is no depfile (char **)
+ *
+ * Note: The list and its strings are allocated in the heap, so they must be freed.
+ */
+char **build_depfile_read(const char *path, size_t *n);
+
+/*
+ * Function: build_db_save()
+ * -----------------------
+ *  Writes the database if anything changed, `build_run` does it when it ends.
+ *
+ */
+void build_db_save();
+
 /*
  * Function: create_directories(const char *s)
  * -----------------------
@@ -310,7 +565,98 @@ void create_directories_from_path(const char *path);
  * d_info: List of items (struct download_info)
  * 
  */
-void download(size_t n, struct download_info d_info[n])
+void download(size_t n, struct download_info d_info[n]);
+
+/*
+ * Function: download_jobs(struct build_graph *g, size_t n, struct download_info d_info[n])
+ * -----------------------
+ *  Same as `download` but adds the downloads and extractions to `g`,
+ *  so they overlap with each other and with the rest of the build.
+ *
+ * g: Graph to add the jobs to (struct build_graph *)
+ * n: Size of download infos. (size_t)
+ * d_info: List of items (struct download_info)
+ *
+ */
+void download_jobs(struct build_graph *g, size_t n, struct download_info d_info[n]);
+
+/*
+ * Function: build_parallelism(int argc, char **argv)
+ * -----------------------
+ *  Reads `-jN` or `-j N` from the arguments.
+ *
+ * argc: Argument count (int)
+ * argv: Arguments (char **)
+ *
+ * returns: N, or the number of online cpus if there is no `-j` (int)
+ */
+int build_parallelism(int argc, char **argv);
+
+/*
+ * Function: build_graph_init(struct build_graph *g, int max_jobs)
+ * -----------------------
+ *  Creates an empty graph.
+ *
+ * g: Graph (struct build_graph *)
+ * max_jobs: How many jobs may run at once, 0 for one per cpu (int)
+ *
+ */
+void build_graph_init(struct build_graph *g, int max_jobs);
+
+/*
+ * Function: build_job_argv(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, size_t argc, const char *argv[])
+ * -----------------------
+ *  Adds a job to the graph. The lists are copied, the strings are not.
+ *  With argc 0 the job is phony: it runs nothing and is done once
+ *  everything it was put after (`build_after`) is done.
+ *  A compiler (gcc, cc, clang, ...) gets `-MD -MF <depfile>`, a file of
+ *  BUILD_DEPFILE_DIR named after the first output, the
+ *  headers it lists there are inputs of the job too.
+ *
+ * g: Graph (struct build_graph *)
+ * inputs: Files the command reads (const char *[])
+ * num_inputs: Length of the list (size_t)
+ * outputs: Files the command writes, the job is skipped while the first one is up to date (const char *[])
+ * num_outputs: Length of the list, 0 to always run (size_t)
+ * argc: Length of the command (size_t)
+ * argv: Command, run like `CMD` runs it (const char *[])
+ *
+ * returns: The job, for `build_after` (struct build_job *)
+ */
+struct build_job *build_job_argv(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, size_t argc, const char *argv[]);
+
+/*
+ * Function: build_job_add(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, char *first, ...)
+ * -----------------------
+ *  `build_job_argv` with the command given like `CMD`, use `JOB`.
+ *
+ * returns: The job (struct build_job *)
+ */
+struct build_job *build_job_add(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, char *first, ...);
+
+/*
+ * Function: build_after(struct build_job *job, struct build_job *dep)
+ * -----------------------
+ *  Orders `job` after `dep` when no file connects them.
+ *
+ * job: Job that waits (struct build_job *)
+ * dep: Job to wait for (struct build_job *)
+ *
+ */
+void build_after(struct build_job *job, struct build_job *dep);
+
+/*
+ * Function: build_run(struct build_graph *g)
+ * -----------------------
+ *  Runs every job that is out of date once its dependencies are done,
+ *  up to `max_jobs` at once. The output of a job is printed in one piece
+ *  when it exits. On the first failure no new job starts, the running
+ *  ones are waited for and the build exits.
+ *
+ * g: Graph (struct build_graph *)
+ *
+ */
+void build_run(struct build_graph *g);
 
 /********************************************
  * 						   DEFINITION	
@@ -398,7 +744,7 @@ char *substr(const char *string, size_t n1, size_t n2)
 		return NULL;
 	}
 
-	char *result = (char*)malloc((n2 - n1) * sizeof(char));
+	char *result = (char*)malloc((n2 - n1 + 1) * sizeof(char));
 	if (result == NULL)
 	{
 		WARN("substr: Failed to allocate buffer.");
@@ -449,35 +795,29 @@ char **get_list_of_files(const char *path, int *count)
 
 time_t get_last_modification_time(const char *filename)
 {
-	struct stat file_stat;
-	if (stat(filename, &file_stat) == -1) {
-		perror(writef("Failed to get file status: %s, ", filename));
+	const struct stat *file_stat = fs_stat(filename);
+	if (file_stat == NULL) {
+		WARN("Failed to get file status: %s", filename);
 		return (time_t)(-1);  // Return -1 on error
 	}
 
-	return file_stat.st_mtime;
+	return file_stat->st_mtime;
 }
 
 bool needs_recompilation(const char *binary, const char *sources[], size_t num_sources)
 {
-	time_t binary_timestamp = get_last_modification_time(binary);
-	if (binary_timestamp == (time_t)(-1))
-		return true;
-
-	for (size_t i = 0; i < num_sources; ++i) {
-		time_t source_timestamp = get_last_modification_time(sources[i]);
-		if (source_timestamp == (time_t)(-1)) {
-			fprintf(stderr, "Failed to get modification time for source file: %s\n", sources[i]);
-			continue;
-		}
+	for (size_t i = 0; i < num_sources; ++i)
+		if (fs_stat(sources[i]) == NULL)
+			fprintf(stderr, "Failed to get status of source file: %s\n", sources[i]);
 
-		if (source_timestamp > binary_timestamp)
-			return true;
-	}
+	uint64_t signature;
+	bool stale = build_db_stale(binary, sources, num_sources, NULL, 0, &signature);
+	build_db_record(binary, signature);
 
-	INFO("`%s` is already updated.", binary);
+	if (!stale)
+		INFO("`%s` is already updated.", binary);
 
-	return false;
+	return stale;
 }
 
 char *join(unsigned char sep, const char **buffer, size_t n)
@@ -519,7 +859,7 @@ char *join(unsigned char sep, const char **buffer, size_t n)
 	}
 
 	// create a final buffer to be returned.
-	char *bf = (char*)malloc(ptr_in_pool);
+	char *bf = (char*)malloc(ptr_in_pool + 1);
 	bf = strncpy(bf, pool, ptr_in_pool);
 	bf[ptr_in_pool] = '\0'; // don't forget to add null ptr, it is pain in the ass.
 	
@@ -552,7 +892,7 @@ char **separate(unsigned char sep, const char *string, size_t *n)
 			char *sub_str = substr(string, p1, p2);
 			size_t sub_str_len = strlen(sub_str);
 
-			buffer[b_idx] = (char*)malloc(sub_str_len * sizeof(char));
+			buffer[b_idx] = (char*)malloc((sub_str_len + 1) * sizeof(char));
 			strcpy(buffer[b_idx], sub_str);
 
 			free(sub_str);
@@ -564,7 +904,7 @@ char **separate(unsigned char sep, const char *string, size_t *n)
 	char *sub_str = substr(string, p1, strlen(string));
 	size_t sub_str_len = strlen(sub_str);
 
-	buffer[b_idx] = (char*)malloc(sub_str_len * sizeof(char));
+	buffer[b_idx] = (char*)malloc((sub_str_len + 1) * sizeof(char));
 	strcpy(buffer[b_idx], sub_str);
 
 	free(sub_str);
@@ -589,7 +929,7 @@ void cmd_execute(char *first, ...)
 	}
 	va_end(args);
 
-	char *buffer[length + 1];
+	char *buffer[length + 2];
 
 	length = 0;
 	buffer[length++] = first;
@@ -602,6 +942,8 @@ void cmd_execute(char *first, ...)
 		buffer[length++] = next;
 	}
 	va_end(args);
+
+	buffer[length] = NULL;
 	
 	char *b = join(' ', (const char**)buffer, length);
 
@@ -609,49 +951,131 @@ void cmd_execute(char *first, ...)
 	INFO("CMD: %s", b);
 #endif
 
-	int status = system(b);
+	int status = process_run((const char**)buffer, NULL, NULL);
 	if (status != 0)
 	{
 		ERROR("Failed: %s", b);
-		exit(EXIT_FAILURE);
-		free(b);
 	}
 
 	free(b);
 }
 
-char *run_command(const char *command)
+int process_spawn(const char *argv[], int out_fd, int err_fd, pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+
+	if (out_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	if (err_fd >= 0)
+		posix_spawn_file_actions_adddup2(&actions, err_fd, STDERR_FILENO);
+
+	/** buffered output would be written twice otherwise, by us and by the child **/
+	fflush(stdout);
+	fflush(stderr);
+
+	int err = posix_spawnp(pid, argv[0], &actions, NULL, (char *const *)argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	return err;
+}
+
+int process_wait(pid_t pid)
 {
-	char* result = NULL;
-	size_t size = 0;
-	FILE* fp = popen(command, "r");
-	if (fp == NULL)
+	int status;
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR) return -1;
+
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : -1;
+}
+
+int process_run(const char *argv[], char **output, size_t *length)
+{
+	int fds[2] = { -1, -1 };
+
+	/** close on exec, so no other child keeps the write end and the read never ends **/
+	if (output != NULL)
 	{
-		perror("popen failed");
-		return NULL;
+		if (pipe(fds) == -1)
+			return -1;
+
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
 	}
 
-	// Read the output a line at a time
-	char buffer[128];
-	while (fgets(buffer, sizeof(buffer), fp) != NULL)
+	pid_t pid;
+	int err = process_spawn(argv, fds[1], -1, &pid);
+	if (fds[1] != -1)
+		close(fds[1]);
+
+	if (err != 0)
+	{
+		if (fds[0] != -1)
+			close(fds[0]);
+
+		WARN("Failed to start `%s` (%s).", argv[0], strerror(err));
+		return -1;
+	}
+
+	if (output != NULL)
 	{
-		size_t len = strlen(buffer);
-		char* new_result = realloc(result, size + len + 1);
-		if (new_result == NULL)
+		const size_t BLOCK_SIZE = 64 * 1024;
+
+		size_t size = 0, capacity = 0;
+		char *result = NULL;
+
+		for (;;)
 		{
-			perror("realloc failed");
-			free(result);
-			pclose(fp);
-			return NULL;
+			if (capacity - size < BLOCK_SIZE + 1)
+			{
+				capacity = capacity ? capacity * 2 : BLOCK_SIZE + 1;
+				char *grown = (char*)realloc(result, capacity);
+				if (grown == NULL)
+					break;
+
+				result = grown;
+			}
+
+			ssize_t n = read(fds[0], result + size, BLOCK_SIZE);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+
+			size += n;
 		}
-		result = new_result;
-		memcpy(result + size, buffer, len);
-		size += len;
-		result[size] = '\0';
+
+		close(fds[0]);
+
+		if (result != NULL)
+			result[size] = '\0';
+
+		*output = result;
+		if (length != NULL)
+			*length = size;
 	}
 
-	pclose(fp);
-	return result;
+	return process_wait(pid);
+}
+
+char *run_argv(const char *argv[])
+{
+	char *output = NULL;
+	if (process_run(argv, &output, NULL) == -1)
+	{
+		free(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+char *run_command(const char *command)
+{
+	return run_argv((const char*[]){ "/bin/sh", "-c", command, NULL });
 }
 
 bool strlistcmp(const char *s1, const char **s2, size_t n)
@@ -662,92 +1086,1190 @@ bool strlistcmp(const char *s1, const char **s2, size_t n)
 	return false;
 }
 
-bool is_directory_exists(const char *path)
+/*
+ * Stat cache: open addressing on the FNV-1a hash of the path,
+ * grown to keep it at most half full.
+*/
+struct fs_entry
 {
-	char *t = run_command(writef("test -d %s && echo 0 || echo 1", path));
-	return !atoi(t);
-}
+	char *path;
+	uint64_t hash;
+	bool exists;
+	struct stat st;
+};
 
-bool is_file_exists(const char *path)
+static struct fs_entry *fs_entries;
+static size_t fs_capacity, fs_count;
+
+static uint64_t fs_hash(const char *path)
 {
-	char *t = run_command(writef("test -f %s && echo 0 || echo 1", path));
-	return !atoi(t);
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (; *path; ++path)
+		h = (h ^ (unsigned char)*path) * 0x100000001b3ull;
+
+	return h;
 }
 
-void create_directories(const char *s)
+/*
+ * fs_slot()
+ *
+ * Slot of `path`, or the empty one it goes into.
+*/
+static struct fs_entry *fs_slot(struct fs_entry *entries, size_t capacity, const char *path, uint64_t hash)
 {
-	size_t n;
-	char **bf = separate(' ', s, &n);
+	size_t i = hash & (capacity - 1);
+	while (entries[i].path != NULL && (entries[i].hash != hash || strcmp(entries[i].path, path)))
+		i = (i + 1) & (capacity - 1);
 
-	for (size_t i = 0; i < n; ++i)
-	{
-		if (!is_directory_exists(bf[i]))
-			CMD("mkdir", bf[i]);
-	}
+	return &entries[i];
 }
 
-void create_directories_from_path(const char *path)
+const struct stat *fs_stat(const char *path)
 {
-	size_t n;
-	char **d = separate('/', path, &n);
+	if (fs_count * 2 >= fs_capacity)
+	{
+		size_t capacity = fs_capacity ? fs_capacity * 2 : 256;
+		struct fs_entry *entries = (struct fs_entry*)calloc(capacity, sizeof(struct fs_entry));
+		if (entries == NULL)
+			ERROR("fs: Failed to allocate the stat cache.");
+
+		for (size_t i = 0; i < fs_capacity; ++i)
+			if (fs_entries[i].path != NULL)
+				*fs_slot(entries, capacity, fs_entries[i].path, fs_entries[i].hash) = fs_entries[i];
+
+		free(fs_entries);
+		fs_entries = entries;
+		fs_capacity = capacity;
+	}
 
-	size_t p2 = 0;
-	for (size_t i = 0; i < n; ++i)
+	uint64_t hash = fs_hash(path);
+	struct fs_entry *e = fs_slot(fs_entries, fs_capacity, path, hash);
+
+	if (e->path == NULL)
 	{
-		char *d_name = d[i];
-		p2 += strlen(d_name) + 1;
+		e->path = strdup(path);
+		e->hash = hash;
+		e->exists = fstatat(AT_FDCWD, path, &e->st, 0) == 0;
+		fs_count++;
+	}
 
-		char *ss = substr(path, 0, p2);
+	return e->exists ? &e->st : NULL;
+}
 
-		if (!is_directory_exists(ss))
-			CMD("mkdir", ss);
+void fs_forget(const char *path)
+{
+	if (fs_capacity == 0)
+		return;
 
-		free(ss);
-	}
+	uint64_t hash = fs_hash(path);
+	struct fs_entry *e = fs_slot(fs_entries, fs_capacity, path, hash);
+	if (e->path == NULL)
+		return;
 
-	free(d);
+	/** the entry stays, it is only refreshed: removing would break the probe chains **/
+	e->exists = fstatat(AT_FDCWD, path, &e->st, 0) == 0;
 }
 
-void download(size_t n, struct download_info d_info[n])
+int fs_mkdirs(const char *path)
 {
-	for (size_t i = 0; i < n; ++i)
+	size_t len = strlen(path);
+	char buffer[len + 1];
+	memcpy(buffer, path, len + 1);
+
+	int dir = AT_FDCWD;
+	if (buffer[0] == '/')
 	{
-		struct download_info df = d_info[i];
+		dir = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir == -1)
+			return errno;
+	}
 
-		create_directories_from_path(df.out_dir);
+	int err = 0;
+	char *name = buffer;
 
-		const char *path = writef("%s%s", df.out_dir, df.filename);
-		if (!is_file_exists(path))
-			CMD("curl", "-L", "-o", path, df.url);
+	while (*name != '\0')
+	{
+		while (*name == '/')
+			name++;
 
-		if (df.extract && !is_directory_exists(df.extract_in_dir))
+		char *end = strchr(name, '/');
+		if (end != NULL)
+			*end = '\0';
+
+		if (*name != '\0')
 		{
-			create_directories_from_path(df.extract_in_dir);
-			CMD((char*)df.tar_command, (char*)path, "-C", df.extract_in_dir, "-v");
+			if (mkdirat(dir, name, 0755) == -1 && errno != EEXIST)
+			{
+				err = errno;
+				break;
+			}
+
+			int next = openat(dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (next == -1)
+			{
+				err = errno;
+				break;
+			}
+
+			if (dir != AT_FDCWD)
+				close(dir);
+
+			dir = next;
 		}
+
+		if (end == NULL)
+			break;
+
+		/** the cache may hold the prefix as missing **/
+		fs_forget(buffer);
+		*end = '/';
+		name = end + 1;
 	}
+
+	if (dir != AT_FDCWD)
+		close(dir);
+
+	fs_forget(path);
+	return err;
+}
+
+bool is_directory_exists(const char *path)
+{
+	const struct stat *st = fs_stat(path);
+	return st != NULL && S_ISDIR(st->st_mode);
 }
 
+bool is_file_exists(const char *path)
+{
+	const struct stat *st = fs_stat(path);
+	return st != NULL && S_ISREG(st->st_mode);
+}
 
-/*
- * build_itself()
- *
- * It is a function that gets called automatically,
- * it checks the status of current build source and build binary.
- * If it needs recompilition then it would do it.
-*/
-void build_itself() __attribute__((constructor));
-void build_itself()
+void create_directories(const char *s)
 {
-	const char *sources[] = { BUILD_SOURCE_FILE, "build.h" };
-	if (needs_recompilation(BUILD_OUTPUT_FILE, sources, sizeof(sources) / sizeof(sources[0])))
+	while (*s != '\0')
 	{
-		INFO("Source file has changed, it needs to be recompiled.");
-		CMD("gcc", BUILD_SOURCE_FILE, "-I.", "-o", writef("%s.new", BUILD_OUTPUT_FILE));
+		size_t len = strcspn(s, " ");
+		if (len > 0)
+		{
+			char *dir = substr(s, 0, len);
+			int err = fs_mkdirs(dir);
+			if (err != 0)
+				ERROR("Failed to create `%s` (%s).", dir, strerror(err));
+
+			free(dir);
+		}
+
+		s += len + (s[len] == ' ');
+	}
+}
+
+void create_directories_from_path(const char *path)
+{
+	int err = fs_mkdirs(path);
+	if (err != 0)
+		ERROR("Failed to create `%s` (%s).", path, strerror(err));
+}
+
+#define BUILD_HASH_P1 11400714785074694791ull
+#define BUILD_HASH_P2 14029467366897019727ull
+#define BUILD_HASH_P3 1609587929392839161ull
+#define BUILD_HASH_P4 9650029242287828579ull
+#define BUILD_HASH_P5 2870177450012600261ull
+
+static inline uint64_t build_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t build_hash_round(uint64_t acc, uint64_t input)
+{
+	return build_rotl(acc + input * BUILD_HASH_P2, 31) * BUILD_HASH_P1;
+}
+
+static inline uint64_t build_hash_merge(uint64_t acc, uint64_t v)
+{
+	return (acc ^ build_hash_round(0, v)) * BUILD_HASH_P1 + BUILD_HASH_P4;
+}
+
+uint64_t build_hash(const void *data, size_t len, uint64_t seed)
+{
+	const uint8_t *p = (const uint8_t*)data, *end = p + len;
+	uint64_t h, k;
+	uint32_t w;
+
+	if (len >= 32)
+	{
+		uint64_t v[4] = { seed + BUILD_HASH_P1 + BUILD_HASH_P2, seed + BUILD_HASH_P2, seed, seed - BUILD_HASH_P1 };
+
+		for (; p + 32 <= end; p += 32)
+			for (int i = 0; i < 4; ++i)
+			{
+				memcpy(&k, p + i * 8, 8);
+				v[i] = build_hash_round(v[i], k);
+			}
+
+		h = build_rotl(v[0], 1) + build_rotl(v[1], 7) + build_rotl(v[2], 12) + build_rotl(v[3], 18);
+		for (int i = 0; i < 4; ++i)
+			h = build_hash_merge(h, v[i]);
+	}
+	else
+		h = seed + BUILD_HASH_P5;
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		memcpy(&k, p, 8);
+		h = build_rotl(h ^ build_hash_round(0, k), 27) * BUILD_HASH_P1 + BUILD_HASH_P4;
+	}
+
+	if (p + 4 <= end)
+	{
+		memcpy(&w, p, 4);
+		h = build_rotl(h ^ (uint64_t)w * BUILD_HASH_P1, 23) * BUILD_HASH_P2 + BUILD_HASH_P3;
+		p += 4;
+	}
+
+	for (; p < end; ++p)
+		h = build_rotl(h ^ *p * BUILD_HASH_P5, 11) * BUILD_HASH_P1;
+
+	h ^= h >> 33;
+	h *= BUILD_HASH_P2;
+	h ^= h >> 29;
+	h *= BUILD_HASH_P3;
+	return h ^ (h >> 32);
+}
+
+/*
+ * The database as loaded (`map`, sorted) and what this run changed
+ * (`changes`, newest last), merged when saved.
+*/
+static struct
+{
+	bool loaded;
+	bool exists;
+	void *map;
+	size_t map_size;
+	const struct build_db_record *records;
+	size_t count;
+
+	struct build_db_record *changes;
+	size_t num_changes;
+	size_t capacity;
+} build_db;
+
+#define BUILD_DB_FILE_SEED 0
+#define BUILD_DB_TARGET_SEED 1
+
+/** signature recorded for the output of a failed job, it never matches **/
+#define BUILD_DB_FAILED 0
+
+static void build_db_load()
+{
+	build_db.loaded = true;
+
+	int fd = open(BUILD_DB_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	build_db.exists = true;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct build_db_header))
+	{
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		const struct build_db_header *header = (const struct build_db_header*)map;
+
+		/** anything unexpected is an empty database, it is only a cache **/
+		if (map != MAP_FAILED && header->magic == BUILD_DB_MAGIC && header->record_size == sizeof(struct build_db_record)
+				&& header->count <= (st.st_size - sizeof(struct build_db_header)) / sizeof(struct build_db_record))
+		{
+			build_db.map = map;
+			build_db.map_size = st.st_size;
+			build_db.records = (const struct build_db_record*)(header + 1);
+			build_db.count = header->count;
+		}
+		else if (map != MAP_FAILED)
+			munmap(map, st.st_size);
+	}
+
+	close(fd);
+}
+
+/*
+ * build_db_find()
+ *
+ * Latest record of `key`, NULL if there is none.
+*/
+static const struct build_db_record *build_db_find(uint64_t key)
+{
+	if (!build_db.loaded)
+		build_db_load();
+
+	for (size_t i = build_db.num_changes; i-- > 0;)
+		if (build_db.changes[i].key == key)
+			return &build_db.changes[i];
+
+	size_t lo = 0, hi = build_db.count;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (build_db.records[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < build_db.count && build_db.records[lo].key == key ? &build_db.records[lo] : NULL;
+}
+
+static void build_db_put(struct build_db_record record)
+{
+	for (size_t i = 0; i < build_db.num_changes; ++i)
+		if (build_db.changes[i].key == record.key)
+		{
+			build_db.changes[i] = record;
+			return;
+		}
+
+	if (build_db.num_changes == build_db.capacity)
+	{
+		build_db.capacity = build_db.capacity ? build_db.capacity * 2 : 64;
+		build_db.changes = (struct build_db_record*)realloc(build_db.changes, build_db.capacity * sizeof(struct build_db_record));
+		if (build_db.changes == NULL)
+			ERROR("build: Failed to allocate database records.");
+	}
+
+	build_db.changes[build_db.num_changes++] = record;
+}
+
+bool build_db_file_hash(const char *path, uint64_t *hash)
+{
+	const struct stat *st = fs_stat(path);
+	if (st == NULL)
+		return false;
+
+	int64_t mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+	uint64_t key = build_hash(path, strlen(path), BUILD_DB_FILE_SEED);
+
+	const struct build_db_record *r = build_db_find(key);
+	if (r != NULL && r->mtime_ns == mtime_ns && r->size == (uint64_t)st->st_size && r->ino == (uint64_t)st->st_ino)
+	{
+		*hash = r->hash;
+		return true;
+	}
+
+	/** directories have no content to hash, what is in them is not followed **/
+	uint64_t h = build_hash(NULL, 0, 0);
+	if (S_ISREG(st->st_mode) && st->st_size > 0)
+	{
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		void *data = fd == -1 ? MAP_FAILED : mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (fd != -1)
+			close(fd);
+
+		if (data == MAP_FAILED)
+			return false;
+
+		h = build_hash(data, st->st_size, 0);
+		munmap(data, st->st_size);
+	}
+
+	build_db_put((struct build_db_record){ key, h, mtime_ns, (uint64_t)st->st_size, (uint64_t)st->st_ino });
+
+	*hash = h;
+	return true;
+}
+
+/*
+ * build_which()
+ *
+ * Path of the program `name` runs, as posix_spawnp finds it in PATH.
+*/
+static const char *build_which(const char *name)
+{
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	const char *path = getenv("PATH");
+	while (path != NULL && *path != '\0')
+	{
+		size_t len = strcspn(path, ":");
+		char *candidate = writef("%.*s/%s", (int)len, path, name);
+
+		const struct stat *st = fs_stat(candidate);
+		if (st != NULL && S_ISREG(st->st_mode) && (st->st_mode & 0111))
+			return candidate;
+
+		free(candidate);
+		path += len + (path[len] == ':');
+	}
+
+	return NULL;
+}
+
+/*
+ * build_is_compiler()
+ *
+ * Whether `program` is a C or C++ compiler that writes depfiles,
+ * cross compilers (aarch64-linux-gnu-gcc) included.
+*/
+static bool build_is_compiler(const char *program)
+{
+	const char *name = strrchr(program, '/');
+	name = name ? name + 1 : program;
+
+	return !strcmp(name, "cc") || !strcmp(name, "c++") || strstr(name, "gcc") || strstr(name, "g++") || strstr(name, "clang");
+}
+
+/*
+ * build_signature()
+ *
+ * Hash of the command, the compiler running it (a new compiler rebuilds
+ * everything, other programs are not hashed) and every input by path and
+ * content.
+*/
+static uint64_t build_signature(const char *inputs[], size_t num_inputs, const char *argv[], size_t argc)
+{
+	uint64_t h = build_hash(&argc, sizeof(argc), 0), content;
+
+	for (size_t i = 0; i < argc; ++i)
+		h = build_hash(argv[i], strlen(argv[i]) + 1, h);
+
+	const char *program = argc && build_is_compiler(argv[0]) ? build_which(argv[0]) : NULL;
+	if (program != NULL && build_db_file_hash(program, &content))
+		h = build_hash(&content, sizeof(content), h);
+
+	for (size_t i = 0; i < num_inputs; ++i)
+	{
+		h = build_hash(inputs[i], strlen(inputs[i]) + 1, h);
+		content = 0;
+		if (build_db_file_hash(inputs[i], &content))
+			h = build_hash(&content, sizeof(content), h);
+		else
+			h = build_hash("", 1, h);
+	}
+
+	return h;
+}
+
+bool build_db_stale(const char *target, const char *inputs[], size_t num_inputs, const char *argv[], size_t argc, uint64_t *signature)
+{
+	*signature = build_signature(inputs, num_inputs, argv, argc);
+
+	const struct stat *binary = fs_stat(target);
+	if (binary == NULL)
+		return true;
+
+	const struct build_db_record *r = build_db_find(build_hash(target, strlen(target), BUILD_DB_TARGET_SEED));
+	if (r != NULL)
+		return r->hash != *signature;
+
+	/** a database that does not know the target never saw it built **/
+	if (build_db.exists)
+		return true;
+
+	/** no database yet: trust the timestamps once, it is recorded from now on **/
+	for (size_t i = 0; i < num_inputs; ++i)
+	{
+		const struct stat *st = fs_stat(inputs[i]);
+		if (st != NULL && st->st_mtime > binary->st_mtime)
+			return true;
+	}
+
+	build_db_record(target, *signature);
+	return false;
+}
+
+void build_db_record(const char *target, uint64_t signature)
+{
+	build_db_put((struct build_db_record){ build_hash(target, strlen(target), BUILD_DB_TARGET_SEED), signature, 0, 0, 0 });
+}
+
+char **build_depfile_read(const char *path, size_t *n)
+{
+	*n = 0;
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t len = 0, capacity = 4096;
+	char *data = (char*)malloc(capacity);
+	for (size_t r; data != NULL && (r = fread(data + len, 1, capacity - len, f)) > 0;)
+	{
+		len += r;
+		if (len == capacity)
+			data = (char*)realloc(data, capacity *= 2);
+	}
+
+	fclose(f);
+
+	char *token = (char*)malloc(len + 1);
+	char **deps = NULL;
+	size_t count = 0, t = 0, i = 0;
+
+	if (data == NULL || token == NULL)
+	{
+		free(data);
+		free(token);
+		return NULL;
+	}
+
+	/** the target ends at a colon followed by a space, `C:\path` style colons are part of it **/
+	for (; i < len && !(data[i] == ':' && (i + 1 == len || data[i + 1] == ' ' || data[i + 1] == '\t' || data[i + 1] == '\n' || data[i + 1] == '\r')); ++i)
+		if (data[i] == '\\' && i + 1 < len) i++;
+
+	/** prerequisites up to the end of the rule, -MP adds empty rules after it **/
+	for (++i; i <= len; ++i)
+	{
+		char c = i < len ? data[i] : '\n';
+		bool separator = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+		if (c == '\\' && i + 1 < len && (data[i + 1] == '\n' || data[i + 1] == '\r'))
+		{
+			i += data[i + 1] == '\r' && i + 2 < len && data[i + 2] == '\n' ? 2 : 1;
+			c = ' ';
+			separator = true;
+		}
+		else if (c == '\\' && i + 1 < len && (data[i + 1] == ' ' || data[i + 1] == '#'))
+		{
+			token[t++] = data[++i];
+			continue;
+		}
+		else if (c == '$' && i + 1 < len && data[i + 1] == '$')
+		{
+			token[t++] = data[++i];
+			continue;
+		}
+
+		if (!separator)
+		{
+			token[t++] = c;
+			continue;
+		}
+
+		if (t > 0)
+		{
+			deps = (char**)realloc(deps, (count + 1) * sizeof(char*));
+			deps[count++] = substr(token, 0, t);
+			t = 0;
+		}
+
+		if (c == '\n')
+			break;
+	}
+
+	free(token);
+	free(data);
+
+	*n = count;
+	return deps;
+}
+
+static int build_db_compare(const void *a, const void *b)
+{
+	uint64_t x = ((const struct build_db_record*)a)->key, y = ((const struct build_db_record*)b)->key;
+	return (x > y) - (x < y);
+}
+
+void build_db_save()
+{
+	if (build_db.num_changes == 0)
+		return;
+
+	/** changed records first, so the stable sort keeps them over the loaded ones **/
+	size_t total = build_db.num_changes + build_db.count;
+	struct build_db_record *records = (struct build_db_record*)malloc(total * sizeof(struct build_db_record));
+	if (records == NULL)
+	{
+		WARN("build: Failed to allocate the database, it is not saved.");
+		return;
+	}
+
+	qsort(build_db.changes, build_db.num_changes, sizeof(struct build_db_record), build_db_compare);
+
+	size_t n = 0, i = 0, j = 0;
+	while (i < build_db.num_changes || j < build_db.count)
+	{
+		if (j == build_db.count || (i < build_db.num_changes && build_db.changes[i].key <= build_db.records[j].key))
+		{
+			if (j < build_db.count && build_db.changes[i].key == build_db.records[j].key)
+				j++;
+
+			records[n++] = build_db.changes[i++];
+		}
+		else
+			records[n++] = build_db.records[j++];
+	}
+
+	const char *tmp = BUILD_DB_FILE ".tmp";
+	FILE *f = fopen(tmp, "wb");
+	struct build_db_header header = { BUILD_DB_MAGIC, sizeof(struct build_db_record), n };
+
+	bool ok = f != NULL && fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(records, sizeof(struct build_db_record), n, f) == n;
+	if (f != NULL)
+		ok = fclose(f) == 0 && ok;
+
+	/** renamed over the old one, a run that dies halfway never leaves half a database **/
+	if (!ok || rename(tmp, BUILD_DB_FILE) == -1)
+	{
+		WARN("build: Failed to save `%s`.", BUILD_DB_FILE);
+		unlink(tmp);
+	}
+
+	free(records);
+
+	/** what is saved now is the base, the changes are in it **/
+	if (build_db.map != NULL)
+		munmap(build_db.map, build_db.map_size);
+
+	build_db.map = NULL;
+	build_db.records = NULL;
+	build_db.count = 0;
+	build_db.num_changes = 0;
+	build_db.loaded = false;
+}
+
+void download(size_t n, struct download_info d_info[n])
+{
+	struct build_graph g;
+	build_graph_init(&g, 0);
+
+	download_jobs(&g, n, d_info);
+	build_run(&g);
+}
+
+void download_jobs(struct build_graph *g, size_t n, struct download_info d_info[n])
+{
+	for (size_t i = 0; i < n; ++i)
+	{
+		struct download_info df = d_info[i];
+
+		create_directories_from_path(df.out_dir);
+
+		const char *path = writef("%s%s", df.out_dir, df.filename);
+		struct build_job *fetch = JOB(g, NULL, 0, (const char*[]){ path }, 1, "curl", "-L", "-o", (char*)path, (char*)df.url);
+
+		/*
+		 * The directory is the output, so it is made by the job itself;
+		 * a fresh download extracts again.
+		 */
+		if (df.extract)
+		{
+			struct build_job *extract = JOB(g, NULL, 0, (const char*[]){ df.extract_in_dir }, 1,
+					"mkdir", "-p", (char*)df.extract_in_dir, "&&", (char*)df.tar_command, (char*)path, "-C", (char*)df.extract_in_dir, "-v");
+			extract->shell = true;
+			build_after(extract, fetch);
+		}
+	}
+}
+
+int build_parallelism(int argc, char **argv)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "-j", 2))
+			continue;
+
+		int jobs = atoi(argv[i][2] ? argv[i] + 2 : (i + 1 < argc ? argv[i + 1] : "0"));
+		if (jobs > 0)
+			return jobs;
+	}
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+void build_graph_init(struct build_graph *g, int max_jobs)
+{
+	g->jobs = NULL;
+	g->num_jobs = 0;
+	g->max_jobs = max_jobs > 0 ? max_jobs : build_parallelism(0, NULL);
+}
+
+/*
+ * build_copy_list()
+ *
+ * Copies a list of strings into a NULL terminated one on the heap,
+ * the lists given to JOB are compound literals of the caller's block.
+*/
+static const char **build_copy_list(const char **list, size_t n)
+{
+	const char **copy = (const char**)malloc((n + 1) * sizeof(char*));
+	if (copy == NULL)
+		ERROR("build: Failed to allocate a list.");
+
+	for (size_t i = 0; i < n; ++i)
+		copy[i] = list[i];
+
+	copy[n] = NULL;
+	return copy;
+}
+
+struct build_job *build_job_argv(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, size_t argc, const char *argv[])
+{
+	struct build_job *job = (struct build_job*)calloc(1, sizeof(struct build_job));
+	g->jobs = (struct build_job**)realloc(g->jobs, (g->num_jobs + 1) * sizeof(struct build_job*));
+	if (job == NULL || g->jobs == NULL)
+		ERROR("build: Failed to allocate a job.");
+
+	job->inputs = build_copy_list(inputs, num_inputs);
+	job->num_inputs = num_inputs;
+	job->outputs = build_copy_list(outputs, num_outputs);
+	job->num_outputs = num_outputs;
+	job->argv = argc ? build_copy_list(argv, argc) : NULL;
+	job->argc = argc;
+
+	/** -MD and not -MMD: system headers (linux/input.h, libdrm) change with packages **/
+	if (argc > 0 && num_outputs > 0 && build_is_compiler(argv[0]))
+	{
+		/** shared/card gives .build.deps/shared%card.d, the directory is flat **/
+		char *depfile = writef("%s/%s.d", BUILD_DEPFILE_DIR, outputs[0]);
+		for (char *c = depfile + strlen(BUILD_DEPFILE_DIR) + 1; *c != '\0'; ++c)
+			if (*c == '/') *c = '%';
+
+		int err = fs_mkdirs(BUILD_DEPFILE_DIR);
+		if (err != 0)
+			ERROR("build: Failed to create `%s` (%s).", BUILD_DEPFILE_DIR, strerror(err));
+
+		job->depfile = depfile;
+		job->argv = (const char**)realloc(job->argv, (argc + 4) * sizeof(char*));
+		if (job->argv == NULL)
+			ERROR("build: Failed to allocate a job.");
+
+		job->argv[argc++] = "-MD";
+		job->argv[argc++] = "-MF";
+		job->argv[argc++] = job->depfile;
+		job->argv[argc] = NULL;
+		job->argc = argc;
+	}
+
+	g->jobs[g->num_jobs++] = job;
+	return job;
+}
+
+struct build_job *build_job_add(struct build_graph *g, const char *inputs[], size_t num_inputs, const char *outputs[], size_t num_outputs, char *first, ...)
+{
+	size_t length = 1;
+
+	va_list args;
+	va_start(args, first);
+	while (va_arg(args, char*) != NULL)
+		length++;
+	va_end(args);
+
+	const char *buffer[length];
+	buffer[0] = first;
+
+	va_start(args, first);
+	for (size_t i = 1; i < length; ++i)
+		buffer[i] = va_arg(args, char*);
+	va_end(args);
+
+	return build_job_argv(g, inputs, num_inputs, outputs, num_outputs, length, buffer);
+}
+
+void build_after(struct build_job *job, struct build_job *dep)
+{
+	for (size_t i = 0; i < job->num_deps; ++i)
+		if (job->deps[i] == dep) return;
+
+	job->deps = (struct build_job**)realloc(job->deps, (job->num_deps + 1) * sizeof(struct build_job*));
+	if (job->deps == NULL)
+		ERROR("build: Failed to allocate dependencies.");
+
+	job->deps[job->num_deps++] = dep;
+}
+
+/*
+ * build_resolve()
+ *
+ * Puts every job after the jobs writing its inputs.
+*/
+static void build_resolve(struct build_graph *g)
+{
+	for (size_t i = 0; i < g->num_jobs; ++i)
+		for (size_t j = 0; j < g->num_jobs; ++j)
+		{
+			if (i == j) continue;
+
+			for (size_t k = 0; k < g->jobs[i]->num_inputs; ++k)
+				if (strlistcmp(g->jobs[i]->inputs[k], g->jobs[j]->outputs, g->jobs[j]->num_outputs))
+					build_after(g->jobs[i], g->jobs[j]);
+		}
+}
+
+/*
+ * build_job_inputs()
+ *
+ * The declared inputs followed by what the job's depfile lists, the
+ * depfile strings are freed by build_job_inputs_free().
+*/
+static const char **build_job_inputs(const struct build_job *job, size_t *n, size_t *num_depfile)
+{
+	char **deps = job->depfile ? build_depfile_read(job->depfile, num_depfile) : NULL;
+	if (deps == NULL)
+		*num_depfile = 0;
+
+	*n = job->num_inputs + *num_depfile;
+	const char **inputs = (const char**)malloc((*n + 1) * sizeof(char*));
+	if (inputs == NULL)
+		ERROR("build: Failed to allocate inputs.");
+
+	memcpy(inputs, job->inputs, job->num_inputs * sizeof(char*));
+	memcpy(inputs + job->num_inputs, deps, *num_depfile * sizeof(char*));
+
+	free(deps);
+	return inputs;
+}
+
+static void build_job_inputs_free(const struct build_job *job, const char **inputs, size_t num_depfile)
+{
+	for (size_t i = 0; i < num_depfile; ++i)
+		free((char*)inputs[job->num_inputs + i]);
+
+	free(inputs);
+}
+
+/*
+ * build_job_stale()
+ *
+ * A job runs when it has no outputs, one of them is missing, its command
+ * or an input changed since it was built (build_db_stale), or something
+ * it comes after ran.
+*/
+static bool build_job_stale(struct build_job *job)
+{
+	if (job->num_outputs == 0)
+		return true;
+
+	size_t num_inputs, num_depfile;
+	const char **inputs = build_job_inputs(job, &num_inputs, &num_depfile);
+
+	bool stale = build_db_stale(job->outputs[0], inputs, num_inputs, job->argv, job->argc, &job->signature);
+	build_job_inputs_free(job, inputs, num_depfile);
+
+	for (size_t i = 1; i < job->num_outputs; ++i)
+		stale = stale || fs_stat(job->outputs[i]) == NULL;
+
+	for (size_t i = 0; i < job->num_deps; ++i)
+		stale = stale || job->deps[i]->ran;
+
+	return stale;
+}
+
+/*
+ * build_job_start()
+ *
+ * Spawns the job's command with its output going to a temporary file,
+ * false if it could not start.
+*/
+static bool build_job_start(struct build_job *job)
+{
+	char *command = join(' ', job->argv, job->argc);
+
+#if CMD_DEBUG_OUTPUT
+	INFO("CMD: %s", command);
+#endif
+
+	/** without a temporary file the output goes straight to the terminal **/
+	job->log = job->console ? NULL : tmpfile();
+
+	int fd = job->log ? fileno(job->log) : -1;
+	if (fd != -1)
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	const char **argv = job->shell ? (const char*[]){ "/bin/sh", "-c", command, NULL } : job->argv;
+
+	int err = process_spawn(argv, fd, fd, &job->pid);
+	if (err != 0)
+	{
+		WARN("Failed to start: %s(%s)", command, strerror(err));
+		if (job->log != NULL)
+			fclose(job->log);
+
+		job->log = NULL;
+		job->state = JOB_DONE;
+		free(command);
+		return false;
+	}
+
+	job->state = JOB_RUNNING;
+	free(command);
+	return true;
+}
+
+/*
+ * build_job_flush()
+ *
+ * Prints what the job wrote and closes its log.
+*/
+static void build_job_flush(struct build_job *job)
+{
+	if (job->log == NULL)
+		return;
+
+	char buffer[64 * 1024];
+	size_t n;
+
+	rewind(job->log);
+	while ((n = fread(buffer, 1, sizeof(buffer), job->log)) > 0)
+		fwrite(buffer, 1, n, stdout);
+
+	fflush(stdout);
+	fclose(job->log);
+	job->log = NULL;
+}
+
+void build_run(struct build_graph *g)
+{
+	build_resolve(g);
+
+	size_t finished = 0, running = 0;
+	bool console = false;
+	struct build_job *failed = NULL, *console_next = NULL;
+
+	while (finished < g->num_jobs)
+	{
+		bool skipped = false;
+
+		/** a console job waits until nothing runs, and nothing else starts meanwhile **/
+		if (console_next != NULL && running == 0 && failed == NULL)
+		{
+			if (build_job_start(console_next))
+			{
+				running++;
+				console = true;
+			}
+			else
+			{
+				failed = console_next;
+				finished++;
+			}
+
+			console_next = NULL;
+		}
+
+		for (size_t i = 0; i < g->num_jobs && failed == NULL && !console && console_next == NULL && running < (size_t)g->max_jobs; ++i)
+		{
+			struct build_job *job = g->jobs[i];
+			if (job->state != JOB_WAITING)
+				continue;
+
+			bool ready = true, deps_ran = false;
+			for (size_t d = 0; d < job->num_deps; ++d)
+			{
+				ready = ready && job->deps[d]->state == JOB_DONE;
+				deps_ran = deps_ran || job->deps[d]->ran;
+			}
+
+			if (!ready)
+				continue;
+
+			if (job->argv == NULL || !build_job_stale(job))
+			{
+				job->state = JOB_DONE;
+				job->ran = job->argv == NULL && deps_ran;
+				finished++;
+				skipped = true;
+
+				if (job->argv != NULL)
+					INFO("`%s` is already updated.", job->outputs[0]);
+
+				continue;
+			}
+
+			if (job->console && running > 0)
+			{
+				console_next = job;
+				break;
+			}
+
+			if (!build_job_start(job))
+			{
+				failed = job;
+				finished++;
+				break;
+			}
+
+			running++;
+			console = job->console;
+		}
+
+		/** skipped jobs may have made earlier ones ready **/
+		if (skipped)
+			continue;
+
+		if (running == 0)
+		{
+			if (failed != NULL)
+				break;
+
+			ERROR("build: %zu jobs wait on each other, the graph has a cycle.", g->num_jobs - finished);
+		}
+
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if (pid == -1)
+		{
+			if (errno == EINTR) continue;
+			ERROR("build: waitpid failed (%s).", strerror(errno));
+		}
+
+		struct build_job *job = NULL;
+		for (size_t i = 0; i < g->num_jobs && job == NULL; ++i)
+			if (g->jobs[i]->state == JOB_RUNNING && g->jobs[i]->pid == pid)
+				job = g->jobs[i];
+
+		if (job == NULL)
+			continue;
+
+		job->state = JOB_DONE;
+		job->ran = true;
+		console = console && !job->console;
+		running--;
+		finished++;
+
+		build_job_flush(job);
+
+		for (size_t i = 0; i < job->num_outputs; ++i)
+			fs_forget(job->outputs[i]);
+
+		bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+		/** the depfile was just written, sign with the headers it lists now **/
+		if (ok && job->depfile != NULL)
+		{
+			size_t num_inputs, num_depfile;
+			const char **inputs = build_job_inputs(job, &num_inputs, &num_depfile);
+
+			job->signature = build_signature(inputs, num_inputs, job->argv, job->argc);
+			build_job_inputs_free(job, inputs, num_depfile);
+		}
+
+		/** a failed job may leave partial outputs behind, they must not pass for built **/
+		if (job->num_outputs > 0)
+			build_db_record(job->outputs[0], ok ? job->signature : BUILD_DB_FAILED);
+
+		if (!ok && failed == NULL)
+		{
+			failed = job;
+			if (running > 0)
+				WARN("Waiting for %zu running jobs.", running);
+		}
+	}
+
+	/** what did get built is kept, even when the build failed **/
+	build_db_save();
+
+	if (failed != NULL)
+	{
+		ERROR("Failed: %s", join(' ', failed->argv, failed->argc));
+	}
+}
+
+
+#ifdef __unix__
+/*
+ * build_self_argv()
+ *
+ * The arguments this process was started with, a constructor is not
+ * given them: read back from /proc/self/cmdline. NULL if it can not be read.
+*/
+static char **build_self_argv()
+{
+	FILE *f = fopen("/proc/self/cmdline", "rb");
+	if (f == NULL)
+		return NULL;
+
+	size_t len = 0, capacity = 4096;
+	char *data = (char*)malloc(capacity);
+	for (size_t r; data != NULL && (r = fread(data + len, 1, capacity - len - 1, f)) > 0;)
+	{
+		len += r;
+		if (len + 1 == capacity)
+			data = (char*)realloc(data, capacity *= 2);
+	}
+
+	fclose(f);
+
+	if (data == NULL || len == 0)
+	{
+		free(data);
+		return NULL;
+	}
+
+	/** every argument ends with a NUL, the last one may not when it was rewritten **/
+	data[len] = '\0';
+	size_t argc = data[len - 1] != '\0';
+	for (size_t i = 0; i < len; ++i)
+		argc += data[i] == '\0';
+
+	char **argv = (char**)malloc((argc + 1) * sizeof(char*));
+	if (argv == NULL)
+	{
+		free(data);
+		return NULL;
+	}
+
+	for (size_t i = 0, a = 0; a < argc; i += strlen(data + i) + 1)
+		argv[a++] = data + i;
+
+	argv[argc] = NULL;
+	return argv;
+}
+#endif
+
+/*
+ * build_itself()
+ *
+ * It is a function that gets called automatically,
+ * it checks the status of current build source and build binary.
+ * If it needs recompilition then it would do it,
+ * and the new binary takes the run over with the same arguments.
+*/
+void build_itself() __attribute__((constructor));
+void build_itself()
+{
+	/** what the last compile included, `build.h` before there is a depfile **/
+	const char *depfile = BUILD_OUTPUT_FILE ".d";
+	size_t n;
+	char **deps = build_depfile_read(depfile, &n);
+
+	const char *fallback[] = { BUILD_SOURCE_FILE, "build.h" };
+	const char **sources = deps ? (const char**)deps : fallback;
+	n = deps ? n : sizeof(fallback) / sizeof(fallback[0]);
+
+	if (needs_recompilation(BUILD_OUTPUT_FILE, sources, n))
+	{
+		INFO("Source file has changed, it needs to be recompiled.");
+		CMD("gcc", BUILD_SOURCE_FILE, "-I.", "-o", writef("%s.new", BUILD_OUTPUT_FILE), "-MD", "-MF", (char*)depfile);
 		CMD("mv", BUILD_OUTPUT_FILE, writef("%s.old", BUILD_OUTPUT_FILE));
 		CMD("mv", writef("%s.new", BUILD_OUTPUT_FILE), BUILD_OUTPUT_FILE);
+
+		/** signed with the headers the new depfile lists, or the next run rebuilds again **/
+		uint64_t signature;
+		deps = build_depfile_read(depfile, &n);
+		if (deps != NULL)
+		{
+			build_db_stale(BUILD_OUTPUT_FILE, (const char**)deps, n, NULL, 0, &signature);
+			build_db_record(BUILD_OUTPUT_FILE, signature);
+		}
+
+		build_db_save();
 #ifdef __unix__
-		CMD(writef("./%s", BUILD_OUTPUT_FILE));
+		/** exec, not spawn: -jN and the other arguments reach the new binary, its status is ours **/
+		char *self = writef("./%s", BUILD_OUTPUT_FILE);
+		char *bare[] = { self, NULL };
+		char **args = build_self_argv();
+		if (args != NULL)
+			args[0] = self;
+
+		fflush(NULL);
+		execv(self, args != NULL ? args : bare);
+		ERROR("build: Failed to run the new %s (%s).", self, strerror(errno));
 #endif
 		exit(0);
 	}
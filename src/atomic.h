@@ -0,0 +1,433 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+#include "damage.h"
+
+#ifndef ATOMIC_MAX_OVERLAYS
+	#define ATOMIC_MAX_OVERLAYS 4
+#endif // ATOMIC_MAX_OVERLAYS
+
+typedef enum {
+	PLANE_FB_ID = 0,
+	PLANE_CRTC_ID,
+	PLANE_SRC_X,
+	PLANE_SRC_Y,
+	PLANE_SRC_W,
+	PLANE_SRC_H,
+	PLANE_CRTC_X,
+	PLANE_CRTC_Y,
+	PLANE_CRTC_W,
+	PLANE_CRTC_H,
+	PLANE_FB_DAMAGE_CLIPS,
+	PLANE_TYPE,
+	PLANE_PROP_COUNT
+} ATOMIC_PLANE_PROP;
+
+typedef enum {
+	CRTC_ACTIVE = 0,
+	CRTC_MODE_ID,
+	CRTC_PROP_COUNT
+} ATOMIC_CRTC_PROP;
+
+typedef enum {
+	CONNECTOR_CRTC_ID = 0,
+	CONNECTOR_PROP_COUNT
+} ATOMIC_CONNECTOR_PROP;
+
+struct atomic_plane
+{
+	uint32_t id;
+	uint32_t type;		/* DRM_PLANE_TYPE_* */
+	uint32_t props[PLANE_PROP_COUNT];
+
+	/** what the next commit puts on screen, fb = 0 turns the plane off **/
+	uint32_t fb;
+	int32_t x;
+	int32_t y;
+	uint32_t w;
+	uint32_t h;
+};
+
+struct atomic_state
+{
+	int fd;
+	uint32_t crtc_id;
+	uint32_t connector_id;
+	drmModeModeInfo mode;
+	uint32_t mode_blob;
+	uint32_t damage_blob;		/* FB_DAMAGE_CLIPS of the next commit, 0 = whole plane */
+
+	uint32_t crtc_props[CRTC_PROP_COUNT];
+	uint32_t connector_props[CONNECTOR_PROP_COUNT];
+
+	struct atomic_plane primary;
+	struct atomic_plane overlays[ATOMIC_MAX_OVERLAYS];	/* kept off, another master may have left them on */
+	int overlay_count;
+	struct atomic_plane cursor;		/* id = 0 if the crtc has no cursor plane */
+
+	bool modeset;		/* next commit has to set the mode */
+	bool validate;	/* plane layout changed since the last TEST_ONLY */
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: atomic_supported(int fd)
+ * -----------------------
+ *  Asks the driver for DRM_CLIENT_CAP_ATOMIC.
+ *
+ * returns: False when the driver only has the legacy api (bool)
+ */
+bool atomic_supported(int fd);
+
+/*
+ * Function: atomic_init(struct atomic_state *a, int fd, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode)
+ * -----------------------
+ *  Looks up the property ids of the crtc and connector, discovers
+ *  the primary and overlay planes usable on `crtc_id` and creates
+ *  the blob for `mode`.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int atomic_init(struct atomic_state *a, int fd, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode);
+
+/*
+ * Function: atomic_set_cursor(struct atomic_state *a, uint32_t fb, int32_t x, int32_t y, uint32_t w, uint32_t h)
+ * -----------------------
+ *  Places framebuffer `fb` (w x h, not scaled) on the cursor plane at x, y,
+ *  fb = 0 turns it off. Moving it alone does not need a new TEST_ONLY.
+ *  Takes effect with the next commit.
+ *
+ * returns: 0 on success, -ENOENT if the crtc has no cursor plane (int)
+ */
+int atomic_set_cursor(struct atomic_state *a, uint32_t fb, int32_t x, int32_t y, uint32_t w, uint32_t h);
+
+/*
+ * Function: atomic_set_damage(struct atomic_state *a, const struct damage *d)
+ * -----------------------
+ *  Attaches the changed rectangles of the primary framebuffer
+ *  to the next commit through FB_DAMAGE_CLIPS, NULL clears them.
+ *  Does nothing if the plane has no such property.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int atomic_set_damage(struct atomic_state *a, const struct damage *d);
+
+/*
+ * Function: atomic_commit(struct atomic_state *a, uint32_t fb, void *user_data)
+ * -----------------------
+ *  Scans out `fb` on the primary plane together with the cursor plane
+ *  on the next vblank. A changed plane layout is checked with
+ *  DRM_MODE_ATOMIC_TEST_ONLY first, the real commit is non-blocking
+ *  and sends a page-flip event carrying `user_data`.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int atomic_commit(struct atomic_state *a, uint32_t fb, void *user_data);
+
+/*
+ * Function: atomic_destroy(struct atomic_state *a)
+ * -----------------------
+ *  Releases the mode and damage blobs.
+ */
+void atomic_destroy(struct atomic_state *a);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static const char *atomic_plane_prop_names[PLANE_PROP_COUNT] = {
+	"FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+	"CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H", "FB_DAMAGE_CLIPS", "type"
+};
+
+static const char *atomic_crtc_prop_names[CRTC_PROP_COUNT] = { "ACTIVE", "MODE_ID" };
+static const char *atomic_connector_prop_names[CONNECTOR_PROP_COUNT] = { "CRTC_ID" };
+
+/*
+ * atomic_lookup()
+ *
+ * Fills `ids` (and `values` if given) with the properties called `names`
+ * on the object, missing properties are left 0.
+*/
+static void atomic_lookup(int fd, uint32_t object, uint32_t type, const char **names, int count, uint32_t *ids, uint64_t *values)
+{
+	memset(ids, 0, count * sizeof(*ids));
+
+	drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object, type);
+	if (!props)
+		return;
+
+	for (uint32_t i = 0; i < props->count_props; ++i)
+	{
+		drmModePropertyPtr prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		for (int j = 0; j < count; ++j)
+		{
+			if (!strcmp(prop->name, names[j]))
+			{
+				ids[j] = prop->prop_id;
+				if (values)
+					values[j] = props->prop_values[i];
+			}
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	drmModeFreeObjectProperties(props);
+}
+
+static int atomic_crtc_index(int fd, uint32_t crtc_id)
+{
+	drmModeResPtr res = drmModeGetResources(fd);
+	if (!res)
+		return -1;
+
+	int index = -1;
+	for (int i = 0; i < res->count_crtcs; ++i)
+		if (res->crtcs[i] == crtc_id)
+			index = i;
+
+	drmModeFreeResources(res);
+	return index;
+}
+
+bool atomic_supported(int fd)
+{
+	return drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+}
+
+static int atomic_discover_planes(struct atomic_state *a)
+{
+	int crtc_index = atomic_crtc_index(a->fd, a->crtc_id);
+	if (crtc_index < 0)
+		return -ENOENT;
+
+	drmModePlaneResPtr planes = drmModeGetPlaneResources(a->fd);
+	if (!planes)
+		return -errno;
+
+	for (uint32_t i = 0; i < planes->count_planes; ++i)
+	{
+		drmModePlanePtr plane = drmModeGetPlane(a->fd, planes->planes[i]);
+		if (!plane)
+			continue;
+
+		if (plane->possible_crtcs & (1u << crtc_index))
+		{
+			struct atomic_plane p;
+			uint64_t values[PLANE_PROP_COUNT] = { 0 };
+
+			memset(&p, 0, sizeof(p));
+			p.id = plane->plane_id;
+			atomic_lookup(a->fd, p.id, DRM_MODE_OBJECT_PLANE, atomic_plane_prop_names, PLANE_PROP_COUNT, p.props, values);
+			p.type = values[PLANE_TYPE];
+
+			/** prefer the primary plane which already scans out this crtc **/
+			if (p.type == DRM_PLANE_TYPE_PRIMARY && (!a->primary.id || plane->crtc_id == a->crtc_id))
+				a->primary = p;
+			else if (p.type == DRM_PLANE_TYPE_OVERLAY && a->overlay_count < ATOMIC_MAX_OVERLAYS)
+				a->overlays[a->overlay_count++] = p;
+			else if (p.type == DRM_PLANE_TYPE_CURSOR && !a->cursor.id)
+				a->cursor = p;
+		}
+
+		drmModeFreePlane(plane);
+	}
+
+	drmModeFreePlaneResources(planes);
+
+	return a->primary.id ? 0 : -ENOENT;
+}
+
+int atomic_init(struct atomic_state *a, int fd, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode)
+{
+	memset(a, 0, sizeof(*a));
+	a->fd = fd;
+	a->crtc_id = crtc_id;
+	a->connector_id = connector_id;
+	a->mode = *mode;
+	a->modeset = true;
+	a->validate = true;
+
+	atomic_lookup(fd, crtc_id, DRM_MODE_OBJECT_CRTC, atomic_crtc_prop_names, CRTC_PROP_COUNT, a->crtc_props, NULL);
+	atomic_lookup(fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, atomic_connector_prop_names, CONNECTOR_PROP_COUNT, a->connector_props, NULL);
+
+	if (!a->crtc_props[CRTC_ACTIVE] || !a->crtc_props[CRTC_MODE_ID] || !a->connector_props[CONNECTOR_CRTC_ID])
+		return -ENOTSUP;
+
+	int ret = atomic_discover_planes(a);
+	if (ret < 0)
+		return ret;
+
+	if (drmModeCreatePropertyBlob(fd, &a->mode, sizeof(a->mode), &a->mode_blob))
+		return -errno;
+
+	a->primary.w = mode->hdisplay;
+	a->primary.h = mode->vdisplay;
+
+	INFO("Atomic: primary plane %u, %d overlay planes, cursor plane %u on crtc %u", a->primary.id, a->overlay_count, a->cursor.id, crtc_id);
+
+	return 0;
+}
+
+static void atomic_clear_damage(struct atomic_state *a)
+{
+	if (a->damage_blob)
+		drmModeDestroyPropertyBlob(a->fd, a->damage_blob);
+
+	a->damage_blob = 0;
+}
+
+int atomic_set_damage(struct atomic_state *a, const struct damage *d)
+{
+	atomic_clear_damage(a);
+
+	if (d == NULL || d->count == 0 || !a->primary.props[PLANE_FB_DAMAGE_CLIPS])
+		return 0;
+
+	struct drm_mode_rect clips[DAMAGE_MAX_RECTS];
+	for (int i = 0; i < d->count; ++i)
+	{
+		clips[i].x1 = d->rects[i].x1;
+		clips[i].y1 = d->rects[i].y1;
+		clips[i].x2 = d->rects[i].x2;
+		clips[i].y2 = d->rects[i].y2;
+	}
+
+	if (drmModeCreatePropertyBlob(a->fd, clips, d->count * sizeof(clips[0]), &a->damage_blob))
+	{
+		a->damage_blob = 0;
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void atomic_add_plane(drmModeAtomicReqPtr req, struct atomic_state *a, struct atomic_plane *p)
+{
+	if (p->fb == 0)
+	{
+		drmModeAtomicAddProperty(req, p->id, p->props[PLANE_FB_ID], 0);
+		drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_ID], 0);
+		return;
+	}
+
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_FB_ID], p->fb);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_ID], a->crtc_id);
+
+	/** source coordinates are 16.16 fixed point **/
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_SRC_X], 0);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_SRC_Y], 0);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_SRC_W], (uint64_t)p->w << 16);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_SRC_H], (uint64_t)p->h << 16);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_X], (uint64_t)(int64_t)p->x);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_Y], (uint64_t)(int64_t)p->y);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_W], p->w);
+	drmModeAtomicAddProperty(req, p->id, p->props[PLANE_CRTC_H], p->h);
+}
+
+int atomic_set_cursor(struct atomic_state *a, uint32_t fb, int32_t x, int32_t y, uint32_t w, uint32_t h)
+{
+	if (!a->cursor.id)
+		return -ENOENT;
+
+	struct atomic_plane *p = &a->cursor;
+
+	/** the position is checked by the kernel on every commit anyway **/
+	if ((p->fb == 0) != (fb == 0) || p->w != w || p->h != h)
+		a->validate = true;
+
+	p->fb = fb;
+	p->x = x;
+	p->y = y;
+	p->w = w;
+	p->h = h;
+
+	return 0;
+}
+
+int atomic_commit(struct atomic_state *a, uint32_t fb, void *user_data)
+{
+	drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	bool validate = a->validate || a->modeset;
+
+	if (a->modeset)
+	{
+		drmModeAtomicAddProperty(req, a->connector_id, a->connector_props[CONNECTOR_CRTC_ID], a->crtc_id);
+		drmModeAtomicAddProperty(req, a->crtc_id, a->crtc_props[CRTC_MODE_ID], a->mode_blob);
+		drmModeAtomicAddProperty(req, a->crtc_id, a->crtc_props[CRTC_ACTIVE], 1);
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	a->primary.fb = fb;
+	atomic_add_plane(req, a, &a->primary);
+
+	/** the kernel drops the clips after every commit, so they only describe this frame **/
+	if (a->damage_blob)
+		drmModeAtomicAddProperty(req, a->primary.id, a->primary.props[PLANE_FB_DAMAGE_CLIPS], a->damage_blob);
+
+	/** overlays are turned off with every new layout **/
+	for (int i = 0; i < a->overlay_count && validate; ++i)
+		atomic_add_plane(req, a, &a->overlays[i]);
+
+	/** the cursor rides along, so every plane changes on the same vblank **/
+	if (a->cursor.id && (a->cursor.fb || validate))
+		atomic_add_plane(req, a, &a->cursor);
+
+	if (validate)
+	{
+		if (drmModeAtomicCommit(a->fd, req, DRM_MODE_ATOMIC_TEST_ONLY | (flags & DRM_MODE_ATOMIC_ALLOW_MODESET), NULL))
+		{
+			int ret = -errno;
+			WARN("Atomic: configuration rejected by TEST_ONLY: %s", strerror(-ret));
+			drmModeAtomicFree(req);
+			atomic_clear_damage(a);
+			return ret;
+		}
+	}
+
+	if (drmModeAtomicCommit(a->fd, req, flags, user_data))
+	{
+		int ret = -errno;
+		drmModeAtomicFree(req);
+		atomic_clear_damage(a);
+		return ret;
+	}
+
+	drmModeAtomicFree(req);
+	atomic_clear_damage(a);
+
+	a->modeset = false;
+	a->validate = false;
+
+	return 0;
+}
+
+void atomic_destroy(struct atomic_state *a)
+{
+	atomic_clear_damage(a);
+
+	if (a->mode_blob)
+		drmModeDestroyPropertyBlob(a->fd, a->mode_blob);
+
+	a->mode_blob = 0;
+}
+
+#endif // ATOMIC_H
@@ -0,0 +1,66 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct present;
+struct damage;
+struct backend;
+
+struct present_buffer
+{
+	uint32_t handle;	/* dumb buffer handle (0 when headless) */
+	uint32_t fb;			/* framebuffer id from drmModeAddFB2 (0 when headless) */
+	uint32_t width;
+	uint32_t height;
+	uint32_t bpp;			/* of the first plane */
+	uint32_t format;	/* DRM_FORMAT_* fourcc */
+	uint64_t modifier;	/* DRM_FORMAT_MOD_*, dumb and memory buffers are linear */
+	uint32_t pitch;		/* of every plane, the second one starts at pitch * height */
+	uint64_t size;
+	uint8_t *map;
+	uint64_t seq;			/* submit number this buffer was last queued with, 0 = never */
+};
+
+/*
+ * What the presentation engine needs from a device.
+ * backend_drm.h drives a dri device, backend_memory.h keeps every buffer
+ * in memory and simulates the vblank, so the render path can be measured
+ * without display hardware.
+ */
+struct backend_ops
+{
+	const char *name;
+
+	/** storage and scanout handle of `b` (width, height, bpp and format are set) **/
+	int (*create_buffer)(struct backend *be, struct present_buffer *b);
+	/** cpu mapping of a created buffer, stored in b->map **/
+	int (*map_buffer)(struct backend *be, struct present_buffer *b);
+	void (*destroy_buffer)(struct backend *be, struct present_buffer *b);
+
+	/** per chain setup, also sets p->wait_fd **/
+	int (*attach)(struct present *p);
+	void (*detach)(struct present *p);
+
+	/** queues the back buffer `b`, see present_submit_damage() **/
+	int (*submit)(struct present *p, struct present_buffer *b, const struct damage *d);
+	/** dispatches at most one vblank, see present_wait() **/
+	int (*wait)(struct present *p, int timeout_ms);
+	/** CLOCK_MONOTONIC ns of the latest vblank, without waiting for one **/
+	int (*vblank)(struct present *p, uint64_t *vblank_ns);
+
+	/** hardware cursor showing the ARGB buffer `b` (NULL hides it), NULL if the device has none **/
+	int (*cursor_set)(struct present *p, const struct present_buffer *b, int32_t hot_x, int32_t hot_y);
+	/** moves the top left corner of the cursor image to (x, y) **/
+	int (*cursor_move)(struct present *p, int32_t x, int32_t y);
+};
+
+struct backend
+{
+	const struct backend_ops *ops;
+	int fd;									/* dri device, -1 for the memory backend */
+	const char *dump_path;	/* memory backend only: prefix of the frame dumps, NULL = no dumps */
+};
+
+#endif // BACKEND_H
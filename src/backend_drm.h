@@ -0,0 +1,288 @@
+#ifndef BACKEND_DRM_H
+#define BACKEND_DRM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <libdrm/drm.h>
+#include <libdrm/drm_mode.h>
+#include <libdrm/drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+#include "backend.h"
+#include "present.h"
+#include "atomic.h"
+#include "damage.h"
+#include "format.h"
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: backend_init_drm(struct backend *be, int fd)
+ * -----------------------
+ *  Presents dumb buffers on an opened dri device.
+ *
+ * be: Backend to initialise (struct backend *)
+ * fd: Opened dri device, owned by the caller (int)
+ */
+void backend_init_drm(struct backend *be, int fd);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static int backend_drm_create_buffer(struct backend *be, struct present_buffer *b)
+{
+	struct drm_mode_create_dumb creq;
+	const struct format_info *f = format_lookup(b->format);
+	if (f == NULL)
+		return -EINVAL;
+
+	/** the planes of a planar format are stacked in one dumb buffer of the first plane's bpp **/
+	memset(&creq, 0, sizeof(creq));
+	creq.width = b->width;
+	creq.height = format_rows(f, b->height);
+	creq.bpp = b->bpp;
+
+	if (drmIoctl(be->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+		return -errno;
+
+	b->handle = creq.handle;
+	b->pitch = creq.pitch;
+	b->size = creq.size;
+	b->modifier = DRM_FORMAT_MOD_LINEAR;
+
+	uint32_t handles[4] = { b->handle }, pitches[4] = { b->pitch }, offsets[4] = { 0 };
+	uint64_t modifiers[4] = { b->modifier };
+
+	if (f->planes == 2)
+	{
+		handles[1] = b->handle;
+		pitches[1] = b->pitch;
+		offsets[1] = b->pitch * b->height;
+		modifiers[1] = b->modifier;
+	}
+
+	/** drivers without modifier support only take implicit (linear for dumb buffers) layouts **/
+	if (drmModeAddFB2WithModifiers(be->fd, b->width, b->height, b->format, handles, pitches, offsets, modifiers, &b->fb, DRM_MODE_FB_MODIFIERS)
+			&& drmModeAddFB2(be->fd, b->width, b->height, b->format, handles, pitches, offsets, &b->fb, 0))
+	{
+		int ret = -errno;
+		ioctl(be->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &b->handle);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int backend_drm_map_buffer(struct backend *be, struct present_buffer *b)
+{
+	struct drm_mode_map_dumb mreq;
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.handle = b->handle;
+
+	if (drmIoctl(be->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq))
+		return -errno;
+
+	b->map = mmap(0, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, be->fd, mreq.offset);
+	if (b->map == MAP_FAILED)
+	{
+		b->map = NULL;
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void backend_drm_destroy_buffer(struct backend *be, struct present_buffer *b)
+{
+	if (b->map)
+		munmap(b->map, b->size);
+
+	drmModeRmFB(be->fd, b->fb);
+	ioctl(be->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &b->handle);
+	b->map = NULL;
+}
+
+static int backend_drm_attach(struct present *p)
+{
+	p->wait_fd = p->fd;
+
+	/** parenthesised, <stdatomic.h> has a function-like atomic_init macro **/
+	if (atomic_supported(p->fd) && (atomic_init)(&p->atomic, p->fd, p->crtc_id, p->connector_id, &p->mode) == 0)
+		p->use_atomic = true;
+	else
+		atomic_destroy(&p->atomic);
+
+	INFO("crtc %u presents through %s", p->crtc_id, p->use_atomic ? "atomic commits" : "legacy page flips");
+
+	return 0;
+}
+
+static void backend_drm_detach(struct present *p)
+{
+	if (p->use_atomic)
+		atomic_destroy(&p->atomic);
+}
+
+static int backend_drm_submit(struct present *p, struct present_buffer *b, const struct damage *d)
+{
+	if (p->use_atomic)
+	{
+		/** the mode set is a full upload anyway **/
+		atomic_set_damage(&p->atomic, p->mode_set ? d : NULL);
+
+		/** the first commit sets the mode as well, both complete with a flip event **/
+		int ret = atomic_commit(&p->atomic, b->fb, p);
+		if (ret < 0)
+			return ret;
+
+		present_record_damage(p, b, p->mode_set ? d : NULL);
+		p->mode_set = true;
+		p->pending = p->back;
+		p->back = -1;
+		return 0;
+	}
+
+	if (!p->mode_set)
+	{
+		if (drmModeSetCrtc(p->fd, p->crtc_id, b->fb, 0, 0, &p->connector_id, 1, &p->mode))
+			return -errno;
+
+		present_record_damage(p, b, NULL);
+		bufpool_unpin(p->pool, p->crtc_id);
+		p->mode_set = true;
+		p->front = p->back;
+		p->back = -1;
+		p->frames++;
+		p->flip_us = present_now_ns() / 1000ull;
+		return 0;
+	}
+
+	/** no drmModeDirtyFB: drivers honouring it upload the whole plane on a flip anyway **/
+	if (drmModePageFlip(p->fd, p->crtc_id, b->fb, DRM_MODE_PAGE_FLIP_EVENT, p))
+		return -errno;
+
+	present_record_damage(p, b, d);
+
+	p->pending = p->back;
+	p->back = -1;
+
+	return 0;
+}
+
+static void backend_drm_page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec, void *user_data)
+{
+	(void)fd;
+	(void)sequence;
+
+	/** event timestamps are CLOCK_MONOTONIC since kernel 2.6.39 **/
+	present_retire((struct present*)user_data, (uint64_t)tv_sec * 1000000ull + tv_usec);
+}
+
+static int backend_drm_wait(struct present *p, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = p->fd, .events = POLLIN };
+
+	int ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	if (ret == 0)
+		return 0;
+
+	drmEventContext ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.version = 2;
+	ev.page_flip_handler = backend_drm_page_flip_handler;
+
+	if (drmHandleEvent(p->fd, &ev))
+		return -errno;
+
+	return 1;
+}
+
+static int backend_drm_vblank(struct present *p, uint64_t *vblank_ns)
+{
+	drmVBlank vbl;
+	memset(&vbl, 0, sizeof(vbl));
+
+	/** relative 0 answers at once with the count and time of the last vblank **/
+	vbl.request.type = DRM_VBLANK_RELATIVE;
+	if (p->pipe == 1)
+		vbl.request.type |= DRM_VBLANK_SECONDARY;
+	else if (p->pipe > 1)
+		vbl.request.type |= (p->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+
+	if (drmWaitVBlank(p->fd, &vbl))
+		return -errno;
+
+	*vblank_ns = (uint64_t)vbl.reply.tval_sec * 1000000000ull + (uint64_t)vbl.reply.tval_usec * 1000ull;
+	return 0;
+}
+
+/*
+ * The cursor plane of an atomic chain rides on the next frame commit: a
+ * commit of its own would still be in flight at the frame's and make the
+ * kernel refuse that one with EBUSY. Legacy chains use the cursor ioctls,
+ * which are never throttled.
+*/
+static int backend_drm_cursor_set(struct present *p, const struct present_buffer *b, int32_t hot_x, int32_t hot_y)
+{
+	if (p->use_atomic)
+	{
+		struct atomic_plane *c = &p->atomic.cursor;
+		return atomic_set_cursor(&p->atomic, b ? b->fb : 0, c->x, c->y, b ? b->width : 0, b ? b->height : 0);
+	}
+
+	if (b == NULL)
+		return drmModeSetCursor(p->fd, p->crtc_id, 0, 0, 0) ? -errno : 0;
+
+	/** SetCursor2 tells virtual machines where the hotspot is, older kernels only have SetCursor **/
+	if (drmModeSetCursor2(p->fd, p->crtc_id, b->handle, b->width, b->height, hot_x, hot_y) == 0)
+		return 0;
+
+	return drmModeSetCursor(p->fd, p->crtc_id, b->handle, b->width, b->height) ? -errno : 0;
+}
+
+static int backend_drm_cursor_move(struct present *p, int32_t x, int32_t y)
+{
+	if (p->use_atomic)
+	{
+		struct atomic_plane *c = &p->atomic.cursor;
+		return atomic_set_cursor(&p->atomic, c->fb, x, y, c->w, c->h);
+	}
+
+	return drmModeMoveCursor(p->fd, p->crtc_id, x, y) ? -errno : 0;
+}
+
+static const struct backend_ops backend_drm_ops = {
+	.name = "drm",
+	.create_buffer = backend_drm_create_buffer,
+	.map_buffer = backend_drm_map_buffer,
+	.destroy_buffer = backend_drm_destroy_buffer,
+	.attach = backend_drm_attach,
+	.detach = backend_drm_detach,
+	.submit = backend_drm_submit,
+	.wait = backend_drm_wait,
+	.vblank = backend_drm_vblank,
+	.cursor_set = backend_drm_cursor_set,
+	.cursor_move = backend_drm_cursor_move,
+};
+
+void backend_init_drm(struct backend *be, int fd)
+{
+	memset(be, 0, sizeof(*be));
+	be->ops = &backend_drm_ops;
+	be->fd = fd;
+}
+
+#endif // BACKEND_DRM_H
@@ -0,0 +1,272 @@
+#ifndef BACKEND_MEMORY_H
+#define BACKEND_MEMORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "log.h"
+#include "backend.h"
+#include "present.h"
+#include "damage.h"
+#include "format.h"
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: backend_init_memory(struct backend *be, const char *dump_path)
+ * -----------------------
+ *  Keeps every buffer in plain memory. Each chain gets a timerfd ticking
+ *  at mode.vrefresh as its vblank, a submitted buffer is "scanned out"
+ *  on the first tick after the submit.
+ *
+ * be: Backend to initialise (struct backend *)
+ * dump_path: If set, every frame reaching the screen is appended as
+ *            binary PPM to `dump_path`-<crtc>.ppm (const char *)
+ */
+void backend_init_memory(struct backend *be, const char *dump_path);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static int backend_memory_create_buffer(struct backend *be, struct present_buffer *b)
+{
+	(void)be;
+
+	const struct format_info *f = format_lookup(b->format);
+	if (f == NULL)
+		return -EINVAL;
+
+	/** keep rows cache-line aligned like most dumb allocators **/
+	b->pitch = (b->width * (b->bpp / 8) + 63) & ~63u;
+	b->size = (uint64_t)b->pitch * format_rows(f, b->height);
+	b->modifier = DRM_FORMAT_MOD_LINEAR;
+	b->map = aligned_alloc(64, b->size);
+
+	return b->map ? 0 : -ENOMEM;
+}
+
+static int backend_memory_map_buffer(struct backend *be, struct present_buffer *b)
+{
+	/** memory buffers are mapped from the start **/
+	(void)be;
+	(void)b;
+	return 0;
+}
+
+static void backend_memory_destroy_buffer(struct backend *be, struct present_buffer *b)
+{
+	(void)be;
+
+	free(b->map);
+	b->map = NULL;
+}
+
+static int backend_memory_attach(struct present *p)
+{
+	uint32_t refresh = p->mode.vrefresh ? p->mode.vrefresh : PRESENT_HEADLESS_REFRESH;
+	p->refresh_ns = 1000000000ull / refresh;
+
+	p->wait_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (p->wait_fd < 0)
+		return -errno;
+
+	p->next_vblank_ns = present_now_ns() + p->refresh_ns;
+
+	struct itimerspec its = {
+		.it_interval = { .tv_sec = p->refresh_ns / 1000000000ull, .tv_nsec = p->refresh_ns % 1000000000ull },
+		.it_value = { .tv_sec = p->next_vblank_ns / 1000000000ull, .tv_nsec = p->next_vblank_ns % 1000000000ull },
+	};
+
+	if (timerfd_settime(p->wait_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+	{
+		int ret = -errno;
+		close(p->wait_fd);
+		p->wait_fd = -1;
+		return ret;
+	}
+
+	if (p->backend->dump_path)
+	{
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s-%u.ppm", p->backend->dump_path, p->crtc_id);
+
+		p->dump_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (p->dump_fd < 0)
+			WARN("Failed to open frame dump %s: %s", path, strerror(errno));
+		else
+			INFO("Dumping frames of crtc %u to %s", p->crtc_id, path);
+	}
+
+	return 0;
+}
+
+static void backend_memory_detach(struct present *p)
+{
+	if (p->wait_fd >= 0)
+		close(p->wait_fd);
+
+	if (p->dump_fd >= 0)
+		close(p->dump_fd);
+
+	p->wait_fd = -1;
+	p->dump_fd = -1;
+}
+
+/*
+ * backend_memory_dump()
+ *
+ * Appends the buffer as one PPM image, the file stays a valid
+ * (multi image) PPM stream that ffmpeg and netpbm read as is.
+*/
+static void backend_memory_dump(struct present *p, struct present_buffer *b)
+{
+	char header[32];
+	size_t header_size = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", b->width, b->height);
+	size_t size = header_size + (size_t)b->width * b->height * 3;
+
+	/** other formats are turned back into XRGB8888 a row at a time **/
+	bool native = b->format == DRM_FORMAT_XRGB8888 || b->format == DRM_FORMAT_ARGB8888;
+	uint8_t *frame = malloc(size);
+	uint32_t *line = native ? NULL : malloc(b->width * 4);
+	if (frame == NULL || (!native && line == NULL))
+	{
+		free(frame);
+		free(line);
+		return;
+	}
+
+	memcpy(frame, header, header_size);
+
+	uint8_t *out = frame + header_size;
+	for (uint32_t y = 0; y < b->height; ++y)
+	{
+		const uint32_t *row = (const uint32_t*)(b->map + (size_t)y * b->pitch);
+		if (!native)
+		{
+			format_read_row(b->format, line, b->map, b->pitch, b->width, b->height, y);
+			row = line;
+		}
+
+		for (uint32_t x = 0; x < b->width; ++x)
+		{
+			*out++ = row[x] >> 16;
+			*out++ = row[x] >> 8;
+			*out++ = row[x];
+		}
+	}
+
+	for (size_t done = 0; done < size; )
+	{
+		ssize_t n = write(p->dump_fd, frame + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+		{
+			WARN("Frame dump failed, stopping it: %s", strerror(errno));
+			close(p->dump_fd);
+			p->dump_fd = -1;
+			break;
+		}
+
+		done += n;
+	}
+
+	free(frame);
+	free(line);
+}
+
+/*
+ * backend_memory_ticks()
+ *
+ * Consumes the vblanks the timer counted so far.
+ * returns: Number of vblanks since the last call.
+*/
+static uint64_t backend_memory_ticks(struct present *p)
+{
+	uint64_t ticks;
+
+	if (read(p->wait_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+		return 0;
+
+	p->next_vblank_ns += ticks * p->refresh_ns;
+
+	return ticks;
+}
+
+static int backend_memory_submit(struct present *p, struct present_buffer *b, const struct damage *d)
+{
+	/** vblanks that passed while rendering are gone, the buffer waits for the next one **/
+	backend_memory_ticks(p);
+
+	present_record_damage(p, b, d);
+	p->pending = p->back;
+	p->back = -1;
+
+	return 0;
+}
+
+static int backend_memory_wait(struct present *p, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = p->wait_fd, .events = POLLIN };
+
+	int ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	/** a late wakeup skips the vblanks we slept through, like real hardware **/
+	if (ret == 0 || backend_memory_ticks(p) == 0)
+		return 0;
+
+	if (p->pending >= 0 && p->dump_fd >= 0)
+		backend_memory_dump(p, p->buffers[p->pending]);
+
+	present_retire(p, (p->next_vblank_ns - p->refresh_ns) / 1000ull);
+
+	return 1;
+}
+
+static int backend_memory_vblank(struct present *p, uint64_t *vblank_ns)
+{
+	/** ticks not read yet still count, the clock runs without us **/
+	uint64_t last = p->next_vblank_ns - p->refresh_ns;
+	uint64_t now = present_now_ns();
+
+	if (now > last)
+		last += (now - last) / p->refresh_ns * p->refresh_ns;
+
+	*vblank_ns = last;
+	return 0;
+}
+
+static const struct backend_ops backend_memory_ops = {
+	.name = "memory",
+	.create_buffer = backend_memory_create_buffer,
+	.map_buffer = backend_memory_map_buffer,
+	.destroy_buffer = backend_memory_destroy_buffer,
+	.attach = backend_memory_attach,
+	.detach = backend_memory_detach,
+	.submit = backend_memory_submit,
+	.wait = backend_memory_wait,
+	.vblank = backend_memory_vblank,
+};
+
+void backend_init_memory(struct backend *be, const char *dump_path)
+{
+	memset(be, 0, sizeof(*be));
+	be->ops = &backend_memory_ops;
+	be->fd = -1;
+	be->dump_path = dump_path;
+}
+
+#endif // BACKEND_MEMORY_H
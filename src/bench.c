@@ -0,0 +1,621 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "pixel.h"
+#include "format.h"
+#include "raster.h"
+#include "text.h"
+#include "compositor.h"
+#include "draw.h"
+
+/** default geometry is a 4K mode with the pitch a dumb buffer would get **/
+#define BENCH_WIDTH 3840
+#define BENCH_HEIGHT 2160
+#define BENCH_ITERATIONS 50
+
+double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * fill_bytes(uint8_t *, uint32_t, uint32_t, uint32_t)
+ * the loop card.c used to fill the framebuffer with,
+ * kept here as the baseline.
+*/
+void fill_bytes(uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height)
+{
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			uint32_t pixel_offset = (y * pitch) + (x * 4);
+			map[pixel_offset] = 0xFF;        // Blue
+			map[pixel_offset + 1] = 0xbb;    // Green
+			map[pixel_offset + 2] = 0xaa;    // Red
+			map[pixel_offset + 3] = 0xFF;    // Alpha
+		}
+	}
+}
+
+void report(const char *name, double seconds, uint64_t bytes, int iterations)
+{
+	INFO("%-10s %8.3f ms/frame %8.2f GB/s", name, seconds * 1e3 / iterations, bytes * (double)iterations / seconds / 1e9);
+}
+
+/*
+ * bench_fill(int, char **)
+ * usage: bench fill [width] [height] [iterations]
+*/
+int bench_fill(int argc, char **argv)
+{
+	uint32_t width = argc > 0 ? atoi(argv[0]) : BENCH_WIDTH;
+	uint32_t height = argc > 1 ? atoi(argv[1]) : BENCH_HEIGHT;
+	int iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint64_t size = (uint64_t)pitch * height;
+	uint64_t bytes = (uint64_t)width * height * 4;
+
+	uint8_t *map = malloc(size);
+	if (map == NULL)
+	{
+		WARN("bench: Failed to allocate %lu bytes.", size);
+		return 1;
+	}
+
+	/** touch every page once, so page faults are not measured **/
+	memset(map, 0, size);
+
+	INFO("fill %ux%u pitch %u, %d iterations", width, height, pitch, iterations);
+
+	double start = bench_now();
+	for (int i = 0; i < iterations; ++i)
+		fill_bytes(map, pitch, width, height);
+	report("bytes", bench_now() - start, bytes, iterations);
+
+	PIXEL_IMPL selected = pixel_current_impl();
+
+	for (int impl = 0; impl < PIXEL_IMPL_COUNT; ++impl)
+	{
+		if (!pixel_use_impl((PIXEL_IMPL)impl))
+			continue;
+
+		start = bench_now();
+		for (int i = 0; i < iterations; ++i)
+			pixel_clear(map, pitch, width, height, 0xFFAABBFF + i);
+		report(pixel_impl_name((PIXEL_IMPL)impl), bench_now() - start, bytes, iterations);
+	}
+
+	pixel_use_impl(selected);
+	INFO("runtime dispatch picked: %s", pixel_impl_name(selected));
+
+	free(map);
+	return 0;
+}
+
+/*
+ * bench_blit(int, char **)
+ * usage: bench blit [width] [height] [iterations]
+ * RGB24 -> XRGB8888 row conversion the image blitter runs,
+ * source and destination both larger than the caches.
+*/
+int bench_blit(int argc, char **argv)
+{
+	uint32_t width = argc > 0 ? atoi(argv[0]) : BENCH_WIDTH;
+	uint32_t height = argc > 1 ? atoi(argv[1]) : BENCH_HEIGHT;
+	int iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint8_t *src = malloc((size_t)width * height * 3);
+	uint8_t *map = malloc((size_t)pitch * height);
+	if (src == NULL || map == NULL)
+	{
+		WARN("bench: Failed to allocate buffers.");
+		free(src);
+		free(map);
+		return 1;
+	}
+
+	for (size_t i = 0; i < (size_t)width * height * 3; ++i)
+		src[i] = i * 7;
+	memset(map, 0, (size_t)pitch * height);
+
+	INFO("blit rgb24 %ux%u pitch %u, %d iterations", width, height, pitch, iterations);
+
+	PIXEL_IMPL selected = pixel_current_impl();
+
+	for (int impl = 0; impl < PIXEL_IMPL_COUNT; ++impl)
+	{
+		if (!pixel_use_impl((PIXEL_IMPL)impl))
+			continue;
+
+		double start = bench_now();
+		for (int i = 0; i < iterations; ++i)
+			for (uint32_t y = 0; y < height; ++y)
+				pixel_rgb24_to_xrgb32((uint32_t*)(map + (size_t)y * pitch), src + (size_t)y * width * 3, width);
+
+		/** bytes read plus bytes written **/
+		report(pixel_impl_name((PIXEL_IMPL)impl), bench_now() - start, (uint64_t)width * height * 7, iterations);
+	}
+
+	pixel_use_impl(selected);
+
+	free(src);
+	free(map);
+	return 0;
+}
+
+/*
+ * bench_text(int, char **)
+ * usage: bench text [scale] [width] [height] [iterations]
+ * covers the whole buffer with text, once laid out from scratch
+ * and then redrawn from the line cache like a static overlay.
+*/
+int bench_text(int argc, char **argv)
+{
+	uint32_t scale = argc > 0 ? atoi(argv[0]) : 1;
+	uint32_t width = argc > 1 ? atoi(argv[1]) : BENCH_WIDTH;
+	uint32_t height = argc > 2 ? atoi(argv[2]) : BENCH_HEIGHT;
+	int iterations = argc > 3 ? atoi(argv[3]) : BENCH_ITERATIONS;
+
+	struct text text;
+	if (text_init(&text, scale) < 0)
+	{
+		WARN("bench: Invalid scale %u.", scale);
+		return 1;
+	}
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint32_t columns = width / text.cell_w, rows = height / text.cell_h;
+	uint8_t *map = malloc((size_t)pitch * height);
+	char *screen = malloc((size_t)(columns + 1) * rows + 1);
+	if (map == NULL || screen == NULL)
+	{
+		WARN("bench: Failed to allocate buffers.");
+		text_destroy(&text);
+		free(map);
+		free(screen);
+		return 1;
+	}
+
+	/** every line starts with its number, so each one gets its own cache entry **/
+	char *c = screen;
+	for (uint32_t y = 0; y < rows; ++y)
+	{
+		char number[16];
+		int digits = snprintf(number, sizeof(number), "%u ", y);
+
+		for (uint32_t x = 0; x < columns; ++x)
+			*c++ = (int)x < digits ? number[x] : TEXT_FIRST_GLYPH + (x * 7 + y * 13) % TEXT_GLYPH_COUNT;
+		*c++ = '\n';
+	}
+	*c = '\0';
+
+	memset(map, 0, (size_t)pitch * height);
+
+	/** the very first pass over the buffer pays for its page tables, keep that out of the layout time **/
+	text_draw(&text, map, pitch, width, height, 0, 0, screen, 0xFFFFFFFF, NULL);
+	text_destroy(&text);
+	text_init(&text, scale);
+
+	INFO("text %ux%u, %ux%u cells of %ux%u, %d iterations", width, height, columns, rows, text.cell_w, text.cell_h, iterations);
+
+	double start = bench_now();
+	text_draw(&text, map, pitch, width, height, 0, 0, screen, 0xFFFFFFFF, NULL);
+	report("layout", bench_now() - start, (uint64_t)width * height * 4, 1);
+
+	PIXEL_IMPL selected = pixel_current_impl();
+
+	for (int impl = 0; impl < PIXEL_IMPL_COUNT; ++impl)
+	{
+		if (!pixel_use_impl((PIXEL_IMPL)impl))
+			continue;
+
+		start = bench_now();
+		for (int i = 0; i < iterations; ++i)
+			text_draw(&text, map, pitch, width, height, 0, 0, screen, 0xFF000000 | (i * 0x10101), NULL);
+		report(pixel_impl_name((PIXEL_IMPL)impl), bench_now() - start, (uint64_t)width * height * 4, iterations);
+	}
+
+	pixel_use_impl(selected);
+
+	INFO("line cache: %lu hits, %lu misses", text.stats.hits, text.stats.misses);
+
+	text_destroy(&text);
+	free(map);
+	free(screen);
+	return 0;
+}
+
+/*
+ * bench_composite(int, char **)
+ * usage: bench composite [width] [height] [iterations]
+ * full screen recomposition of an opaque background under a
+ * half transparent gradient and a translucent panel, then the same
+ * with an opaque window on top hiding most of it.
+*/
+int bench_composite(int argc, char **argv)
+{
+	uint32_t width = argc > 0 ? atoi(argv[0]) : BENCH_WIDTH;
+	uint32_t height = argc > 1 ? atoi(argv[1]) : BENCH_HEIGHT;
+	int iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint8_t *map = malloc((size_t)pitch * height);
+
+	struct compositor c;
+	compositor_init(&c, width, height, 0xFF000000);
+
+	struct compositor_layer *background = compositor_layer_create(&c, width, height, 0, true);
+	struct compositor_layer *gradient = compositor_layer_create(&c, width, height, 1, false);
+	struct compositor_layer *panel = compositor_layer_create(&c, width / 2, height / 2, 2, false);
+	if (map == NULL || background == NULL || gradient == NULL || panel == NULL)
+	{
+		WARN("bench: Failed to allocate buffers.");
+		compositor_destroy(&c);
+		free(map);
+		return 1;
+	}
+
+	memset(map, 0, (size_t)pitch * height);
+
+	/** premultiplied, every alpha from 0 to 255 shows up along a row **/
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			uint32_t a = x * 255 / width;
+			background->pixels[(size_t)y * background->stride + x] = 0xFF000000 | (x * 7 + y) * 0x010203;
+			gradient->pixels[(size_t)y * gradient->stride + x] = a << 24 | (a * (y & 0xFF) / 255) << 8 | a / 2;
+		}
+
+	pixel_fill_rect32((uint8_t*)panel->pixels, panel->stride * 4, 0, 0, panel->width, panel->height, 0xC0101010);
+	compositor_layer_move(&c, panel, width / 4, height / 4);
+	compositor_layer_set_opacity(&c, panel, 200);
+
+	INFO("composite %ux%u, %d layers, %d iterations", width, height, c.count, iterations);
+
+	PIXEL_IMPL selected = pixel_current_impl();
+
+	for (int occluded = 0; occluded < 2; ++occluded)
+	{
+		if (occluded)
+		{
+			struct compositor_layer *window = compositor_layer_create(&c, width * 7 / 8, height * 7 / 8, 3, true);
+			if (window == NULL)
+				break;
+
+			INFO("with an opaque window over 3/4 of the screen");
+		}
+
+		for (int impl = 0; impl < PIXEL_IMPL_COUNT; ++impl)
+		{
+			if (!pixel_use_impl((PIXEL_IMPL)impl))
+				continue;
+
+			double start = bench_now();
+			for (int i = 0; i < iterations; ++i)
+				compositor_composite(&c, map, pitch, NULL);
+			report(pixel_impl_name((PIXEL_IMPL)impl), bench_now() - start, (uint64_t)width * height * 4, iterations);
+		}
+	}
+
+	pixel_use_impl(selected);
+
+	INFO("%.1f Mpixels blended, %.1f Mpixels skipped under opaque layers",
+			c.stats.pixels_blended / 1e6, c.stats.pixels_occluded / 1e6);
+
+	compositor_destroy(&c);
+	free(map);
+	return 0;
+}
+
+/*
+ * bench_raster(int, char **)
+ * usage: bench raster [threads] [width] [height] [frames]
+ * draws the same pseudo random scene with 1, 2, 4 ... threads
+ * up to `threads` (default: every core) into an offscreen buffer.
+*/
+int bench_raster(int argc, char **argv)
+{
+	int max_threads = argc > 0 ? atoi(argv[0]) : 0;
+	uint32_t width = argc > 1 ? atoi(argv[1]) : BENCH_WIDTH;
+	uint32_t height = argc > 2 ? atoi(argv[2]) : BENCH_HEIGHT;
+	int frames = argc > 3 ? atoi(argv[3]) : BENCH_ITERATIONS;
+
+	if (max_threads <= 0)
+		max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint8_t *map = malloc((size_t)pitch * height);
+	if (map == NULL)
+	{
+		WARN("bench: Failed to allocate buffer.");
+		return 1;
+	}
+
+	memset(map, 0, (size_t)pitch * height);
+
+	INFO("raster %ux%u, %d frames of 1 clear + 3000 primitives", width, height, frames);
+
+	double single = 0;
+	for (int threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads)
+	{
+		struct raster r;
+		if (raster_init(&r, threads) < 0)
+		{
+			WARN("bench: Failed to start %d threads.", threads);
+			break;
+		}
+
+		double start = bench_now();
+		for (int f = 0; f < frames; ++f)
+		{
+			srand(f);
+			raster_begin(&r, (struct raster_target) { .map = map, .pitch = pitch, .width = width, .height = height });
+			raster_rect(&r, 0, 0, width, height, 0xFF202020);
+
+			for (int i = 0; i < 1000; ++i)
+			{
+				int32_t x = rand() % width, y = rand() % height;
+				raster_triangle(&r, x, y, x + rand() % 256 - 128, y + rand() % 256 - 128, x + rand() % 256 - 128, y + rand() % 256 - 128, rand());
+				raster_rect(&r, rand() % width, rand() % height, rand() % 128, rand() % 128, rand());
+				raster_line(&r, x, y, rand() % width, rand() % height, rand());
+			}
+
+			raster_flush(&r);
+		}
+		double seconds = bench_now() - start;
+
+		if (threads == 1)
+			single = seconds;
+
+		INFO("%2d threads %8.3f ms/frame  speedup %.2fx", threads, seconds * 1e3 / frames, single / seconds);
+		raster_destroy(&r);
+
+		if (threads == max_threads)
+			break;
+	}
+
+	free(map);
+	return 0;
+}
+
+/*
+ * bench_convert(int, char **)
+ * usage: bench convert [width] [height] [iterations]
+ * full frame conversion of the XRGB8888 drawing surface
+ * into each scanout format, with every kernel tier.
+*/
+int bench_convert(int argc, char **argv)
+{
+	uint32_t width = argc > 0 ? atoi(argv[0]) : BENCH_WIDTH;
+	uint32_t height = argc > 1 ? atoi(argv[1]) : BENCH_HEIGHT;
+	int iterations = argc > 2 ? atoi(argv[2]) : BENCH_ITERATIONS;
+
+	const uint32_t formats[] = { DRM_FORMAT_XRGB8888, DRM_FORMAT_RGB565, DRM_FORMAT_XRGB2101010, DRM_FORMAT_NV12 };
+
+	uint32_t src_pitch = (width * 4 + 63) & ~63u;
+	uint8_t *src = malloc((size_t)src_pitch * height);
+	uint8_t *dst = malloc((size_t)src_pitch * height * 2);
+	if (src == NULL || dst == NULL)
+	{
+		WARN("bench: Failed to allocate buffers.");
+		free(src);
+		free(dst);
+		return 1;
+	}
+
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x)
+			((uint32_t*)(src + (size_t)y * src_pitch))[x] = 0xFF000000 | (x * 7 + y) * 0x010203;
+
+	INFO("convert %ux%u, %d iterations, GB/s of XRGB8888 read", width, height, iterations);
+
+	PIXEL_IMPL selected = pixel_current_impl();
+
+	for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f)
+	{
+		const struct format_info *info = format_lookup(formats[f]);
+		uint32_t pitch = (width * info->bpp / 8 + 63) & ~63u;
+
+		INFO("%s, %.1f MiB per frame", info->name, (double)pitch * format_rows(info, height) / (1 << 20));
+
+		for (int impl = 0; impl < PIXEL_IMPL_COUNT; ++impl)
+		{
+			if (!pixel_use_impl((PIXEL_IMPL)impl))
+				continue;
+
+			double start = bench_now();
+			for (int i = 0; i < iterations; ++i)
+				format_convert(formats[f], dst, pitch, width, height, src, src_pitch, 0, 0, width, height);
+			report(pixel_impl_name((PIXEL_IMPL)impl), bench_now() - start, (uint64_t)width * height * 4, iterations);
+		}
+	}
+
+	pixel_use_impl(selected);
+
+	free(src);
+	free(dst);
+	return 0;
+}
+
+/** what each producer of bench_ring draws into **/
+struct ring_producer
+{
+	pthread_t thread;
+	struct draw_queue *q;
+	uint32_t commands;
+	uint32_t width;
+	uint32_t height;
+	unsigned seed;
+	const uint32_t *sprite;
+};
+
+/*
+ * ring_produce(void *)
+ * a mix of small rectangles and lines, with a text
+ * and a 32x32 sprite every 16 commands.
+*/
+void *ring_produce(void *arg)
+{
+	struct ring_producer *p = arg;
+	char label[48];
+
+	for (uint32_t i = 0; i < p->commands; ++i)
+	{
+		int32_t x = rand_r(&p->seed) % p->width, y = rand_r(&p->seed) % p->height;
+		uint32_t color = rand_r(&p->seed) | 0xFF000000;
+
+		switch (i & 15)
+		{
+			case 0:
+				snprintf(label, sizeof(label), "producer %u command %u", p->seed & 0xFF, i);
+				draw_text(p->q, x, y, label, color);
+				break;
+			case 8:
+				draw_blit(p->q, x, y, 32, 32, p->sprite, 32 * 4);
+				break;
+			default:
+				if (i & 1)
+					draw_line(p->q, x, y, x + rand_r(&p->seed) % 128 - 64, y + rand_r(&p->seed) % 128 - 64, color);
+				else
+					draw_rect(p->q, x, y, 16 + rand_r(&p->seed) % 48, 16 + rand_r(&p->seed) % 48, color);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * bench_ring(int, char **)
+ * usage: bench ring [producers] [commands] [width] [height]
+ * `commands` split over 1, 2, 4 ... producer threads up to `producers`
+ * (default: every core), first dropped by the render thread to measure
+ * the ring alone, then drawn.
+*/
+int bench_ring(int argc, char **argv)
+{
+	int max_producers = argc > 0 ? atoi(argv[0]) : 0;
+	uint32_t commands = argc > 1 ? strtoul(argv[1], NULL, 10) : 4000000;
+	uint32_t width = argc > 2 ? atoi(argv[2]) : BENCH_WIDTH;
+	uint32_t height = argc > 3 ? atoi(argv[3]) : BENCH_HEIGHT;
+
+	if (max_producers <= 0)
+		max_producers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	uint32_t pitch = (width * 4 + 63) & ~63u;
+	uint8_t *map = malloc((size_t)pitch * height);
+	uint32_t *sprite = malloc(32 * 32 * 4);
+	struct ring_producer *producers = calloc(max_producers, sizeof(*producers));
+	if (map == NULL || sprite == NULL || producers == NULL)
+	{
+		WARN("bench: Failed to allocate buffers.");
+		free(map);
+		free(sprite);
+		free(producers);
+		return 1;
+	}
+
+	memset(map, 0, (size_t)pitch * height);
+	for (int i = 0; i < 32 * 32; ++i)
+		sprite[i] = 0xFF000000 | i * 0x040201;
+
+	INFO("ring %ux%u, %u commands, %d slots", width, height, commands, 4096);
+
+	for (int drawn = 0; drawn < 2; ++drawn)
+	{
+		INFO(drawn ? "drawn by the render thread" : "dropped by the render thread");
+
+		for (int n = 1; ; n = n * 2 < max_producers ? n * 2 : max_producers)
+		{
+			struct draw_queue q;
+			struct raster_target target = { .map = drawn ? map : NULL, .pitch = pitch, .width = width, .height = height };
+			if (draw_init(&q, 4096, target, 0, 1) < 0)
+			{
+				WARN("bench: Failed to start the render thread.");
+				break;
+			}
+
+			double start = bench_now();
+			int started = 0;
+			for (; started < n; ++started)
+			{
+				producers[started] = (struct ring_producer) { .q = &q, .commands = commands / n,
+						.width = width, .height = height, .seed = started + 1, .sprite = sprite };
+				if (pthread_create(&producers[started].thread, NULL, ring_produce, &producers[started]))
+					break;
+			}
+
+			for (int i = 0; i < started; ++i)
+				pthread_join(producers[i].thread, NULL);
+
+			draw_sync(&q);
+			double seconds = bench_now() - start;
+
+			/** text longer than DRAW_TEXT_MAX is more than one command, count what was queued **/
+			uint64_t queued = atomic_load(&q.head);
+			INFO("%2d producers %8.2f Mcommands/s  %6lu batches  %8lu full ring retries",
+					started, queued / seconds / 1e6, q.stats.batches, atomic_load(&q.full));
+
+			draw_destroy(&q);
+
+			if (n == max_producers)
+				break;
+		}
+	}
+
+	free(producers);
+	free(sprite);
+	free(map);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printf(
+			"usage: %s fill [width] [height] [iterations]\n"
+			"       %s blit [width] [height] [iterations]\n"
+			"       %s text [scale] [width] [height] [iterations]\n"
+			"       %s composite [width] [height] [iterations]\n"
+			"       %s raster [threads] [width] [height] [frames]\n"
+			"       %s ring [producers] [commands] [width] [height]\n"
+			"       %s convert [width] [height] [iterations]\n",
+			argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]
+		);
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "fill"))
+		return bench_fill(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "blit"))
+		return bench_blit(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "text"))
+		return bench_text(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "composite"))
+		return bench_composite(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "raster"))
+		return bench_raster(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "ring"))
+		return bench_ring(argc - 2, argv + 2);
+
+	if (!strcmp(argv[1], "convert"))
+		return bench_convert(argc - 2, argv + 2);
+
+	printf("Err: unknown benchmark `%s`.\n", argv[1]);
+	return 1;
+}
@@ -0,0 +1,327 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "backend.h"
+
+/*
+ * Idle buffers are kept mapped and registered up to this many bytes,
+ * enough for a triple buffered 4K chain, past it the least recently
+ * used ones are destroyed.
+ */
+#ifndef BUFPOOL_MAX_IDLE_BYTES
+	#define BUFPOOL_MAX_IDLE_BYTES (3ull * 3840 * 2160 * 4)
+#endif // BUFPOOL_MAX_IDLE_BYTES
+
+struct bufpool_entry
+{
+	struct present_buffer buf;	/* first, so a buffer pointer is an entry pointer */
+	bool in_use;
+	uint64_t last_used;					/* pool tick of the last release, for LRU */
+
+	/** idle but maybe still scanned out by `pinned_crtc`, trimming skips it **/
+	bool pinned;
+	uint32_t pinned_crtc;
+};
+
+struct bufpool_stats
+{
+	uint64_t hits;				/* get served from an idle buffer */
+	uint64_t misses;			/* get which had to allocate */
+	uint64_t allocations;	/* buffers created and mapped through the backend */
+	uint64_t frees;				/* buffers destroyed */
+	uint64_t live;				/* buffers existing right now */
+	uint64_t idle;				/* of those, not handed out */
+	uint64_t bytes_live;
+	uint64_t bytes_idle;
+};
+
+struct bufpool
+{
+	struct backend *backend;
+	uint64_t max_idle_bytes;
+
+	struct bufpool_entry **entries;
+	uint32_t count;
+	uint32_t capacity;
+
+	uint64_t tick;
+	struct bufpool_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: bufpool_init(struct bufpool *pool, struct backend *be, uint64_t max_idle_bytes)
+ * -----------------------
+ *  Creates an empty pool.
+ *
+ * pool: Pool (struct bufpool *)
+ * be: Backend buffers are created on (struct backend *)
+ * max_idle_bytes: Idle memory kept for reuse, 0 = BUFPOOL_MAX_IDLE_BYTES (uint64_t)
+ */
+void bufpool_init(struct bufpool *pool, struct backend *be, uint64_t max_idle_bytes);
+
+/*
+ * Function: bufpool_get(struct bufpool *pool, uint32_t width, uint32_t height, uint32_t bpp, uint32_t format)
+ * -----------------------
+ *  Hands out a mapped buffer with a framebuffer id, an idle one with
+ *  the same (width, height, bpp, format) is reused without any syscall.
+ *
+ * returns: Buffer (struct present_buffer *), NULL with errno set on failure.
+ *
+ * Note: Contents of a reused buffer are whatever its last user left.
+ */
+struct present_buffer *bufpool_get(struct bufpool *pool, uint32_t width, uint32_t height, uint32_t bpp, uint32_t format);
+
+/*
+ * Function: bufpool_put(struct bufpool *pool, struct present_buffer *buf)
+ * -----------------------
+ *  Gives a buffer back. It stays mapped for the next bufpool_get()
+ *  unless idle memory goes over the limit.
+ */
+void bufpool_put(struct bufpool *pool, struct present_buffer *buf);
+
+/*
+ * Function: bufpool_put_pinned(struct bufpool *pool, struct present_buffer *buf, uint32_t crtc_id)
+ * -----------------------
+ *  Gives back a buffer `crtc_id` still scans out. bufpool_get() may hand
+ *  it out again, but bufpool_trim() keeps it until bufpool_unpin().
+ */
+void bufpool_put_pinned(struct bufpool *pool, struct present_buffer *buf, uint32_t crtc_id);
+
+/*
+ * Function: bufpool_unpin(struct bufpool *pool, uint32_t crtc_id)
+ * -----------------------
+ *  `crtc_id` flipped away from the buffers it pinned, they can be trimmed.
+ */
+void bufpool_unpin(struct bufpool *pool, uint32_t crtc_id);
+
+/*
+ * Function: bufpool_trim(struct bufpool *pool, uint64_t max_idle_bytes)
+ * -----------------------
+ *  Destroys least recently used idle buffers until at most `max_idle_bytes`
+ *  are idle, 0 drops every idle buffer (memory pressure).
+ */
+void bufpool_trim(struct bufpool *pool, uint64_t max_idle_bytes);
+
+/*
+ * Function: bufpool_destroy(struct bufpool *pool)
+ * -----------------------
+ *  Destroys every buffer, handed out ones included.
+ */
+void bufpool_destroy(struct bufpool *pool);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static int bufpool_create(struct bufpool *pool, struct present_buffer *b)
+{
+	struct backend *be = pool->backend;
+
+	int ret = be->ops->create_buffer(be, b);
+	if (ret < 0)
+		return ret;
+
+	ret = be->ops->map_buffer(be, b);
+	if (ret < 0)
+	{
+		be->ops->destroy_buffer(be, b);
+		return ret;
+	}
+
+	memset(b->map, 0, b->size);
+
+	return 0;
+}
+
+static void bufpool_release(struct bufpool *pool, struct bufpool_entry *e)
+{
+	struct present_buffer *b = &e->buf;
+
+	pool->backend->ops->destroy_buffer(pool->backend, b);
+
+	pool->stats.frees++;
+	pool->stats.live--;
+	pool->stats.bytes_live -= b->size;
+
+	if (!e->in_use)
+	{
+		pool->stats.idle--;
+		pool->stats.bytes_idle -= b->size;
+	}
+
+	free(e);
+}
+
+void bufpool_init(struct bufpool *pool, struct backend *be, uint64_t max_idle_bytes)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->backend = be;
+	pool->max_idle_bytes = max_idle_bytes ? max_idle_bytes : BUFPOOL_MAX_IDLE_BYTES;
+}
+
+struct present_buffer *bufpool_get(struct bufpool *pool, uint32_t width, uint32_t height, uint32_t bpp, uint32_t format)
+{
+	/** most recently released match first, it is the most likely to still be in cache **/
+	struct bufpool_entry *best = NULL;
+
+	for (uint32_t i = 0; i < pool->count; ++i)
+	{
+		struct bufpool_entry *e = pool->entries[i];
+		struct present_buffer *b = &e->buf;
+
+		if (e->in_use || b->width != width || b->height != height || b->bpp != bpp || b->format != format)
+			continue;
+
+		if (best == NULL || e->last_used > best->last_used)
+			best = e;
+	}
+
+	if (best)
+	{
+		best->in_use = true;
+		best->pinned = false;
+		best->buf.seq = 0;
+
+		pool->stats.hits++;
+		pool->stats.idle--;
+		pool->stats.bytes_idle -= best->buf.size;
+
+		return &best->buf;
+	}
+
+	pool->stats.misses++;
+
+	if (pool->count == pool->capacity)
+	{
+		uint32_t capacity = pool->capacity ? pool->capacity * 2 : 8;
+		struct bufpool_entry **entries = realloc(pool->entries, capacity * sizeof(*entries));
+		if (entries == NULL)
+		{
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		pool->entries = entries;
+		pool->capacity = capacity;
+	}
+
+	struct bufpool_entry *e = calloc(1, sizeof(*e));
+	if (e == NULL)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	e->buf.width = width;
+	e->buf.height = height;
+	e->buf.bpp = bpp;
+	e->buf.format = format;
+
+	int ret = bufpool_create(pool, &e->buf);
+	if (ret < 0)
+	{
+		free(e);
+		errno = -ret;
+		return NULL;
+	}
+
+	e->in_use = true;
+	pool->entries[pool->count++] = e;
+
+	pool->stats.allocations++;
+	pool->stats.live++;
+	pool->stats.bytes_live += e->buf.size;
+
+	return &e->buf;
+}
+
+void bufpool_put(struct bufpool *pool, struct present_buffer *buf)
+{
+	if (buf == NULL)
+		return;
+
+	struct bufpool_entry *e = (struct bufpool_entry*)buf;
+
+	e->in_use = false;
+	e->last_used = ++pool->tick;
+
+	pool->stats.idle++;
+	pool->stats.bytes_idle += buf->size;
+
+	if (pool->stats.bytes_idle > pool->max_idle_bytes)
+		bufpool_trim(pool, pool->max_idle_bytes);
+}
+
+void bufpool_put_pinned(struct bufpool *pool, struct present_buffer *buf, uint32_t crtc_id)
+{
+	if (buf == NULL)
+		return;
+
+	struct bufpool_entry *e = (struct bufpool_entry*)buf;
+	e->pinned = true;
+	e->pinned_crtc = crtc_id;
+
+	bufpool_put(pool, buf);
+}
+
+void bufpool_unpin(struct bufpool *pool, uint32_t crtc_id)
+{
+	bool any = false;
+
+	for (uint32_t i = 0; i < pool->count; ++i)
+	{
+		struct bufpool_entry *e = pool->entries[i];
+		if (e->pinned && e->pinned_crtc == crtc_id)
+		{
+			e->pinned = false;
+			any = true;
+		}
+	}
+
+	/** what was kept over the limit for the screen goes now **/
+	if (any && pool->stats.bytes_idle > pool->max_idle_bytes)
+		bufpool_trim(pool, pool->max_idle_bytes);
+}
+
+void bufpool_trim(struct bufpool *pool, uint64_t max_idle_bytes)
+{
+	while (pool->stats.bytes_idle > max_idle_bytes)
+	{
+		int oldest = -1;
+
+		for (uint32_t i = 0; i < pool->count; ++i)
+		{
+			struct bufpool_entry *e = pool->entries[i];
+			if (!e->in_use && !e->pinned && (oldest < 0 || e->last_used < pool->entries[oldest]->last_used))
+				oldest = i;
+		}
+
+		if (oldest < 0)
+			break;
+
+		bufpool_release(pool, pool->entries[oldest]);
+		pool->entries[oldest] = pool->entries[--pool->count];
+	}
+}
+
+void bufpool_destroy(struct bufpool *pool)
+{
+	for (uint32_t i = 0; i < pool->count; ++i)
+		bufpool_release(pool, pool->entries[i]);
+
+	free(pool->entries);
+	pool->entries = NULL;
+	pool->count = 0;
+	pool->capacity = 0;
+}
+
+#endif // BUFPOOL_H
@@ -10,192 +10,432 @@
 #include <sys/ioctl.h>
 #include <libdrm/drm.h>
 #include <libdrm/drm_mode.h>
+#include <poll.h>
+#include <time.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-typedef enum {
-	BLACK 	= 0,
-	RED 		= 1,
-	GREEN 	= 2,
-	YELLOW 	= 3,
-	BLUE 		= 4,
-	MAGENTA = 5,
-	CYAN 		= 6,
-	WHITE 	= 7
-} TERM_COLOR;
-
-typedef enum {
-	TEXT = 0,
-	BOLD_TEXT,
-	UNDERLINE_TEXT,
-	BACKGROUND,
-	HIGH_INTEN_BG,
-	HIGH_INTEN_TEXT,
-	BOLD_HIGH_INTEN_TEXT,
-	RESET
-} TERM_KIND;
-
-#define writef(...) ({  writef_function(__VA_ARGS__, NULL); })
-#define INFO(...) printf("%s[INFO]:%s %s\n", get_term_color(TEXT, GREEN), get_term_color(RESET, 0), writef(__VA_ARGS__))
-#define WARN(...) printf("%s[WARN]:%s %s\n", get_term_color(TEXT, YELLOW), get_term_color(RESET, 0), writef(__VA_ARGS__))
-#define ERROR(...) printf("%s[ERROR]:%s %s\n", get_term_color(TEXT, RED), get_term_color(RESET, 0), writef(__VA_ARGS__)), exit(1);
+#include "log.h"
+#include "present.h"
+#include "pixel.h"
+#include "format.h"
+#include "raster.h"
+#include "damage.h"
+#include "output.h"
+#include "timing.h"
+#include "image.h"
+#include "text.h"
+#include "compositor.h"
+#include "cursor.h"
+#include "input.h"
+#include "replay.h"
+#include "server.h"
+#include "bufpool.h"
+#include "backend.h"
+#include "backend_drm.h"
+#include "backend_memory.h"
+
+/** remove connect to enable debug which will 
+		print information about resources and connector. **/
+
+// #define DEBUG
+
+/** number of buffers in the chain, 2 = double buffering, 3 = triple buffering **/
+#define BUFFER_COUNT 2
+
+/** headless target has no keyboard to stop it, so head 0 renders a fixed amount of frames **/
+#define HEADLESS_WIDTH 1280
+#define HEADLESS_HEIGHT 800
+#define HEADLESS_FRAMES 300
+
+/** how long the splash image stays up before the scene starts **/
+#define SPLASH_MS 1000
+
+/** the stats overlay in the top left corner is rewritten this often **/
+#define OVERLAY_MS 500
+#define OVERLAY_X 16
+#define OVERLAY_Y 16
+#define OVERLAY_PAD 8
+#define OVERLAY_COLUMNS 40
+#define OVERLAY_LINES 4
+#define OVERLAY_SIZE 160
+
+/** behind the surfaces of the clients of `card --serve` **/
+#define DESKTOP_BACKGROUND 0xFF303840
+
+/** square in the top right corner which changes color on every key press **/
+#define MARKER_SIZE 48
 
 /*
- * writef_function(char *, args) 
- * It works like printf but it returns string.
+ * every head composites four layers: the static background drawn once,
+ * the moving band and triangle, the translucent stats panel
+ * and the key press marker.
 */
-char *writef_function(char *s, ...);
+struct scene_output
+{
+	struct compositor compositor;
+	struct compositor_layer *background;
+	struct compositor_layer *sprites;
+	struct compositor_layer *stats;
+	struct compositor_layer *marker;
+	uint64_t marker_keys;		/* key presses the marker shows */
+	uint64_t input_ns;			/* oldest input not on this head yet, 0 = none */
+	struct cursor cursor;
+	bool have_cursor;
+
+	char overlay[OVERLAY_SIZE];
+	uint64_t overlay_ns;
+};
+
+/** everything the heads draw with, shared as they render one after the other **/
+struct scene
+{
+	struct raster raster;
+	struct text text;
+	struct bufpool *pool;		/* hardware cursor images */
+
+	/** every evdev device, read once per frame right before drawing **/
+	struct input input;
+	bool have_input;
+	bool pointer;				/* a mouse moved, the cursor follows it from now on */
+	int32_t pointer_x;
+	int32_t pointer_y;
+	bool quit;					/* Escape was pressed */
+	uint64_t keys;				/* key presses so far */
+
+	struct scene_output outputs[OUTPUT_MAX];
+};
 
 /*
- * get_term_color(TERM_KIND, TERM_COLOR)
- * return terminal color string
+ * scene_layout(uint64_t, int32_t, int32_t *, int32_t *)
+ * position of the moving band and triangle in `frame`.
 */
-const char *get_term_color(TERM_KIND kind, TERM_COLOR color)
+void scene_layout(uint64_t frame, int32_t w, int32_t *band, int32_t *tx)
 {
-	switch (kind)
-	{
-		case TEXT: return writef("\e[0;3%dm", color);
-		case BOLD_TEXT: return writef("\e[1;3%dm", color);
-		case UNDERLINE_TEXT: return writef("\e[4;3%dm", color);
-		case BACKGROUND: return writef("\e[4%dm", color);
-		case HIGH_INTEN_BG: return writef("\e[0;10%dm", color);
-		case HIGH_INTEN_TEXT: return writef("\e[0;9%dm", color);
-		case BOLD_HIGH_INTEN_TEXT: return writef("\e[1;9%dm", color);
-		case RESET: return writef("\e[0m");
-	}
+	*band = (frame * 8) % w;
+
+	/** triangle bounces between the left and right edge **/
+	int32_t span = w > 256 ? w - 256 : 1;
+	*tx = (frame * 6) % (2 * span);
+	if (*tx >= span)
+		*tx = 2 * span - *tx;
 }
 
-char *writef_function(char *s, ...)
+/*
+ * scene_damage(uint64_t, int32_t, int32_t, struct damage *)
+ * add the area covered by the moving objects of `frame`.
+*/
+void scene_damage(uint64_t frame, int32_t w, int32_t h, struct damage *d)
 {
-	// allocate small size buffer
-	size_t buffer_size = 64; // 64 bytes
-	char *buffer = (char*)malloc(buffer_size);
+	int32_t band, tx;
+	scene_layout(frame, w, &band, &tx);
 
-	if (buffer == NULL)
-	{
-		WARN("writef: Failed to allocate buffer.");
-		return NULL;
-	}
+	damage_add(d, band, 0, 32, h);
+	damage_add(d, tx, 64, 257, h - 127);
+}
 
-	va_list ap;
-	va_start(ap, s);
+/*
+ * layer_target(struct compositor_layer *)
+ * lets the rasterizer draw into a layer.
+*/
+struct raster_target layer_target(struct compositor_layer *l)
+{
+	return (struct raster_target) { .map = (uint8_t*)l->pixels, .pitch = l->stride * 4, .width = l->width, .height = l->height };
+}
 
-	int nSize = vsnprintf(buffer, buffer_size, s, ap);
-	if (nSize < 0)
-	{
-		free(buffer);
-		va_end(ap);
-	}
+/*
+ * scene_output_init(struct scene *, struct scene_output *, struct output *, int32_t, int32_t)
+ * (re)creates the layers and the cursor of a head for a w x h mode
+ * and draws the background, which never changes after that.
+*/
+int scene_output_init(struct scene *s, struct scene_output *so, struct output *o, int32_t w, int32_t h)
+{
+	if (so->have_cursor)
+		cursor_destroy(&so->cursor);
 
-	// if buffer does not have enough space then extend it.
-	if (nSize >= buffer_size)
-	{
-		buffer_size = nSize + 1;
-		buffer = (char*)realloc(buffer, buffer_size);
+	so->have_cursor = false;
+	compositor_destroy(&so->compositor);
+	compositor_init(&so->compositor, w, h, 0xFF000000);
+	so->overlay[0] = '\0';
 
-		if (buffer == NULL)
-		{
-			WARN("writef: Failed to re-allocate buffer.");
-			return NULL;
-		}
+	so->background = compositor_layer_create(&so->compositor, w, h, 0, true);
+	so->sprites = compositor_layer_create(&so->compositor, w, h, 1, false);
+	so->stats = compositor_layer_create(&so->compositor, OVERLAY_COLUMNS * s->text.cell_w + 2 * OVERLAY_PAD,
+			OVERLAY_LINES * s->text.cell_h + 2 * OVERLAY_PAD, 2, false);
 
-		va_end(ap);
+	so->marker = compositor_layer_create(&so->compositor, MARKER_SIZE, MARKER_SIZE, 3, true);
 
-		va_start(ap, s);
-		vsnprintf(buffer, buffer_size, s, ap);
-	}
+	if (so->background == NULL || so->sprites == NULL || so->stats == NULL || so->marker == NULL)
+		return -ENOMEM;
 
-	va_end(ap);
+	compositor_layer_move(&so->compositor, so->stats, OVERLAY_X, OVERLAY_Y);
+	compositor_layer_move(&so->compositor, so->marker, w - MARKER_SIZE - OVERLAY_X, OVERLAY_Y);
+	so->marker_keys = s->keys - 1;
 
-	return buffer;
-}
+	int ret = cursor_init(&so->cursor, &o->present, s->pool, &so->compositor);
+	if (ret < 0)
+		return ret;
 
+	so->have_cursor = true;
+	cursor_show(&so->cursor, true);
 
-/** remove connect to enable debug which will 
-		print information about resources and connector. **/
+	struct raster *r = &s->raster;
+	raster_begin(r, layer_target(so->background));
+	raster_rect(r, 0, 0, w, h, 0xFFAABBFF);
+	raster_line(r, 0, 0, w - 1, h - 1, 0xFF000000);
+	raster_line(r, w - 1, 0, 0, h - 1, 0xFF000000);
 
-// #define DEBUG
+	return raster_flush(r);
+}
 
-int main(int argc, char **argv)
+/*
+ * cursor_layout(uint64_t, int32_t, int32_t, int32_t *, int32_t *)
+ * until a mouse moves, the cursor bounces around the screen.
+*/
+void cursor_layout(uint64_t frame, int32_t w, int32_t h, int32_t *x, int32_t *y)
 {
-	/** check if user has provided the dri device or not. **/
-	if (argc < 2)
+	*x = (frame * 5) % (2 * w);
+	if (*x >= w)
+		*x = 2 * w - *x - 1;
+
+	*y = (frame * 3) % (2 * h);
+	if (*y >= h)
+		*y = 2 * h - *y - 1;
+}
+
+/*
+ * scene_input(struct scene *)
+ * takes the frames every device has completed since the last call,
+ * without waiting: relative motion moves the pointer, a key press
+ * recolors the marker and Escape quits. every head remembers the
+ * oldest of them until it has drawn the response.
+*/
+void scene_input(struct scene *s)
+{
+	if (!s->have_input || input_dispatch(&s->input, 0) < 0)
+		return;
+
+	struct input_msg msg;
+	while (input_next(&s->input, &msg))
 	{
-		printf("Err: provide dri device.\n");
-		return -EINVAL;
+		if (msg.type == EV_REL && (msg.code == REL_X || msg.code == REL_Y))
+		{
+			if (!s->pointer)
+				s->pointer_x = s->pointer_y = 0;
+
+			s->pointer = true;
+			if (msg.code == REL_X)
+				s->pointer_x += msg.value;
+			else
+				s->pointer_y += msg.value;
+		}
+		else if (msg.type == EV_KEY && msg.value == 1)
+		{
+			s->keys++;
+			if (msg.code == KEY_ESC)
+				s->quit = true;
+		}
+		else
+			continue;
+
+		for (int i = 0; i < OUTPUT_MAX; ++i)
+			if (s->outputs[i].input_ns == 0 || msg.time_ns < s->outputs[i].input_ns)
+				s->outputs[i].input_ns = msg.time_ns;
 	}
+}
 
-	/** the first argument must be a dri device, else it might fail. **/
-	const char *card = argv[1];
+/*
+ * overlay_update(struct scene *, struct scene_output *, struct output *)
+ * rewrites the stats of the head every OVERLAY_MS.
+*/
+void overlay_update(struct scene *s, struct scene_output *so, struct output *o)
+{
+	uint64_t now = timing_now();
 
-	/** open dri device in read and write mode **/
-	int fd = open(card, O_RDWR | O_CLOEXEC);
-	if (fd < 0)
+	if (so->overlay[0] && now - so->overlay_ns < OVERLAY_MS * 1000000ull)
+		return;
+
+	const struct timing *t = &o->present.timing;
+
+	snprintf(so->overlay, OVERLAY_SIZE, "%ux%u  %.1f fps\nframe %.2f ms  p99 %.2f ms\nrender p99 %.2f ms  missed %lu\ninput p50 %.2f ms  p99 %.2f ms",
+			o->mode.hdisplay, o->mode.vdisplay, o->frame_us ? 1e6 / o->frame_us : 0, o->frame_us / 1e3,
+			timing_percentile(t, TIMING_FRAME, 0.99) / 1e6, timing_percentile(t, TIMING_RENDER, 0.99) / 1e6,
+			t->missed_vblanks, timing_percentile(t, TIMING_INPUT, 0.5) / 1e6, timing_percentile(t, TIMING_INPUT, 0.99) / 1e6);
+	so->overlay_ns = now;
+
+	/** premultiplied: a dark panel at 75% with opaque white text **/
+	struct compositor_layer *l = so->stats;
+	pixel_fill_rect32((uint8_t*)l->pixels, l->stride * 4, 0, 0, l->width, l->height, 0xC0101010);
+	text_draw(&s->text, (uint8_t*)l->pixels, l->stride * 4, l->width, l->height, OVERLAY_PAD, OVERLAY_PAD, so->overlay, 0xFFFFFFFF, NULL);
+
+	compositor_layer_damage(&so->compositor, l, 0, 0, l->width, l->height);
+}
+
+/*
+ * draw_frame(struct scene *, struct output *, struct present_buffer *, struct damage *)
+ * a vertical band and a triangle move every frame over the background,
+ * so tearing would be visible, with the stats on top.
+ * only the sprites that moved are redrawn into their layer, and only
+ * `repaint` is composited: what changed in any layer, plus whatever
+ * the back buffer missed since it was last on screen.
+*/
+void draw_frame(struct scene *s, struct output *o, struct present_buffer *b, struct damage *repaint)
+{
+	struct scene_output *so = &s->outputs[o->index];
+	struct raster *r = &s->raster;
+	uint64_t frame = o->frame;
+	int32_t w = b->width, h = b->height;
+	int32_t band, tx;
+
+	struct damage moved;
+	damage_init(&moved, w, h);
+
+	if (so->compositor.width != w || so->compositor.height != h)
 	{
-		perror("Err: failed to open dri device: ");
-		return -EINVAL;
+		if (scene_output_init(s, so, o, w, h) < 0)
+			WARN("Output %d: failed to create its layers", o->index);
+
+		damage_full(&moved);
+	}
+	else
+	{
+		scene_damage(frame - 1, w, h, &moved);
+		scene_damage(frame, w, h, &moved);
 	}
 
-	INFO("Successfully opened dri device: %s", card);
+	scene_layout(frame, w, &band, &tx);
 
-	/** get resource information from dri device **/
-	drmModeResPtr res = drmModeGetResources(fd);
-	if (!res)
+	/** clear the old place of the sprites to transparent and draw the new one **/
+	if (so->sprites)
 	{
-		perror("Err: cannot get drm resources: ");
-		close(fd);
-		return -EINVAL;
+		raster_begin(r, layer_target(so->sprites));
+		raster_clip(r, &moved);
+		raster_rect(r, 0, 0, w, h, 0x00000000);
+		raster_rect(r, band, 0, 32, h, 0xFFFFFFFF);
+		raster_triangle(r, tx, h - 64, tx + 128, 64, tx + 256, h - 64, 0xFF3050A0);
+		raster_flush(r);
+
+		for (int i = 0; i < moved.count; ++i)
+			compositor_layer_damage(&so->compositor, so->sprites, moved.rects[i].x1, moved.rects[i].y1,
+					moved.rects[i].x2 - moved.rects[i].x1, moved.rects[i].y2 - moved.rects[i].y1);
 	}
 
-	INFO("Successfully got drm resources");
+	if (so->stats)
+		overlay_update(s, so, o);
 
-#ifdef DEBUG
-	printf(
-		"count_fbs: %d\n"
-		"count_crtcs: %d\n"
-		"count_connectors: %d\n"
-		"count_encoders: %d\n"
-		"min_width: %d, max_width: %d\n"
-		"min_height: %d, max_height: %d\n",
-		res->count_fbs,
-		res->count_crtcs,
-		res->count_connectors,
-		res->count_encoders,
-		res->min_width, res->max_width,
-		res->min_height, res->max_height
-	);
-#endif
+	if (so->marker && so->marker_keys != s->keys)
+	{
+		static const uint32_t colors[] = { 0xFFE04040, 0xFF40E040, 0xFF4040E0, 0xFFE0E040 };
+		struct compositor_layer *l = so->marker;
 
-	/** get current connector from resource **/
+		pixel_fill_rect32((uint8_t*)l->pixels, l->stride * 4, 0, 0, l->width, l->height, colors[s->keys % 4]);
+		compositor_layer_damage(&so->compositor, l, 0, 0, l->width, l->height);
+		so->marker_keys = s->keys;
+	}
 
-	/**
-	 * NOTE: I only care about first connector,
-	 * as i am running this in virtual machine,
-	 * so it only shows 1 connector.
-	**/
-	drmModeConnectorPtr connector = drmModeGetConnectorCurrent(fd, res->connectors[0]);
-	if (!connector)
+	/** this frame shows the response, its flip ends the input-to-photon time **/
+	if (so->input_ns)
 	{
-		perror("Err: failed to get connector: ");
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		timing_input(&o->present.timing, so->input_ns);
+		so->input_ns = 0;
+	}
+
+	/** a hardware cursor moves with one ioctl and never shows up in the damage **/
+	if (so->have_cursor)
+	{
+		int32_t cx, cy;
+		if (s->pointer)
+		{
+			/** every head shows the pointer at the same place, kept on screen **/
+			s->pointer_x = s->pointer_x < 0 ? 0 : s->pointer_x >= w ? w - 1 : s->pointer_x;
+			s->pointer_y = s->pointer_y < 0 ? 0 : s->pointer_y >= h ? h - 1 : s->pointer_y;
+			cx = s->pointer_x;
+			cy = s->pointer_y;
+		}
+		else
+			cursor_layout(frame, w, h, &cx, &cy);
+
+		cursor_move(&so->cursor, cx, cy);
 	}
 
-	INFO("Successfully got connector");
+	struct damage changed;
+	damage_init(&changed, w, h);
+	compositor_take_damage(&so->compositor, &changed);
+
+	present_repaint_region(&o->present, &changed, repaint);
+	compositor_composite(&so->compositor, b->map, b->pitch, repaint);
+}
 
-	/** find appropriate mode for finding resolution **/
-	drmModeModeInfoPtr resolution = 0;
-	for (int i = 0; i < connector->count_modes; i++) {
-		resolution = &connector->modes[i];
-		if (resolution->type & DRM_MODE_TYPE_PREFERRED)
+/*
+ * stdin_ready()
+ * returns true once user has pressed enter.
+*/
+bool stdin_ready()
+{
+	struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+	return poll(&pfd, 1, 0) > 0;
+}
+
+/*
+ * render_output(struct output *, struct present_buffer *, struct damage *, void *)
+ * every head draws the same scene at its own pace.
+*/
+void render_output(struct output *o, struct present_buffer *b, struct damage *repaint, void *data)
+{
+	draw_frame((struct scene*)data, o, b, repaint);
+}
+
+/*
+ * splash(struct output_manager *, const char *)
+ * shows an image centered on every head for SPLASH_MS,
+ * the file is converted straight from its mapping into the buffers.
+*/
+int splash(struct output_manager *m, const char *path)
+{
+	struct image img;
+	int ret = image_open(&img, path);
+	if (ret < 0)
+		return ret;
+
+	INFO("Splash %s: %ux%u %s", path, img.width, img.height, img.format == IMAGE_PPM ? "ppm" : "qoi");
+
+	for (int i = 0; i < m->count && ret == 0; ++i)
+	{
+		struct present *p = &m->outputs[i].present;
+		struct present_buffer *b = present_acquire(p);
+		if (b == NULL)
+		{
+			ret = -EIO;
 			break;
+		}
+
+		int32_t x = ((int32_t)b->width - (int32_t)img.width) / 2;
+		int32_t y = ((int32_t)b->height - (int32_t)img.height) / 2;
+
+		/** only the borders around the image need clearing **/
+		if (x > 0 || y > 0 || img.width < b->width || img.height < b->height)
+			pixel_clear(b->map, b->pitch, b->width, b->height, 0xFF000000);
+
+		ret = image_blit(&img, b->map, b->pitch, b->width, b->height, x, y);
+		if (ret == 0)
+			ret = present_submit(p);
 	}
 
-	INFO("Mode has been selected");
+	image_close(&img);
+
+	uint64_t end = timing_now() + SPLASH_MS * 1000000ull;
+	while (ret >= 0 && timing_now() < end)
+		ret = output_manager_wait(m, (end - timing_now()) / 1000000ull);
+
+	return ret < 0 ? ret : 0;
+}
 
 #ifdef DEBUG
+void print_mode(struct output *o)
+{
+	drmModeModeInfoPtr resolution = &o->mode;
 	printf(
+			"output: %d, connector: %u, crtc: %u\n"
 			"clock: %d\n"
 		  "hdisplay: %d, hsync_start: %d, hsync_end: %d, htotal: %d, hskew: %d\n"
 		  "vdisplay: %d, vsync_start: %d, vsync_end: %d, vtotal: %d, vscan: %d\n"
@@ -203,6 +443,7 @@ int main(int argc, char **argv)
 			"flags: %d\n"
 			"type: %d\n"
 			"name: %s\n",
+			o->index, o->connector_id, o->crtc_id,
 			resolution->clock,
 			resolution->hdisplay, resolution->hsync_start, resolution->hsync_end, resolution->htotal, resolution->hskew,
 			resolution->vdisplay, resolution->vsync_start, resolution->vsync_end, resolution->vtotal, resolution->vscan,
@@ -211,146 +452,478 @@ int main(int argc, char **argv)
 			resolution->type,
 			resolution->name
 	);
+}
 #endif
 
-	struct drm_mode_create_dumb creq;
-	struct drm_mode_map_dumb mreq;
-	uint32_t fb;
-	int ret;
-	uint8_t *map;
+/*
+ * run(struct output_manager *, uint64_t, const char *)
+ * render into the back buffers while the front ones scan out,
+ * every head is locked to its own vblank so the loop never spins
+ * and a slow head does not hold back the others.
+ * input is read at the top of every iteration, the latest point
+ * before drawing, so what it changes makes the very next frame.
+ * frames = 0 runs until enter or Escape is pressed.
+ * replay plays a recording ("-" the synthetic script) as input,
+ * so the input-to-photon latency is measured unattended.
+*/
+int run(struct output_manager *m, uint64_t frames, const char *replay)
+{
+	static struct replay player;
+	static struct scene scene;
+	scene.pool = &m->pool;
+	if (raster_init(&scene.raster, 0) < 0)
+	{
+		perror("err: Failed to start render workers: ");
+		return -EINVAL;
+	}
+
+	if (text_init(&scene.text, 2) < 0)
+	{
+		perror("err: Failed to build the glyph atlas: ");
+		raster_destroy(&scene.raster);
+		return -EINVAL;
+	}
+
+	INFO("Rendering with %d threads", scene.raster.thread_count + 1);
+
+	/** no device is fine, headless or without access to /dev/input **/
+	scene.have_input = input_init(&scene.input) == 0;
+	if (scene.have_input && frames == 0)
+		input_add_all(&scene.input);
+
+	bool replaying = false;
+	if (scene.have_input && replay)
+	{
+		int err = replay_load(&player, strcmp(replay, "-") ? replay : NULL);
+		if (err == 0 && (err = replay_start(&player, &scene.input)) < 0)
+			replay_destroy(&player);
+
+		if (err < 0)
+			WARN("Replay of %s failed: %s", replay, strerror(-err));
+		else
+			replaying = true;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	/** create dumb buffer and fill with details **/
-	memset(&creq, 0, sizeof(creq));
-	creq.width = resolution->hdisplay;
-	creq.height = resolution->vdisplay;
-	creq.bpp = 32;
+	int ret = 0;
+	for (;;)
+	{
+		if (frames ? m->outputs[0].frame >= frames : stdin_ready())
+			break;
 
-	/** fill it with appropriate data **/
-	ret = drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+		scene_input(&scene);
+		if (scene.quit)
+			break;
+
+		ret = output_manager_frame(m, render_output, &scene);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to present frame: ");
+			break;
+		}
+
+		ret = output_manager_wait(m, -1);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to wait for flip: ");
+			break;
+		}
+
+		/** drain the timing rings before they overflow, it is cheap next to a frame **/
+		for (int i = 0; i < m->count; ++i)
+			timing_collect(&m->outputs[i].present.timing);
+	}
+
+	if (replaying)
+	{
+		INFO("Replay: %lu frames written", atomic_load(&player.frames));
+		replay_destroy(&player);
+	}
+
+	if (scene.have_input)
+	{
+		struct input_stats *is = &scene.input.stats;
+		INFO("Input: %lu frames in %lu reads (%lu events, %lu dropped)", is->frames, is->reads, is->events, is->dropped_frames);
+		input_destroy(&scene.input);
+	}
+
+	INFO("Text: %lu lines drawn from cache, %lu laid out", scene.text.stats.hits, scene.text.stats.misses);
+
+	uint64_t blended = 0, occluded = 0;
+	for (int i = 0; i < m->count; ++i)
+	{
+		struct scene_output *so = &scene.outputs[i];
+
+		if (so->have_cursor)
+		{
+			INFO("Output %d: %s cursor moved %lu times", i,
+					so->cursor.mode == CURSOR_HARDWARE ? "hardware" : "software", so->cursor.moves);
+			cursor_destroy(&so->cursor);
+		}
+
+		blended += so->compositor.stats.pixels_blended;
+		occluded += so->compositor.stats.pixels_occluded;
+		compositor_destroy(&so->compositor);
+	}
+
+	INFO("Compositor: %.1f Mpixels blended, %.1f Mpixels skipped under opaque layers", blended / 1e6, occluded / 1e6);
+
+	raster_destroy(&scene.raster);
+	text_destroy(&scene.text);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	for (int i = 0; i < m->count; ++i)
+	{
+		struct output *o = &m->outputs[i];
+		struct damage_stats *ds = &o->present.damage_stats;
+
+		INFO("Output %d: presented %lu frames in %.2fs (%.1f fps, %.2f ms between flips)",
+				i, o->present.frames, seconds, seconds > 0 ? o->present.frames / seconds : 0, o->frame_us / 1e3);
+		INFO("Output %d: damaged %.1f MiB of %.1f MiB (%.2f%%)",
+				i, ds->bytes_damaged / 1048576.0, ds->bytes_full / 1048576.0,
+				ds->bytes_full ? 100.0 * ds->bytes_damaged / ds->bytes_full : 0);
+		timing_report(&o->present.timing, writef("Output %d:", i));
+		pacing_report(&o->pacing, writef("Output %d:", i));
+	}
+
+	struct bufpool_stats *ps = &m->pool.stats;
+	INFO("Buffer pool: %lu hits, %lu misses, %lu allocations, %lu live (%.1f MiB, %lu idle)",
+			ps->hits, ps->misses, ps->allocations, ps->live, ps->bytes_live / 1048576.0, ps->idle);
+
+	return ret < 0 ? ret : 0;
+}
+
+/** what `card --serve` draws with: the input and cursors of the scene, the surfaces of its clients **/
+struct desktop
+{
+	struct scene scene;
+	struct server server;
+};
+
+/*
+ * desktop_output(struct output *, struct present_buffer *, struct damage *, void *)
+ * composites the client surfaces of one head over the background,
+ * the clients draw them, the daemon never touches their pixels.
+*/
+void desktop_output(struct output *o, struct present_buffer *b, struct damage *repaint, void *data)
+{
+	struct desktop *d = data;
+	struct scene *s = &d->scene;
+	struct scene_output *so = &s->outputs[o->index];
+	int32_t w = b->width, h = b->height;
+
+	if (so->compositor.width != w || so->compositor.height != h)
+	{
+		if (so->have_cursor)
+			cursor_destroy(&so->cursor);
+
+		so->have_cursor = false;
+		server_head(&d->server, o->index, NULL);
+		compositor_destroy(&so->compositor);
+		compositor_init(&so->compositor, w, h, DESKTOP_BACKGROUND);
+		server_head(&d->server, o->index, &so->compositor);
+
+		if (cursor_init(&so->cursor, &o->present, s->pool, &so->compositor) == 0)
+		{
+			so->have_cursor = true;
+			cursor_show(&so->cursor, true);
+			cursor_move(&so->cursor, w / 2, h / 2);
+		}
+	}
+
+	if (so->have_cursor && s->pointer)
+	{
+		s->pointer_x = s->pointer_x < 0 ? 0 : s->pointer_x >= w ? w - 1 : s->pointer_x;
+		s->pointer_y = s->pointer_y < 0 ? 0 : s->pointer_y >= h ? h - 1 : s->pointer_y;
+		cursor_move(&so->cursor, s->pointer_x, s->pointer_y);
+	}
+
+	if (so->input_ns)
+	{
+		timing_input(&o->present.timing, so->input_ns);
+		so->input_ns = 0;
+	}
+
+	struct damage changed;
+	damage_init(&changed, w, h);
+	compositor_take_damage(&so->compositor, &changed);
+
+	present_repaint_region(&o->present, &changed, repaint);
+	compositor_composite(&so->compositor, b->map, b->pitch, repaint);
+
+	server_composited(&d->server, o->index);
+}
+
+/*
+ * desktop_wait(struct output_manager *, struct desktop *)
+ * sleeps until a flip completes, a client sends something or input
+ * arrives, so a request is answered right away and not a frame later.
+*/
+int desktop_wait(struct output_manager *m, struct desktop *d)
+{
+	struct pollfd pfds[OUTPUT_MAX + 2];
+	int count = 0;
+
+	pfds[count++] = (struct pollfd) { .fd = server_fd(&d->server), .events = POLLIN };
+	if (d->scene.have_input)
+		pfds[count++] = (struct pollfd) { .fd = input_fd(&d->scene.input), .events = POLLIN };
+
+	int first_output = count;
+	for (int i = 0; i < m->count; ++i)
+		pfds[count++] = (struct pollfd) { .fd = m->outputs[i].present.wait_fd, .events = POLLIN };
+
+	/** a paced head due before anything arrives is the wakeup **/
+	if (poll(pfds, count, output_manager_timeout(m, -1)) < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (int i = first_output; i < count; ++i)
+		if (pfds[i].revents & POLLIN)
+			return output_manager_wait(m, 0);
+
+	return 0;
+}
+
+/*
+ * serve(struct output_manager *, const char *)
+ * keeps the outputs and shows what clients draw into shared memory,
+ * until enter or Escape is pressed. requests are handled as they
+ * come and the heads render as soon as they have a free buffer,
+ * so damage is on screen with the next flip.
+*/
+int serve(struct output_manager *m, const char *path)
+{
+	static struct desktop desktop;
+	struct scene *s = &desktop.scene;
+	s->pool = &m->pool;
+
+	int ret = server_init(&desktop.server, path);
 	if (ret < 0)
 	{
-		perror("err: Failed to create dumb buffer: ");
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		errno = -ret;
+		perror("err: Failed to listen for clients: ");
+		return ret;
 	}
 
-	/** get framebuffer id **/
-	ret = drmModeAddFB(fd, creq.width, creq.height, 24, creq.bpp, creq.pitch, creq.handle, &fb);
-	if (ret)
+	s->have_input = input_init(&s->input) == 0;
+	if (s->have_input)
+		input_add_all(&s->input);
+
+	INFO("Serving the display on %s", desktop.server.path);
+
+	for (;;)
 	{
-		perror("err: Failed to create framebuffer: ");
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		if (stdin_ready())
+			break;
+
+		scene_input(s);
+		if (s->quit)
+			break;
+
+		ret = server_dispatch(&desktop.server, 0);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to serve clients: ");
+			break;
+		}
+
+		ret = output_manager_frame(m, desktop_output, &desktop);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to present frame: ");
+			break;
+		}
+
+		ret = desktop_wait(m, &desktop);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to wait for flip: ");
+			break;
+		}
+
+		for (int i = 0; i < m->count; ++i)
+			timing_collect(&m->outputs[i].present.timing);
 	}
 
-	memset(&mreq, 0, sizeof(mreq));
-	mreq.handle = creq.handle;
+	struct server_stats *st = &desktop.server.stats;
+	INFO("Display: %lu clients, %lu requests, %lu surfaces, %lu damage rects, %lu frames sent",
+			st->clients, st->requests, st->surfaces, st->damage_rects, st->frames_sent);
+
+	/** the layers of the surfaces go with the compositors **/
+	for (int i = 0; i < m->count; ++i)
+		server_head(&desktop.server, i, NULL);
+
+	server_destroy(&desktop.server);
 
-	ret = drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-	if (ret)
+	for (int i = 0; i < m->count; ++i)
 	{
-		perror("err: DRM buffer preparation failed: ");
-		drmModeRmFB(fd, fb);
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		struct scene_output *so = &s->outputs[i];
+
+		if (so->have_cursor)
+			cursor_destroy(&so->cursor);
+
+		compositor_destroy(&so->compositor);
+		timing_report(&m->outputs[i].present.timing, writef("Output %d:", i));
 	}
 
-	map = mmap(0, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-	if (map == MAP_FAILED)
+	if (s->have_input)
+		input_destroy(&s->input);
+
+	return ret < 0 ? ret : 0;
+}
+
+int main(int argc, char **argv)
+{
+	/** check if user has provided the dri device or not. **/
+	if (argc < 2)
 	{
-		perror("err: Memory-mapping failed: ");
-		drmModeRmFB(fd, fb);
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
+		printf("Err: provide [--format rgb565|xrgb8888|xrgb2101010|nv12] [--pace missed%%] [--replay recording|-] [--serve socket|-] dri device [splash image] (or --headless [heads] [dump prefix] [splash image]).\n");
 		return -EINVAL;
 	}
 
-	/* clear framebuffer to 0 */
-	memset(map, 0, creq.size);
+	/** scanout format, 16bpp halves what is scanned out and uploaded; drawing is XRGB8888 anyway **/
+	uint32_t format = DRM_FORMAT_XRGB8888;
+	if (argc > 3 && !strcmp(argv[1], "--format"))
+	{
+		const struct format_info *f = format_by_name(argv[2]);
+		if (f == NULL)
+		{
+			printf("Err: unknown format `%s`.\n", argv[2]);
+			return -EINVAL;
+		}
 
-	INFO("Memory allocate for frameBuffer");
+		format = f->fourcc;
+		argc -= 2;
+		argv += 2;
+	}
 
-	/* get encoder */
-	drmModeEncoderPtr encoder = drmModeGetEncoder(fd, connector->encoder_id);
-	if (!encoder)
+	/** render just in time for the vblank, missing at most this % of them **/
+	double pace = 0;
+	if (argc > 3 && !strcmp(argv[1], "--pace"))
 	{
-		perror("err: Failed to get encoder: ");
-		munmap(map, creq.size);
-		drmModeRmFB(fd, fb);
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		pace = atof(argv[2]) / 100;
+		argc -= 2;
+		argv += 2;
 	}
 
-	/* get crtc */
-	drmModeCrtcPtr crtc = drmModeGetCrtc(fd, encoder->crtc_id);
-	if (!crtc)
+	/** input played back instead of typed, for latency runs **/
+	const char *replay = NULL;
+	if (argc > 3 && !strcmp(argv[1], "--replay"))
 	{
-		perror("err: Failed to get crtc: ");
-		drmModeFreeEncoder(encoder);
-		munmap(map, creq.size);
-		drmModeRmFB(fd, fb);
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
-		close(fd);
-		return -EINVAL;
+		replay = argv[2];
+		argc -= 2;
+		argv += 2;
 	}
 
-	INFO("Successfully got Encoder & CRTC");
+	/** stay up as a display daemon instead of drawing the demo scene **/
+	const char *serve_path = NULL;
+	if (argc > 3 && !strcmp(argv[1], "--serve"))
+	{
+		serve_path = strcmp(argv[2], "-") ? argv[2] : DISPLAY_SOCKET;
+		argc -= 2;
+		argv += 2;
+	}
+
+	/** the first argument must be a dri device, else it might fail. **/
+	const char *card = argv[1];
+	struct output_manager outputs;
+	struct backend backend;
+	int fd = -1;
+	int ret;
 
-	// Fill the framebuffer with a solid color (e.g., red)
-	for (uint32_t y = 0; y < creq.height; y++) {
-		for (uint32_t x = 0; x < creq.width; x++) {
-			uint32_t pixel_offset = (y * creq.pitch) + (x * 4);
-			map[pixel_offset] = 0xFF;        // Blue
-			map[pixel_offset + 1] = 0xbb;    // Green
-			map[pixel_offset + 2] = 0xaa;    // Red
-			map[pixel_offset + 3] = 0xFF;    // Alpha
+	if (!strcmp(card, "--headless"))
+	{
+		int heads = 1;
+		if (argc > 2)
+		{
+			char *end;
+			long n = strtol(argv[2], &end, 10);
+			if (end == argv[2] || *end != '\0' || n < 1 || n > OUTPUT_MAX)
+			{
+				printf("Err: --headless takes 1 to %d heads, not `%s`.\n", OUTPUT_MAX, argv[2]);
+				return -EINVAL;
+			}
+			heads = n;
 		}
+
+		/** a third argument dumps every presented frame, <prefix>-<head>.ppm **/
+		backend_init_memory(&backend, argc > 3 ? argv[3] : NULL);
+
+		ret = output_manager_init_headless(&outputs, &backend, heads, HEADLESS_WIDTH, HEADLESS_HEIGHT, BUFFER_COUNT, format);
+		if (ret < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to create headless buffers: ");
+			return -EINVAL;
+		}
+
+		if (pace > 0)
+			output_manager_pace(&outputs, pace);
+
+		if (argc > 4 && (ret = splash(&outputs, argv[4])) < 0)
+		{
+			errno = -ret;
+			perror("err: Failed to show splash image: ");
+		}
+
+		ret = serve_path ? serve(&outputs, serve_path) : run(&outputs, HEADLESS_FRAMES, replay);
+		output_manager_destroy(&outputs);
+
+		return ret < 0 ? -EINVAL : 0;
 	}
 
-	INFO("Modified color to the framebuffer");
+	/** open dri device in read and write mode **/
+	fd = open(card, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+	{
+		perror("Err: failed to open dri device: ");
+		return -EINVAL;
+	}
+
+	INFO("Successfully opened dri device: %s", card);
 
-	// Set the CRTC
-	if (drmModeSetCrtc(fd, crtc->crtc_id, fb, 0, 0, &connector->connector_id, 1, resolution))
+	/** every connected connector gets its own crtc and buffer chain **/
+	backend_init_drm(&backend, fd);
+	ret = output_manager_init(&outputs, &backend, BUFFER_COUNT, format);
+	if (ret < 0)
 	{
-		perror("err: Failed to set CRTC: ");
-		drmModeFreeCrtc(crtc);
-		drmModeFreeEncoder(encoder);
-		munmap(map, creq.size);
-		drmModeRmFB(fd, fb);
-		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-		drmModeFreeConnector(connector);
-		drmModeFreeResources(res);
+		errno = -ret;
+		perror("err: Failed to set up outputs: ");
 		close(fd);
 		return -EINVAL;
 	}
 
-	getchar();
+	INFO("Driving %d outputs", outputs.count);
+
+	if (pace > 0)
+		output_manager_pace(&outputs, pace);
+
+#ifdef DEBUG
+	for (int i = 0; i < outputs.count; ++i)
+		print_mode(&outputs.outputs[i]);
+#endif
+
+	if (argc > 2 && (ret = splash(&outputs, argv[2])) < 0)
+	{
+		errno = -ret;
+		perror("err: Failed to show splash image: ");
+	}
+
+	ret = serve_path ? serve(&outputs, serve_path) : run(&outputs, 0, replay);
 
 	INFO("Leaving now...");
 
-	drmModeFreeCrtc(crtc);
-	drmModeFreeEncoder(encoder);
-	munmap(map, creq.size);
-	drmModeRmFB(fd, fb);
-	ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &creq.handle);
-	drmModeFreeConnector(connector);
-	drmModeFreeResources(res);
+	output_manager_destroy(&outputs);
 	close(fd);
 
-	return 0;
+	return ret < 0 ? -EINVAL : 0;
 }
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "log.h"
+#include "display.h"
+#include "pixel.h"
+
+/** a window that draws itself every frame, for `card --serve` **/
+#define WINDOW_WIDTH 320
+#define WINDOW_HEIGHT 200
+#define WINDOW_FRAMES 300
+#define WINDOW_BAR 16
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * bar_x(struct display_surface *, uint64_t, int32_t)
+ * left edge of the bar sweeping across the window in `frame`.
+*/
+int32_t bar_x(const struct display_surface *s, uint64_t frame, int32_t bar)
+{
+	return frame * 4 % (s->width - bar);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : NULL;
+	uint64_t frames = argc > 2 ? strtoull(argv[2], NULL, 10) : WINDOW_FRAMES;
+
+	uint64_t start = now_ns();
+
+	int32_t width, height;
+	int fd = display_connect(path, &width, &height);
+	if (fd < 0)
+	{
+		errno = -fd;
+		perror("err: Failed to connect to the display: ");
+		return 1;
+	}
+
+	struct display_surface s;
+	int ret = display_surface_create(fd, &s, WINDOW_WIDTH, WINDOW_HEIGHT, width / 2 - WINDOW_WIDTH / 2, height / 2 - WINDOW_HEIGHT / 2, 1, false);
+	if (ret < 0)
+	{
+		errno = -ret;
+		perror("err: Failed to create a surface: ");
+		close(fd);
+		return 1;
+	}
+
+	INFO("Connected to a %dx%d display with a %ux%u surface in %.3f ms", width, height, s.width, s.height, (now_ns() - start) / 1e6);
+
+	uint64_t sum = 0, max = 0, frame = 0;
+	for (; frame < frames; ++frame)
+	{
+		/** a translucent window, only where the bar was and is are redrawn **/
+		int32_t x = bar_x(&s, frame, WINDOW_BAR);
+		if (frame == 0)
+		{
+			pixel_fill_rect32((uint8_t*)s.pixels, s.stride * 4, 0, 0, s.width, s.height, 0xC0202060);
+			ret = 0;
+		}
+		else
+		{
+			int32_t old = bar_x(&s, frame - 1, WINDOW_BAR);
+			pixel_fill_rect32((uint8_t*)s.pixels, s.stride * 4, old, 0, WINDOW_BAR, s.height, 0xC0202060);
+			ret = display_damage(fd, &s, old, 0, WINDOW_BAR, s.height, false);
+		}
+
+		pixel_fill_rect32((uint8_t*)s.pixels, s.stride * 4, x, 0, WINDOW_BAR, s.height, 0xFFE0A020);
+
+		uint64_t drawn = now_ns();
+		if (ret == 0)
+			ret = frame == 0 ? display_damage(fd, &s, 0, 0, s.width, s.height, true) : display_damage(fd, &s, x, 0, WINDOW_BAR, s.height, true);
+
+		uint64_t composited = ret == 0 ? display_wait_frame(fd, &s) : 0;
+		if (composited == 0)
+		{
+			WARN("The display went away");
+			break;
+		}
+
+		uint64_t latency = composited > drawn ? composited - drawn : 0;
+		sum += latency;
+		max = latency > max ? latency : max;
+	}
+
+	INFO("%lu frames, damage to composited avg %.3f ms max %.3f ms", frame, frame ? sum / 1e6 / frame : 0, max / 1e6);
+
+	display_surface_destroy(fd, &s);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,466 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pixel.h"
+#include "damage.h"
+
+#ifndef COMPOSITOR_MAX_LAYERS
+	#define COMPOSITOR_MAX_LAYERS 16
+#endif // COMPOSITOR_MAX_LAYERS
+
+/*
+ * A layer owns premultiplied ARGB8888 pixels, drawn by whoever
+ * created it. The compositor only reads them inside the damage.
+ */
+struct compositor_layer
+{
+	uint32_t *pixels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;			/* pixels per row */
+
+	int32_t x;
+	int32_t y;
+	int z;								/* higher is closer to the viewer */
+	uint8_t opacity;			/* 255 = as drawn */
+	bool visible;
+
+	/** every pixel has alpha 255, the layer hides whatever is below it **/
+	bool opaque;
+	bool borrowed;				/* pixels belong to the caller of compositor_layer_attach() */
+};
+
+struct compositor_stats
+{
+	uint64_t pixels_copied;		/* bottom layer of a span written as is */
+	uint64_t pixels_blended;
+	uint64_t pixels_occluded;	/* layer pixels skipped below an opaque one */
+};
+
+struct compositor
+{
+	int32_t width;
+	int32_t height;
+	uint32_t background;	/* XRGB below every layer */
+
+	/** sorted by z, bottom first **/
+	struct compositor_layer *layers[COMPOSITOR_MAX_LAYERS];
+	int count;
+
+	/** screen area that changed since the last compositor_take_damage() **/
+	struct damage damage;
+
+	struct compositor_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: compositor_init(struct compositor *c, int32_t width, int32_t height, uint32_t background)
+ * -----------------------
+ *  Starts without layers, the whole screen is damaged.
+ */
+void compositor_init(struct compositor *c, int32_t width, int32_t height, uint32_t background);
+
+/*
+ * Function: compositor_layer_create(struct compositor *c, uint32_t width, uint32_t height, int z, bool opaque)
+ * -----------------------
+ *  Adds a visible, fully transparent (or black if `opaque`) layer at (0, 0).
+ *
+ * opaque: Caller promises to only draw pixels with alpha 255 (bool)
+ *
+ * returns: The layer, NULL if out of memory or layers (struct compositor_layer *)
+ */
+struct compositor_layer *compositor_layer_create(struct compositor *c, uint32_t width, uint32_t height, int z, bool opaque);
+
+/*
+ * Function: compositor_layer_attach(struct compositor *c, uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride, int z, bool opaque)
+ * -----------------------
+ *  Adds a visible layer at (0, 0) over pixels owned by the caller, a shared
+ *  mapping for example. They must stay mapped until the layer is destroyed.
+ *
+ * stride: Pixels per row (uint32_t)
+ *
+ * returns: The layer, NULL if out of memory or layers (struct compositor_layer *)
+ */
+struct compositor_layer *compositor_layer_attach(struct compositor *c, uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride, int z, bool opaque);
+
+/*
+ * Function: compositor_layer_damage(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y, int32_t w, int32_t h)
+ * -----------------------
+ *  The pixels of `l` in the rectangle (layer coordinates) were redrawn.
+ */
+void compositor_layer_damage(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/*
+ * Function: compositor_layer_move(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y)
+ * -----------------------
+ *  Places the top left corner of `l` at (`x`, `y`) on the screen.
+ */
+void compositor_layer_move(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y);
+
+/*
+ * Function: compositor_layer_set_opacity(struct compositor *c, struct compositor_layer *l, uint8_t opacity)
+ * -----------------------
+ *  Fades the whole layer, 0 hides it without skipping its damage.
+ */
+void compositor_layer_set_opacity(struct compositor *c, struct compositor_layer *l, uint8_t opacity);
+
+/*
+ * Function: compositor_layer_set_z(struct compositor *c, struct compositor_layer *l, int z)
+ * -----------------------
+ *  Restacks `l`, layers with the same z keep their order of creation.
+ */
+void compositor_layer_set_z(struct compositor *c, struct compositor_layer *l, int z);
+
+/*
+ * Function: compositor_layer_set_visible(struct compositor *c, struct compositor_layer *l, bool visible)
+ * -----------------------
+ *  Hidden layers cost nothing while compositing.
+ */
+void compositor_layer_set_visible(struct compositor *c, struct compositor_layer *l, bool visible);
+
+/*
+ * Function: compositor_layer_destroy(struct compositor *c, struct compositor_layer *l)
+ * -----------------------
+ *  Removes and frees `l`, the area it covered is damaged.
+ */
+void compositor_layer_destroy(struct compositor *c, struct compositor_layer *l);
+
+/*
+ * Function: compositor_take_damage(struct compositor *c, struct damage *changed)
+ * -----------------------
+ *  Adds what changed since the last call to `changed` and starts over,
+ *  to be passed to present_repaint_region() before compositing.
+ */
+void compositor_take_damage(struct compositor *c, struct damage *changed);
+
+/*
+ * Function: compositor_composite(struct compositor *c, uint8_t *map, uint32_t pitch, const struct damage *region)
+ * -----------------------
+ *  Recomposites `region` of the screen into `map` (XRGB8888, width x height).
+ *  Every row is split where layers start and end, each piece starts
+ *  from the topmost opaque layer covering it and blends the ones above.
+ *
+ * region: Area to redraw, NULL for the whole screen (const struct damage *)
+ */
+void compositor_composite(struct compositor *c, uint8_t *map, uint32_t pitch, const struct damage *region);
+
+/*
+ * Function: compositor_destroy(struct compositor *c)
+ * -----------------------
+ *  Frees every layer.
+ */
+void compositor_destroy(struct compositor *c);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+void compositor_init(struct compositor *c, int32_t width, int32_t height, uint32_t background)
+{
+	memset(c, 0, sizeof(*c));
+	c->width = width;
+	c->height = height;
+	c->background = background;
+
+	damage_init(&c->damage, width, height);
+	damage_full(&c->damage);
+}
+
+static void compositor_damage_layer(struct compositor *c, const struct compositor_layer *l)
+{
+	if (l->visible)
+		damage_add(&c->damage, l->x, l->y, l->width, l->height);
+}
+
+/*
+ * compositor_sort()
+ *
+ * Insertion sort by z, stable, there are only a handful of layers.
+*/
+static void compositor_sort(struct compositor *c)
+{
+	for (int i = 1; i < c->count; ++i)
+	{
+		struct compositor_layer *l = c->layers[i];
+		int j = i;
+
+		for (; j > 0 && c->layers[j - 1]->z > l->z; --j)
+			c->layers[j] = c->layers[j - 1];
+
+		c->layers[j] = l;
+	}
+}
+
+/*
+ * compositor_layer_add()
+ *
+ * Puts `l` into the stack and damages it.
+*/
+static struct compositor_layer *compositor_layer_add(struct compositor *c, struct compositor_layer *l, uint32_t width, uint32_t height, int z, bool opaque)
+{
+	l->width = width;
+	l->height = height;
+	l->z = z;
+	l->opacity = 255;
+	l->visible = true;
+	l->opaque = opaque;
+
+	c->layers[c->count++] = l;
+	compositor_sort(c);
+	compositor_damage_layer(c, l);
+
+	return l;
+}
+
+struct compositor_layer *compositor_layer_create(struct compositor *c, uint32_t width, uint32_t height, int z, bool opaque)
+{
+	if (c->count >= COMPOSITOR_MAX_LAYERS || width == 0 || height == 0)
+		return NULL;
+
+	struct compositor_layer *l = calloc(1, sizeof(*l));
+	if (l == NULL)
+		return NULL;
+
+	/** rows start on a cache line like the dumb buffers **/
+	l->stride = (width + 15) & ~15u;
+	l->pixels = aligned_alloc(64, (size_t)l->stride * height * 4);
+	if (l->pixels == NULL)
+	{
+		free(l);
+		return NULL;
+	}
+
+	memset(l->pixels, 0, (size_t)l->stride * height * 4);
+	if (opaque)
+		pixel_fill_rect32((uint8_t*)l->pixels, l->stride * 4, 0, 0, width, height, 0xFF000000);
+
+	return compositor_layer_add(c, l, width, height, z, opaque);
+}
+
+struct compositor_layer *compositor_layer_attach(struct compositor *c, uint32_t *pixels, uint32_t width, uint32_t height, uint32_t stride, int z, bool opaque)
+{
+	if (c->count >= COMPOSITOR_MAX_LAYERS || width == 0 || height == 0 || stride < width)
+		return NULL;
+
+	struct compositor_layer *l = calloc(1, sizeof(*l));
+	if (l == NULL)
+		return NULL;
+
+	l->pixels = pixels;
+	l->stride = stride;
+	l->borrowed = true;
+
+	return compositor_layer_add(c, l, width, height, z, opaque);
+}
+
+void compositor_layer_damage(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	/** damage_add() clips to the screen, the layer edges clip here **/
+	int32_t x2 = x + w, y2 = y + h;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
+	if (x2 > (int32_t)l->width) x2 = l->width;
+	if (y2 > (int32_t)l->height) y2 = l->height;
+
+	if (l->visible && x < x2 && y < y2)
+		damage_add(&c->damage, l->x + x, l->y + y, x2 - x, y2 - y);
+}
+
+void compositor_layer_move(struct compositor *c, struct compositor_layer *l, int32_t x, int32_t y)
+{
+	if (l->x == x && l->y == y)
+		return;
+
+	compositor_damage_layer(c, l);
+	l->x = x;
+	l->y = y;
+	compositor_damage_layer(c, l);
+}
+
+void compositor_layer_set_opacity(struct compositor *c, struct compositor_layer *l, uint8_t opacity)
+{
+	if (l->opacity == opacity)
+		return;
+
+	l->opacity = opacity;
+	compositor_damage_layer(c, l);
+}
+
+void compositor_layer_set_z(struct compositor *c, struct compositor_layer *l, int z)
+{
+	if (l->z == z)
+		return;
+
+	l->z = z;
+	compositor_sort(c);
+	compositor_damage_layer(c, l);
+}
+
+void compositor_layer_set_visible(struct compositor *c, struct compositor_layer *l, bool visible)
+{
+	if (l->visible == visible)
+		return;
+
+	/** damaged while visible, either before hiding or after showing **/
+	compositor_damage_layer(c, l);
+	l->visible = visible;
+	compositor_damage_layer(c, l);
+}
+
+void compositor_layer_destroy(struct compositor *c, struct compositor_layer *l)
+{
+	compositor_damage_layer(c, l);
+
+	int i = 0;
+	while (i < c->count && c->layers[i] != l)
+		++i;
+
+	if (i < c->count)
+	{
+		memmove(&c->layers[i], &c->layers[i + 1], (c->count - i - 1) * sizeof(c->layers[0]));
+		c->count--;
+	}
+
+	if (!l->borrowed)
+		free(l->pixels);
+	free(l);
+}
+
+void compositor_take_damage(struct compositor *c, struct damage *changed)
+{
+	damage_union(changed, &c->damage);
+	damage_reset(&c->damage);
+}
+
+static inline bool compositor_covers(const struct compositor_layer *l, int32_t y, int32_t x1, int32_t x2)
+{
+	return l->visible && l->opacity && y >= l->y && y < l->y + (int32_t)l->height
+			&& x1 >= l->x && x2 <= l->x + (int32_t)l->width;
+}
+
+static inline const uint32_t *compositor_row(const struct compositor_layer *l, int32_t y, int32_t x)
+{
+	return l->pixels + (size_t)(y - l->y) * l->stride + (x - l->x);
+}
+
+/*
+ * compositor_span()
+ *
+ * Composites screen row `y` from x1 to x2 (exclusive). Between two
+ * consecutive layer edges every layer either covers all of a piece or none of it.
+*/
+static void compositor_span(struct compositor *c, uint32_t *row, int32_t y, int32_t x1, int32_t x2)
+{
+	int32_t edges[2 * COMPOSITOR_MAX_LAYERS + 2];
+	int count = 0;
+
+	edges[count++] = x1;
+	edges[count++] = x2;
+
+	for (int i = 0; i < c->count; ++i)
+	{
+		const struct compositor_layer *l = c->layers[i];
+		if (!l->visible || y < l->y || y >= l->y + (int32_t)l->height)
+			continue;
+
+		int32_t e[2] = { l->x, l->x + (int32_t)l->width };
+		for (int k = 0; k < 2; ++k)
+			if (e[k] > x1 && e[k] < x2)
+				edges[count++] = e[k];
+	}
+
+	/** a handful of edges, insertion sort **/
+	for (int i = 1; i < count; ++i)
+	{
+		int32_t e = edges[i];
+		int j = i;
+		for (; j > 0 && edges[j - 1] > e; --j)
+			edges[j] = edges[j - 1];
+		edges[j] = e;
+	}
+
+	for (int s = 0; s + 1 < count; ++s)
+	{
+		int32_t a = edges[s], b = edges[s + 1];
+		if (a == b)
+			continue;
+
+		/** the topmost opaque layer hides everything under it **/
+		int base = -1;
+		for (int i = c->count - 1; i >= 0; --i)
+		{
+			const struct compositor_layer *l = c->layers[i];
+			if (l->opaque && l->opacity == 255 && compositor_covers(l, y, a, b))
+			{
+				base = i;
+				break;
+			}
+		}
+
+		if (base < 0)
+			pixel_fill_row32(row + a, c->background, b - a);
+		else
+		{
+			memcpy(row + a, compositor_row(c->layers[base], y, a), (size_t)(b - a) * 4);
+			c->stats.pixels_copied += b - a;
+
+			for (int i = 0; i < base; ++i)
+				if (compositor_covers(c->layers[i], y, a, b))
+					c->stats.pixels_occluded += b - a;
+		}
+
+		for (int i = base + 1; i < c->count; ++i)
+		{
+			const struct compositor_layer *l = c->layers[i];
+			if (!compositor_covers(l, y, a, b))
+				continue;
+
+			pixel_blend_row32(row + a, compositor_row(l, y, a), b - a, l->opacity);
+			c->stats.pixels_blended += b - a;
+		}
+	}
+}
+
+void compositor_composite(struct compositor *c, uint8_t *map, uint32_t pitch, const struct damage *region)
+{
+	struct damage full;
+	if (region == NULL)
+	{
+		damage_init(&full, c->width, c->height);
+		damage_full(&full);
+		region = &full;
+	}
+
+	for (int i = 0; i < region->count; ++i)
+	{
+		const struct damage_rect *r = &region->rects[i];
+		int32_t x1 = r->x1 > 0 ? r->x1 : 0, y1 = r->y1 > 0 ? r->y1 : 0;
+		int32_t x2 = r->x2 < c->width ? r->x2 : c->width, y2 = r->y2 < c->height ? r->y2 : c->height;
+
+		for (int32_t y = y1; y < y2 && x1 < x2; ++y)
+			compositor_span(c, (uint32_t*)(map + (size_t)y * pitch), y, x1, x2);
+	}
+}
+
+void compositor_destroy(struct compositor *c)
+{
+	for (int i = 0; i < c->count; ++i)
+	{
+		if (!c->layers[i]->borrowed)
+			free(c->layers[i]->pixels);
+		free(c->layers[i]);
+	}
+
+	c->count = 0;
+}
+
+#endif // COMPOSITOR_H
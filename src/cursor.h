@@ -0,0 +1,244 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <libdrm/drm_fourcc.h>
+
+#include "log.h"
+#include "backend.h"
+#include "present.h"
+#include "bufpool.h"
+#include "compositor.h"
+
+/** every driver takes a 64x64 cursor, most take larger ones too **/
+#define CURSOR_SIZE 64
+
+/** above every other layer of the compositor **/
+#define CURSOR_Z 0x7FFFFFFF
+
+typedef enum {
+	CURSOR_HARDWARE = 0,	/* scanned out on its own plane, a move is one ioctl */
+	CURSOR_SOFTWARE				/* top layer of the compositor, a move damages two rectangles */
+} CURSOR_MODE;
+
+struct cursor
+{
+	CURSOR_MODE mode;
+	struct present *present;
+	struct bufpool *pool;
+	struct compositor *compositor;
+
+	struct present_buffer *image;			/* hardware: ARGB8888 buffer scanned out as is */
+	struct compositor_layer *layer;		/* software */
+
+	int32_t hot_x;
+	int32_t hot_y;
+	int32_t x;		/* pointer position, the hotspot is drawn here */
+	int32_t y;
+	bool visible;
+
+	uint64_t moves;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: cursor_init(struct cursor *c, struct present *p, struct bufpool *pool, struct compositor *compositor)
+ * -----------------------
+ *  Shows the built-in arrow on the cursor plane of `p` if its backend has one,
+ *  else as the top layer of `compositor`. Starts hidden at (0, 0).
+ *  A chain re-created by output_set_mode() needs a new cursor.
+ *
+ * pool: Where the hardware cursor buffer comes from (struct bufpool *)
+ * compositor: Composites the frames of `p`, for the fallback (struct compositor *)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int cursor_init(struct cursor *c, struct present *p, struct bufpool *pool, struct compositor *compositor);
+
+/*
+ * Function: cursor_move(struct cursor *c, int32_t x, int32_t y)
+ * -----------------------
+ *  Puts the hotspot at (`x`, `y`). The hardware cursor moves right away,
+ *  the software one with the next composited frame.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int cursor_move(struct cursor *c, int32_t x, int32_t y);
+
+/*
+ * Function: cursor_show(struct cursor *c, bool visible)
+ * -----------------------
+ *  returns: 0 on success, negative errno on failure (int)
+ */
+int cursor_show(struct cursor *c, bool visible);
+
+/*
+ * Function: cursor_destroy(struct cursor *c)
+ * -----------------------
+ *  Hides the cursor and gives its buffer or layer back.
+ */
+void cursor_destroy(struct cursor *c);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/** left pointing arrow, X is the outline, . the fill, hotspot at the tip **/
+static const char *cursor_arrow[] = {
+	"X",
+	"XX",
+	"X.X",
+	"X..X",
+	"X...X",
+	"X....X",
+	"X.....X",
+	"X......X",
+	"X.......X",
+	"X........X",
+	"X.........X",
+	"X......XXXXX",
+	"X...X..X",
+	"X..XX..X",
+	"X.X  X..X",
+	"XX   X..X",
+	"X     X..X",
+	"      X..X",
+	"       XX",
+};
+
+/*
+ * cursor_draw()
+ *
+ * Premultiplied ARGB, the arrow on a transparent square.
+*/
+static void cursor_draw(uint32_t *pixels, uint32_t stride)
+{
+	for (uint32_t y = 0; y < CURSOR_SIZE; ++y)
+		memset(pixels + (size_t)y * stride, 0, CURSOR_SIZE * 4);
+
+	for (uint32_t y = 0; y < sizeof(cursor_arrow) / sizeof(cursor_arrow[0]); ++y)
+		for (uint32_t x = 0; cursor_arrow[y][x]; ++x)
+		{
+			if (cursor_arrow[y][x] == 'X')
+				pixels[(size_t)y * stride + x] = 0xFF000000;
+			else if (cursor_arrow[y][x] == '.')
+				pixels[(size_t)y * stride + x] = 0xFFFFFFFF;
+		}
+}
+
+static int cursor_init_hardware(struct cursor *c)
+{
+	const struct backend_ops *ops = c->present->backend->ops;
+	if (ops->cursor_set == NULL || ops->cursor_move == NULL)
+		return -ENOTSUP;
+
+	c->image = bufpool_get(c->pool, CURSOR_SIZE, CURSOR_SIZE, 32, DRM_FORMAT_ARGB8888);
+	if (c->image == NULL)
+		return -errno;
+
+	cursor_draw((uint32_t*)c->image->map, c->image->pitch / 4);
+
+	/** park it first, the image is set by cursor_show() **/
+	int ret = ops->cursor_move(c->present, -c->hot_x, -c->hot_y);
+	if (ret == 0)
+		ret = ops->cursor_set(c->present, NULL, 0, 0);
+
+	if (ret < 0)
+	{
+		bufpool_put(c->pool, c->image);
+		c->image = NULL;
+	}
+
+	return ret;
+}
+
+static int cursor_init_software(struct cursor *c)
+{
+	c->layer = compositor_layer_create(c->compositor, CURSOR_SIZE, CURSOR_SIZE, CURSOR_Z, false);
+	if (c->layer == NULL)
+		return -ENOMEM;
+
+	cursor_draw(c->layer->pixels, c->layer->stride);
+	compositor_layer_set_visible(c->compositor, c->layer, false);
+	compositor_layer_move(c->compositor, c->layer, -c->hot_x, -c->hot_y);
+
+	return 0;
+}
+
+int cursor_init(struct cursor *c, struct present *p, struct bufpool *pool, struct compositor *compositor)
+{
+	memset(c, 0, sizeof(*c));
+	c->present = p;
+	c->pool = pool;
+	c->compositor = compositor;
+
+	int ret = cursor_init_hardware(c);
+	if (ret == 0)
+	{
+		c->mode = CURSOR_HARDWARE;
+		INFO("crtc %u: hardware cursor", p->crtc_id);
+		return 0;
+	}
+
+	if (ret != -ENOTSUP)
+		WARN("crtc %u: hardware cursor failed (%s), compositing it instead", p->crtc_id, strerror(-ret));
+
+	c->mode = CURSOR_SOFTWARE;
+	return cursor_init_software(c);
+}
+
+int cursor_move(struct cursor *c, int32_t x, int32_t y)
+{
+	if (c->x == x && c->y == y)
+		return 0;
+
+	c->x = x;
+	c->y = y;
+	c->moves++;
+
+	if (c->mode == CURSOR_SOFTWARE)
+	{
+		compositor_layer_move(c->compositor, c->layer, x - c->hot_x, y - c->hot_y);
+		return 0;
+	}
+
+	return c->present->backend->ops->cursor_move(c->present, x - c->hot_x, y - c->hot_y);
+}
+
+int cursor_show(struct cursor *c, bool visible)
+{
+	if (c->visible == visible)
+		return 0;
+
+	c->visible = visible;
+
+	if (c->mode == CURSOR_SOFTWARE)
+	{
+		compositor_layer_set_visible(c->compositor, c->layer, visible);
+		return 0;
+	}
+
+	return c->present->backend->ops->cursor_set(c->present, visible ? c->image : NULL, c->hot_x, c->hot_y);
+}
+
+void cursor_destroy(struct cursor *c)
+{
+	cursor_show(c, false);
+
+	if (c->image)
+		bufpool_put(c->pool, c->image);
+
+	if (c->layer)
+		compositor_layer_destroy(c->compositor, c->layer);
+
+	c->image = NULL;
+	c->layer = NULL;
+}
+
+#endif // CURSOR_H
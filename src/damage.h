@@ -0,0 +1,222 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * More rectangles than this get folded into their neighbours,
+ * past a handful of clips the per-clip overhead of the host copy
+ * costs more than the few extra pixels.
+ */
+#ifndef DAMAGE_MAX_RECTS
+	#define DAMAGE_MAX_RECTS 16
+#endif // DAMAGE_MAX_RECTS
+
+struct damage_rect
+{
+	int32_t x1;
+	int32_t y1;
+	int32_t x2;		/* exclusive */
+	int32_t y2;		/* exclusive */
+};
+
+struct damage
+{
+	int32_t width;
+	int32_t height;
+
+	/** rectangles never overlap each other **/
+	struct damage_rect rects[DAMAGE_MAX_RECTS];
+	int count;
+};
+
+struct damage_stats
+{
+	uint64_t frames;
+	uint64_t bytes_damaged;	/* bytes marked dirty and handed to the device */
+	uint64_t bytes_full;		/* bytes a full repaint of the same frames would have sent */
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: damage_init(struct damage *d, int32_t width, int32_t height)
+ * -----------------------
+ *  Creates an empty tracker for a `width` x `height` buffer.
+ */
+void damage_init(struct damage *d, int32_t width, int32_t height);
+
+/*
+ * Function: damage_reset(struct damage *d)
+ * -----------------------
+ *  Drops every rectangle.
+ */
+void damage_reset(struct damage *d);
+
+/*
+ * Function: damage_add(struct damage *d, int32_t x, int32_t y, int32_t w, int32_t h)
+ * -----------------------
+ *  Marks a rectangle as changed. It is clipped to the buffer and
+ *  merged with every rectangle it overlaps.
+ */
+void damage_add(struct damage *d, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/*
+ * Function: damage_union(struct damage *d, const struct damage *other)
+ * -----------------------
+ *  Adds every rectangle of `other` to `d`.
+ */
+void damage_union(struct damage *d, const struct damage *other);
+
+/*
+ * Function: damage_full(struct damage *d)
+ * -----------------------
+ *  Marks the whole buffer as changed.
+ */
+void damage_full(struct damage *d);
+
+/*
+ * Function: damage_area(const struct damage *d)
+ * -----------------------
+ *  returns: Number of damaged pixels (uint64_t)
+ */
+uint64_t damage_area(const struct damage *d);
+
+/*
+ * Function: damage_account(struct damage_stats *s, const struct damage *d, uint32_t bpp)
+ * -----------------------
+ *  Adds one submitted frame to the counters.
+ *
+ * bpp: Bits per pixel of all planes together, 12 for NV12 (uint32_t)
+ */
+void damage_account(struct damage_stats *s, const struct damage *d, uint32_t bpp);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static inline bool damage_overlaps(const struct damage_rect *a, const struct damage_rect *b)
+{
+	return a->x1 < b->x2 && b->x1 < a->x2 && a->y1 < b->y2 && b->y1 < a->y2;
+}
+
+static inline void damage_extend(struct damage_rect *a, const struct damage_rect *b)
+{
+	if (b->x1 < a->x1) a->x1 = b->x1;
+	if (b->y1 < a->y1) a->y1 = b->y1;
+	if (b->x2 > a->x2) a->x2 = b->x2;
+	if (b->y2 > a->y2) a->y2 = b->y2;
+}
+
+static inline uint64_t damage_rect_area(const struct damage_rect *r)
+{
+	return (uint64_t)(r->x2 - r->x1) * (uint64_t)(r->y2 - r->y1);
+}
+
+void damage_init(struct damage *d, int32_t width, int32_t height)
+{
+	memset(d, 0, sizeof(*d));
+	d->width = width;
+	d->height = height;
+}
+
+void damage_reset(struct damage *d)
+{
+	d->count = 0;
+}
+
+static void damage_insert(struct damage *d, struct damage_rect r)
+{
+	/*
+	 * Swallow every rectangle the new one overlaps,
+	 * the grown rectangle can reach new ones, so start over until none is left.
+	 */
+	for (int i = 0; i < d->count; )
+	{
+		if (damage_overlaps(&r, &d->rects[i]))
+		{
+			damage_extend(&r, &d->rects[i]);
+			d->rects[i] = d->rects[--d->count];
+			i = 0;
+		}
+		else
+			++i;
+	}
+
+	if (d->count < DAMAGE_MAX_RECTS)
+	{
+		d->rects[d->count++] = r;
+		return;
+	}
+
+	/** out of slots: merge with the rectangle whose bounding box grows the least **/
+	int best = 0;
+	uint64_t best_growth = UINT64_MAX;
+	for (int i = 0; i < d->count; ++i)
+	{
+		struct damage_rect u = d->rects[i];
+		damage_extend(&u, &r);
+
+		uint64_t growth = damage_rect_area(&u) - damage_rect_area(&d->rects[i]);
+		if (growth < best_growth)
+		{
+			best = i;
+			best_growth = growth;
+		}
+	}
+
+	damage_extend(&r, &d->rects[best]);
+	d->rects[best] = d->rects[--d->count];
+	damage_insert(d, r);
+}
+
+void damage_add(struct damage *d, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	struct damage_rect r = { x, y, x + w, y + h };
+
+	if (r.x1 < 0) r.x1 = 0;
+	if (r.y1 < 0) r.y1 = 0;
+	if (r.x2 > d->width) r.x2 = d->width;
+	if (r.y2 > d->height) r.y2 = d->height;
+
+	if (r.x1 >= r.x2 || r.y1 >= r.y2)
+		return;
+
+	damage_insert(d, r);
+}
+
+void damage_union(struct damage *d, const struct damage *other)
+{
+	for (int i = 0; i < other->count; ++i)
+	{
+		const struct damage_rect *r = &other->rects[i];
+		damage_add(d, r->x1, r->y1, r->x2 - r->x1, r->y2 - r->y1);
+	}
+}
+
+void damage_full(struct damage *d)
+{
+	d->count = 1;
+	d->rects[0] = (struct damage_rect) { 0, 0, d->width, d->height };
+}
+
+uint64_t damage_area(const struct damage *d)
+{
+	uint64_t area = 0;
+	for (int i = 0; i < d->count; ++i)
+		area += damage_rect_area(&d->rects[i]);
+
+	return area;
+}
+
+void damage_account(struct damage_stats *s, const struct damage *d, uint32_t bpp)
+{
+	s->frames++;
+	s->bytes_damaged += damage_area(d) * bpp / 8;
+	s->bytes_full += (uint64_t)d->width * d->height * bpp / 8;
+}
+
+#endif // DAMAGE_H
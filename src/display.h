@@ -0,0 +1,353 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * The protocol between `card --serve` and its clients. Messages are
+ * fixed size on a SOCK_SEQPACKET socket, so every recv() is one message.
+ * A client asks for surfaces. The daemon answers with a memfd of
+ * premultiplied ARGB8888 pixels, passed with SCM_RIGHTS. The client maps
+ * it and draws straight into it; nothing is copied until compositing.
+ * After drawing, the client sends the damage. It should not touch the
+ * surface again until DISPLAY_FRAME says the daemon has composited it.
+ */
+
+#define DISPLAY_SOCKET "/tmp/card-display"
+
+typedef enum {
+	/** client -> daemon **/
+	DISPLAY_HELLO = 1,		/* answered by DISPLAY_INFO */
+	DISPLAY_CREATE,				/* w, h, x, y, z, flags; answered by DISPLAY_SURFACE or DISPLAY_ERROR */
+	DISPLAY_DAMAGE,				/* surface, x, y, w, h in surface coordinates, flags */
+	DISPLAY_MOVE,					/* surface, x, y, z */
+	DISPLAY_DESTROY,			/* surface */
+
+	/** daemon -> client **/
+	DISPLAY_INFO,					/* w, h of the first head */
+	DISPLAY_SURFACE,			/* surface, w, h, stride, with the memfd */
+	DISPLAY_FRAME,				/* surface, time_ns: composited on every head, free to draw */
+	DISPLAY_ERROR					/* error: negative errno of the last request */
+} DISPLAY_MSG;
+
+#define DISPLAY_OPAQUE 0x1		/* DISPLAY_CREATE: only alpha 255 will be drawn */
+#define DISPLAY_WANT_FRAME 0x2	/* DISPLAY_DAMAGE: answer with DISPLAY_FRAME */
+
+struct display_msg
+{
+	uint32_t type;
+	uint32_t surface;
+	int32_t x;
+	int32_t y;
+	int32_t w;
+	int32_t h;
+	int32_t z;
+	uint32_t flags;
+	uint32_t stride;		/* bytes per row */
+	int32_t error;
+	uint64_t time_ns;
+};
+
+/*
+ * A surface as the client sees it.
+ */
+struct display_surface
+{
+	uint32_t id;
+	uint32_t *pixels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;		/* pixels per row */
+	size_t size;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: display_send(int fd, const struct display_msg *msg, int pass_fd)
+ * -----------------------
+ *  Sends one message, with `pass_fd` attached if it is not -1.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int display_send(int fd, const struct display_msg *msg, int pass_fd);
+
+/*
+ * Function: display_recv(int fd, struct display_msg *msg, int *pass_fd)
+ * -----------------------
+ *  Receives one message. A passed fd is stored in `pass_fd` (-1 if none),
+ *  or closed if `pass_fd` is NULL.
+ *
+ * returns: 0 on success, -ECONNRESET once the peer is gone, negative errno on failure (int)
+ */
+int display_recv(int fd, struct display_msg *msg, int *pass_fd);
+
+/*
+ * Function: display_connect(const char *path, int32_t *width, int32_t *height)
+ * -----------------------
+ *  Connects to the daemon (NULL = DISPLAY_SOCKET) and says hello.
+ *
+ * width, height: Size of the first head, may be NULL (int32_t *)
+ *
+ * returns: The connection, negative errno on failure (int)
+ */
+int display_connect(const char *path, int32_t *width, int32_t *height);
+
+/*
+ * Function: display_surface_create(int fd, struct display_surface *s, uint32_t w, uint32_t h, int32_t x, int32_t y, int z, bool opaque)
+ * -----------------------
+ *  Asks for a w x h surface at (x, y) and maps it. It starts transparent
+ *  (black if `opaque`) and is shown with its first damage.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int display_surface_create(int fd, struct display_surface *s, uint32_t w, uint32_t h, int32_t x, int32_t y, int z, bool opaque);
+
+/*
+ * Function: display_damage(int fd, const struct display_surface *s, int32_t x, int32_t y, int32_t w, int32_t h, bool want_frame)
+ * -----------------------
+ *  The rectangle of `s` was drawn. With `want_frame`, a DISPLAY_FRAME follows
+ *  once it is composited, see display_wait_frame().
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int display_damage(int fd, const struct display_surface *s, int32_t x, int32_t y, int32_t w, int32_t h, bool want_frame);
+
+/*
+ * Function: display_wait_frame(int fd, struct display_surface *s)
+ * -----------------------
+ *  Blocks until the DISPLAY_FRAME of `s`.
+ *
+ * returns: When it was composited, CLOCK_MONOTONIC ns, 0 on failure (uint64_t)
+ */
+uint64_t display_wait_frame(int fd, const struct display_surface *s);
+
+/*
+ * Function: display_surface_move(int fd, const struct display_surface *s, int32_t x, int32_t y, int z)
+ * -----------------------
+ *  returns: 0 on success, negative errno on failure (int)
+ */
+int display_surface_move(int fd, const struct display_surface *s, int32_t x, int32_t y, int z);
+
+/*
+ * Function: display_surface_destroy(int fd, struct display_surface *s)
+ * -----------------------
+ *  Unmaps `s` and removes it from the screen.
+ */
+void display_surface_destroy(int fd, struct display_surface *s);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+int display_send(int fd, const struct display_msg *msg, int pass_fd)
+{
+	struct iovec iov = { .iov_base = (void*)msg, .iov_len = sizeof(*msg) };
+	union {
+		struct cmsghdr align;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (pass_fd >= 0)
+	{
+		memset(&control, 0, sizeof(control));
+		mh.msg_control = control.buffer;
+		mh.msg_controllen = sizeof(control.buffer);
+
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cm), &pass_fd, sizeof(int));
+	}
+
+	ssize_t n;
+	do
+		n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return -errno;
+
+	return n == sizeof(*msg) ? 0 : -EIO;
+}
+
+int display_recv(int fd, struct display_msg *msg, int *pass_fd)
+{
+	struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+	union {
+		struct cmsghdr align;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+
+	struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+
+	if (pass_fd)
+		*pass_fd = -1;
+
+	ssize_t n;
+	do
+		n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		return -errno;
+
+	if (n == 0)
+		return -ECONNRESET;
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+	{
+		if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		int received;
+		memcpy(&received, CMSG_DATA(cm), sizeof(int));
+
+		if (pass_fd && *pass_fd < 0)
+			*pass_fd = received;
+		else
+			close(received);
+	}
+
+	/** a short or truncated message is not something we sent **/
+	if (n != sizeof(*msg) || (mh.msg_flags & MSG_TRUNC))
+	{
+		if (pass_fd && *pass_fd >= 0)
+			close(*pass_fd);
+
+		return -EPROTO;
+	}
+
+	return 0;
+}
+
+int display_connect(const char *path, int32_t *width, int32_t *height)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, path ? path : DISPLAY_SOCKET, sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	struct display_msg msg = { .type = DISPLAY_HELLO };
+	int ret = display_send(fd, &msg, -1);
+	if (ret == 0)
+		ret = display_recv(fd, &msg, NULL);
+
+	if (ret == 0 && msg.type != DISPLAY_INFO)
+		ret = -EPROTO;
+
+	if (ret < 0)
+	{
+		close(fd);
+		return ret;
+	}
+
+	if (width)
+		*width = msg.w;
+	if (height)
+		*height = msg.h;
+
+	return fd;
+}
+
+int display_surface_create(int fd, struct display_surface *s, uint32_t w, uint32_t h, int32_t x, int32_t y, int z, bool opaque)
+{
+	memset(s, 0, sizeof(*s));
+
+	struct display_msg msg = { .type = DISPLAY_CREATE, .x = x, .y = y, .w = w, .h = h, .z = z, .flags = opaque ? DISPLAY_OPAQUE : 0 };
+	int ret = display_send(fd, &msg, -1);
+	if (ret < 0)
+		return ret;
+
+	int memfd;
+	ret = display_recv(fd, &msg, &memfd);
+	if (ret < 0)
+		return ret;
+
+	if (msg.type == DISPLAY_ERROR)
+		return msg.error < 0 ? msg.error : -EIO;
+
+	if (msg.type != DISPLAY_SURFACE || memfd < 0)
+	{
+		if (memfd >= 0)
+			close(memfd);
+		return -EPROTO;
+	}
+
+	s->id = msg.surface;
+	s->width = msg.w;
+	s->height = msg.h;
+	s->stride = msg.stride / 4;
+	s->size = (size_t)msg.stride * msg.h;
+
+	void *map = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	ret = map == MAP_FAILED ? -errno : 0;
+	close(memfd);
+
+	if (ret < 0)
+		return ret;
+
+	s->pixels = map;
+	return 0;
+}
+
+int display_damage(int fd, const struct display_surface *s, int32_t x, int32_t y, int32_t w, int32_t h, bool want_frame)
+{
+	struct display_msg msg = { .type = DISPLAY_DAMAGE, .surface = s->id, .x = x, .y = y, .w = w, .h = h,
+			.flags = want_frame ? DISPLAY_WANT_FRAME : 0 };
+
+	return display_send(fd, &msg, -1);
+}
+
+uint64_t display_wait_frame(int fd, const struct display_surface *s)
+{
+	struct display_msg msg;
+
+	/** frames of other surfaces are dropped, one surface per wait **/
+	while (display_recv(fd, &msg, NULL) == 0)
+		if (msg.type == DISPLAY_FRAME && msg.surface == s->id)
+			return msg.time_ns;
+
+	return 0;
+}
+
+int display_surface_move(int fd, const struct display_surface *s, int32_t x, int32_t y, int z)
+{
+	struct display_msg msg = { .type = DISPLAY_MOVE, .surface = s->id, .x = x, .y = y, .z = z };
+	return display_send(fd, &msg, -1);
+}
+
+void display_surface_destroy(int fd, struct display_surface *s)
+{
+	struct display_msg msg = { .type = DISPLAY_DESTROY, .surface = s->id };
+	display_send(fd, &msg, -1);
+
+	if (s->pixels)
+		munmap(s->pixels, s->size);
+
+	s->pixels = NULL;
+}
+
+#endif // DISPLAY_H
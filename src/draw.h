@@ -0,0 +1,508 @@
+#ifndef DRAW_H
+#define DRAW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "raster.h"
+#include "text.h"
+
+/*
+ * Draw commands from any number of threads, drawn by one render thread.
+ * Producers claim a slot of a bounded ring with one CAS on its head and
+ * publish it with the slot's sequence number; no locks are taken unless
+ * the render thread is asleep. The render thread drains up to
+ * DRAW_BATCH commands at a time into a raster.h frame, which bins them
+ * by tile, and draws the batch on its workers.
+ */
+
+/** commands drained into one raster_flush() **/
+#ifndef DRAW_BATCH
+	#define DRAW_BATCH 4096
+#endif // DRAW_BATCH
+
+/** characters a text command holds inline, draw_text() splits longer strings **/
+#define DRAW_TEXT_MAX 32
+
+/** text masks of one batch are copied here, text.h may evict them mid batch **/
+#ifndef DRAW_ARENA_SIZE
+	#define DRAW_ARENA_SIZE (256 * 1024)
+#endif // DRAW_ARENA_SIZE
+
+typedef enum {
+	DRAW_RECT = 0,
+	DRAW_LINE,
+	DRAW_BLIT,
+	DRAW_TEXT
+} DRAW_CMD;
+
+struct draw_cmd
+{
+	uint8_t type;
+	uint8_t length;		/* text */
+	uint16_t pad;
+	uint32_t color;
+	int32_t v[4];			/* rect, blit: x, y, w, h | line: x0, y0, x1, y1 | text: x, y */
+
+	union {
+		struct {
+			const uint32_t *pixels;
+			uint32_t pitch;		/* bytes per row */
+		} blit;
+		char text[DRAW_TEXT_MAX];
+	};
+};
+
+/*
+ * `seq` is the position the slot is free for, and position + 1 once
+ * the command at that position is written. One slot per cache line.
+ */
+struct draw_slot
+{
+	_Atomic uint64_t seq;
+	struct draw_cmd cmd;
+} __attribute__((aligned(64)));
+
+struct draw_stats
+{
+	uint64_t commands;		/* drawn, or dropped with no target */
+	uint64_t batches;			/* raster_flush() calls */
+	uint64_t sleeps;			/* times the render thread found the ring empty and waited */
+};
+
+struct draw_queue
+{
+	struct draw_slot *slots;
+	uint64_t mask;				/* slot count - 1 */
+
+	/** producers only touch head, the render thread owns tail **/
+	_Alignas(64) _Atomic uint64_t head;
+	_Alignas(64) uint64_t tail;
+	_Atomic uint64_t drawn;			/* commands before this position are on the target */
+	_Atomic uint64_t full;			/* producer retries on a full ring */
+
+	_Atomic bool sleeping;
+	_Atomic int waiters;
+	_Atomic bool quit;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;			/* render thread: the ring is not empty */
+	pthread_cond_t done;			/* draw_sync(): a batch was drawn */
+	pthread_t thread;
+
+	struct raster_target target;
+	struct raster raster;
+	struct text text;
+	uint8_t *arena;
+	size_t arena_used;
+
+	struct draw_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: draw_init(struct draw_queue *q, uint32_t slots, struct raster_target target, int threads, uint32_t scale)
+ * -----------------------
+ *  Allocates the ring and starts the render thread.
+ *
+ * q: Command queue (struct draw_queue *)
+ * slots: Ring size, rounded up to a power of 2 (uint32_t)
+ * target: Where commands are drawn, a NULL map drops them, to measure the ring alone (struct raster_target)
+ * threads: Raster workers, the render thread included, 0 = one per core (int)
+ * scale: Text scale, see text_init() (uint32_t)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int draw_init(struct draw_queue *q, uint32_t slots, struct raster_target target, int threads, uint32_t scale);
+
+/*
+ * Function: draw_submit(struct draw_queue *q, const struct draw_cmd *cmd)
+ * -----------------------
+ *  Queues one command, from any thread. Waits for a free slot if the ring is full.
+ */
+void draw_submit(struct draw_queue *q, const struct draw_cmd *cmd);
+
+/*
+ * Function: draw_rect(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+ * -----------------------
+ *  Queues a filled rectangle.
+ */
+void draw_rect(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+
+/*
+ * Function: draw_line(struct draw_queue *q, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+ * -----------------------
+ *  Queues a one pixel wide line, both ends included.
+ */
+void draw_line(struct draw_queue *q, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color);
+
+/*
+ * Function: draw_blit(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *pixels, uint32_t pitch)
+ * -----------------------
+ *  Queues copying w x h XRGB8888 pixels. Only the pointer is queued,
+ *  `pixels` must stay valid until a draw_sync() after this call returns.
+ */
+void draw_blit(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *pixels, uint32_t pitch);
+
+/*
+ * Function: draw_text(struct draw_queue *q, int32_t x, int32_t y, const char *str, uint32_t color)
+ * -----------------------
+ *  Queues `str` with its top left corner at (`x`, `y`), '\n' starts a new
+ *  line. The characters are copied, `str` may be reused at once.
+ */
+void draw_text(struct draw_queue *q, int32_t x, int32_t y, const char *str, uint32_t color);
+
+/*
+ * Function: draw_sync(struct draw_queue *q)
+ * -----------------------
+ *  Waits until every command queued before the call, by any thread, is drawn.
+ */
+void draw_sync(struct draw_queue *q);
+
+/*
+ * Function: draw_destroy(struct draw_queue *q)
+ * -----------------------
+ *  Draws what is still queued, stops the render thread and frees the ring.
+ */
+void draw_destroy(struct draw_queue *q);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/*
+ * draw_pop()
+ *
+ * The next published command, false if the ring is empty or the
+ * producer of the next slot has not finished writing it.
+*/
+static bool draw_pop(struct draw_queue *q, struct draw_cmd *cmd)
+{
+	struct draw_slot *slot = &q->slots[q->tail & q->mask];
+	if (atomic_load_explicit(&slot->seq, memory_order_acquire) != q->tail + 1)
+		return false;
+
+	*cmd = slot->cmd;
+	atomic_store_explicit(&slot->seq, q->tail + q->mask + 1, memory_order_release);
+	q->tail++;
+
+	return true;
+}
+
+/*
+ * draw_text_cmd()
+ *
+ * Lays out a text command and queues its mask, copied into the arena.
+ * A full arena draws the batch so far first.
+*/
+static void draw_text_cmd(struct draw_queue *q, const struct draw_cmd *cmd)
+{
+	uint32_t width, pitch;
+	const uint8_t *bits = text_mask(&q->text, cmd->text, cmd->length, &width, &pitch);
+	if (bits == NULL)
+		return;
+
+	size_t size = (size_t)pitch * q->text.cell_h;
+	if (size > DRAW_ARENA_SIZE)
+		return;
+
+	if (q->arena_used + size > DRAW_ARENA_SIZE)
+	{
+		raster_flush(&q->raster);
+		q->stats.batches++;
+		q->arena_used = 0;
+	}
+
+	uint8_t *copy = q->arena + q->arena_used;
+	memcpy(copy, bits, size);
+	q->arena_used += size;
+
+	raster_mask(&q->raster, cmd->v[0], cmd->v[1], width, q->text.cell_h, copy, pitch, cmd->color);
+}
+
+/*
+ * draw_batch()
+ *
+ * Drains up to DRAW_BATCH commands and draws them.
+ *
+ * returns: number of commands taken off the ring
+*/
+static uint32_t draw_batch(struct draw_queue *q)
+{
+	struct draw_cmd cmd;
+	uint32_t n = 0;
+
+	if (q->target.map)
+		raster_begin(&q->raster, q->target);
+
+	for (; n < DRAW_BATCH && draw_pop(q, &cmd); ++n)
+	{
+		if (q->target.map == NULL)
+			continue;
+
+		switch (cmd.type)
+		{
+			case DRAW_RECT: raster_rect(&q->raster, cmd.v[0], cmd.v[1], cmd.v[2], cmd.v[3], cmd.color); break;
+			case DRAW_LINE: raster_line(&q->raster, cmd.v[0], cmd.v[1], cmd.v[2], cmd.v[3], cmd.color); break;
+			case DRAW_BLIT: raster_blit(&q->raster, cmd.v[0], cmd.v[1], cmd.v[2], cmd.v[3], cmd.blit.pixels, cmd.blit.pitch); break;
+			case DRAW_TEXT: draw_text_cmd(q, &cmd); break;
+		}
+	}
+
+	if (n && q->target.map)
+	{
+		raster_flush(&q->raster);
+		q->stats.batches++;
+	}
+
+	q->arena_used = 0;
+	q->stats.commands += n;
+
+	return n;
+}
+
+/*
+ * draw_thread()
+ *
+ * The render thread. The sleeping flag and the slot sequence numbers are
+ * both seq_cst, so either the thread sees the new command or the producer
+ * sees it sleeping and wakes it up.
+*/
+static void *draw_thread(void *arg)
+{
+	struct draw_queue *q = arg;
+
+	for (;;)
+	{
+		uint32_t n = draw_batch(q);
+		if (n)
+		{
+			atomic_fetch_add(&q->drawn, n);
+			if (atomic_load(&q->waiters))
+			{
+				pthread_mutex_lock(&q->lock);
+				pthread_cond_broadcast(&q->done);
+				pthread_mutex_unlock(&q->lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&q->lock);
+		atomic_store(&q->sleeping, true);
+
+		struct draw_slot *slot = &q->slots[q->tail & q->mask];
+		bool empty = atomic_load(&slot->seq) != q->tail + 1;
+
+		if (empty && atomic_load(&q->quit))
+		{
+			pthread_mutex_unlock(&q->lock);
+			return NULL;
+		}
+
+		if (empty)
+		{
+			q->stats.sleeps++;
+			pthread_cond_wait(&q->wake, &q->lock);
+		}
+
+		atomic_store(&q->sleeping, false);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+int draw_init(struct draw_queue *q, uint32_t slots, struct raster_target target, int threads, uint32_t scale)
+{
+	memset(q, 0, sizeof(*q));
+
+	uint64_t size = 2;
+	while (size < slots)
+		size *= 2;
+
+	q->slots = aligned_alloc(64, size * sizeof(*q->slots));
+	q->arena = malloc(DRAW_ARENA_SIZE);
+	if (q->slots == NULL || q->arena == NULL)
+	{
+		free(q->slots);
+		free(q->arena);
+		return -ENOMEM;
+	}
+
+	q->mask = size - 1;
+	for (uint64_t i = 0; i < size; ++i)
+		atomic_init(&q->slots[i].seq, i);
+
+	q->target = target;
+
+	int ret = raster_init(&q->raster, threads);
+	if (ret < 0)
+		goto fail;
+
+	ret = text_init(&q->text, scale);
+	if (ret < 0)
+	{
+		raster_destroy(&q->raster);
+		goto fail;
+	}
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->wake, NULL);
+	pthread_cond_init(&q->done, NULL);
+
+	ret = -pthread_create(&q->thread, NULL, draw_thread, q);
+	if (ret == 0)
+		return 0;
+
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->wake);
+	pthread_cond_destroy(&q->done);
+	text_destroy(&q->text);
+	raster_destroy(&q->raster);
+
+fail:
+	free(q->slots);
+	free(q->arena);
+	q->slots = NULL;
+	q->arena = NULL;
+	return ret;
+}
+
+void draw_submit(struct draw_queue *q, const struct draw_cmd *cmd)
+{
+	uint64_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	struct draw_slot *slot;
+
+	for (;;)
+	{
+		slot = &q->slots[pos & q->mask];
+		int64_t diff = (int64_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+
+		if (diff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			/** the render thread is a whole ring behind, let it catch up **/
+			atomic_fetch_add_explicit(&q->full, 1, memory_order_relaxed);
+			if (atomic_load(&q->sleeping))
+			{
+				pthread_mutex_lock(&q->lock);
+				pthread_cond_signal(&q->wake);
+				pthread_mutex_unlock(&q->lock);
+			}
+
+			sched_yield();
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+		else
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	}
+
+	slot->cmd = *cmd;
+	atomic_store(&slot->seq, pos + 1);
+
+	if (atomic_load(&q->sleeping))
+	{
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->wake);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+void draw_rect(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+	struct draw_cmd cmd = { .type = DRAW_RECT, .color = color, .v = { x, y, w, h } };
+	draw_submit(q, &cmd);
+}
+
+void draw_line(struct draw_queue *q, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+	struct draw_cmd cmd = { .type = DRAW_LINE, .color = color, .v = { x0, y0, x1, y1 } };
+	draw_submit(q, &cmd);
+}
+
+void draw_blit(struct draw_queue *q, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *pixels, uint32_t pitch)
+{
+	struct draw_cmd cmd = { .type = DRAW_BLIT, .v = { x, y, w, h }, .blit = { .pixels = pixels, .pitch = pitch } };
+	draw_submit(q, &cmd);
+}
+
+void draw_text(struct draw_queue *q, int32_t x, int32_t y, const char *str, uint32_t color)
+{
+	struct draw_cmd cmd = { .type = DRAW_TEXT, .color = color, .v = { x, y } };
+
+	while (*str)
+	{
+		if (*str == '\n')
+		{
+			cmd.v[0] = x;
+			cmd.v[1] += q->text.cell_h;
+			++str;
+			continue;
+		}
+
+		uint8_t n = 0;
+		while (n < DRAW_TEXT_MAX && str[n] && str[n] != '\n')
+			++n;
+
+		memcpy(cmd.text, str, n);
+		cmd.length = n;
+		draw_submit(q, &cmd);
+
+		cmd.v[0] += n * q->text.cell_w;
+		str += n;
+	}
+}
+
+void draw_sync(struct draw_queue *q)
+{
+	uint64_t target = atomic_load(&q->head);
+
+	if (atomic_load(&q->drawn) >= target)
+		return;
+
+	atomic_fetch_add(&q->waiters, 1);
+
+	pthread_mutex_lock(&q->lock);
+	while (atomic_load(&q->drawn) < target)
+		pthread_cond_wait(&q->done, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+
+	atomic_fetch_sub(&q->waiters, 1);
+}
+
+void draw_destroy(struct draw_queue *q)
+{
+	if (q->slots == NULL)
+		return;
+
+	pthread_mutex_lock(&q->lock);
+	atomic_store(&q->quit, true);
+	pthread_cond_signal(&q->wake);
+	pthread_mutex_unlock(&q->lock);
+
+	pthread_join(q->thread, NULL);
+
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->wake);
+	pthread_cond_destroy(&q->done);
+	text_destroy(&q->text);
+	raster_destroy(&q->raster);
+
+	free(q->slots);
+	free(q->arena);
+	q->slots = NULL;
+	q->arena = NULL;
+}
+
+#endif // DRAW_H
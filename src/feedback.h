@@ -0,0 +1,242 @@
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#include "log.h"
+
+/** sound and force feedback events one frame may hold, LEDs are kept apart **/
+#ifndef FEEDBACK_QUEUE_SIZE
+	#define FEEDBACK_QUEUE_SIZE 64
+#endif // FEEDBACK_QUEUE_SIZE
+
+#define FEEDBACK_LED_BYTES ((LED_CNT + 7) / 8)
+
+struct feedback_stats
+{
+	uint64_t requests;		/* feedback_led / _sound / _ff calls */
+	uint64_t redundant;		/* LED requests which did not end up as an event */
+	uint64_t frames;			/* flushes which wrote something */
+	uint64_t events;			/* events written, the SYN_REPORTs included */
+	uint64_t syscalls;		/* write() calls */
+};
+
+/*
+ * The events going to one evdev device: LEDs, sounds and force feedback
+ * are queued during a frame and written at once by feedback_flush().
+ * LEDs only store the wanted state, diffed against the device's on flush,
+ * so any number of changes to them costs at most one event each.
+ */
+struct feedback
+{
+	int fd;
+
+	uint8_t leds[FEEDBACK_LED_BYTES];		/* as the device has them */
+	uint8_t wanted[FEEDBACK_LED_BYTES];	/* as they should be after the flush */
+	uint32_t led_requests;							/* since the last flush */
+
+	struct input_event queue[FEEDBACK_QUEUE_SIZE];
+	int count;
+
+	struct feedback_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: feedback_open(struct feedback *f, const char *path)
+ * -----------------------
+ *  Opens an evdev node for writing and reads its LED state.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int feedback_open(struct feedback *f, const char *path);
+
+/*
+ * Function: feedback_sync(struct feedback *f)
+ * -----------------------
+ *  Reads the LED state again with EVIOCGLED, others may have changed it.
+ *  Devices which can not tell (or a pipe) are taken as all off.
+ *
+ * returns: 0 on success, negative errno if the device can not tell (int)
+ */
+int feedback_sync(struct feedback *f);
+
+/*
+ * Function: feedback_led(struct feedback *f, uint16_t code, bool on)
+ * -----------------------
+ *  Wants LED `code` (LED_CAPSL, ...) on or off after the next flush.
+ *
+ * returns: 0 on success, -EINVAL for an unknown LED (int)
+ */
+int feedback_led(struct feedback *f, uint16_t code, bool on);
+
+/*
+ * Function: feedback_sound(struct feedback *f, uint16_t code, int32_t value)
+ * -----------------------
+ *  Queues a sound, SND_BELL / SND_CLICK on or off, SND_TONE in Hz (0 = off).
+ *
+ * returns: 0 on success, -ENOBUFS if the frame is full (int)
+ */
+int feedback_sound(struct feedback *f, uint16_t code, int32_t value);
+
+/*
+ * Function: feedback_ff(struct feedback *f, int16_t effect, int32_t count)
+ * -----------------------
+ *  Queues playing an effect uploaded with EVIOCSFF `count` times (0 = stop).
+ *
+ * returns: 0 on success, -ENOBUFS if the frame is full (int)
+ */
+int feedback_ff(struct feedback *f, int16_t effect, int32_t count);
+
+/*
+ * Function: feedback_flush(struct feedback *f)
+ * -----------------------
+ *  Writes the changed LEDs and the queued events, closed by a SYN_REPORT,
+ *  with one write(). Nothing is written if nothing changed.
+ *
+ * returns: Number of events written, negative errno on failure (int)
+ */
+int feedback_flush(struct feedback *f);
+
+/*
+ * Function: feedback_close(struct feedback *f)
+ * -----------------------
+ *  Closes the device, what was not flushed is lost.
+ */
+void feedback_close(struct feedback *f);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+int feedback_sync(struct feedback *f)
+{
+	memset(f->leds, 0, sizeof(f->leds));
+
+	int ret = ioctl(f->fd, EVIOCGLED(sizeof(f->leds)), f->leds) < 0 ? -errno : 0;
+
+	memcpy(f->wanted, f->leds, sizeof(f->wanted));
+	return ret;
+}
+
+int feedback_open(struct feedback *f, const char *path)
+{
+	memset(f, 0, sizeof(*f));
+
+	f->fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (f->fd < 0)
+		return -errno;
+
+	int ret = feedback_sync(f);
+	if (ret < 0)
+		WARN("%s: LED state unknown, taken as all off: %s", path, strerror(-ret));
+
+	return 0;
+}
+
+int feedback_led(struct feedback *f, uint16_t code, bool on)
+{
+	if (code > LED_MAX)
+		return -EINVAL;
+
+	f->stats.requests++;
+	f->led_requests++;
+
+	if (on)
+		f->wanted[code / 8] |= 1u << (code % 8);
+	else
+		f->wanted[code / 8] &= ~(1u << (code % 8));
+
+	return 0;
+}
+
+/*
+ * feedback_push()
+ *
+ * Appends one event to the frame.
+*/
+static int feedback_push(struct feedback *f, uint16_t type, uint16_t code, int32_t value)
+{
+	f->stats.requests++;
+
+	if (f->count == FEEDBACK_QUEUE_SIZE)
+		return -ENOBUFS;
+
+	f->queue[f->count++] = (struct input_event) { .type = type, .code = code, .value = value };
+	return 0;
+}
+
+int feedback_sound(struct feedback *f, uint16_t code, int32_t value)
+{
+	return feedback_push(f, EV_SND, code, value);
+}
+
+int feedback_ff(struct feedback *f, int16_t effect, int32_t count)
+{
+	return feedback_push(f, EV_FF, effect, count);
+}
+
+int feedback_flush(struct feedback *f)
+{
+	struct input_event frame[LED_CNT + FEEDBACK_QUEUE_SIZE + 1];
+	int n = 0;
+
+	for (uint16_t code = 0; code <= LED_MAX; ++code)
+	{
+		uint8_t bit = 1u << (code % 8);
+		if ((f->leds[code / 8] ^ f->wanted[code / 8]) & bit)
+			frame[n++] = (struct input_event) { .type = EV_LED, .code = code, .value = !!(f->wanted[code / 8] & bit) };
+	}
+
+	/** what was set back before the flush, or was already so, costs nothing **/
+	f->stats.redundant += f->led_requests > (uint32_t)n ? f->led_requests - n : 0;
+	f->led_requests = 0;
+
+	memcpy(frame + n, f->queue, f->count * sizeof(frame[0]));
+	n += f->count;
+	f->count = 0;
+
+	if (n == 0)
+		return 0;
+
+	frame[n++] = (struct input_event) { .type = EV_SYN, .code = SYN_REPORT, .value = 0 };
+
+	ssize_t size = n * sizeof(frame[0]);
+	ssize_t written;
+	do
+	{
+		written = write(f->fd, frame, size);
+		f->stats.syscalls++;
+	}
+	while (written < 0 && errno == EINTR);
+
+	if (written != size)
+		return written < 0 ? -errno : -EIO;
+
+	memcpy(f->leds, f->wanted, sizeof(f->leds));
+	f->stats.frames++;
+	f->stats.events += n;
+
+	return n;
+}
+
+void feedback_close(struct feedback *f)
+{
+	if (f->fd >= 0)
+		close(f->fd);
+
+	f->fd = -1;
+	f->count = 0;
+}
+
+#endif // FEEDBACK_H
@@ -0,0 +1,473 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <libdrm/drm_fourcc.h>
+
+#include "pixel.h"
+
+/*
+ * Everything is drawn in XRGB8888, scanout buffers may be in another
+ * format. These kernels convert a rectangle of the drawing surface into
+ * one, they use the same kernel tier as pixel.h (pixel_use_impl()).
+ *
+ * Planar formats (NV12) live in one allocation: the luma plane with
+ * `pitch` bytes per row, then the chroma plane at `pitch * height`
+ * with the same pitch, as dumb buffers are laid out by the backends.
+ */
+
+struct format_info
+{
+	uint32_t fourcc;
+	const char *name;
+	uint32_t bpp;			/* bits per pixel of the first plane */
+	uint32_t planes;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: format_lookup(uint32_t fourcc)
+ * -----------------------
+ *  returns: The description of a DRM_FORMAT_* fourcc, NULL if it can not be converted to (const struct format_info *)
+ */
+const struct format_info *format_lookup(uint32_t fourcc);
+
+/*
+ * Function: format_by_name(const char *name)
+ * -----------------------
+ *  Looks a format up by name ("rgb565", "xrgb8888", "xrgb2101010", "nv12", ...).
+ *
+ * returns: The description, NULL if unknown (const struct format_info *)
+ */
+const struct format_info *format_by_name(const char *name);
+
+/*
+ * Function: format_rows(const struct format_info *f, uint32_t height)
+ * -----------------------
+ *  returns: Rows of `pitch` bytes a `height` pixels tall buffer needs, chroma planes included (uint32_t)
+ */
+uint32_t format_rows(const struct format_info *f, uint32_t height);
+
+/*
+ * Function: format_convert(uint32_t fourcc, uint8_t *dst, uint32_t pitch, uint32_t width, uint32_t height, const uint8_t *src, uint32_t src_pitch, int32_t x, int32_t y, int32_t w, int32_t h)
+ * -----------------------
+ *  Converts the rectangle (x, y, w, h) of the XRGB8888 image `src` to the
+ *  same pixels of `dst`, a width x height buffer in `fourcc`. The rectangle
+ *  is clipped to the buffer. NV12 rounds it out to even coordinates, a
+ *  chroma sample covers 2x2 pixels.
+ */
+void format_convert(uint32_t fourcc, uint8_t *dst, uint32_t pitch, uint32_t width, uint32_t height,
+		const uint8_t *src, uint32_t src_pitch, int32_t x, int32_t y, int32_t w, int32_t h);
+
+/*
+ * Function: format_read_row(uint32_t fourcc, uint32_t *dst, const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height, uint32_t y)
+ * -----------------------
+ *  Converts row `y` of a buffer in `fourcc` back to XRGB8888, for frame
+ *  dumps and checks. Plain C, it is not meant to be fast.
+ */
+void format_read_row(uint32_t fourcc, uint32_t *dst, const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height, uint32_t y);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static const struct format_info format_table[] = {
+	{ DRM_FORMAT_XRGB8888, "xrgb8888", 32, 1 },
+	{ DRM_FORMAT_ARGB8888, "argb8888", 32, 1 },
+	{ DRM_FORMAT_RGB565, "rgb565", 16, 1 },
+	{ DRM_FORMAT_XRGB2101010, "xrgb2101010", 32, 1 },
+	{ DRM_FORMAT_ARGB2101010, "argb2101010", 32, 1 },
+	{ DRM_FORMAT_NV12, "nv12", 8, 2 },
+};
+
+typedef void (*format_row_fn)(void *dst, const uint32_t *src, size_t count);
+
+static void format_565_scalar(void *dst, const uint32_t *src, size_t count)
+{
+	uint16_t *out = dst;
+	for (size_t i = 0; i < count; ++i)
+		out[i] = (src[i] >> 8 & 0xF800) | (src[i] >> 5 & 0x07E0) | (src[i] >> 3 & 0x001F);
+}
+
+/** 8 to 10 bits by repeating the top bits, so 0xFF becomes 0x3FF; alpha is opaque **/
+static inline uint32_t format_2101010(uint32_t p)
+{
+	return 0xC0000000u | (p & 0xFF0000) << 6 | (p & 0xC00000) >> 2 | (p & 0xFF00) << 4
+			| (p & 0xC000) >> 4 | (p & 0xFF) << 2 | (p & 0xC0) >> 6;
+}
+
+static void format_2101010_scalar(void *dst, const uint32_t *src, size_t count)
+{
+	uint32_t *out = dst;
+	for (size_t i = 0; i < count; ++i)
+		out[i] = format_2101010(src[i]);
+}
+
+/** BT.601 limited range, what video planes and most scanout hardware expect **/
+static inline uint8_t format_luma(uint32_t p)
+{
+	return ((66 * (p >> 16 & 0xFF) + 129 * (p >> 8 & 0xFF) + 25 * (p & 0xFF) + 128) >> 8) + 16;
+}
+
+static void format_luma_scalar(void *dst, const uint32_t *src, size_t count)
+{
+	uint8_t *out = dst;
+	for (size_t i = 0; i < count; ++i)
+		out[i] = format_luma(src[i]);
+}
+
+#if PIXEL_X86
+
+/*
+ * Same shape as the pixel.h kernels: vector body, scalar tail.
+ * Destinations are not aligned to anything, damage starts anywhere.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i format_565_sse2_px(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F));
+
+	/** packs saturates signed, so shift into its range and back **/
+	return _mm_sub_epi32(_mm_or_si128(_mm_or_si128(r, g), b), _mm_set1_epi32(0x8000));
+}
+
+__attribute__((target("sse2")))
+static void format_565_sse2(void *dst, const uint32_t *src, size_t count)
+{
+	uint16_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i lo = format_565_sse2_px(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m128i hi = format_565_sse2_px(_mm_loadu_si128((const __m128i*)(src + i + 4)));
+		__m128i packed = _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16((short)0x8000));
+		_mm_storeu_si128((__m128i*)(out + i), packed);
+	}
+
+	format_565_scalar(out + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i format_565_avx2_px(__m256i p)
+{
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xF800));
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07E0));
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001F));
+
+	return _mm256_sub_epi32(_mm256_or_si256(_mm256_or_si256(r, g), b), _mm256_set1_epi32(0x8000));
+}
+
+__attribute__((target("avx2")))
+static void format_565_avx2(void *dst, const uint32_t *src, size_t count)
+{
+	uint16_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i lo = format_565_avx2_px(_mm256_loadu_si256((const __m256i*)(src + i)));
+		__m256i hi = format_565_avx2_px(_mm256_loadu_si256((const __m256i*)(src + i + 8)));
+
+		/** packs works per 128-bit lane, put the quarters back in order **/
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_xor_si256(packed, _mm256_set1_epi16((short)0x8000)));
+	}
+
+	format_565_sse2(out + i, src + i, count - i);
+}
+
+#define FORMAT_2101010_VECTOR(prefix, type, p) \
+	prefix##_or_si##type(prefix##_or_si##type(prefix##_or_si##type(prefix##_set1_epi32((int)0xC0000000), \
+			prefix##_or_si##type(prefix##_slli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xFF0000)), 6), \
+				prefix##_srli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xC00000)), 2))), \
+		prefix##_or_si##type(prefix##_slli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xFF00)), 4), \
+			prefix##_srli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xC000)), 4))), \
+		prefix##_or_si##type(prefix##_slli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xFF)), 2), \
+			prefix##_srli_epi32(prefix##_and_si##type(p, prefix##_set1_epi32(0xC0)), 6)))
+
+__attribute__((target("sse2")))
+static void format_2101010_sse2(void *dst, const uint32_t *src, size_t count)
+{
+	uint32_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+		_mm_storeu_si128((__m128i*)(out + i), FORMAT_2101010_VECTOR(_mm, 128, p));
+	}
+
+	format_2101010_scalar(out + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void format_2101010_avx2(void *dst, const uint32_t *src, size_t count)
+{
+	uint32_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i p = _mm256_loadu_si256((const __m256i*)(src + i));
+		_mm256_storeu_si256((__m256i*)(out + i), FORMAT_2101010_VECTOR(_mm256, 256, p));
+	}
+
+	format_2101010_sse2(out + i, src + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void format_2101010_avx512(void *dst, const uint32_t *src, size_t count)
+{
+	uint32_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m512i p = _mm512_loadu_si512((const void*)(src + i));
+		_mm512_storeu_si512((void*)(out + i), FORMAT_2101010_VECTOR(_mm512, 512, p));
+	}
+
+	format_2101010_avx2(out + i, src + i, count - i);
+}
+
+/*
+ * Luma of 4 pixels: pmaddwd gives B*25 + G*129 and R*66 per pixel,
+ * the two halves are added across the even and odd lanes.
+ */
+__attribute__((target("sse2")))
+static inline __m128i format_luma_sse2_px(__m128i p)
+{
+	const __m128i coeff = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+	const __m128i zero = _mm_setzero_si128();
+
+	__m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(p, zero), coeff));
+	__m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(p, zero), coeff));
+
+	__m128i sum = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+	return _mm_add_epi32(_mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+}
+
+__attribute__((target("sse2")))
+static void format_luma_sse2(void *dst, const uint32_t *src, size_t count)
+{
+	uint8_t *out = dst;
+	size_t i = 0;
+
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = format_luma_sse2_px(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m128i b = format_luma_sse2_px(_mm_loadu_si128((const __m128i*)(src + i + 4)));
+		__m128i c = format_luma_sse2_px(_mm_loadu_si128((const __m128i*)(src + i + 8)));
+		__m128i d = format_luma_sse2_px(_mm_loadu_si128((const __m128i*)(src + i + 12)));
+
+		/** luma is 16 to 235, no pack saturates **/
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+	}
+
+	format_luma_scalar(out + i, src + i, count - i);
+}
+
+#endif // PIXEL_X86
+
+/*
+ * A table per format, indexed by the kernel tier. Tiers without a wider
+ * kernel repeat the one below: 565 would need avx512bw to pack, and
+ * luma is a handful of instructions per 16 pixels already.
+ */
+static const format_row_fn format_565_table[PIXEL_IMPL_COUNT] = {
+	[PIXEL_IMPL_SCALAR] = format_565_scalar,
+#if PIXEL_X86
+	[PIXEL_IMPL_SSE2] = format_565_sse2,
+	[PIXEL_IMPL_AVX2] = format_565_avx2,
+	[PIXEL_IMPL_AVX512] = format_565_avx2,
+#endif
+};
+
+static const format_row_fn format_2101010_table[PIXEL_IMPL_COUNT] = {
+	[PIXEL_IMPL_SCALAR] = format_2101010_scalar,
+#if PIXEL_X86
+	[PIXEL_IMPL_SSE2] = format_2101010_sse2,
+	[PIXEL_IMPL_AVX2] = format_2101010_avx2,
+	[PIXEL_IMPL_AVX512] = format_2101010_avx512,
+#endif
+};
+
+static const format_row_fn format_luma_table[PIXEL_IMPL_COUNT] = {
+	[PIXEL_IMPL_SCALAR] = format_luma_scalar,
+#if PIXEL_X86
+	[PIXEL_IMPL_SSE2] = format_luma_sse2,
+	[PIXEL_IMPL_AVX2] = format_luma_sse2,
+	[PIXEL_IMPL_AVX512] = format_luma_sse2,
+#endif
+};
+
+const struct format_info *format_lookup(uint32_t fourcc)
+{
+	for (size_t i = 0; i < sizeof(format_table) / sizeof(format_table[0]); ++i)
+		if (format_table[i].fourcc == fourcc)
+			return &format_table[i];
+
+	return NULL;
+}
+
+const struct format_info *format_by_name(const char *name)
+{
+	for (size_t i = 0; i < sizeof(format_table) / sizeof(format_table[0]); ++i)
+		if (!strcasecmp(format_table[i].name, name))
+			return &format_table[i];
+
+	return NULL;
+}
+
+uint32_t format_rows(const struct format_info *f, uint32_t height)
+{
+	return f->planes == 2 ? height + (height + 1) / 2 : height;
+}
+
+/*
+ * format_chroma()
+ *
+ * One CbCr row of NV12 from the two source rows `a` and `b`,
+ * each sample is the average of its 2x2 block.
+*/
+static void format_chroma(uint8_t *dst, const uint32_t *a, const uint32_t *b, uint32_t x, uint32_t w, uint32_t width)
+{
+	for (uint32_t i = x; i < x + w; i += 2)
+	{
+		uint32_t j = i + 1 < width ? i + 1 : i;
+		uint32_t p[4] = { a[i], a[j], b[i], b[j] };
+		int32_t r = 2, g = 2, bl = 2;
+
+		for (int k = 0; k < 4; ++k)
+		{
+			r += p[k] >> 16 & 0xFF;
+			g += p[k] >> 8 & 0xFF;
+			bl += p[k] & 0xFF;
+		}
+
+		r >>= 2; g >>= 2; bl >>= 2;
+
+		/** biased by 128 << 8 first, so the shift never sees a negative number **/
+		dst[i] = (-38 * r - 74 * g + 112 * bl + 128 + (128 << 8)) >> 8;
+		dst[i + 1] = (112 * r - 94 * g - 18 * bl + 128 + (128 << 8)) >> 8;
+	}
+}
+
+void format_convert(uint32_t fourcc, uint8_t *dst, uint32_t pitch, uint32_t width, uint32_t height,
+		const uint8_t *src, uint32_t src_pitch, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+	int32_t x1 = x + w, y1 = y + h;
+
+	if (fourcc == DRM_FORMAT_NV12)
+	{
+		x &= ~1; y &= ~1;
+		x1 += x1 & 1; y1 += y1 & 1;
+	}
+
+	x = x < 0 ? 0 : x;
+	y = y < 0 ? 0 : y;
+	x1 = x1 > (int32_t)width ? (int32_t)width : x1;
+	y1 = y1 > (int32_t)height ? (int32_t)height : y1;
+
+	if (x >= x1 || y >= y1)
+		return;
+
+	PIXEL_IMPL impl = pixel_current_impl();
+	const uint32_t *row = (const uint32_t*)(src + (size_t)y * src_pitch);
+	uint32_t count = x1 - x;
+
+	switch (fourcc)
+	{
+		case DRM_FORMAT_XRGB8888:
+		case DRM_FORMAT_ARGB8888:
+			for (int32_t i = y; i < y1; ++i, row = (const uint32_t*)((const uint8_t*)row + src_pitch))
+				memcpy(dst + (size_t)i * pitch + x * 4, row + x, count * 4);
+			break;
+
+		case DRM_FORMAT_RGB565:
+			for (int32_t i = y; i < y1; ++i, row = (const uint32_t*)((const uint8_t*)row + src_pitch))
+				format_565_table[impl](dst + (size_t)i * pitch + x * 2, row + x, count);
+			break;
+
+		case DRM_FORMAT_XRGB2101010:
+		case DRM_FORMAT_ARGB2101010:
+			for (int32_t i = y; i < y1; ++i, row = (const uint32_t*)((const uint8_t*)row + src_pitch))
+				format_2101010_table[impl](dst + (size_t)i * pitch + x * 4, row + x, count);
+			break;
+
+		case DRM_FORMAT_NV12:
+		{
+			uint8_t *chroma = dst + (size_t)pitch * height;
+
+			for (int32_t i = y; i < y1; i += 2)
+			{
+				const uint32_t *next = i + 1 < (int32_t)height ? (const uint32_t*)((const uint8_t*)row + src_pitch) : row;
+
+				format_luma_table[impl](dst + (size_t)i * pitch + x, row + x, count);
+				if (next != row)
+					format_luma_table[impl](dst + (size_t)(i + 1) * pitch + x, next + x, count);
+
+				format_chroma(chroma + (size_t)(i / 2) * pitch, row, next, x, count, width);
+				row = (const uint32_t*)((const uint8_t*)next + src_pitch);
+			}
+			break;
+		}
+	}
+}
+
+static inline uint32_t format_clamp(int32_t v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+void format_read_row(uint32_t fourcc, uint32_t *dst, const uint8_t *src, uint32_t pitch, uint32_t width, uint32_t height, uint32_t y)
+{
+	const uint8_t *row = src + (size_t)y * pitch;
+
+	for (uint32_t x = 0; x < width; ++x)
+	{
+		uint32_t v, r, g, b;
+
+		switch (fourcc)
+		{
+			case DRM_FORMAT_RGB565:
+				v = ((const uint16_t*)row)[x];
+				r = v >> 11 & 0x1F; g = v >> 5 & 0x3F; b = v & 0x1F;
+				dst[x] = 0xFF000000u | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+				break;
+
+			case DRM_FORMAT_XRGB2101010:
+			case DRM_FORMAT_ARGB2101010:
+				v = ((const uint32_t*)row)[x];
+				dst[x] = 0xFF000000u | (v >> 22 & 0xFF) << 16 | (v >> 12 & 0xFF) << 8 | (v >> 2 & 0xFF);
+				break;
+
+			case DRM_FORMAT_NV12:
+			{
+				const uint8_t *uv = src + (size_t)pitch * height + (size_t)(y / 2) * pitch + (x & ~1u);
+				int32_t c = 298 * (row[x] - 16), d = uv[0] - 128, e = uv[1] - 128;
+
+				dst[x] = 0xFF000000u | format_clamp((c + 409 * e + 128) >> 8) << 16
+						| format_clamp((c - 100 * d - 208 * e + 128) >> 8) << 8 | format_clamp((c + 516 * d + 128) >> 8);
+				break;
+			}
+
+			default:
+				dst[x] = ((const uint32_t*)row)[x];
+		}
+	}
+}
+
+#endif // FORMAT_H
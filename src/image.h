@@ -0,0 +1,360 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pixel.h"
+
+/** larger sides are refused, no mode comes close **/
+#ifndef IMAGE_MAX_SIZE
+	#define IMAGE_MAX_SIZE 16384
+#endif // IMAGE_MAX_SIZE
+
+typedef enum {
+	IMAGE_PPM = 0,	/* binary P6, maxval 255 */
+	IMAGE_QOI
+} IMAGE_FORMAT;
+
+/*
+ * The file stays mapped read-only, pixels are converted or decoded
+ * from the page cache straight into the destination buffer.
+ */
+struct image
+{
+	IMAGE_FORMAT format;
+	uint32_t width;
+	uint32_t height;
+
+	const uint8_t *data;		/* whole file */
+	size_t size;
+	const uint8_t *pixels;	/* first byte after the header */
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: image_open(struct image *img, const char *path)
+ * -----------------------
+ *  Maps a PPM (P6) or QOI file and reads its header.
+ *
+ * returns: 0 on success, -EINVAL for an unknown or broken file, negative errno on failure (int)
+ */
+int image_open(struct image *img, const char *path);
+
+/*
+ * Function: image_blit(const struct image *img, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y)
+ * -----------------------
+ *  Writes the image as XRGB8888 with its top left corner at (`x`, `y`)
+ *  of a `width` x `height` buffer, whatever falls outside is clipped.
+ *
+ * map: Destination buffer (uint8_t *)
+ * pitch: Bytes per row of the destination (uint32_t)
+ *
+ * returns: 0 on success, -EINVAL if the pixel data is truncated (int)
+ */
+int image_blit(const struct image *img, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y);
+
+/*
+ * Function: image_close(struct image *img)
+ * -----------------------
+ *  Unmaps the file.
+ */
+void image_close(struct image *img);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/*
+ * image_ppm_field()
+ *
+ * Reads one header number, skipping whitespace and # comments.
+*/
+static bool image_ppm_field(const uint8_t **p, const uint8_t *end, uint32_t *value)
+{
+	for (;;)
+	{
+		while (*p < end && (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r'))
+			(*p)++;
+
+		if (*p < end && **p == '#')
+		{
+			while (*p < end && **p != '\n')
+				(*p)++;
+			continue;
+		}
+
+		break;
+	}
+
+	if (*p >= end || **p < '0' || **p > '9')
+		return false;
+
+	uint64_t v = 0;
+	while (*p < end && **p >= '0' && **p <= '9' && v <= UINT32_MAX)
+		v = v * 10 + (*(*p)++ - '0');
+
+	*value = v;
+	return v <= UINT32_MAX;
+}
+
+static int image_parse_ppm(struct image *img)
+{
+	const uint8_t *p = img->data + 2, *end = img->data + img->size;
+	uint32_t maxval;
+
+	if (!image_ppm_field(&p, end, &img->width) || !image_ppm_field(&p, end, &img->height) || !image_ppm_field(&p, end, &maxval))
+		return -EINVAL;
+
+	/** exactly one whitespace byte separates the header from the raster **/
+	if (maxval != 255 || p >= end)
+		return -EINVAL;
+
+	img->format = IMAGE_PPM;
+	img->pixels = p + 1;
+
+	if (img->width == 0 || img->height == 0 || img->width > IMAGE_MAX_SIZE || img->height > IMAGE_MAX_SIZE)
+		return -EINVAL;
+
+	/** one side at a time, the product of two header numbers can wrap **/
+	size_t avail = end - img->pixels;
+	if (img->width > avail / 3 / img->height)
+		return -EINVAL;
+
+	return 0;
+}
+
+static inline uint32_t image_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static int image_parse_qoi(struct image *img)
+{
+	if (img->size < 14 + 8)
+		return -EINVAL;
+
+	img->format = IMAGE_QOI;
+	img->width = image_be32(img->data + 4);
+	img->height = image_be32(img->data + 8);
+	img->pixels = img->data + 14;
+
+	uint8_t channels = img->data[12];
+	if (channels != 3 && channels != 4)
+		return -EINVAL;
+
+	if (img->width == 0 || img->height == 0 || img->width > IMAGE_MAX_SIZE || img->height > IMAGE_MAX_SIZE)
+		return -EINVAL;
+
+	return 0;
+}
+
+int image_open(struct image *img, const char *path)
+{
+	memset(img, 0, sizeof(*img));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+	{
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	if (st.st_size < 4)
+	{
+		close(fd);
+		return -EINVAL;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int ret = -errno;
+
+	/** the mapping keeps the file alive **/
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return ret;
+
+	/** read once front to back, let the kernel read ahead and drop pages behind us **/
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+	img->data = data;
+	img->size = st.st_size;
+
+	if (img->data[0] == 'P' && img->data[1] == '6')
+		ret = image_parse_ppm(img);
+	else if (!memcmp(img->data, "qoif", 4))
+		ret = image_parse_qoi(img);
+	else
+		ret = -EINVAL;
+
+	if (ret < 0)
+		image_close(img);
+
+	return ret;
+}
+
+/*
+ * image_clip()
+ *
+ * Visible part of the image: source origin (sx, sy), destination origin (dx, dy), size w x h.
+ * returns: False if nothing is visible.
+*/
+static bool image_clip(const struct image *img, uint32_t width, uint32_t height, int32_t x, int32_t y,
+		uint32_t *sx, uint32_t *sy, uint32_t *dx, uint32_t *dy, uint32_t *w, uint32_t *h)
+{
+	int64_t x1 = x > 0 ? x : 0, y1 = y > 0 ? y : 0;
+	int64_t x2 = (int64_t)x + img->width, y2 = (int64_t)y + img->height;
+
+	if (x2 > width) x2 = width;
+	if (y2 > height) y2 = height;
+
+	if (x1 >= x2 || y1 >= y2)
+		return false;
+
+	*dx = x1;
+	*dy = y1;
+	*sx = x1 - x;
+	*sy = y1 - y;
+	*w = x2 - x1;
+	*h = y2 - y1;
+
+	return true;
+}
+
+static int image_blit_ppm(const struct image *img, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y)
+{
+	uint32_t sx, sy, dx, dy, w, h;
+	if (!image_clip(img, width, height, x, y, &sx, &sy, &dx, &dy, &w, &h))
+		return 0;
+
+	const uint8_t *src = img->pixels + ((size_t)sy * img->width + sx) * 3;
+	uint8_t *dst = map + (size_t)dy * pitch + (size_t)dx * 4;
+
+	for (uint32_t row = 0; row < h; ++row, src += (size_t)img->width * 3, dst += pitch)
+		pixel_rgb24_to_xrgb32((uint32_t*)dst, src, w);
+
+	return 0;
+}
+
+/*
+ * image_blit_qoi()
+ *
+ * QOI can only be decoded front to back, so rows above the destination
+ * are decoded and thrown away and decoding stops below it.
+ * See https://qoiformat.org/qoi-specification.pdf
+*/
+static int image_blit_qoi(const struct image *img, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y)
+{
+	uint32_t sx, sy, dx, dy, w, h;
+	if (!image_clip(img, width, height, x, y, &sx, &sy, &dx, &dy, &w, &h))
+		return 0;
+
+	const uint8_t *p = img->pixels;
+	const uint8_t *end = img->data + img->size - 8;	/* end marker */
+
+	uint32_t index[64] = { 0 };
+	uint32_t px = 0xFF000000;	/* ARGB, alpha is decoded for the hash only */
+	uint32_t run = 0;
+
+	for (uint32_t row = 0; row < sy + h; ++row)
+	{
+		uint32_t *dst = row >= sy ? (uint32_t*)(map + (size_t)(dy + row - sy) * pitch) + dx : NULL;
+
+		for (uint32_t col = 0; col < img->width; ++col)
+		{
+			if (run)
+				run--;
+			else
+			{
+				if (p >= end)
+					return -EINVAL;
+
+				uint8_t op = *p++;
+				uint8_t r = px >> 16, g = px >> 8, b = px, a = px >> 24;
+
+				if (op == 0xFE)
+				{
+					if (end - p < 3)
+						return -EINVAL;
+					r = p[0], g = p[1], b = p[2];
+					p += 3;
+				}
+				else if (op == 0xFF)
+				{
+					if (end - p < 4)
+						return -EINVAL;
+					r = p[0], g = p[1], b = p[2], a = p[3];
+					p += 4;
+				}
+				else switch (op >> 6)
+				{
+					case 0:
+						px = index[op];
+						goto decoded;
+					case 1:
+						r += ((op >> 4) & 3) - 2;
+						g += ((op >> 2) & 3) - 2;
+						b += (op & 3) - 2;
+						break;
+					case 2:
+					{
+						if (p >= end)
+							return -EINVAL;
+						int8_t dg = (op & 0x3F) - 32;
+						uint8_t rb = *p++;
+						r += dg - 8 + (rb >> 4);
+						g += dg;
+						b += dg - 8 + (rb & 15);
+						break;
+					}
+					case 3:
+						/** this pixel is the first of the run **/
+						run = op & 0x3F;
+						break;
+				}
+
+				px = (uint32_t)a << 24 | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+				index[(r * 3 + g * 5 + b * 7 + a * 11) & 63] = px;
+			}
+
+decoded:
+			if (dst && col >= sx && col < sx + w)
+				dst[col - sx] = px | 0xFF000000;
+		}
+	}
+
+	return 0;
+}
+
+int image_blit(const struct image *img, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y)
+{
+	if (img->format == IMAGE_PPM)
+		return image_blit_ppm(img, map, pitch, width, height, x, y);
+
+	return image_blit_qoi(img, map, pitch, width, height, x, y);
+}
+
+void image_close(struct image *img)
+{
+	if (img->data)
+		munmap((void*)img->data, img->size);
+
+	memset(img, 0, sizeof(*img));
+}
+
+#endif // IMAGE_H
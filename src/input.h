@@ -0,0 +1,434 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+#include "log.h"
+
+#ifndef INPUT_MAX_DEVICES
+	#define INPUT_MAX_DEVICES 32
+#endif // INPUT_MAX_DEVICES
+
+/** events taken per read(), a mouse frame is 3 - 4 events, a touchpad frame ~20 **/
+#ifndef INPUT_BATCH
+	#define INPUT_BATCH 64
+#endif // INPUT_BATCH
+
+/** delivered events waiting for the render loop, power of 2 **/
+#ifndef INPUT_QUEUE_SIZE
+	#define INPUT_QUEUE_SIZE 1024
+#endif // INPUT_QUEUE_SIZE
+
+#define INPUT_MAX_FRAME 128	/* longest frame kept whole, longer ones are dropped */
+
+/*
+ * One evdev event, with the time the kernel stamped it (CLOCK_MONOTONIC,
+ * the clock of the flip events) and the time it was read.
+ */
+struct input_msg
+{
+	int device;
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+	uint64_t time_ns;
+	uint64_t read_ns;
+};
+
+struct input_device
+{
+	int fd;
+	char path[272];		/* /dev/input/ and the longest file name */
+	char name[128];
+
+	/** events of the frame being read, delivered on its SYN_REPORT **/
+	struct input_event pending[INPUT_MAX_FRAME];
+	int pending_count;
+	bool syncing;			/* after SYN_DROPPED, skip up to the next SYN_REPORT */
+};
+
+struct input_stats
+{
+	uint64_t reads;
+	uint64_t events;
+	uint64_t frames;
+	uint64_t dropped_frames;	/* SYN_DROPPED, oversized frames or a full queue */
+};
+
+struct input
+{
+	int epoll_fd;
+
+	struct input_device devices[INPUT_MAX_DEVICES];
+	int count;
+
+	/** only complete frames are queued **/
+	struct input_msg queue[INPUT_QUEUE_SIZE];
+	uint32_t head;		/* next slot written */
+	uint32_t tail;		/* next slot read */
+
+	struct input_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: input_init(struct input *in)
+ * -----------------------
+ *  Creates the epoll set, without devices.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int input_init(struct input *in);
+
+/*
+ * Function: input_add(struct input *in, const char *path)
+ * -----------------------
+ *  Opens an evdev node read only and adds it to the epoll set.
+ *
+ * returns: Index of the device, negative errno on failure (int)
+ */
+int input_add(struct input *in, const char *path);
+
+/*
+ * Function: input_add_fd(struct input *in, int fd, const char *name)
+ * -----------------------
+ *  Adds an already open, non blocking source of struct input_event, an evdev
+ *  node or the read end of a pipe some replay writes into. `in` owns `fd` then.
+ *
+ * returns: Index of the device, negative errno on failure (int)
+ */
+int input_add_fd(struct input *in, int fd, const char *name);
+
+/*
+ * Function: input_add_all(struct input *in)
+ * -----------------------
+ *  Adds every /dev/input/event* that can be opened.
+ *
+ * returns: Number of devices added, negative errno if /dev/input is unreadable (int)
+ */
+int input_add_all(struct input *in);
+
+/*
+ * Function: input_fd(const struct input *in)
+ * -----------------------
+ *  returns: The epoll fd, readable when any device has events, for poll() (int)
+ */
+int input_fd(const struct input *in);
+
+/*
+ * Function: input_dispatch(struct input *in, int timeout_ms)
+ * -----------------------
+ *  Waits up to `timeout_ms` (0 = not at all, -1 = forever) for input and reads
+ *  every ready device dry, INPUT_BATCH events per read(). Events are queued
+ *  frame by frame once their SYN_REPORT arrived. A device which is unplugged is removed.
+ *
+ * returns: Number of frames queued, negative errno on failure (int)
+ */
+int input_dispatch(struct input *in, int timeout_ms);
+
+/*
+ * Function: input_next(struct input *in, struct input_msg *msg)
+ * -----------------------
+ *  Pops the oldest queued event, the SYN_REPORT closing a frame included.
+ *
+ * returns: False if the queue is empty (bool)
+ */
+bool input_next(struct input *in, struct input_msg *msg);
+
+/*
+ * Function: input_destroy(struct input *in)
+ * -----------------------
+ *  Closes every device and the epoll set.
+ */
+void input_destroy(struct input *in);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static uint64_t input_now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int input_init(struct input *in)
+{
+	memset(in, 0, sizeof(*in));
+
+	in->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (in->epoll_fd < 0)
+		return -errno;
+
+	for (int i = 0; i < INPUT_MAX_DEVICES; ++i)
+		in->devices[i].fd = -1;
+
+	return 0;
+}
+
+int input_add_fd(struct input *in, int fd, const char *name)
+{
+	int index = 0;
+	while (index < INPUT_MAX_DEVICES && in->devices[index].fd >= 0)
+		++index;
+
+	if (index == INPUT_MAX_DEVICES)
+		return -ENOSPC;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = index };
+	if (epoll_ctl(in->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+
+	struct input_device *d = &in->devices[index];
+	memset(d, 0, sizeof(*d));
+	d->fd = fd;
+	snprintf(d->path, sizeof(d->path), "%s", name);
+
+	if (ioctl(fd, EVIOCGNAME(sizeof(d->name)), d->name) < 0)
+		snprintf(d->name, sizeof(d->name), "%s", name);
+
+	if (index >= in->count)
+		in->count = index + 1;
+
+	return index;
+}
+
+int input_add(struct input *in, const char *path)
+{
+	int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	/** evdev stamps with CLOCK_REALTIME unless told otherwise **/
+	int clock = CLOCK_MONOTONIC;
+	if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0)
+		WARN("%s: events keep their realtime stamps: %s", path, strerror(errno));
+
+	int index = input_add_fd(in, fd, path);
+	if (index < 0)
+		close(fd);
+
+	return index;
+}
+
+int input_add_all(struct input *in)
+{
+	DIR *dir = opendir("/dev/input");
+	if (dir == NULL)
+		return -errno;
+
+	int added = 0;
+	for (struct dirent *e; (e = readdir(dir)) != NULL; )
+	{
+		if (strncmp(e->d_name, "event", 5))
+			continue;
+
+		char path[sizeof(in->devices[0].path)];
+		snprintf(path, sizeof(path), "/dev/input/%s", e->d_name);
+
+		int index = input_add(in, path);
+		if (index < 0)
+		{
+			WARN("%s: %s", path, strerror(-index));
+			continue;
+		}
+
+		INFO("Input %d: %s (%s)", index, path, in->devices[index].name);
+		added++;
+	}
+
+	closedir(dir);
+	return added;
+}
+
+int input_fd(const struct input *in)
+{
+	return in->epoll_fd;
+}
+
+static void input_remove(struct input *in, int index)
+{
+	struct input_device *d = &in->devices[index];
+
+	INFO("Input %d: %s is gone", index, d->path);
+
+	epoll_ctl(in->epoll_fd, EPOLL_CTL_DEL, d->fd, NULL);
+	close(d->fd);
+	d->fd = -1;
+}
+
+/*
+ * input_frame()
+ *
+ * Moves the pending frame of device `index` to the queue, all or nothing.
+*/
+static bool input_frame(struct input *in, int index, uint64_t read_ns)
+{
+	struct input_device *d = &in->devices[index];
+
+	if (INPUT_QUEUE_SIZE - (in->head - in->tail) < (uint32_t)d->pending_count)
+		return false;
+
+	for (int i = 0; i < d->pending_count; ++i)
+	{
+		const struct input_event *e = &d->pending[i];
+		struct input_msg *m = &in->queue[in->head++ & (INPUT_QUEUE_SIZE - 1)];
+
+		m->device = index;
+		m->type = e->type;
+		m->code = e->code;
+		m->value = e->value;
+		m->time_ns = (uint64_t)e->input_event_sec * 1000000000ull + (uint64_t)e->input_event_usec * 1000ull;
+		m->read_ns = read_ns;
+	}
+
+	return true;
+}
+
+/*
+ * input_read()
+ *
+ * Reads device `index` until it would block.
+ * returns: Number of frames queued, -ENODEV once it is unplugged.
+*/
+static int input_read(struct input *in, int index)
+{
+	struct input_device *d = &in->devices[index];
+	struct input_event batch[INPUT_BATCH];
+	int frames = 0;
+
+	for (;;)
+	{
+		ssize_t n = read(d->fd, batch, sizeof(batch));
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return errno == EAGAIN ? frames : -errno;
+		}
+
+		if (n == 0)
+			return frames;
+
+		uint64_t read_ns = input_now_ns();
+		int count = n / sizeof(batch[0]);
+
+		in->stats.reads++;
+		in->stats.events += count;
+
+		for (int i = 0; i < count; ++i)
+		{
+			const struct input_event *e = &batch[i];
+
+			/** the kernel dropped events, what is pending is incomplete **/
+			if (e->type == EV_SYN && e->code == SYN_DROPPED)
+			{
+				d->pending_count = 0;
+				d->syncing = true;
+				in->stats.dropped_frames++;
+				continue;
+			}
+
+			if (d->syncing)
+			{
+				if (e->type == EV_SYN && e->code == SYN_REPORT)
+					d->syncing = false;
+				continue;
+			}
+
+			if (d->pending_count == INPUT_MAX_FRAME)
+			{
+				d->pending_count = 0;
+				d->syncing = true;
+				in->stats.dropped_frames++;
+				continue;
+			}
+
+			d->pending[d->pending_count++] = *e;
+
+			if (e->type == EV_SYN && e->code == SYN_REPORT)
+			{
+				if (input_frame(in, index, read_ns))
+				{
+					in->stats.frames++;
+					frames++;
+				}
+				else
+					in->stats.dropped_frames++;
+
+				d->pending_count = 0;
+			}
+		}
+
+		/** a short read means the device is empty, no need for another syscall **/
+		if (count < INPUT_BATCH)
+			return frames;
+	}
+}
+
+int input_dispatch(struct input *in, int timeout_ms)
+{
+	struct epoll_event events[INPUT_MAX_DEVICES];
+
+	int ready = epoll_wait(in->epoll_fd, events, INPUT_MAX_DEVICES, timeout_ms);
+	if (ready < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	int frames = 0;
+	for (int i = 0; i < ready; ++i)
+	{
+		int index = events[i].data.u32;
+		if (index >= in->count || in->devices[index].fd < 0)
+			continue;
+
+		int ret = (events[i].events & (EPOLLHUP | EPOLLERR)) ? -ENODEV : input_read(in, index);
+		if (ret < 0)
+		{
+			input_remove(in, index);
+			continue;
+		}
+
+		frames += ret;
+	}
+
+	return frames;
+}
+
+bool input_next(struct input *in, struct input_msg *msg)
+{
+	if (in->tail == in->head)
+		return false;
+
+	*msg = in->queue[in->tail++ & (INPUT_QUEUE_SIZE - 1)];
+	return true;
+}
+
+void input_destroy(struct input *in)
+{
+	for (int i = 0; i < in->count; ++i)
+		if (in->devices[i].fd >= 0)
+			close(in->devices[i].fd);
+
+	if (in->epoll_fd >= 0)
+		close(in->epoll_fd);
+
+	in->count = 0;
+	in->epoll_fd = -1;
+}
+
+#endif // INPUT_H
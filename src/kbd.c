@@ -1,49 +1,277 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <linux/input.h>
 #include <string.h>
+#include <time.h>
+
+#include "input.h"
+#include "feedback.h"
 
 /*
  * event3 -> wireless keyboard
  * event4 -> laptop keyboard
 */
 
-int main() {
-    const char *device = "/dev/input/event1"; // Change this to your keyboard's event file
-    int fd = open(device, O_WRONLY);
-    
-    if (fd == -1) {
+/** how long `kbd` listens when no time is given **/
+#define MONITOR_SECONDS 10
+
+/*
+ * led(const char *)
+ * toggles the Caps Lock LED of one device for 2 seconds.
+*/
+int led(const char *device) {
+    struct feedback f;
+
+    if (feedback_open(&f, device) < 0) {
         perror("Failed to open input device");
         return 1;
     }
 
-    struct input_event event;
-    memset(&event, 0, sizeof(struct input_event));
-    
-    event.type = EV_LED;
-    event.code = LED_CAPSL;
-    event.value = 1; // 1 to turn on, 0 to turn off
+    /** remembered, so it ends as it was **/
+    bool was_on = f.leds[LED_CAPSL / 8] & (1u << (LED_CAPSL % 8));
 
-    // Turn on the Caps Lock LED
-    if (write(fd, &event, sizeof(struct input_event)) == -1) {
-        perror("Failed to turn on Caps Lock LED");
-        close(fd);
+    feedback_led(&f, LED_CAPSL, !was_on);
+    if (feedback_flush(&f) < 0) {
+        perror("Failed to toggle Caps Lock LED");
+        feedback_close(&f);
         return 1;
     }
 
-    // Sleep for 2 seconds
     sleep(2);
 
-    // Turn off the Caps Lock LED
-    event.value = 0;
-    if (write(fd, &event, sizeof(struct input_event)) == -1) {
-        perror("Failed to turn off Caps Lock LED");
-        close(fd);
+    feedback_led(&f, LED_CAPSL, was_on);
+    if (feedback_flush(&f) < 0) {
+        perror("Failed to restore Caps Lock LED");
+        feedback_close(&f);
         return 1;
     }
 
     printf("Caps Lock LED toggled successfully!\n");
-    close(fd);
+    feedback_close(&f);
+    return 0;
+}
+
+/*
+ * churn(const char *, int)
+ * drives Caps, Num and Scroll Lock as status indicators for `frames`
+ * frames of 16 ms, 16 updates a frame which mostly repeat the status,
+ * and compares the syscalls with one write() per update.
+*/
+int churn(const char *device, int frames) {
+    struct feedback f;
+
+    if (feedback_open(&f, device) < 0) {
+        perror("Failed to open input device");
+        return 1;
+    }
+
+    static const uint16_t leds[] = { LED_CAPSL, LED_NUML, LED_SCROLLL };
+    bool status[3] = { false, false, false };
+    uint64_t updates = 0;
+
+    srand(1);
+    for (int frame = 0; frame < frames; ++frame) {
+        /** now and then a status really changes **/
+        if (frame % 30 == 0)
+            status[rand() % 3] ^= true;
+
+        /** the rest is noise: set again, or blinked and set back **/
+        for (int i = 0; i < 16; ++i, ++updates) {
+            int l = rand() % 3;
+            feedback_led(&f, leds[l], rand() % 8 ? status[l] : !status[l]);
+        }
+
+        for (int l = 0; l < 3; ++l, ++updates)
+            feedback_led(&f, leds[l], status[l]);
+
+        if (feedback_flush(&f) < 0) {
+            perror("Failed to write LEDs");
+            break;
+        }
+
+        usleep(16000);
+    }
+
+    printf("%lu LED updates in %d frames: %lu write() one per update, %lu batched (%lu events, %lu redundant dropped)\n",
+            updates, frames, updates, f.stats.syscalls, f.stats.events, f.stats.redundant);
+
+    /** leave them off **/
+    for (int l = 0; l < 3; ++l)
+        feedback_led(&f, leds[l], false);
+
+    feedback_flush(&f);
+    feedback_close(&f);
+    return 0;
+}
+
+/*
+ * monitor(int, int, char **)
+ * prints every key and button of every input device (or of the ones given)
+ * with the delay between the kernel stamping it and us reading it,
+ * until Escape is pressed or `seconds` have passed.
+*/
+int monitor(int seconds, int count, char **devices) {
+    struct input in;
+
+    if (input_init(&in) < 0) {
+        perror("Failed to create epoll set");
+        return 1;
+    }
+
+    int added = 0;
+    if (count == 0) {
+        added = input_add_all(&in);
+    } else {
+        for (int i = 0; i < count; ++i) {
+            if (input_add(&in, devices[i]) >= 0)
+                added++;
+            else
+                fprintf(stderr, "Failed to open %s\n", devices[i]);
+        }
+    }
+
+    if (added <= 0) {
+        fprintf(stderr, "No input device to listen to\n");
+        input_destroy(&in);
+        return 1;
+    }
+
+    printf("Listening to %d devices for %d seconds, Escape stops\n", added, seconds);
+
+    uint64_t end = input_now_ns() + (uint64_t)seconds * 1000000000ull;
+    uint64_t latency_sum = 0, latency_max = 0, frames = 0;
+    int quit = 0;
+
+    while (!quit) {
+        uint64_t now = input_now_ns();
+        if (now >= end)
+            break;
+
+        if (input_dispatch(&in, (end - now) / 1000000ull + 1) < 0)
+            break;
+
+        struct input_msg msg;
+        while (input_next(&in, &msg)) {
+            if (msg.type == EV_SYN) {
+                /** a frame is read as a whole, its SYN_REPORT is as late as any event of it **/
+                uint64_t latency = msg.read_ns > msg.time_ns ? msg.read_ns - msg.time_ns : 0;
+                latency_sum += latency;
+                if (latency > latency_max)
+                    latency_max = latency;
+                frames++;
+                continue;
+            }
+
+            if (msg.type != EV_KEY || msg.value == 2)
+                continue;
+
+            printf("%-28s key %3u %s (read %.3f ms after the event)\n",
+                    in.devices[msg.device].name, msg.code, msg.value ? "down" : "up",
+                    (msg.read_ns - msg.time_ns) / 1e6);
+
+            if (msg.code == KEY_ESC)
+                quit = 1;
+        }
+    }
+
+    printf("%lu frames in %lu reads (%lu events, %lu dropped), read latency avg %.3f ms max %.3f ms\n",
+            in.stats.frames, in.stats.reads, in.stats.events, in.stats.dropped_frames,
+            frames ? latency_sum / 1e6 / frames : 0, latency_max / 1e6);
+
+    input_destroy(&in);
+    return 0;
+}
+
+/*
+ * record(const char *, int, int, char **)
+ * writes every frame of every input device (or of the ones given) to `path`
+ * for `seconds`, as raw struct input_event which `card --replay` plays back.
+*/
+int record(const char *path, int seconds, int count, char **devices) {
+    struct input in;
+
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        perror("Failed to create recording");
+        return 1;
+    }
+
+    if (input_init(&in) < 0) {
+        perror("Failed to create epoll set");
+        fclose(out);
+        return 1;
+    }
+
+    int added = count == 0 ? input_add_all(&in) : 0;
+    for (int i = 0; i < count; ++i) {
+        if (input_add(&in, devices[i]) >= 0)
+            added++;
+        else
+            fprintf(stderr, "Failed to open %s\n", devices[i]);
+    }
+
+    if (added <= 0) {
+        fprintf(stderr, "No input device to record\n");
+        input_destroy(&in);
+        fclose(out);
+        return 1;
+    }
+
+    printf("Recording %d devices for %d seconds to %s\n", added, seconds, path);
+
+    uint64_t end = input_now_ns() + (uint64_t)seconds * 1000000000ull;
+    uint64_t written = 0;
+
+    for (uint64_t now; (now = input_now_ns()) < end; ) {
+        if (input_dispatch(&in, (end - now) / 1000000ull + 1) < 0)
+            break;
+
+        /** frames of different devices are merged, they replay as one **/
+        struct input_msg msg;
+        while (input_next(&in, &msg)) {
+            struct input_event e = {
+                .input_event_sec = msg.time_ns / 1000000000ull,
+                .input_event_usec = msg.time_ns % 1000000000ull / 1000ull,
+                .type = msg.type,
+                .code = msg.code,
+                .value = msg.value,
+            };
+
+            if (fwrite(&e, sizeof(e), 1, out) == 1)
+                written++;
+        }
+    }
+
+    printf("%lu events in %lu frames recorded\n", written, in.stats.frames);
+
+    input_destroy(&in);
+    fclose(out);
     return 0;
 }
+
+int main(int argc, char **argv) {
+    if (argc > 2 && !strcmp(argv[1], "led"))
+        return led(argv[2]);
+
+    /** kbd churn <device> [frames] **/
+    if (argc > 2 && !strcmp(argv[1], "churn"))
+        return churn(argv[2], argc > 3 ? atoi(argv[3]) : 300);
+
+    /** kbd record <file> <seconds> [devices...] **/
+    if (argc > 3 && !strcmp(argv[1], "record"))
+        return record(argv[2], atoi(argv[3]), argc - 4, argv + 4);
+
+    /** kbd [seconds] [devices...] **/
+    int seconds = argc > 1 ? atoi(argv[1]) : MONITOR_SECONDS;
+    if (seconds <= 0) {
+        printf("usage: %s [seconds] [/dev/input/eventN...]\n"
+               "       %s record <file> <seconds> [/dev/input/eventN...]\n"
+               "       %s led /dev/input/eventN\n"
+               "       %s churn /dev/input/eventN [frames]\n", argv[0], argv[0], argv[0], argv[0]);
+        return 1;
+    }
+
+    return monitor(seconds, argc > 2 ? argc - 2 : 0, argv + 2);
+}
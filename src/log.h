@@ -0,0 +1,105 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+typedef enum {
+	BLACK 	= 0,
+	RED 		= 1,
+	GREEN 	= 2,
+	YELLOW 	= 3,
+	BLUE 		= 4,
+	MAGENTA = 5,
+	CYAN 		= 6,
+	WHITE 	= 7
+} TERM_COLOR;
+
+typedef enum {
+	TEXT = 0,
+	BOLD_TEXT,
+	UNDERLINE_TEXT,
+	BACKGROUND,
+	HIGH_INTEN_BG,
+	HIGH_INTEN_TEXT,
+	BOLD_HIGH_INTEN_TEXT,
+	RESET
+} TERM_KIND;
+
+#define writef(...) ({  writef_function(__VA_ARGS__, NULL); })
+#define INFO(...) printf("%s[INFO]:%s %s\n", get_term_color(TEXT, GREEN), get_term_color(RESET, 0), writef(__VA_ARGS__))
+#define WARN(...) printf("%s[WARN]:%s %s\n", get_term_color(TEXT, YELLOW), get_term_color(RESET, 0), writef(__VA_ARGS__))
+#define ERROR(...) printf("%s[ERROR]:%s %s\n", get_term_color(TEXT, RED), get_term_color(RESET, 0), writef(__VA_ARGS__)), exit(1);
+
+/*
+ * writef_function(char *, args)
+ * It works like printf but it returns string.
+*/
+char *writef_function(char *s, ...);
+
+/*
+ * get_term_color(TERM_KIND, TERM_COLOR)
+ * return terminal color string
+*/
+const char *get_term_color(TERM_KIND kind, TERM_COLOR color)
+{
+	switch (kind)
+	{
+		case TEXT: return writef("\e[0;3%dm", color);
+		case BOLD_TEXT: return writef("\e[1;3%dm", color);
+		case UNDERLINE_TEXT: return writef("\e[4;3%dm", color);
+		case BACKGROUND: return writef("\e[4%dm", color);
+		case HIGH_INTEN_BG: return writef("\e[0;10%dm", color);
+		case HIGH_INTEN_TEXT: return writef("\e[0;9%dm", color);
+		case BOLD_HIGH_INTEN_TEXT: return writef("\e[1;9%dm", color);
+		case RESET: return writef("\e[0m");
+	}
+}
+
+char *writef_function(char *s, ...)
+{
+	// allocate small size buffer
+	size_t buffer_size = 64; // 64 bytes
+	char *buffer = (char*)malloc(buffer_size);
+
+	if (buffer == NULL)
+	{
+		WARN("writef: Failed to allocate buffer.");
+		return NULL;
+	}
+
+	va_list ap;
+	va_start(ap, s);
+
+	int nSize = vsnprintf(buffer, buffer_size, s, ap);
+	if (nSize < 0)
+	{
+		free(buffer);
+		va_end(ap);
+	}
+
+	// if buffer does not have enough space then extend it.
+	if ((size_t)nSize >= buffer_size)
+	{
+		buffer_size = nSize + 1;
+		buffer = (char*)realloc(buffer, buffer_size);
+
+		if (buffer == NULL)
+		{
+			WARN("writef: Failed to re-allocate buffer.");
+			return NULL;
+		}
+
+		va_end(ap);
+
+		va_start(ap, s);
+		vsnprintf(buffer, buffer_size, s, ap);
+	}
+
+	va_end(ap);
+
+	return buffer;
+}
+
+#endif // LOG_H
@@ -0,0 +1,590 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+#include "present.h"
+#include "damage.h"
+#include "backend.h"
+#include "bufpool.h"
+#include "pacing.h"
+
+#ifndef OUTPUT_MAX
+	#define OUTPUT_MAX 8
+#endif // OUTPUT_MAX
+
+struct output
+{
+	int index;
+	uint32_t connector_id;
+	uint32_t crtc_id;
+	uint32_t pipe;					/* index of crtc_id in the device's list */
+	drmModeModeInfo mode;
+
+	/** every head has its own buffer chain and flip queue **/
+	struct present present;
+
+	/** paced heads start a frame at start_ns (0 = not picked yet), see output_manager_pace() **/
+	struct pacing pacing;
+	uint64_t start_ns;
+
+	bool ready;							/* back buffer is rendered and waits for the previous flip */
+	struct damage repaint;	/* what the ready buffer has to upload */
+	uint64_t frame;					/* frames rendered for this head */
+
+	/** frame timing of this head only **/
+	uint64_t flips_seen;
+	uint64_t last_flip_us;
+	uint64_t frame_us;			/* moving average of the time between flips */
+};
+
+struct output_manager
+{
+	struct backend *backend;
+	struct output outputs[OUTPUT_MAX];
+	int count;
+	int buffers;		/* chain length of every head */
+	uint32_t format;	/* DRM_FORMAT_* of the chains, see present_init() */
+	bool paced;
+	double miss_target;
+
+	/** shared by every head, a head switching to another head's mode reuses its buffers **/
+	struct bufpool pool;
+};
+
+/*
+ * Called for a head whose back buffer is free.
+ * Draw into `b` and put the pixels written into `repaint`
+ * (present_repaint_region() gives the minimum).
+ */
+typedef void (*output_render_fn)(struct output *o, struct present_buffer *b, struct damage *repaint, void *data);
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: output_manager_init(struct output_manager *m, struct backend *be, int buffers, uint32_t format)
+ * -----------------------
+ *  Finds every connected connector, gives each one a free CRTC
+ *  it can be driven by (through the encoders' possible_crtcs)
+ *  and creates a buffer chain for its preferred mode.
+ *  Connectors without a mode or a free CRTC are skipped.
+ *
+ * m: Output manager (struct output_manager *)
+ * be: Drm backend of the opened dri device (struct backend *)
+ * buffers: Buffers per head, 2 or 3 (int)
+ * format: DRM_FORMAT_* the heads scan out, drawing stays XRGB8888 (uint32_t)
+ *
+ * returns: Number of outputs, negative errno on failure (int)
+ */
+int output_manager_init(struct output_manager *m, struct backend *be, int buffers, uint32_t format);
+
+/*
+ * Function: output_manager_init_headless(struct output_manager *m, struct backend *be, int count, uint32_t width, uint32_t height, int buffers, uint32_t format)
+ * -----------------------
+ *  Creates `count` heads without connectors, usually on the memory backend.
+ *  Head i refreshes at 60 / (i + 1) Hz so a slow head can be watched
+ *  next to a fast one. `count` must be at least 1.
+ *
+ * returns: Number of outputs, negative errno on failure (int)
+ */
+int output_manager_init_headless(struct output_manager *m, struct backend *be, int count, uint32_t width, uint32_t height, int buffers, uint32_t format);
+
+/*
+ * Function: output_manager_pace(struct output_manager *m, double miss_target)
+ * -----------------------
+ *  Stops rendering heads as soon as a buffer is free. Each head waits for
+ *  its previous flip, then starts its next frame just in time for the
+ *  following vblank, as late as its recent frames allow while missing at
+ *  most `miss_target` (0.01 = 1%) of the vblanks. See pacing.h.
+ */
+void output_manager_pace(struct output_manager *m, double miss_target);
+
+/*
+ * Function: output_manager_timeout(struct output_manager *m, int timeout_ms)
+ * -----------------------
+ *  returns: `timeout_ms`, shortened to when the first paced head starts its frame,
+ *           for callers polling more than the heads (int)
+ */
+int output_manager_timeout(struct output_manager *m, int timeout_ms);
+
+/*
+ * Function: output_manager_frame(struct output_manager *m, output_render_fn render, void *data)
+ * -----------------------
+ *  Renders every head which has a free buffer (paced ones: once it is
+ *  their time) and queues every head which has a rendered buffer and
+ *  no flip in flight. Never sleeps, so a head waiting for its vblank
+ *  does not hold back the others.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int output_manager_frame(struct output_manager *m, output_render_fn render, void *data);
+
+/*
+ * Function: output_manager_wait(struct output_manager *m, int timeout_ms)
+ * -----------------------
+ *  Sleeps until any head completes a flip, or a paced head is due, and
+ *  updates the timing of every head that flipped, -1 waits forever.
+ *
+ * returns: 1 if a flip completed, 0 on timeout, negative errno on failure (int)
+ */
+int output_manager_wait(struct output_manager *m, int timeout_ms);
+
+/*
+ * Function: output_set_mode(struct output_manager *m, struct output *o, const drmModeModeInfo *mode)
+ * -----------------------
+ *  Switches a head to `mode`, set with its next frame. The old chain goes
+ *  back to the pool and the new one comes from it, so switching
+ *  between modes seen before allocates nothing.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int output_set_mode(struct output_manager *m, struct output *o, const drmModeModeInfo *mode);
+
+/*
+ * Function: output_manager_destroy(struct output_manager *m)
+ * -----------------------
+ *  Releases every buffer chain and the pool.
+ */
+void output_manager_destroy(struct output_manager *m);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static int output_crtc_index(drmModeResPtr res, uint32_t crtc_id)
+{
+	for (int i = 0; i < res->count_crtcs; ++i)
+		if (res->crtcs[i] == crtc_id)
+			return i;
+
+	return -1;
+}
+
+/*
+ * output_pick_crtc()
+ *
+ * Keeps the CRTC the connector is already driven by if nobody took it,
+ * so no modeset is needed, else the first free one an encoder can reach.
+*/
+static int output_pick_crtc(int fd, drmModeResPtr res, drmModeConnectorPtr conn, uint32_t used)
+{
+	if (conn->encoder_id)
+	{
+		drmModeEncoderPtr enc = drmModeGetEncoder(fd, conn->encoder_id);
+		if (enc)
+		{
+			int index = enc->crtc_id ? output_crtc_index(res, enc->crtc_id) : -1;
+			drmModeFreeEncoder(enc);
+
+			if (index >= 0 && !(used & (1u << index)))
+				return index;
+		}
+	}
+
+	for (int i = 0; i < conn->count_encoders; ++i)
+	{
+		drmModeEncoderPtr enc = drmModeGetEncoder(fd, conn->encoders[i]);
+		if (!enc)
+			continue;
+
+		for (int c = 0; c < res->count_crtcs; ++c)
+		{
+			if ((enc->possible_crtcs & (1u << c)) && !(used & (1u << c)))
+			{
+				drmModeFreeEncoder(enc);
+				return c;
+			}
+		}
+
+		drmModeFreeEncoder(enc);
+	}
+
+	return -1;
+}
+
+static const drmModeModeInfo *output_pick_mode(drmModeConnectorPtr conn)
+{
+	for (int i = 0; i < conn->count_modes; ++i)
+		if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED)
+			return &conn->modes[i];
+
+	/** no preferred mode, the driver lists the best one first **/
+	return conn->count_modes ? &conn->modes[0] : NULL;
+}
+
+int output_manager_init(struct output_manager *m, struct backend *be, int buffers, uint32_t format)
+{
+	int fd = be->fd;
+
+	memset(m, 0, sizeof(*m));
+	m->backend = be;
+	m->buffers = buffers;
+	m->format = format;
+	bufpool_init(&m->pool, be, 0);
+
+	drmModeResPtr res = drmModeGetResources(fd);
+	if (!res)
+	{
+		int ret = -errno;
+		bufpool_destroy(&m->pool);
+		return ret;
+	}
+
+	uint32_t used = 0;
+
+	for (int i = 0; i < res->count_connectors && m->count < OUTPUT_MAX; ++i)
+	{
+		drmModeConnectorPtr conn = drmModeGetConnector(fd, res->connectors[i]);
+		if (!conn)
+			continue;
+
+		const drmModeModeInfo *mode = output_pick_mode(conn);
+		if (conn->connection != DRM_MODE_CONNECTED || mode == NULL)
+		{
+			drmModeFreeConnector(conn);
+			continue;
+		}
+
+		int crtc = output_pick_crtc(fd, res, conn, used);
+		if (crtc < 0)
+		{
+			WARN("No free CRTC for connector %u, skipping it.", conn->connector_id);
+			drmModeFreeConnector(conn);
+			continue;
+		}
+
+		struct output *o = &m->outputs[m->count];
+		memset(o, 0, sizeof(*o));
+		o->index = m->count;
+		o->connector_id = conn->connector_id;
+		o->crtc_id = res->crtcs[crtc];
+		o->pipe = crtc;
+		o->mode = *mode;
+
+		drmModeFreeConnector(conn);
+
+		int ret = present_init(&o->present, &m->pool, o->crtc_id, o->connector_id, &o->mode, buffers, format);
+		if (ret < 0)
+		{
+			WARN("Failed to create buffers for connector %u: %s", o->connector_id, strerror(-ret));
+			continue;
+		}
+
+		o->present.pipe = o->pipe;
+
+		used |= 1u << crtc;
+		m->count++;
+
+		INFO("Output %d: connector %u -> crtc %u, %s @ %uHz", o->index, o->connector_id, o->crtc_id, o->mode.name, o->mode.vrefresh);
+	}
+
+	drmModeFreeResources(res);
+
+	if (m->count == 0)
+	{
+		bufpool_destroy(&m->pool);
+		return -ENODEV;
+	}
+
+	return m->count;
+}
+
+int output_manager_init_headless(struct output_manager *m, struct backend *be, int count, uint32_t width, uint32_t height, int buffers, uint32_t format)
+{
+	/** without a head nothing ever flips and the loop would spin **/
+	if (count < 1)
+		return -EINVAL;
+
+	memset(m, 0, sizeof(*m));
+	m->backend = be;
+	m->buffers = buffers;
+	m->format = format;
+	bufpool_init(&m->pool, be, 0);
+
+	if (count > OUTPUT_MAX)
+		count = OUTPUT_MAX;
+
+	for (int i = 0; i < count; ++i)
+	{
+		struct output *o = &m->outputs[i];
+		memset(o, 0, sizeof(*o));
+		o->index = i;
+		o->crtc_id = i;
+		o->pipe = i;
+		o->mode.hdisplay = width;
+		o->mode.vdisplay = height;
+		o->mode.vrefresh = PRESENT_HEADLESS_REFRESH / (i + 1);
+		snprintf(o->mode.name, sizeof(o->mode.name), "%ux%u", width, height);
+
+		int ret = present_init(&o->present, &m->pool, o->crtc_id, 0, &o->mode, buffers, format);
+		if (ret < 0)
+		{
+			output_manager_destroy(m);
+			return ret;
+		}
+
+		o->present.pipe = o->pipe;
+
+		m->count++;
+	}
+
+	return m->count;
+}
+
+void output_manager_pace(struct output_manager *m, double miss_target)
+{
+	m->paced = true;
+	m->miss_target = miss_target;
+
+	for (int i = 0; i < m->count; ++i)
+	{
+		struct output *o = &m->outputs[i];
+		pacing_init(&o->pacing, o->present.timing.refresh_ns, miss_target);
+		o->start_ns = 0;
+	}
+}
+
+/*
+ * output_next_start()
+ *
+ * The earliest start time picked by a paced head, 0 if none.
+*/
+static uint64_t output_next_start(struct output_manager *m)
+{
+	uint64_t first = 0;
+
+	for (int i = 0; m->paced && i < m->count; ++i)
+	{
+		uint64_t start = m->outputs[i].start_ns;
+		if (start && (first == 0 || start < first))
+			first = start;
+	}
+
+	return first;
+}
+
+int output_manager_timeout(struct output_manager *m, int timeout_ms)
+{
+	uint64_t start = output_next_start(m);
+	if (start == 0)
+		return timeout_ms;
+
+	/** rounded up, polling in ms must not wake before the frame is due **/
+	uint64_t now = timing_now();
+	int left = start > now ? (int)((start - now + 999999) / 1000000) : 0;
+
+	return timeout_ms < 0 || left < timeout_ms ? left : timeout_ms;
+}
+
+/*
+ * output_due()
+ *
+ * True if a paced head should start its frame now. The start time is
+ * picked once the previous flip landed, from the phase of the vblank.
+*/
+static bool output_due(struct output *o)
+{
+	struct present *p = &o->present;
+
+	if (p->pending >= 0)
+		return false;
+
+	uint64_t now = timing_now();
+
+	if (o->start_ns == 0)
+	{
+		uint64_t vblank;
+		if (present_last_vblank(p, &vblank) < 0)
+			vblank = p->flip_us ? p->flip_us * 1000ull : now;
+
+		o->start_ns = pacing_next_start(&o->pacing, vblank, now);
+	}
+
+	if (now < o->start_ns)
+		return false;
+
+	o->start_ns = 0;
+	pacing_begin(&o->pacing, now);
+
+	return true;
+}
+
+int output_manager_frame(struct output_manager *m, output_render_fn render, void *data)
+{
+	for (int i = 0; i < m->count; ++i)
+	{
+		struct output *o = &m->outputs[i];
+		struct present *p = &o->present;
+
+		if (!o->ready)
+		{
+			if (m->paced && !output_due(o))
+				continue;
+
+			struct present_buffer *b = present_try_acquire(p);
+			if (b == NULL)
+				continue;
+
+			timing_render_start(&p->timing);
+			render(o, b, &o->repaint, data);
+			timing_render_end(&p->timing);
+			o->ready = true;
+			o->frame++;
+		}
+
+		/** a head may only have one flip in flight, its next buffer waits here **/
+		if (p->pending >= 0)
+			continue;
+
+		/** the kernel still has a commit of ours in flight, the rendered frame is submitted on a later pass **/
+		int ret = present_submit_damage(p, &o->repaint);
+		if (ret == -EBUSY)
+			continue;
+		if (ret < 0)
+			return ret;
+
+		if (m->paced)
+			pacing_submitted(&o->pacing, timing_now());
+
+		o->ready = false;
+	}
+
+	return 0;
+}
+
+static void output_update_timing(struct output *o)
+{
+	struct present *p = &o->present;
+
+	if (p->frames == o->flips_seen)
+		return;
+
+	pacing_flipped(&o->pacing, p->flip_us * 1000ull);
+
+	if (o->last_flip_us && p->flip_us > o->last_flip_us)
+	{
+		uint64_t interval = (p->flip_us - o->last_flip_us) / (p->frames - o->flips_seen);
+		o->frame_us = o->frame_us ? (o->frame_us * 7 + interval) / 8 : interval;
+	}
+
+	o->flips_seen = p->frames;
+	o->last_flip_us = p->flip_us;
+}
+
+int output_manager_wait(struct output_manager *m, int timeout_ms)
+{
+	struct pollfd pfds[OUTPUT_MAX];
+	struct output *owner[OUTPUT_MAX];
+	int count = 0;
+
+	/*
+	 * Drm heads share the device fd, one dispatch serves every head
+	 * since the event's user_data finds the right one.
+	 * Memory heads have a vblank timer each.
+	 */
+	for (int i = 0; i < m->count; ++i)
+	{
+		int fd = m->outputs[i].present.wait_fd;
+		bool seen = false;
+
+		for (int j = 0; j < count; ++j)
+			seen |= pfds[j].fd == fd;
+
+		if (!seen)
+		{
+			pfds[count] = (struct pollfd) { .fd = fd, .events = POLLIN };
+			owner[count++] = &m->outputs[i];
+		}
+	}
+
+	if (count == 0)
+		return 0;
+
+	/** the whole ms of a paced start are polled, the rest is slept without the 1 ms granularity **/
+	uint64_t start = output_next_start(m);
+	if (start)
+	{
+		uint64_t now = timing_now();
+		int left = start > now ? (int)((start - now) / 1000000) : 0;
+
+		if (timeout_ms >= 0 && timeout_ms < left)
+			start = 0;
+		else
+			timeout_ms = left;
+	}
+
+	int ret = poll(pfds, count, timeout_ms);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	if (ret == 0 && start)
+	{
+		struct timespec ts = { .tv_sec = start / 1000000000ull, .tv_nsec = start % 1000000000ull };
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+		return 0;
+	}
+
+	int flipped = 0;
+	for (int i = 0; i < count && ret > 0; ++i)
+	{
+		if (!(pfds[i].revents & POLLIN))
+			continue;
+
+		int r = present_wait(&owner[i]->present, 0);
+		if (r < 0)
+			return r;
+
+		flipped |= r;
+	}
+
+	for (int i = 0; i < m->count; ++i)
+		output_update_timing(&m->outputs[i]);
+
+	return flipped;
+}
+
+int output_set_mode(struct output_manager *m, struct output *o, const drmModeModeInfo *mode)
+{
+	/** the frame rendered for the old mode would be the wrong size **/
+	o->ready = false;
+	present_destroy(&o->present);
+
+	int ret = present_init(&o->present, &m->pool, o->crtc_id, o->connector_id, mode, m->buffers, m->format);
+	if (ret < 0)
+		return ret;
+
+	o->mode = *mode;
+	o->present.pipe = o->pipe;
+
+	/** flip counters and the pacing of the old refresh rate start over with the new chain **/
+	o->flips_seen = 0;
+	o->last_flip_us = 0;
+	o->frame_us = 0;
+	o->start_ns = 0;
+
+	if (m->paced)
+		pacing_init(&o->pacing, o->present.timing.refresh_ns, m->miss_target);
+
+	return 0;
+}
+
+void output_manager_destroy(struct output_manager *m)
+{
+	for (int i = 0; i < m->count; ++i)
+		present_destroy(&m->outputs[i].present);
+
+	m->count = 0;
+	bufpool_destroy(&m->pool);
+}
+
+#endif // OUTPUT_H
@@ -0,0 +1,235 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+
+/*
+ * Just in time rendering: a frame starts as late as its predicted cost
+ * allows and still makes the next vblank, so what it shows is as fresh
+ * as possible. The cost is the worst of the last PACING_WINDOW frames
+ * (render start to submit), plus a margin which doubles on a miss and
+ * shrinks while the miss rate stays under the target.
+ */
+
+/** frames the cost is predicted from, power of 2 **/
+#ifndef PACING_WINDOW
+	#define PACING_WINDOW 32
+#endif // PACING_WINDOW
+
+/** margins never shrink below this, the wakeup itself is late by about as much **/
+#ifndef PACING_MIN_MARGIN_NS
+	#define PACING_MIN_MARGIN_NS 300000ull
+#endif // PACING_MIN_MARGIN_NS
+
+struct pacing_stats
+{
+	uint64_t frames;
+	uint64_t missed;				/* flipped a vblank or more after the targeted one */
+	uint64_t headroom_sum;	/* submit to targeted vblank, ns */
+	uint64_t headroom_min;
+	uint64_t latency_sum;		/* render start to flip, ns */
+};
+
+struct pacing
+{
+	uint64_t period_ns;
+	double miss_target;		/* wanted fraction of missed frames, 0.01 = 1% */
+
+	uint64_t costs[PACING_WINDOW];
+	uint32_t cost_count;
+	uint64_t submits;
+	uint64_t margin_ns;
+	double miss_rate;			/* moving average over about 64 frames */
+
+	/** the frame in flight: when it started, was submitted and should flip **/
+	uint64_t start_ns;
+	uint64_t submit_ns;
+	uint64_t target_ns;
+
+	struct pacing_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: pacing_period(const drmModeModeInfo *mode, uint32_t fallback_hz)
+ * -----------------------
+ *  returns: Refresh period of `mode` in ns, from the pixel clock and totals when set,
+ *           else from vrefresh, else `fallback_hz` (uint64_t)
+ */
+uint64_t pacing_period(const drmModeModeInfo *mode, uint32_t fallback_hz);
+
+/*
+ * Function: pacing_init(struct pacing *pc, uint64_t period_ns, double miss_target)
+ * -----------------------
+ *  pc: Scheduler of one head (struct pacing *)
+ *  period_ns: Refresh period, see pacing_period() (uint64_t)
+ *  miss_target: Fraction of frames allowed to miss their vblank (double)
+ */
+void pacing_init(struct pacing *pc, uint64_t period_ns, double miss_target);
+
+/*
+ * Function: pacing_next_start(struct pacing *pc, uint64_t vblank_ns, uint64_t now_ns)
+ * -----------------------
+ *  Picks the first vblank the next frame can make and when rendering it
+ *  should start to just make it, never before `now_ns`.
+ *
+ * vblank_ns: Time of a past vblank, to know the phase (uint64_t)
+ * now_ns: CLOCK_MONOTONIC now (uint64_t)
+ *
+ * returns: When to start rendering, CLOCK_MONOTONIC ns (uint64_t)
+ */
+uint64_t pacing_next_start(struct pacing *pc, uint64_t vblank_ns, uint64_t now_ns);
+
+/*
+ * Function: pacing_begin(struct pacing *pc, uint64_t now_ns)
+ * -----------------------
+ *  The frame starts rendering.
+ */
+void pacing_begin(struct pacing *pc, uint64_t now_ns);
+
+/*
+ * Function: pacing_submitted(struct pacing *pc, uint64_t now_ns)
+ * -----------------------
+ *  The frame was submitted, its cost is known.
+ */
+void pacing_submitted(struct pacing *pc, uint64_t now_ns);
+
+/*
+ * Function: pacing_flipped(struct pacing *pc, uint64_t flip_ns)
+ * -----------------------
+ *  The frame reached the screen, which tells whether it made its vblank
+ *  and adapts the margin.
+ */
+void pacing_flipped(struct pacing *pc, uint64_t flip_ns);
+
+/*
+ * Function: pacing_report(const struct pacing *pc, const char *name)
+ * -----------------------
+ *  Prints the budget, the headroom left before the vblank and the miss rate.
+ */
+void pacing_report(const struct pacing *pc, const char *name);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+uint64_t pacing_period(const drmModeModeInfo *mode, uint32_t fallback_hz)
+{
+	/** exact from the pixel clock (kHz), vrefresh is rounded **/
+	if (mode->clock && mode->htotal && mode->vtotal)
+		return (uint64_t)mode->htotal * mode->vtotal * 1000000ull / mode->clock;
+
+	return 1000000000ull / (mode->vrefresh ? mode->vrefresh : fallback_hz);
+}
+
+void pacing_init(struct pacing *pc, uint64_t period_ns, double miss_target)
+{
+	memset(pc, 0, sizeof(*pc));
+	pc->period_ns = period_ns;
+	pc->miss_target = miss_target;
+
+	/** nothing measured yet, the first frames start half a period early **/
+	pc->margin_ns = period_ns / 2;
+}
+
+/*
+ * pacing_cost()
+ *
+ * Worst cost of the window, 0 before the first frame.
+*/
+static uint64_t pacing_cost(const struct pacing *pc)
+{
+	uint32_t n = pc->cost_count < PACING_WINDOW ? pc->cost_count : PACING_WINDOW;
+	uint64_t worst = 0;
+
+	for (uint32_t i = 0; i < n; ++i)
+		worst = pc->costs[i] > worst ? pc->costs[i] : worst;
+
+	return worst;
+}
+
+uint64_t pacing_next_start(struct pacing *pc, uint64_t vblank_ns, uint64_t now_ns)
+{
+	uint64_t budget = pacing_cost(pc) + pc->margin_ns;
+
+	/** the first vblank a frame started now could make, frames longer than a period included **/
+	uint64_t ready = now_ns + budget;
+	uint64_t target = vblank_ns + pc->period_ns;
+	if (ready > target)
+		target += (ready - target + pc->period_ns - 1) / pc->period_ns * pc->period_ns;
+
+	pc->target_ns = target;
+	return target - budget;
+}
+
+void pacing_begin(struct pacing *pc, uint64_t now_ns)
+{
+	pc->start_ns = now_ns;
+	pc->submit_ns = 0;
+}
+
+void pacing_submitted(struct pacing *pc, uint64_t now_ns)
+{
+	/** the first frame repaints everything and allocates, it says nothing about the next ones **/
+	if (pc->submits++ == 0)
+		return;
+
+	pc->submit_ns = now_ns;
+	pc->costs[pc->cost_count++ & (PACING_WINDOW - 1)] = now_ns - pc->start_ns;
+}
+
+void pacing_flipped(struct pacing *pc, uint64_t flip_ns)
+{
+	if (pc->submit_ns == 0 || pc->target_ns == 0)
+		return;
+
+	/** flip timestamps jitter around the vblank, half a period late is a vblank late **/
+	bool missed = flip_ns > pc->target_ns + pc->period_ns / 2;
+
+	pc->stats.frames++;
+	pc->stats.missed += missed;
+	pc->stats.latency_sum += flip_ns > pc->start_ns ? flip_ns - pc->start_ns : 0;
+
+	uint64_t headroom = pc->target_ns > pc->submit_ns ? pc->target_ns - pc->submit_ns : 0;
+	pc->stats.headroom_sum += headroom;
+	if (pc->stats.frames == 1 || headroom < pc->stats.headroom_min)
+		pc->stats.headroom_min = headroom;
+
+	pc->miss_rate += ((missed ? 1.0 : 0.0) - pc->miss_rate) / 64;
+
+	/** multiplicative increase on a miss, slow decrease while under the target **/
+	if (missed)
+		pc->margin_ns = pc->margin_ns * 2 + PACING_MIN_MARGIN_NS;
+	else if (pc->miss_rate <= pc->miss_target)
+		pc->margin_ns -= pc->margin_ns / 32;
+
+	if (pc->margin_ns < PACING_MIN_MARGIN_NS)
+		pc->margin_ns = PACING_MIN_MARGIN_NS;
+	if (pc->margin_ns > pc->period_ns)
+		pc->margin_ns = pc->period_ns;
+
+	pc->submit_ns = 0;
+}
+
+void pacing_report(const struct pacing *pc, const char *name)
+{
+	const struct pacing_stats *s = &pc->stats;
+	if (s->frames == 0)
+		return;
+
+	INFO("%s paced %lu frames: budget %.3f ms (cost %.3f + margin %.3f) of %.3f ms",
+			name, s->frames, (pacing_cost(pc) + pc->margin_ns) / 1e6, pacing_cost(pc) / 1e6, pc->margin_ns / 1e6, pc->period_ns / 1e6);
+	INFO("%s headroom avg %.3f ms min %.3f ms, start to flip avg %.3f ms, missed %lu (%.2f%%, target %.2f%%)",
+			name, s->headroom_sum / 1e6 / s->frames, s->headroom_min / 1e6, s->latency_sum / 1e6 / s->frames,
+			s->missed, 100.0 * s->missed / s->frames, 100.0 * pc->miss_target);
+}
+
+#endif // PACING_H
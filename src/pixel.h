@@ -0,0 +1,639 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define PIXEL_X86 1
+#else
+	#define PIXEL_X86 0
+#endif
+
+/*
+ * Fills smaller than this (in bytes) use regular stores and stay in cache,
+ * bigger ones are streamed with non-temporal stores because nobody
+ * is going to read them back before scanout.
+ */
+#ifndef PIXEL_STREAM_THRESHOLD
+	#define PIXEL_STREAM_THRESHOLD (256 * 1024)
+#endif // PIXEL_STREAM_THRESHOLD
+
+typedef enum {
+	PIXEL_IMPL_SCALAR = 0,
+	PIXEL_IMPL_SSE2,
+	PIXEL_IMPL_AVX2,
+	PIXEL_IMPL_AVX512,
+	PIXEL_IMPL_COUNT
+} PIXEL_IMPL;
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: pixel_fill_row32(uint32_t *dst, uint32_t color, size_t count)
+ * -----------------------
+ *  Writes `count` 32-bit pixels of `color` starting at `dst`.
+ */
+void pixel_fill_row32(uint32_t *dst, uint32_t color, size_t count);
+
+/*
+ * Function: pixel_fill_rect32(uint8_t *map, uint32_t pitch, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
+ * -----------------------
+ *  Fills a rectangle of a 32bpp buffer, every row starts at `pitch` bytes
+ *  from the previous one. The caller clips the rectangle.
+ *
+ * map: Start of the buffer (uint8_t *)
+ * pitch: Bytes per row (uint32_t)
+ * x, y, w, h: Rectangle in pixels (uint32_t)
+ * color: XRGB8888 / ARGB8888 value (uint32_t)
+ */
+void pixel_fill_rect32(uint8_t *map, uint32_t pitch, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
+
+/*
+ * Function: pixel_clear(uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+ * -----------------------
+ *  Fills the whole buffer with `color`.
+ */
+void pixel_clear(uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color);
+
+/*
+ * Function: pixel_rgb24_to_xrgb32(uint32_t *dst, const uint8_t *src, size_t count)
+ * -----------------------
+ *  Converts `count` packed R, G, B byte triplets (PPM order)
+ *  to XRGB8888 pixels with alpha set to 0xFF.
+ */
+void pixel_rgb24_to_xrgb32(uint32_t *dst, const uint8_t *src, size_t count);
+
+/*
+ * Function: pixel_mask_row32(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+ * -----------------------
+ *  Writes `color` to dst[i] for every bit i set in `bits` (LSB first),
+ *  pixels whose bit is clear are not touched, not even read.
+ */
+void pixel_mask_row32(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color);
+
+/*
+ * Function: pixel_blend_row32(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity)
+ * -----------------------
+ *  Composites premultiplied ARGB8888 `src` over `dst`, with `src` first
+ *  scaled by `opacity` (255 = as is): dst = src + dst * (255 - src.a) / 255.
+ *  Every kernel rounds the same way, the results are bit identical.
+ */
+void pixel_blend_row32(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity);
+
+/*
+ * Function: pixel_impl_supported(PIXEL_IMPL impl)
+ * -----------------------
+ *  returns: True if this cpu can run `impl` (bool)
+ */
+bool pixel_impl_supported(PIXEL_IMPL impl);
+
+/*
+ * Function: pixel_use_impl(PIXEL_IMPL impl)
+ * -----------------------
+ *  Forces a kernel, used by the benchmark.
+ *  The best supported kernel is picked at startup.
+ *
+ * returns: False if `impl` is not supported, nothing is changed then (bool)
+ */
+bool pixel_use_impl(PIXEL_IMPL impl);
+
+/*
+ * Function: pixel_current_impl()
+ * -----------------------
+ *  returns: Kernel in use (PIXEL_IMPL)
+ */
+PIXEL_IMPL pixel_current_impl(void);
+
+/*
+ * Function: pixel_impl_name(PIXEL_IMPL impl)
+ * -----------------------
+ *  returns: Printable name of `impl` (const char *)
+ */
+const char *pixel_impl_name(PIXEL_IMPL impl);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+typedef void (*pixel_row_fn)(uint32_t *dst, uint32_t color, size_t count, bool stream);
+typedef void (*pixel_convert_fn)(uint32_t *dst, const uint8_t *src, size_t count);
+typedef void (*pixel_mask_fn)(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color);
+typedef void (*pixel_blend_fn)(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity);
+
+static void pixel_row_scalar(uint32_t *dst, uint32_t color, size_t count, bool stream)
+{
+	(void)stream;
+
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = color;
+}
+
+static void pixel_rgb24_scalar(uint32_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; ++i, src += 3)
+		dst[i] = 0xFF000000u | (uint32_t)src[0] << 16 | (uint32_t)src[1] << 8 | src[2];
+}
+
+static void pixel_mask_scalar(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+{
+	for (size_t i = 0; i < count; i += 8)
+	{
+		uint8_t b = bits[i / 8];
+		if (count - i < 8)
+			b &= (1u << (count - i)) - 1;
+
+		for (; b; b &= b - 1)
+			dst[i + __builtin_ctz(b)] = color;
+	}
+}
+
+/** x / 255 rounded to nearest, exact for x <= 255 * 255 **/
+static inline uint32_t pixel_div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/** one channel of src over dst, saturated like the vector kernels: a source that is not premultiplied can exceed 255 **/
+static inline uint32_t pixel_over8(uint32_t s, uint32_t d, uint32_t inv)
+{
+	uint32_t x = s + pixel_div255(d * inv);
+	return x > 255 ? 255 : x;
+}
+
+static void pixel_blend_scalar(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t s = src[i];
+
+		if (opacity != 255)
+			s = pixel_div255((s >> 24) * opacity) << 24 | pixel_div255(((s >> 16) & 0xFF) * opacity) << 16
+					| pixel_div255(((s >> 8) & 0xFF) * opacity) << 8 | pixel_div255((s & 0xFF) * opacity);
+
+		uint32_t inv = 255 - (s >> 24);
+		if (inv == 0)
+		{
+			dst[i] = s;
+			continue;
+		}
+
+		if (s == 0)
+			continue;
+
+		uint32_t d = dst[i];
+		dst[i] = pixel_over8(s >> 24, d >> 24, inv) << 24 | pixel_over8((s >> 16) & 0xFF, (d >> 16) & 0xFF, inv) << 16
+				| pixel_over8((s >> 8) & 0xFF, (d >> 8) & 0xFF, inv) << 8 | pixel_over8(s & 0xFF, d & 0xFF, inv);
+	}
+}
+
+#if PIXEL_X86
+
+/*
+ * All the vector kernels work the same way:
+ * scalar head until `dst` is aligned to the vector width,
+ * (streaming) aligned stores for the body, scalar tail.
+ */
+
+__attribute__((target("sse2")))
+static void pixel_row_sse2(uint32_t *dst, uint32_t color, size_t count, bool stream)
+{
+	while (count && ((uintptr_t)dst & 15))
+		*dst++ = color, count--;
+
+	__m128i v = _mm_set1_epi32((int)color);
+	size_t body = count & ~(size_t)3;
+
+	if (stream)
+		for (size_t i = 0; i < body; i += 4)
+			_mm_stream_si128((__m128i*)(dst + i), v);
+	else
+		for (size_t i = 0; i < body; i += 4)
+			_mm_store_si128((__m128i*)(dst + i), v);
+
+	for (size_t i = body; i < count; ++i)
+		dst[i] = color;
+}
+
+__attribute__((target("avx2")))
+static void pixel_row_avx2(uint32_t *dst, uint32_t color, size_t count, bool stream)
+{
+	while (count && ((uintptr_t)dst & 31))
+		*dst++ = color, count--;
+
+	__m256i v = _mm256_set1_epi32((int)color);
+	size_t body = count & ~(size_t)7;
+
+	if (stream)
+		for (size_t i = 0; i < body; i += 8)
+			_mm256_stream_si256((__m256i*)(dst + i), v);
+	else
+		for (size_t i = 0; i < body; i += 8)
+			_mm256_store_si256((__m256i*)(dst + i), v);
+
+	for (size_t i = body; i < count; ++i)
+		dst[i] = color;
+}
+
+__attribute__((target("avx512f")))
+static void pixel_row_avx512(uint32_t *dst, uint32_t color, size_t count, bool stream)
+{
+	while (count && ((uintptr_t)dst & 63))
+		*dst++ = color, count--;
+
+	__m512i v = _mm512_set1_epi32((int)color);
+	size_t body = count & ~(size_t)15;
+
+	if (stream)
+		for (size_t i = 0; i < body; i += 16)
+			_mm512_stream_si512((void*)(dst + i), v);
+	else
+		for (size_t i = 0; i < body; i += 16)
+			_mm512_store_si512((void*)(dst + i), v);
+
+	/** masked store finishes the row without a scalar loop **/
+	if (body < count)
+		_mm512_mask_storeu_epi32(dst + body, (__mmask16)((1u << (count - body)) - 1), v);
+}
+
+/*
+ * RGB24 -> XRGB8888: one pshufb turns 12 source bytes into 4 pixels,
+ * swapping R and B and leaving a zero byte which the alpha OR fills.
+ * Loads are 16 bytes wide, so the last pixels, whose load would run
+ * past the source, are left to the scalar loop.
+ */
+#define PIXEL_RGB24_SHUFFLE 2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128
+
+__attribute__((target("ssse3")))
+static void pixel_rgb24_ssse3(uint32_t *dst, const uint8_t *src, size_t count)
+{
+	const __m128i shuffle = _mm_setr_epi8(PIXEL_RGB24_SHUFFLE);
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	size_t i = 0;
+
+	for (; i + 6 <= count; i += 4)
+	{
+		__m128i rgb = _mm_loadu_si128((const __m128i*)(src + i * 3));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+	}
+
+	pixel_rgb24_scalar(dst + i, src + i * 3, count - i);
+}
+
+__attribute__((target("avx2")))
+static void pixel_rgb24_avx2(uint32_t *dst, const uint8_t *src, size_t count)
+{
+	/** vpshufb stays inside 128-bit lanes, so each lane gets its own 12 bytes **/
+	const __m256i shuffle = _mm256_setr_epi8(PIXEL_RGB24_SHUFFLE, PIXEL_RGB24_SHUFFLE);
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	size_t i = 0;
+
+	for (; i + 10 <= count; i += 8)
+	{
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + i * 3));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + i * 3 + 12));
+		__m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), alpha));
+	}
+
+	pixel_rgb24_ssse3(dst + i, src + i * 3, count - i);
+}
+
+/*
+ * Masked rows: empty bytes (the gaps between glyph strokes)
+ * cost one compare, full ones a plain store.
+ */
+__attribute__((target("sse2")))
+static void pixel_mask_sse2(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+{
+	__m128i v = _mm_set1_epi32((int)color);
+	size_t body = count & ~(size_t)7;
+
+	for (size_t i = 0; i < body; i += 8)
+	{
+		uint8_t b = bits[i / 8];
+		if (b == 0xFF)
+		{
+			_mm_storeu_si128((__m128i*)(dst + i), v);
+			_mm_storeu_si128((__m128i*)(dst + i + 4), v);
+		}
+		else
+			for (; b; b &= b - 1)
+				dst[i + __builtin_ctz(b)] = color;
+	}
+
+	pixel_mask_scalar(dst + body, bits + body / 8, count - body, color);
+}
+
+__attribute__((target("avx2")))
+static void pixel_mask_avx2(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+{
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i v = _mm256_set1_epi32((int)color);
+	size_t body = count & ~(size_t)7;
+
+	for (size_t i = 0; i < body; i += 8)
+	{
+		uint8_t b = bits[i / 8];
+		if (b == 0)
+			continue;
+
+		if (b == 0xFF)
+			_mm256_storeu_si256((__m256i*)(dst + i), v);
+		else
+		{
+			/** spread the 8 bits over the 8 lanes: lane j is all ones if bit j is set **/
+			__m256i m = _mm256_and_si256(_mm256_set1_epi32(b), lanes);
+			_mm256_maskstore_epi32((int*)(dst + i), _mm256_cmpeq_epi32(m, lanes), v);
+		}
+	}
+
+	pixel_mask_scalar(dst + body, bits + body / 8, count - body, color);
+}
+
+__attribute__((target("avx512f")))
+static void pixel_mask_avx512(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+{
+	__m512i v = _mm512_set1_epi32((int)color);
+
+	/** 16 bits are a write mask as they are **/
+	for (size_t i = 0; i < count; i += 16)
+	{
+		uint32_t k = bits[i / 8];
+		if (count - i > 8)
+			k |= (uint32_t)bits[i / 8 + 1] << 8;
+		if (count - i < 16)
+			k &= (1u << (count - i)) - 1;
+
+		if (k)
+			_mm512_mask_storeu_epi32(dst + i, (__mmask16)k, v);
+	}
+}
+
+/*
+ * Blending works on 16 bit lanes, two pixels per 128 bits, with the
+ * same rounded division by 255 as the scalar kernel.
+ */
+__attribute__((target("sse2")))
+static inline __m128i pixel_div255_sse2(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i pixel_over_sse2(__m128i s, __m128i d, __m128i opacity)
+{
+	const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(255);
+
+	__m128i s_lo = _mm_unpacklo_epi8(s, zero), s_hi = _mm_unpackhi_epi8(s, zero);
+	s_lo = pixel_div255_sse2(_mm_mullo_epi16(s_lo, opacity));
+	s_hi = pixel_div255_sse2(_mm_mullo_epi16(s_hi, opacity));
+
+	/** alpha of each pixel in all four of its lanes **/
+	__m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, 0xFF), 0xFF);
+	__m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, 0xFF), 0xFF);
+
+	__m128i d_lo = _mm_unpacklo_epi8(d, zero), d_hi = _mm_unpackhi_epi8(d, zero);
+	d_lo = pixel_div255_sse2(_mm_mullo_epi16(d_lo, _mm_sub_epi16(full, a_lo)));
+	d_hi = pixel_div255_sse2(_mm_mullo_epi16(d_hi, _mm_sub_epi16(full, a_hi)));
+
+	return _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi));
+}
+
+__attribute__((target("sse2")))
+static void pixel_blend_sse2(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity)
+{
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	__m128i op = _mm_set1_epi16(opacity);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+
+		/** runs of transparent and opaque pixels are the common case in a layer **/
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) == 0xFFFF)
+			continue;
+
+		if (opacity == 255 && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, alpha), alpha)) == 0xFFFF)
+		{
+			_mm_storeu_si128((__m128i*)(dst + i), s);
+			continue;
+		}
+
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), pixel_over_sse2(s, d, op));
+	}
+
+	pixel_blend_scalar(dst + i, src + i, count - i, opacity);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pixel_div255_avx2(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void pixel_blend_avx2(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity)
+{
+	const __m256i zero = _mm256_setzero_si256(), full = _mm256_set1_epi16(255);
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i alpha_lanes = _mm256_setr_epi8(
+			6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+			6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+	__m256i op = _mm256_set1_epi16(opacity);
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+
+		if (_mm256_testz_si256(s, s))
+			continue;
+
+		if (opacity == 255 && _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), alpha)) == -1)
+		{
+			_mm256_storeu_si256((__m256i*)(dst + i), s);
+			continue;
+		}
+
+		/** unpack and pack both stay inside 128 bit lanes, so the pixel order survives **/
+		__m256i s_lo = pixel_div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), op));
+		__m256i s_hi = pixel_div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), op));
+
+		__m256i inv_lo = _mm256_sub_epi16(full, _mm256_shuffle_epi8(s_lo, alpha_lanes));
+		__m256i inv_hi = _mm256_sub_epi16(full, _mm256_shuffle_epi8(s_hi, alpha_lanes));
+
+		__m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+		__m256i d_lo = pixel_div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), inv_lo));
+		__m256i d_hi = pixel_div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), inv_hi));
+
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_packus_epi16(_mm256_add_epi16(s_lo, d_lo), _mm256_add_epi16(s_hi, d_hi)));
+	}
+
+	pixel_blend_sse2(dst + i, src + i, count - i, opacity);
+}
+
+#endif // PIXEL_X86
+
+static PIXEL_IMPL pixel_impl = PIXEL_IMPL_SCALAR;
+static pixel_row_fn pixel_row = pixel_row_scalar;
+static pixel_convert_fn pixel_rgb24 = pixel_rgb24_scalar;
+static pixel_mask_fn pixel_mask = pixel_mask_scalar;
+static pixel_blend_fn pixel_blend = pixel_blend_scalar;
+
+static const pixel_mask_fn pixel_mask_table[PIXEL_IMPL_COUNT] = {
+	[PIXEL_IMPL_SCALAR] = pixel_mask_scalar,
+#if PIXEL_X86
+	[PIXEL_IMPL_SSE2] = pixel_mask_sse2,
+	[PIXEL_IMPL_AVX2] = pixel_mask_avx2,
+	[PIXEL_IMPL_AVX512] = pixel_mask_avx512,
+#endif
+};
+
+static const pixel_row_fn pixel_row_table[PIXEL_IMPL_COUNT] = {
+	[PIXEL_IMPL_SCALAR] = pixel_row_scalar,
+#if PIXEL_X86
+	[PIXEL_IMPL_SSE2] = pixel_row_sse2,
+	[PIXEL_IMPL_AVX2] = pixel_row_avx2,
+	[PIXEL_IMPL_AVX512] = pixel_row_avx512,
+#endif
+};
+
+static inline void pixel_fence(bool stream)
+{
+#if PIXEL_X86
+	/** streaming stores are weakly ordered, make them visible before scanout / flip **/
+	if (stream && pixel_impl != PIXEL_IMPL_SCALAR)
+		_mm_sfence();
+#endif
+}
+
+bool pixel_impl_supported(PIXEL_IMPL impl)
+{
+	switch (impl)
+	{
+		case PIXEL_IMPL_SCALAR: return true;
+#if PIXEL_X86
+		case PIXEL_IMPL_SSE2: return __builtin_cpu_supports("sse2");
+		case PIXEL_IMPL_AVX2: return __builtin_cpu_supports("avx2");
+		case PIXEL_IMPL_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+		default: return false;
+	}
+}
+
+bool pixel_use_impl(PIXEL_IMPL impl)
+{
+	if (impl >= PIXEL_IMPL_COUNT || !pixel_impl_supported(impl))
+		return false;
+
+	pixel_impl = impl;
+	pixel_row = pixel_row_table[impl];
+	pixel_mask = pixel_mask_table[impl];
+	pixel_rgb24 = pixel_rgb24_scalar;
+	pixel_blend = pixel_blend_scalar;
+
+#if PIXEL_X86
+	/** blending is bound by the multiplies in 16 bit lanes, avx512 would need avx512bw **/
+	if (impl >= PIXEL_IMPL_AVX2)
+		pixel_blend = pixel_blend_avx2;
+	else if (impl == PIXEL_IMPL_SSE2)
+		pixel_blend = pixel_blend_sse2;
+
+	/** there is no wider shuffle without avx512vbmi, the avx512 tier keeps the avx2 one **/
+	if (impl >= PIXEL_IMPL_AVX2)
+		pixel_rgb24 = pixel_rgb24_avx2;
+	else if (impl == PIXEL_IMPL_SSE2 && __builtin_cpu_supports("ssse3"))
+		pixel_rgb24 = pixel_rgb24_ssse3;
+#endif
+
+	return true;
+}
+
+PIXEL_IMPL pixel_current_impl(void)
+{
+	return pixel_impl;
+}
+
+const char *pixel_impl_name(PIXEL_IMPL impl)
+{
+	switch (impl)
+	{
+		case PIXEL_IMPL_SCALAR: return "scalar";
+		case PIXEL_IMPL_SSE2: return "sse2";
+		case PIXEL_IMPL_AVX2: return "avx2";
+		case PIXEL_IMPL_AVX512: return "avx512";
+		default: return "unknown";
+	}
+}
+
+/*
+ * pixel_init()
+ *
+ * Runs before main and picks the widest kernel cpuid reports.
+*/
+void pixel_init() __attribute__((constructor));
+void pixel_init()
+{
+#if PIXEL_X86
+	__builtin_cpu_init();
+#endif
+
+	for (int impl = PIXEL_IMPL_COUNT - 1; impl >= 0; --impl)
+		if (pixel_use_impl((PIXEL_IMPL)impl))
+			break;
+}
+
+void pixel_fill_row32(uint32_t *dst, uint32_t color, size_t count)
+{
+	bool stream = count * 4 >= PIXEL_STREAM_THRESHOLD;
+
+	pixel_row(dst, color, count, stream);
+	pixel_fence(stream);
+}
+
+void pixel_fill_rect32(uint8_t *map, uint32_t pitch, uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
+{
+	bool stream = (size_t)w * h * 4 >= PIXEL_STREAM_THRESHOLD;
+	uint8_t *row = map + (size_t)y * pitch + (size_t)x * 4;
+
+	for (uint32_t i = 0; i < h; ++i, row += pitch)
+		pixel_row((uint32_t*)row, color, w, stream);
+
+	pixel_fence(stream);
+}
+
+void pixel_rgb24_to_xrgb32(uint32_t *dst, const uint8_t *src, size_t count)
+{
+	pixel_rgb24(dst, src, count);
+}
+
+void pixel_mask_row32(uint32_t *dst, const uint8_t *bits, size_t count, uint32_t color)
+{
+	pixel_mask(dst, bits, count, color);
+}
+
+void pixel_blend_row32(uint32_t *dst, const uint32_t *src, size_t count, uint8_t opacity)
+{
+	pixel_blend(dst, src, count, opacity);
+}
+
+void pixel_clear(uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+	/** without padding the buffer is one long row **/
+	if (pitch == width * 4)
+		pixel_fill_row32((uint32_t*)map, color, (size_t)width * height);
+	else
+		pixel_fill_rect32(map, pitch, 0, 0, width, height, color);
+}
+
+#endif // PIXEL_H
@@ -0,0 +1,503 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <libdrm/drm.h>
+#include <libdrm/drm_mode.h>
+#include <libdrm/drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "log.h"
+#include "atomic.h"
+#include "damage.h"
+#include "timing.h"
+#include "backend.h"
+#include "bufpool.h"
+#include "format.h"
+#include "pacing.h"
+
+/** 2 = double buffering, 3 = triple buffering **/
+#ifndef PRESENT_MAX_BUFFERS
+	#define PRESENT_MAX_BUFFERS 3
+#endif // PRESENT_MAX_BUFFERS
+
+/** refresh rate used by the memory backend when the mode has none **/
+#ifndef PRESENT_HEADLESS_REFRESH
+	#define PRESENT_HEADLESS_REFRESH 60
+#endif // PRESENT_HEADLESS_REFRESH
+
+struct present
+{
+	struct backend *backend;
+	int fd;						/* dri device, -1 on the memory backend */
+	int wait_fd;			/* readable when present_wait() has something to dispatch */
+
+	uint32_t crtc_id;
+	uint32_t connector_id;
+	uint32_t pipe;			/* index of the crtc in the device's list, for drmWaitVBlank */
+	drmModeModeInfo mode;
+
+	/** drm only: atomic commits when the driver has them, legacy SetCrtc / PageFlip otherwise **/
+	bool use_atomic;
+	struct atomic_state atomic;
+
+	/** buffers come from and go back to a pool, so a new chain of the same size costs no syscall **/
+	struct bufpool *pool;
+	struct present_buffer *buffers[PRESENT_MAX_BUFFERS];
+	int count;
+
+	/*
+	 * Scanout format of the chain. Anything but XRGB8888 / ARGB8888 is drawn
+	 * into `shadow`, one XRGB8888 buffer for the whole chain, and the
+	 * submitted damage is converted into the back buffer.
+	 */
+	uint32_t format;
+	struct present_buffer shadow;
+
+	/*
+	 * front: buffer being scanned out.
+	 * pending: buffer queued for the next vblank.
+	 * back: buffer handed out for rendering.
+	 * -1 means no buffer is in that state.
+	 */
+	int front;
+	int pending;
+	int back;
+
+	bool mode_set;
+	uint64_t frames;	/* number of completed flips */
+	uint64_t flip_us;	/* CLOCK_MONOTONIC time of the last completed flip */
+	uint64_t submits;	/* number of queued buffers */
+
+	/** what changed between consecutive frames, indexed by submit number, to repaint older buffers **/
+	struct damage history[PRESENT_MAX_BUFFERS];
+	struct damage frame_damage;
+	bool have_frame_damage;
+	struct damage_stats damage_stats;
+
+	/** render / submit / flip latency of every frame of this chain **/
+	struct timing timing;
+
+	/** memory only: simulated vblank clock and frame dump **/
+	uint64_t refresh_ns;
+	uint64_t next_vblank_ns;
+	int dump_fd;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: present_init(struct present *p, struct bufpool *pool, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode, int count, uint32_t format)
+ * -----------------------
+ *  Takes a chain of `count` mapped buffers sized for `mode` from `pool`
+ *  and presents them through the pool's backend. On a dri device that is
+ *  atomic commits if DRM_CLIENT_CAP_ATOMIC is available and
+ *  drmModeSetCrtc / drmModePageFlip otherwise, in memory flips
+ *  complete on a simulated vblank of mode->vrefresh Hz.
+ *
+ * p: Presentation engine to initialise (struct present *)
+ * pool: Pool of the backend to present on (struct bufpool *)
+ * crtc_id: CRTC which will scan out the chain, head number in memory (uint32_t)
+ * connector_id: Connector driven by the CRTC (uint32_t)
+ * mode: Mode to set on the first present (const drmModeModeInfo *)
+ * count: Number of buffers, 2 or 3 (int)
+ * format: DRM_FORMAT_* of the buffers, see format.h. The device may refuse
+ *         it, the chain is XRGB8888 then. Drawing is XRGB8888 either way (uint32_t)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int present_init(struct present *p, struct bufpool *pool, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode, int count, uint32_t format);
+
+/*
+ * Function: present_acquire(struct present *p)
+ * -----------------------
+ *  Returns a buffer that is neither scanned out nor queued,
+ *  if every buffer is busy it sleeps until the pending flip completes.
+ *  Chains in another format than XRGB8888 return the shadow buffer,
+ *  which always holds the previous frame.
+ *
+ * returns: Back buffer (struct present_buffer *), NULL on failure.
+ */
+struct present_buffer *present_acquire(struct present *p);
+
+/*
+ * Function: present_try_acquire(struct present *p)
+ * -----------------------
+ *  Same as present_acquire() but never sleeps.
+ *
+ * returns: Back buffer (struct present_buffer *), NULL if every buffer is busy.
+ */
+struct present_buffer *present_try_acquire(struct present *p);
+
+/*
+ * Function: present_submit(struct present *p)
+ * -----------------------
+ *  Queues the acquired back buffer for the next vblank.
+ *  The first submit sets the mode, later ones page-flip.
+ *  The whole buffer is considered damaged.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int present_submit(struct present *p);
+
+/*
+ * Function: present_submit_damage(struct present *p, const struct damage *d)
+ * -----------------------
+ *  Same as present_submit() but only the rectangles of `d` are handed
+ *  to the device (and converted from the shadow buffer), with FB_DAMAGE_CLIPS on the atomic path.
+ *  A legacy page flip always takes the whole plane. NULL means the whole buffer.
+ *
+ * d: Pixels written into the back buffer, usually the result
+ *    of present_repaint_region() (const struct damage *)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int present_submit_damage(struct present *p, const struct damage *d);
+
+/*
+ * Function: present_repaint_region(struct present *p, const struct damage *frame, struct damage *out)
+ * -----------------------
+ *  The back buffer still holds an older frame, so on top of what changed
+ *  since the previous frame (`frame`) it misses whatever changed since it was
+ *  last on screen. Writes the region to redraw into `out`, the whole buffer
+ *  if it was never used or is older than the history.
+ */
+void present_repaint_region(struct present *p, const struct damage *frame, struct damage *out);
+
+/*
+ * Function: present_wait(struct present *p, int timeout_ms)
+ * -----------------------
+ *  Sleeps until a vblank or flip event arrives (or `timeout_ms` runs out)
+ *  and dispatches it, -1 waits forever.
+ *
+ * returns: 1 if an event was handled, 0 on timeout, negative errno on failure (int)
+ */
+int present_wait(struct present *p, int timeout_ms);
+
+/*
+ * Function: present_last_vblank(struct present *p, uint64_t *vblank_ns)
+ * -----------------------
+ *  Asks for the time of the latest vblank of the crtc, drmWaitVBlank on a
+ *  dri device, the simulated clock in memory. Never sleeps.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int present_last_vblank(struct present *p, uint64_t *vblank_ns);
+
+/*
+ * Function: present_destroy(struct present *p)
+ * -----------------------
+ *  Waits for the queued flip and gives every buffer of the chain back to the pool.
+ */
+void present_destroy(struct present *p);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static uint64_t present_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void present_retire(struct present *p, uint64_t flip_us)
+{
+	if (p->pending < 0)
+		return;
+
+	timing_flip(&p->timing, flip_us * 1000ull);
+
+	/** the previous chain's front is off the screen now **/
+	if (p->frames == 0)
+		bufpool_unpin(p->pool, p->crtc_id);
+
+	p->flip_us = flip_us;
+	p->front = p->pending;
+	p->pending = -1;
+	p->frames++;
+}
+
+static void present_reset(struct present *p, int count)
+{
+	memset(p, 0, sizeof(*p));
+	p->fd = -1;
+	p->wait_fd = -1;
+	p->dump_fd = -1;
+	p->front = -1;
+	p->pending = -1;
+	p->back = -1;
+	p->count = count < 2 ? 2 : (count > PRESENT_MAX_BUFFERS ? PRESENT_MAX_BUFFERS : count);
+}
+
+static int present_take_buffers(struct present *p, struct bufpool *pool, uint32_t width, uint32_t height)
+{
+	const struct format_info *f = format_lookup(p->format);
+	if (f == NULL)
+		return -EINVAL;
+
+	p->pool = pool;
+
+	for (int i = 0; i < p->count; ++i)
+	{
+		p->buffers[i] = bufpool_get(pool, width, height, f->bpp, p->format);
+		if (p->buffers[i] == NULL)
+		{
+			int ret = -errno;
+			while (i--)
+				bufpool_put(pool, p->buffers[i]);
+			p->count = 0;
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * present_native()
+ *
+ * True if the chain is drawn into directly.
+*/
+static bool present_native(uint32_t format)
+{
+	return format == DRM_FORMAT_XRGB8888 || format == DRM_FORMAT_ARGB8888;
+}
+
+static int present_create_shadow(struct present *p, uint32_t width, uint32_t height)
+{
+	struct present_buffer *s = &p->shadow;
+
+	s->width = width;
+	s->height = height;
+	s->bpp = 32;
+	s->format = DRM_FORMAT_XRGB8888;
+	s->pitch = (width * 4 + 63) & ~63u;
+	s->size = (uint64_t)s->pitch * height;
+	s->map = aligned_alloc(64, s->size);
+	if (s->map == NULL)
+		return -ENOMEM;
+
+	/** the first frame is a full repaint, but the converted padding should not be garbage **/
+	memset(s->map, 0, s->size);
+	return 0;
+}
+
+int present_init(struct present *p, struct bufpool *pool, uint32_t crtc_id, uint32_t connector_id, const drmModeModeInfo *mode, int count, uint32_t format)
+{
+	present_reset(p, count);
+	p->format = format;
+	p->backend = pool->backend;
+	p->fd = pool->backend->fd;
+	p->crtc_id = crtc_id;
+	p->connector_id = connector_id;
+	p->mode = *mode;
+
+	timing_init(&p->timing, pacing_period(mode, PRESENT_HEADLESS_REFRESH));
+
+	int ret = present_take_buffers(p, pool, mode->hdisplay, mode->vdisplay);
+	if (ret < 0 && !present_native(format))
+	{
+		WARN("crtc %u: no %s buffers (%s), using xrgb8888", crtc_id, format_lookup(format) ? format_lookup(format)->name : "unknown", strerror(-ret));
+		p->format = DRM_FORMAT_XRGB8888;
+		p->count = count < 2 ? 2 : (count > PRESENT_MAX_BUFFERS ? PRESENT_MAX_BUFFERS : count);
+		ret = present_take_buffers(p, pool, mode->hdisplay, mode->vdisplay);
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (!present_native(p->format))
+		ret = present_create_shadow(p, mode->hdisplay, mode->vdisplay);
+
+	if (ret == 0)
+		ret = p->backend->ops->attach(p);
+
+	if (ret < 0)
+	{
+		for (int i = 0; i < p->count; ++i)
+			bufpool_put(pool, p->buffers[i]);
+		free(p->shadow.map);
+		p->shadow.map = NULL;
+		p->count = 0;
+		return ret;
+	}
+
+	INFO("Using %d %s buffers of %ux%u for crtc %u (%s)", p->count, format_lookup(p->format)->name,
+			mode->hdisplay, mode->vdisplay, crtc_id, p->backend->ops->name);
+
+	return 0;
+}
+
+struct present_buffer *present_try_acquire(struct present *p)
+{
+	for (int i = 0; i < p->count; ++i)
+	{
+		if (i != p->front && i != p->pending)
+		{
+			p->back = i;
+			return p->shadow.map ? &p->shadow : p->buffers[i];
+		}
+	}
+
+	return NULL;
+}
+
+struct present_buffer *present_acquire(struct present *p)
+{
+	for (;;)
+	{
+		struct present_buffer *b = present_try_acquire(p);
+		if (b)
+			return b;
+
+		/** every buffer is on screen or queued, sleep until the flip lands **/
+		if (present_wait(p, -1) < 0)
+			return NULL;
+	}
+}
+
+void present_repaint_region(struct present *p, const struct damage *frame, struct damage *out)
+{
+	damage_init(out, p->mode.hdisplay, p->mode.vdisplay);
+
+	p->frame_damage = *frame;
+	p->have_frame_damage = true;
+
+	if (p->back < 0)
+	{
+		damage_full(out);
+		return;
+	}
+
+	uint64_t seq = p->buffers[p->back]->seq;
+	uint64_t age = seq ? p->submits - seq + 1 : 0;
+
+	if (age == 0 || age > PRESENT_MAX_BUFFERS)
+	{
+		damage_full(out);
+		return;
+	}
+
+	damage_union(out, frame);
+
+	/** age 1 is the previous frame, nothing but `frame` is missing then **/
+	for (uint64_t s = seq + 1; s <= p->submits; ++s)
+		damage_union(out, &p->history[s % PRESENT_MAX_BUFFERS]);
+}
+
+static void present_record_damage(struct present *p, struct present_buffer *b, const struct damage *d)
+{
+	struct damage submitted;
+	struct damage *slot;
+
+	p->submits++;
+	b->seq = p->submits;
+
+	damage_init(&submitted, p->mode.hdisplay, p->mode.vdisplay);
+	if (d)
+		damage_union(&submitted, d);
+	else
+		damage_full(&submitted);
+
+	/** the chroma plane is uploaded too: the buffer's rows over its height scale the first plane's bpp **/
+	const struct format_info *f = format_lookup(b->format);
+	damage_account(&p->damage_stats, &submitted, f && b->height ? b->bpp * format_rows(f, b->height) / b->height : b->bpp);
+
+	/*
+	 * History has to hold the change between frames, not what was uploaded,
+	 * otherwise every repaint would include the previous one and grow forever.
+	 */
+	slot = &p->history[p->submits % PRESENT_MAX_BUFFERS];
+	*slot = p->have_frame_damage ? p->frame_damage : submitted;
+	p->have_frame_damage = false;
+}
+
+int present_submit(struct present *p)
+{
+	return present_submit_damage(p, NULL);
+}
+
+int present_submit_damage(struct present *p, const struct damage *d)
+{
+	if (p->back < 0)
+		return -EINVAL;
+
+	/** only one flip may be queued on a crtc at a time **/
+	while (p->pending >= 0)
+	{
+		int ret = present_wait(p, -1);
+		if (ret < 0)
+			return ret;
+	}
+
+	struct present_buffer *b = p->buffers[p->back];
+
+	/** the shadow has the whole frame, only what the back buffer misses is converted **/
+	if (p->shadow.map)
+	{
+		const struct present_buffer *s = &p->shadow;
+
+		if (d == NULL)
+			format_convert(b->format, b->map, b->pitch, b->width, b->height, s->map, s->pitch, 0, 0, b->width, b->height);
+		else
+			for (int i = 0; i < d->count; ++i)
+				format_convert(b->format, b->map, b->pitch, b->width, b->height, s->map, s->pitch,
+						d->rects[i].x1, d->rects[i].y1, d->rects[i].x2 - d->rects[i].x1, d->rects[i].y2 - d->rects[i].y1);
+	}
+
+	int ret = p->backend->ops->submit(p, b, d);
+	if (ret == 0)
+		timing_submit(&p->timing);
+
+	return ret;
+}
+
+int present_wait(struct present *p, int timeout_ms)
+{
+	return p->backend->ops->wait(p, timeout_ms);
+}
+
+int present_last_vblank(struct present *p, uint64_t *vblank_ns)
+{
+	if (p->backend->ops->vblank == NULL)
+		return -ENOTSUP;
+
+	return p->backend->ops->vblank(p, vblank_ns);
+}
+
+void present_destroy(struct present *p)
+{
+	while (p->pending >= 0)
+		if (present_wait(p, -1) < 0)
+			break;
+
+	/*
+	 * Front goes back first, so the next chain reuses it last, and pinned,
+	 * so trimming keeps it mapped while it is on screen: until the next
+	 * chain on this crtc completes its first flip.
+	 */
+	if (p->front >= 0)
+		bufpool_put_pinned(p->pool, p->buffers[p->front], p->crtc_id);
+
+	for (int i = 0; i < p->count; ++i)
+		if (i != p->front)
+			bufpool_put(p->pool, p->buffers[i]);
+
+	if (p->count)
+		p->backend->ops->detach(p);
+
+	free(p->shadow.map);
+	p->shadow.map = NULL;
+	p->count = 0;
+}
+
+#endif // PRESENT_H
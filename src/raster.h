@@ -0,0 +1,714 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "pixel.h"
+#include "damage.h"
+
+/*
+ * 64x64 pixels at 32bpp is 16KiB, so a tile and its bin fit in L1/L2.
+ * TILE_SIZE must stay a multiple of 16 so that no two tiles share
+ * a cache line of the framebuffer.
+ */
+#ifndef RASTER_TILE_SIZE
+	#define RASTER_TILE_SIZE 64
+#endif // RASTER_TILE_SIZE
+
+#ifndef RASTER_MAX_THREADS
+	#define RASTER_MAX_THREADS 64
+#endif // RASTER_MAX_THREADS
+
+typedef enum {
+	RASTER_RECT = 0,
+	RASTER_TRIANGLE,
+	RASTER_LINE,
+	RASTER_BLIT,
+	RASTER_MASK
+} RASTER_PRIM;
+
+struct raster_target
+{
+	uint8_t *map;
+	uint32_t pitch;
+	uint32_t width;
+	uint32_t height;
+};
+
+struct raster_prim
+{
+	RASTER_PRIM type;
+	uint32_t color;
+	int32_t v[6];			/* rect, blit, mask: x, y, w, h | triangle: x0, y0, x1, y1, x2, y2 | line: x0, y0, x1, y1 */
+	int32_t bbox[4];	/* clipped to the target: x0, y0, x1, y1 (exclusive) */
+
+	/** blit: XRGB8888 pixels, mask: 1 bit per pixel, LSB is the leftmost **/
+	const uint8_t *src;
+	uint32_t src_pitch;	/* bytes per row */
+};
+
+struct raster_bin
+{
+	uint32_t *prims;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+struct raster
+{
+	struct raster_target target;
+
+	const struct damage *clip;	/* draw only inside these rectangles, NULL = everywhere */
+	struct damage *track;				/* every queued primitive is added here, NULL = off */
+
+	struct raster_prim *prims;
+	uint32_t prim_count;
+	uint32_t prim_capacity;
+
+	struct raster_bin *bins;
+	uint32_t tiles_x;
+	uint32_t tiles_y;
+	uint32_t bin_capacity;	/* number of allocated bins */
+
+	pthread_t threads[RASTER_MAX_THREADS];
+	int thread_count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t generation;
+	int active;
+	bool quit;
+
+	atomic_uint next_tile;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: raster_init(struct raster *r, int threads)
+ * -----------------------
+ *  Starts the worker pool.
+ *
+ * r: Rasterizer (struct raster *)
+ * threads: Number of workers, 0 starts one per online core (int)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int raster_init(struct raster *r, int threads);
+
+/*
+ * Function: raster_begin(struct raster *r, struct raster_target target)
+ * -----------------------
+ *  Starts a new frame into `target`, queued primitives are dropped.
+ */
+void raster_begin(struct raster *r, struct raster_target target);
+
+/*
+ * Function: raster_clip(struct raster *r, const struct damage *region)
+ * -----------------------
+ *  Limits drawing of the current frame to `region`, tiles outside of it
+ *  are skipped. NULL draws everywhere. `region` must stay valid until flush.
+ */
+void raster_clip(struct raster *r, const struct damage *region);
+
+/*
+ * Function: raster_track(struct raster *r, struct damage *d)
+ * -----------------------
+ *  Adds the bounds of every primitive queued from now on to `d`,
+ *  NULL stops tracking.
+ */
+void raster_track(struct raster *r, struct damage *d);
+
+/*
+ * Function: raster_rect(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+ * -----------------------
+ *  Queues a filled rectangle.
+ */
+void raster_rect(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+
+/*
+ * Function: raster_triangle(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color)
+ * -----------------------
+ *  Queues a filled triangle, any winding. Pixel centers exactly on an edge
+ *  shared by two triangles are drawn by only one of them.
+ */
+void raster_triangle(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color);
+
+/*
+ * Function: raster_line(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+ * -----------------------
+ *  Queues a one pixel wide line, both end points included.
+ */
+void raster_line(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color);
+
+/*
+ * Function: raster_blit(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *src, uint32_t src_pitch)
+ * -----------------------
+ *  Queues copying w x h pixels of `src` with their top left corner at (`x`, `y`).
+ *  `src` is read by the workers, it must stay valid until flush.
+ */
+void raster_blit(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *src, uint32_t src_pitch);
+
+/*
+ * Function: raster_mask(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint8_t *bits, uint32_t pitch, uint32_t color)
+ * -----------------------
+ *  Queues filling the set pixels of a 1 bit per pixel mask (LSB is the
+ *  leftmost, like a line of text.h) with `color`, the others stay.
+ *  `bits` must stay valid until flush.
+ */
+void raster_mask(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint8_t *bits, uint32_t pitch, uint32_t color);
+
+/*
+ * Function: raster_flush(struct raster *r)
+ * -----------------------
+ *  Bins every queued primitive into tiles, hands the tiles to the workers
+ *  and returns once the whole frame is drawn. Primitives are drawn
+ *  in the order they were queued.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int raster_flush(struct raster *r);
+
+/*
+ * Function: raster_destroy(struct raster *r)
+ * -----------------------
+ *  Stops the workers and frees the bins.
+ */
+void raster_destroy(struct raster *r);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static inline int32_t raster_min(int32_t a, int32_t b) { return a < b ? a : b; }
+static inline int32_t raster_max(int32_t a, int32_t b) { return a > b ? a : b; }
+
+static void raster_draw_rect(struct raster_target *t, const struct raster_prim *p, const int32_t clip[4])
+{
+	int32_t x0 = raster_max(p->bbox[0], clip[0]);
+	int32_t y0 = raster_max(p->bbox[1], clip[1]);
+	int32_t x1 = raster_min(p->bbox[2], clip[2]);
+	int32_t y1 = raster_min(p->bbox[3], clip[3]);
+
+	if (x0 < x1 && y0 < y1)
+		pixel_fill_rect32(t->map, t->pitch, x0, y0, x1 - x0, y1 - y0, p->color);
+}
+
+/*
+ * Edge functions are evaluated at pixel centers, to keep them integer
+ * every coordinate is doubled and the center of pixel x sits at 2x + 1.
+ */
+static void raster_draw_triangle(struct raster_target *t, const struct raster_prim *p, const int32_t clip[4])
+{
+	int32_t x0 = raster_max(p->bbox[0], clip[0]);
+	int32_t y0 = raster_max(p->bbox[1], clip[1]);
+	int32_t x1 = raster_min(p->bbox[2], clip[2]);
+	int32_t y1 = raster_min(p->bbox[3], clip[3]);
+
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	int64_t vx[3] = { 2ll * p->v[0], 2ll * p->v[2], 2ll * p->v[4] };
+	int64_t vy[3] = { 2ll * p->v[1], 2ll * p->v[3], 2ll * p->v[5] };
+
+	int64_t a[3], b[3], c[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		int j = (i + 1) % 3;
+
+		/** edge i goes from vertex i to vertex j, inside is where a*x + b*y + c >= 0 **/
+		a[i] = vy[i] - vy[j];
+		b[i] = vx[j] - vx[i];
+		c[i] = vx[i] * vy[j] - vy[i] * vx[j];
+
+		/** tie breaking: of two triangles sharing this edge only one keeps the pixels on it **/
+		bool owns_edge = a[i] > 0 || (a[i] == 0 && b[i] < 0);
+		if (!owns_edge)
+			c[i] -= 1;
+	}
+
+	int64_t sx = 2ll * x0 + 1;
+	int64_t sy = 2ll * y0 + 1;
+
+	int64_t row[3];
+	for (int i = 0; i < 3; ++i)
+		row[i] = a[i] * sx + b[i] * sy + c[i];
+
+	uint8_t *line = t->map + (size_t)y0 * t->pitch;
+	for (int32_t y = y0; y < y1; ++y, line += t->pitch)
+	{
+		int64_t w0 = row[0], w1 = row[1], w2 = row[2];
+		uint32_t *dst = (uint32_t*)line;
+
+		for (int32_t x = x0; x < x1; ++x)
+		{
+			if ((w0 | w1 | w2) >= 0)
+				dst[x] = p->color;
+
+			w0 += 2 * a[0];
+			w1 += 2 * a[1];
+			w2 += 2 * a[2];
+		}
+
+		row[0] += 2 * b[0];
+		row[1] += 2 * b[1];
+		row[2] += 2 * b[2];
+	}
+}
+
+/*
+ * Lines are walked along their major axis only inside the tile,
+ * the minor coordinate is computed exactly for every step,
+ * so each tile plots the same pixels a single pass would.
+ */
+static void raster_draw_line(struct raster_target *t, const struct raster_prim *p, const int32_t clip[4])
+{
+	int64_t lx0 = p->v[0], ly0 = p->v[1], lx1 = p->v[2], ly1 = p->v[3];
+	int64_t dx = lx1 - lx0, dy = ly1 - ly0;
+	bool x_major = (dx < 0 ? -dx : dx) >= (dy < 0 ? -dy : dy);
+
+	if (!x_major)
+	{
+		/** swap the roles of x and y so the loop below only handles x-major **/
+		int64_t tmp;
+		tmp = lx0; lx0 = ly0; ly0 = tmp;
+		tmp = lx1; lx1 = ly1; ly1 = tmp;
+		tmp = dx; dx = dy; dy = tmp;
+	}
+
+	if (dx < 0)
+	{
+		int64_t tmp;
+		tmp = lx0; lx0 = lx1; lx1 = tmp;
+		tmp = ly0; ly0 = ly1; ly1 = tmp;
+		dx = -dx; dy = -dy;
+	}
+
+	int32_t major_lo = x_major ? clip[0] : clip[1];
+	int32_t major_hi = x_major ? clip[2] : clip[3];
+	int32_t minor_lo = x_major ? clip[1] : clip[0];
+	int32_t minor_hi = x_major ? clip[3] : clip[2];
+
+	int64_t from = lx0 > major_lo ? lx0 : major_lo;
+	int64_t to = lx1 < major_hi - 1 ? lx1 : major_hi - 1;
+
+	for (int64_t m = from; m <= to; ++m)
+	{
+		int64_t n = ly0;
+		if (dx)
+		{
+			/** round to nearest, ties away from zero **/
+			int64_t num = 2 * (m - lx0) * dy;
+			n += (num >= 0 ? num + dx : num - dx) / (2 * dx);
+		}
+
+		if (n < minor_lo || n >= minor_hi)
+			continue;
+
+		int64_t x = x_major ? m : n;
+		int64_t y = x_major ? n : m;
+		((uint32_t*)(t->map + (size_t)y * t->pitch))[x] = p->color;
+	}
+}
+
+static void raster_draw_blit(struct raster_target *t, const struct raster_prim *p, const int32_t clip[4])
+{
+	int32_t x0 = raster_max(p->bbox[0], clip[0]);
+	int32_t y0 = raster_max(p->bbox[1], clip[1]);
+	int32_t x1 = raster_min(p->bbox[2], clip[2]);
+	int32_t y1 = raster_min(p->bbox[3], clip[3]);
+
+	for (int32_t y = y0; y < y1 && x0 < x1; ++y)
+		memcpy(t->map + (size_t)y * t->pitch + x0 * 4,
+				p->src + (size_t)(y - p->v[1]) * p->src_pitch + (x0 - p->v[0]) * 4, (x1 - x0) * 4);
+}
+
+static void raster_draw_mask(struct raster_target *t, const struct raster_prim *p, const int32_t clip[4])
+{
+	int32_t x0 = raster_max(p->bbox[0], clip[0]);
+	int32_t y0 = raster_max(p->bbox[1], clip[1]);
+	int32_t x1 = raster_min(p->bbox[2], clip[2]);
+	int32_t y1 = raster_min(p->bbox[3], clip[3]);
+
+	for (int32_t y = y0; y < y1 && x0 < x1; ++y)
+	{
+		const uint8_t *bits = p->src + (size_t)(y - p->v[1]) * p->src_pitch;
+		uint32_t *dst = (uint32_t*)(t->map + (size_t)y * t->pitch) + x0;
+		uint32_t bit = x0 - p->v[0], left = x1 - x0;
+
+		/** a tile edge inside a byte, step bit by bit up to the next byte **/
+		for (; (bit & 7) && left; ++bit, --left, ++dst)
+			if (bits[bit / 8] & (1u << (bit & 7)))
+				*dst = p->color;
+
+		if (left)
+			pixel_mask_row32(dst, bits + bit / 8, left, p->color);
+	}
+}
+
+static void raster_draw_bin(struct raster *r, struct raster_bin *bin, const int32_t clip[4])
+{
+	for (uint32_t i = 0; i < bin->count; ++i)
+	{
+		const struct raster_prim *p = &r->prims[bin->prims[i]];
+
+		switch (p->type)
+		{
+			case RASTER_RECT: raster_draw_rect(&r->target, p, clip); break;
+			case RASTER_TRIANGLE: raster_draw_triangle(&r->target, p, clip); break;
+			case RASTER_LINE: raster_draw_line(&r->target, p, clip); break;
+			case RASTER_BLIT: raster_draw_blit(&r->target, p, clip); break;
+			case RASTER_MASK: raster_draw_mask(&r->target, p, clip); break;
+		}
+	}
+}
+
+static void raster_draw_tile(struct raster *r, uint32_t tile)
+{
+	uint32_t tx = tile % r->tiles_x;
+	uint32_t ty = tile / r->tiles_x;
+
+	struct raster_bin *bin = &r->bins[tile];
+	if (bin->count == 0)
+		return;
+
+	int32_t clip[4] = {
+		tx * RASTER_TILE_SIZE,
+		ty * RASTER_TILE_SIZE,
+		raster_min((tx + 1) * RASTER_TILE_SIZE, r->target.width),
+		raster_min((ty + 1) * RASTER_TILE_SIZE, r->target.height)
+	};
+
+	if (r->clip == NULL)
+	{
+		raster_draw_bin(r, bin, clip);
+		return;
+	}
+
+	/** clip rectangles never overlap, so no pixel is drawn twice **/
+	for (int i = 0; i < r->clip->count; ++i)
+	{
+		const struct damage_rect *c = &r->clip->rects[i];
+		int32_t sub[4] = {
+			raster_max(clip[0], c->x1),
+			raster_max(clip[1], c->y1),
+			raster_min(clip[2], c->x2),
+			raster_min(clip[3], c->y2)
+		};
+
+		if (sub[0] < sub[2] && sub[1] < sub[3])
+			raster_draw_bin(r, bin, sub);
+	}
+}
+
+static void raster_run_tiles(struct raster *r)
+{
+	uint32_t count = r->tiles_x * r->tiles_y;
+	uint32_t tile;
+
+	/** tiles are handed out one by one, so a busy tile does not hold back a whole row **/
+	while ((tile = atomic_fetch_add(&r->next_tile, 1)) < count)
+		raster_draw_tile(r, tile);
+}
+
+static void *raster_worker(void *arg)
+{
+	struct raster *r = arg;
+	uint64_t seen = 0;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&r->lock);
+		while (!r->quit && r->generation == seen)
+			pthread_cond_wait(&r->start, &r->lock);
+
+		if (r->quit)
+		{
+			pthread_mutex_unlock(&r->lock);
+			return NULL;
+		}
+
+		seen = r->generation;
+		pthread_mutex_unlock(&r->lock);
+
+		raster_run_tiles(r);
+
+		pthread_mutex_lock(&r->lock);
+		if (--r->active == 0)
+			pthread_cond_signal(&r->done);
+		pthread_mutex_unlock(&r->lock);
+	}
+}
+
+int raster_init(struct raster *r, int threads)
+{
+	memset(r, 0, sizeof(*r));
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	if (threads > RASTER_MAX_THREADS)
+		threads = RASTER_MAX_THREADS;
+
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->start, NULL);
+	pthread_cond_init(&r->done, NULL);
+
+	/** the thread calling raster_flush() works too, so it counts as one worker **/
+	for (int i = 0; i < threads - 1; ++i)
+	{
+		int ret = pthread_create(&r->threads[i], NULL, raster_worker, r);
+		if (ret)
+		{
+			raster_destroy(r);
+			return -ret;
+		}
+
+		r->thread_count++;
+	}
+
+	return 0;
+}
+
+void raster_begin(struct raster *r, struct raster_target target)
+{
+	r->target = target;
+	r->prim_count = 0;
+	r->clip = NULL;
+}
+
+void raster_clip(struct raster *r, const struct damage *region)
+{
+	r->clip = region;
+}
+
+void raster_track(struct raster *r, struct damage *d)
+{
+	r->track = d;
+}
+
+static struct raster_prim *raster_push(struct raster *r, RASTER_PRIM type, uint32_t color, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+	/** clip the bounds to the target, fully outside primitives are not queued **/
+	x0 = raster_max(x0, 0);
+	y0 = raster_max(y0, 0);
+	x1 = raster_min(x1, r->target.width);
+	y1 = raster_min(y1, r->target.height);
+
+	if (x0 >= x1 || y0 >= y1)
+		return NULL;
+
+	if (r->track)
+		damage_add(r->track, x0, y0, x1 - x0, y1 - y0);
+
+	if (r->prim_count == r->prim_capacity)
+	{
+		uint32_t capacity = r->prim_capacity ? r->prim_capacity * 2 : 256;
+		struct raster_prim *prims = realloc(r->prims, capacity * sizeof(*prims));
+		if (prims == NULL)
+			return NULL;
+
+		r->prims = prims;
+		r->prim_capacity = capacity;
+	}
+
+	struct raster_prim *p = &r->prims[r->prim_count++];
+	p->type = type;
+	p->color = color;
+	p->bbox[0] = x0;
+	p->bbox[1] = y0;
+	p->bbox[2] = x1;
+	p->bbox[3] = y1;
+
+	return p;
+}
+
+void raster_rect(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+	struct raster_prim *p = raster_push(r, RASTER_RECT, color, x, y, x + w, y + h);
+	if (p == NULL)
+		return;
+
+	p->v[0] = x; p->v[1] = y; p->v[2] = w; p->v[3] = h;
+}
+
+void raster_triangle(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color)
+{
+	/** wind every triangle the same way so the edge functions are positive inside **/
+	int64_t area = (int64_t)(x1 - x0) * (y2 - y0) - (int64_t)(y1 - y0) * (x2 - x0);
+	if (area == 0)
+		return;
+
+	if (area < 0)
+	{
+		int32_t tx = x1, ty = y1;
+		x1 = x2; y1 = y2;
+		x2 = tx; y2 = ty;
+	}
+
+	struct raster_prim *p = raster_push(r, RASTER_TRIANGLE, color,
+			raster_min(x0, raster_min(x1, x2)), raster_min(y0, raster_min(y1, y2)),
+			raster_max(x0, raster_max(x1, x2)) + 1, raster_max(y0, raster_max(y1, y2)) + 1);
+	if (p == NULL)
+		return;
+
+	p->v[0] = x0; p->v[1] = y0;
+	p->v[2] = x1; p->v[3] = y1;
+	p->v[4] = x2; p->v[5] = y2;
+}
+
+void raster_line(struct raster *r, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+	struct raster_prim *p = raster_push(r, RASTER_LINE, color,
+			raster_min(x0, x1), raster_min(y0, y1),
+			raster_max(x0, x1) + 1, raster_max(y0, y1) + 1);
+	if (p == NULL)
+		return;
+
+	p->v[0] = x0; p->v[1] = y0;
+	p->v[2] = x1; p->v[3] = y1;
+}
+
+void raster_blit(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint32_t *src, uint32_t src_pitch)
+{
+	struct raster_prim *p = raster_push(r, RASTER_BLIT, 0, x, y, x + w, y + h);
+	if (p == NULL)
+		return;
+
+	p->v[0] = x; p->v[1] = y; p->v[2] = w; p->v[3] = h;
+	p->src = (const uint8_t*)src;
+	p->src_pitch = src_pitch;
+}
+
+void raster_mask(struct raster *r, int32_t x, int32_t y, int32_t w, int32_t h, const uint8_t *bits, uint32_t pitch, uint32_t color)
+{
+	struct raster_prim *p = raster_push(r, RASTER_MASK, color, x, y, x + w, y + h);
+	if (p == NULL)
+		return;
+
+	p->v[0] = x; p->v[1] = y; p->v[2] = w; p->v[3] = h;
+	p->src = bits;
+	p->src_pitch = pitch;
+}
+
+static int raster_bin_push(struct raster_bin *bin, uint32_t prim)
+{
+	if (bin->count == bin->capacity)
+	{
+		uint32_t capacity = bin->capacity ? bin->capacity * 2 : 16;
+		uint32_t *prims = realloc(bin->prims, capacity * sizeof(*prims));
+		if (prims == NULL)
+			return -ENOMEM;
+
+		bin->prims = prims;
+		bin->capacity = capacity;
+	}
+
+	bin->prims[bin->count++] = prim;
+	return 0;
+}
+
+static int raster_bin_all(struct raster *r)
+{
+	r->tiles_x = (r->target.width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	r->tiles_y = (r->target.height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+
+	uint32_t count = r->tiles_x * r->tiles_y;
+	if (count > r->bin_capacity)
+	{
+		struct raster_bin *bins = realloc(r->bins, count * sizeof(*bins));
+		if (bins == NULL)
+			return -ENOMEM;
+
+		memset(bins + r->bin_capacity, 0, (count - r->bin_capacity) * sizeof(*bins));
+		r->bins = bins;
+		r->bin_capacity = count;
+	}
+
+	for (uint32_t i = 0; i < count; ++i)
+		r->bins[i].count = 0;
+
+	/** walking primitives in order keeps every bin in submission order **/
+	for (uint32_t i = 0; i < r->prim_count; ++i)
+	{
+		const struct raster_prim *p = &r->prims[i];
+
+		uint32_t tx0 = p->bbox[0] / RASTER_TILE_SIZE;
+		uint32_t ty0 = p->bbox[1] / RASTER_TILE_SIZE;
+		uint32_t tx1 = (p->bbox[2] - 1) / RASTER_TILE_SIZE;
+		uint32_t ty1 = (p->bbox[3] - 1) / RASTER_TILE_SIZE;
+
+		for (uint32_t ty = ty0; ty <= ty1; ++ty)
+			for (uint32_t tx = tx0; tx <= tx1; ++tx)
+				if (raster_bin_push(&r->bins[ty * r->tiles_x + tx], i) < 0)
+					return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int raster_flush(struct raster *r)
+{
+	int ret = raster_bin_all(r);
+	if (ret < 0)
+		return ret;
+
+	atomic_store(&r->next_tile, 0);
+
+	pthread_mutex_lock(&r->lock);
+	r->active = r->thread_count;
+	r->generation++;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+
+	raster_run_tiles(r);
+
+	pthread_mutex_lock(&r->lock);
+	while (r->active)
+		pthread_cond_wait(&r->done, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+
+	r->prim_count = 0;
+	r->clip = NULL;
+
+	return 0;
+}
+
+void raster_destroy(struct raster *r)
+{
+	pthread_mutex_lock(&r->lock);
+	r->quit = true;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+
+	for (int i = 0; i < r->thread_count; ++i)
+		pthread_join(r->threads[i], NULL);
+
+	for (uint32_t i = 0; i < r->bin_capacity; ++i)
+		free(r->bins[i].prims);
+
+	free(r->bins);
+	free(r->prims);
+
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->start);
+	pthread_cond_destroy(&r->done);
+
+	r->bins = NULL;
+	r->prims = NULL;
+	r->bin_capacity = 0;
+	r->prim_capacity = 0;
+	r->thread_count = 0;
+}
+
+#endif // RASTER_H
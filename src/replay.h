@@ -0,0 +1,398 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "log.h"
+#include "input.h"
+
+/** the synthetic script: a key press and a mouse move, repeated **/
+#define REPLAY_KEY_MS 100
+#define REPLAY_MOTION_MS 10
+#define REPLAY_PERIOD_MS 1000
+
+/** not bound by any console or desktop, pressing it is harmless **/
+#define REPLAY_KEY KEY_F13
+
+typedef enum {
+	REPLAY_UINPUT = 0,	/* a virtual evdev device, stamped by the kernel like real input */
+	REPLAY_PIPE					/* no /dev/uinput: a pipe, stamped by the writer */
+} REPLAY_SINK;
+
+/*
+ * Plays a script of input events in real time to a struct input,
+ * so input-to-photon latency can be measured without anyone typing.
+ */
+struct replay
+{
+	REPLAY_SINK sink;
+	int fd;								/* uinput device or write end of the pipe */
+
+	/** the script, times relative to its first event **/
+	struct input_event *events;
+	size_t count;
+	uint64_t period_ns;		/* the script restarts after it, 0 = played once */
+
+	pthread_t thread;
+	bool running;
+	_Atomic bool stop;
+	_Atomic uint64_t frames;	/* written so far */
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: replay_load(struct replay *r, const char *path)
+ * -----------------------
+ *  Loads a recording, raw struct input_event as written by `kbd record`,
+ *  played once. NULL builds the synthetic script instead, played in a loop:
+ *  REPLAY_KEY pressed every REPLAY_KEY_MS, the mouse moved every REPLAY_MOTION_MS.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int replay_load(struct replay *r, const char *path);
+
+/*
+ * Function: replay_start(struct replay *r, struct input *in)
+ * -----------------------
+ *  Creates a uinput device, or a pipe if that is not allowed, adds its
+ *  reading side to `in` and starts playing on a thread of its own.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int replay_start(struct replay *r, struct input *in);
+
+/*
+ * Function: replay_destroy(struct replay *r)
+ * -----------------------
+ *  Stops playing, removes the device and frees the script.
+ *  The reading side stays with the struct input it was added to.
+ */
+void replay_destroy(struct replay *r);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/*
+ * replay_push()
+ *
+ * Appends one event at `ms` into the script.
+*/
+static void replay_push(struct input_event *e, uint64_t ms, uint16_t type, uint16_t code, int32_t value)
+{
+	e->input_event_sec = ms / 1000;
+	e->input_event_usec = (ms % 1000) * 1000;
+	e->type = type;
+	e->code = code;
+	e->value = value;
+}
+
+static int replay_synthetic(struct replay *r)
+{
+	size_t keys = REPLAY_PERIOD_MS / REPLAY_KEY_MS;
+	size_t motions = REPLAY_PERIOD_MS / REPLAY_MOTION_MS;
+
+	/** a key is down and up, 2 frames of 2 events, a motion is 3 events **/
+	r->events = malloc((keys * 4 + motions * 3) * sizeof(struct input_event));
+	if (r->events == NULL)
+		return -ENOMEM;
+
+	size_t n = 0;
+	for (uint64_t ms = 0; ms < REPLAY_PERIOD_MS; ms += REPLAY_MOTION_MS)
+	{
+		/** right and down for half the period, then back, so the pointer stays on screen **/
+		int32_t dx = ms < REPLAY_PERIOD_MS / 2 ? 4 : -4;
+		replay_push(&r->events[n++], ms, EV_REL, REL_X, dx);
+		replay_push(&r->events[n++], ms, EV_REL, REL_Y, dx / 2);
+		replay_push(&r->events[n++], ms, EV_SYN, SYN_REPORT, 0);
+
+		if (ms % REPLAY_KEY_MS == 0)
+		{
+			replay_push(&r->events[n++], ms, EV_KEY, REPLAY_KEY, 1);
+			replay_push(&r->events[n++], ms, EV_SYN, SYN_REPORT, 0);
+		}
+		else if (ms % REPLAY_KEY_MS == REPLAY_KEY_MS / 2)
+		{
+			replay_push(&r->events[n++], ms, EV_KEY, REPLAY_KEY, 0);
+			replay_push(&r->events[n++], ms, EV_SYN, SYN_REPORT, 0);
+		}
+	}
+
+	r->count = n;
+	r->period_ns = REPLAY_PERIOD_MS * 1000000ull;
+
+	return 0;
+}
+
+int replay_load(struct replay *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+
+	if (path == NULL)
+		return replay_synthetic(r);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct input_event))
+	{
+		close(fd);
+		return -EINVAL;
+	}
+
+	r->count = st.st_size / sizeof(struct input_event);
+	r->events = malloc(r->count * sizeof(struct input_event));
+	if (r->events == NULL)
+	{
+		close(fd);
+		return -ENOMEM;
+	}
+
+	size_t size = r->count * sizeof(struct input_event), done = 0;
+	while (done < size)
+	{
+		ssize_t n = read(fd, (uint8_t*)r->events + done, size - done);
+		if (n <= 0)
+		{
+			int ret = n < 0 ? -errno : -EIO;
+			close(fd);
+			free(r->events);
+			r->events = NULL;
+			return ret;
+		}
+
+		done += n;
+	}
+
+	close(fd);
+
+	/** the recording keeps its monotonic stamps, the script starts at 0 **/
+	struct input_event *first = &r->events[0];
+	uint64_t base = (uint64_t)first->input_event_sec * 1000000ull + first->input_event_usec;
+
+	for (size_t i = 0; i < r->count; ++i)
+	{
+		struct input_event *e = &r->events[i];
+		uint64_t us = (uint64_t)e->input_event_sec * 1000000ull + e->input_event_usec;
+		uint64_t rel = us > base ? us - base : 0;
+
+		e->input_event_sec = rel / 1000000ull;
+		e->input_event_usec = rel % 1000000ull;
+	}
+
+	return 0;
+}
+
+/*
+ * replay_uinput()
+ *
+ * Creates the virtual device and opens its evdev node, which is
+ * found through sysfs as /sys/class/input/<sysname>/event*.
+ * returns: The node opened for reading, negative errno on failure.
+*/
+static int replay_uinput(struct replay *r, char *node, size_t size)
+{
+	r->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (r->fd < 0)
+		return -errno;
+
+	ioctl(r->fd, UI_SET_EVBIT, EV_SYN);
+	ioctl(r->fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(r->fd, UI_SET_EVBIT, EV_REL);
+	ioctl(r->fd, UI_SET_RELBIT, REL_X);
+	ioctl(r->fd, UI_SET_RELBIT, REL_Y);
+	ioctl(r->fd, UI_SET_RELBIT, REL_WHEEL);
+
+	/** recordings may hold any key or button **/
+	for (int key = KEY_ESC; key < KEY_MAX; ++key)
+		ioctl(r->fd, UI_SET_KEYBIT, key);
+
+	struct uinput_setup setup = { .id = { .bustype = BUS_VIRTUAL, .vendor = 0x1, .product = 0x1 } };
+	snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "card replay");
+
+	char sysname[64], dirname[128];
+	if (ioctl(r->fd, UI_DEV_SETUP, &setup) < 0 || ioctl(r->fd, UI_DEV_CREATE) < 0 ||
+			ioctl(r->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0)
+	{
+		int ret = -errno;
+		close(r->fd);
+		r->fd = -1;
+		return ret;
+	}
+
+	/** udev and devtmpfs need a moment before the node shows up **/
+	snprintf(dirname, sizeof(dirname), "/sys/class/input/%s", sysname);
+	for (int attempt = 0; attempt < 100; ++attempt)
+	{
+		DIR *dir = opendir(dirname);
+		for (struct dirent *e; dir && (e = readdir(dir)) != NULL; )
+		{
+			if (strncmp(e->d_name, "event", 5))
+				continue;
+
+			snprintf(node, size, "/dev/input/%s", e->d_name);
+
+			int fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+			if (fd >= 0)
+			{
+				closedir(dir);
+				return fd;
+			}
+		}
+
+		if (dir)
+			closedir(dir);
+
+		usleep(10000);
+	}
+
+	ioctl(r->fd, UI_DEV_DESTROY);
+	close(r->fd);
+	r->fd = -1;
+	return -ENODEV;
+}
+
+static void *replay_thread(void *data)
+{
+	struct replay *r = data;
+	uint64_t start = input_now_ns();
+
+	for (uint64_t loop = 0; !atomic_load(&r->stop); ++loop)
+	{
+		for (size_t i = 0; i < r->count && !atomic_load(&r->stop); )
+		{
+			/** a frame goes out in one write(), as the kernel would deliver it **/
+			size_t end = i;
+			while (end < r->count && !(r->events[end].type == EV_SYN && r->events[end].code == SYN_REPORT))
+				++end;
+			end = end < r->count ? end + 1 : end;
+
+			const struct input_event *e = &r->events[i];
+			uint64_t at = start + loop * r->period_ns +
+					(uint64_t)e->input_event_sec * 1000000000ull + (uint64_t)e->input_event_usec * 1000ull;
+			struct timespec ts = { .tv_sec = at / 1000000000ull, .tv_nsec = at % 1000000000ull };
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+
+			struct input_event frame[INPUT_MAX_FRAME];
+			size_t n = end - i < INPUT_MAX_FRAME ? end - i : INPUT_MAX_FRAME;
+			memcpy(frame, &r->events[i], n * sizeof(frame[0]));
+
+			/** uinput is stamped by the kernel, the pipe by us, right before it is written **/
+			uint64_t now = input_now_ns();
+			for (size_t k = 0; k < n; ++k)
+			{
+				frame[k].input_event_sec = r->sink == REPLAY_PIPE ? now / 1000000000ull : 0;
+				frame[k].input_event_usec = r->sink == REPLAY_PIPE ? now % 1000000000ull / 1000ull : 0;
+			}
+
+			if (write(r->fd, frame, n * sizeof(frame[0])) == (ssize_t)(n * sizeof(frame[0])))
+				atomic_fetch_add(&r->frames, 1);
+
+			i = end;
+		}
+
+		if (r->period_ns == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+int replay_start(struct replay *r, struct input *in)
+{
+	char node[sizeof(in->devices[0].path)];
+
+	int fd = replay_uinput(r, node, sizeof(node));
+	if (fd >= 0)
+	{
+		r->sink = REPLAY_UINPUT;
+
+		/** the kernel stamps it, with the clock asked for **/
+		int clock = CLOCK_MONOTONIC;
+		ioctl(fd, EVIOCSCLOCKID, &clock);
+	}
+	else
+	{
+		WARN("uinput is not available (%s), replaying through a pipe", strerror(-fd));
+
+		int pipes[2];
+		if (pipe(pipes) < 0)
+			return -errno;
+
+		r->sink = REPLAY_PIPE;
+		r->fd = pipes[1];
+		fd = pipes[0];
+
+		/** the writer blocks, the reader must not **/
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		fcntl(r->fd, F_SETFD, FD_CLOEXEC);
+		snprintf(node, sizeof(node), "replay");
+	}
+
+	int index = input_add_fd(in, fd, node);
+	if (index < 0)
+	{
+		close(fd);
+		return index;
+	}
+
+	int ret = pthread_create(&r->thread, NULL, replay_thread, r);
+	if (ret != 0)
+		return -ret;
+
+	r->running = true;
+	INFO("Replaying %zu events through %s", r->count, r->sink == REPLAY_UINPUT ? node : "a pipe");
+
+	return 0;
+}
+
+void replay_destroy(struct replay *r)
+{
+	if (r->running)
+	{
+		atomic_store(&r->stop, true);
+
+		/** a writer asleep until the next event is woken up, not waited for **/
+		pthread_cancel(r->thread);
+		pthread_join(r->thread, NULL);
+		r->running = false;
+	}
+
+	if (r->fd >= 0)
+	{
+		if (r->sink == REPLAY_UINPUT)
+			ioctl(r->fd, UI_DEV_DESTROY);
+
+		close(r->fd);
+	}
+
+	free(r->events);
+	r->events = NULL;
+	r->fd = -1;
+}
+
+#endif // REPLAY_H
@@ -0,0 +1,569 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <linux/memfd.h>
+
+#include "log.h"
+#include "display.h"
+#include "compositor.h"
+#include "timing.h"
+
+#ifndef SERVER_MAX_CLIENTS
+	#define SERVER_MAX_CLIENTS 16
+#endif // SERVER_MAX_CLIENTS
+
+/** every surface is a layer of every head, leave room for the cursor **/
+#ifndef SERVER_MAX_SURFACES
+	#define SERVER_MAX_SURFACES (COMPOSITOR_MAX_LAYERS - 2)
+#endif // SERVER_MAX_SURFACES
+
+#define SERVER_MAX_SIZE 8192
+#define SERVER_MAX_Z 0x7FFFFFFE		/* the cursor stays on top */
+
+#define SERVER_HEADS 8		/* bits of server_surface.pending */
+
+/** memfd sealing, older libc headers do not have it **/
+#ifndef F_ADD_SEALS
+	#define F_ADD_SEALS 1033
+	#define F_SEAL_SHRINK 0x0002
+	#define F_SEAL_GROW 0x0004
+#endif // F_ADD_SEALS
+
+struct server_surface
+{
+	uint32_t id;				/* 0 = free */
+	int client;
+
+	uint32_t *pixels;		/* the daemon's mapping of the memfd */
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;		/* pixels per row */
+	size_t size;
+
+	int32_t x;
+	int32_t y;
+	int z;
+	bool opaque;
+	bool shown;					/* hidden until its first damage */
+
+	struct compositor_layer *layers[SERVER_HEADS];
+
+	/** heads which have not composited the last damage yet **/
+	uint32_t pending;
+	bool want_frame;
+};
+
+struct server_stats
+{
+	uint64_t clients;
+	uint64_t requests;
+	uint64_t surfaces;
+	uint64_t damage_rects;
+	uint64_t frames_sent;
+};
+
+/*
+ * The daemon side of display.h: accepts clients on a Unix socket and
+ * shows their surfaces as layers of the compositor of every head.
+ */
+struct server
+{
+	int listen_fd;
+	int epoll_fd;
+	char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+	int clients[SERVER_MAX_CLIENTS];		/* -1 = free */
+	struct server_surface surfaces[SERVER_MAX_SURFACES];
+	uint32_t next_id;
+
+	struct compositor *heads[SERVER_HEADS];
+	int head_count;
+
+	struct server_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: server_init(struct server *s, const char *path)
+ * -----------------------
+ *  Listens on `path` (NULL = DISPLAY_SOCKET), a stale socket left by a
+ *  daemon which died is replaced.
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int server_init(struct server *s, const char *path);
+
+/*
+ * Function: server_head(struct server *s, int index, struct compositor *c)
+ * -----------------------
+ *  Head `index` composites with `c` from now on, which gets a layer for every
+ *  surface. Called again when the head's compositor is re-created, NULL once
+ *  it is destroyed (with its layers).
+ */
+void server_head(struct server *s, int index, struct compositor *c);
+
+/*
+ * Function: server_fd(const struct server *s)
+ * -----------------------
+ *  returns: The epoll fd, readable when a client connects or sends, for poll() (int)
+ */
+int server_fd(const struct server *s);
+
+/*
+ * Function: server_dispatch(struct server *s, int timeout_ms)
+ * -----------------------
+ *  Accepts new clients and handles every request waiting, up to
+ *  `timeout_ms` (0 = not at all) for the first one.
+ *
+ * returns: Number of requests handled, negative errno on failure (int)
+ */
+int server_dispatch(struct server *s, int timeout_ms);
+
+/*
+ * Function: server_composited(struct server *s, int index)
+ * -----------------------
+ *  Head `index` composited its damage. Surfaces which are now on every
+ *  head send the DISPLAY_FRAME their client asked for.
+ */
+void server_composited(struct server *s, int index);
+
+/*
+ * Function: server_destroy(struct server *s)
+ * -----------------------
+ *  Disconnects every client, removes their surfaces and the socket.
+ */
+void server_destroy(struct server *s);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/** the listening socket in the epoll set, clients are their index **/
+#define SERVER_LISTEN UINT32_MAX
+
+int server_init(struct server *s, const char *path)
+{
+	memset(s, 0, sizeof(*s));
+	s->listen_fd = s->epoll_fd = -1;
+	s->next_id = 1;
+
+	for (int i = 0; i < SERVER_MAX_CLIENTS; ++i)
+		s->clients[i] = -1;
+
+	snprintf(s->path, sizeof(s->path), "%s", path ? path : DISPLAY_SOCKET);
+
+	s->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (s->listen_fd < 0)
+		return -errno;
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	memcpy(addr.sun_path, s->path, sizeof(addr.sun_path));
+
+	/** only replace a socket nobody answers on **/
+	int probe = display_connect(s->path, NULL, NULL);
+	if (probe >= 0)
+	{
+		close(probe);
+		close(s->listen_fd);
+		s->listen_fd = -1;
+		return -EADDRINUSE;
+	}
+
+	unlink(s->path);
+
+	if (bind(s->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s->listen_fd, SERVER_MAX_CLIENTS) < 0)
+	{
+		int ret = -errno;
+		server_destroy(s);
+		return ret;
+	}
+
+	s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = SERVER_LISTEN };
+	if (s->epoll_fd < 0 || epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, s->listen_fd, &ev) < 0)
+	{
+		int ret = -errno;
+		server_destroy(s);
+		return ret;
+	}
+
+	return 0;
+}
+
+int server_fd(const struct server *s)
+{
+	return s->epoll_fd;
+}
+
+/*
+ * server_attach()
+ *
+ * Gives surface `sf` its layer on head `index`.
+*/
+static void server_attach(struct server *s, struct server_surface *sf, int index)
+{
+	struct compositor *c = s->heads[index];
+	struct compositor_layer *l = compositor_layer_attach(c, sf->pixels, sf->width, sf->height, sf->stride, sf->z, sf->opaque);
+
+	sf->layers[index] = l;
+	if (l == NULL)
+	{
+		WARN("Surface %u: no layer left on head %d", sf->id, index);
+		return;
+	}
+
+	compositor_layer_move(c, l, sf->x, sf->y);
+	compositor_layer_set_visible(c, l, sf->shown);
+}
+
+void server_head(struct server *s, int index, struct compositor *c)
+{
+	if (index < 0 || index >= SERVER_HEADS)
+		return;
+
+	s->heads[index] = c;
+	if (index >= s->head_count)
+		s->head_count = index + 1;
+
+	for (int i = 0; i < SERVER_MAX_SURFACES; ++i)
+	{
+		struct server_surface *sf = &s->surfaces[i];
+		if (sf->id == 0)
+			continue;
+
+		/** the layers went with the old compositor **/
+		sf->layers[index] = NULL;
+		sf->pending &= ~(1u << index);
+
+		if (c)
+			server_attach(s, sf, index);
+	}
+}
+
+static struct server_surface *server_surface_find(struct server *s, int client, uint32_t id)
+{
+	for (int i = 0; i < SERVER_MAX_SURFACES; ++i)
+		if (s->surfaces[i].id == id && id != 0 && s->surfaces[i].client == client)
+			return &s->surfaces[i];
+
+	return NULL;
+}
+
+static void server_surface_destroy(struct server *s, struct server_surface *sf)
+{
+	for (int h = 0; h < s->head_count; ++h)
+		if (s->heads[h] && sf->layers[h])
+			compositor_layer_destroy(s->heads[h], sf->layers[h]);
+
+	munmap(sf->pixels, sf->size);
+	memset(sf, 0, sizeof(*sf));
+}
+
+/*
+ * server_surface_create()
+ *
+ * Allocates the memfd and maps it, `*out` is the new surface.
+ * returns: The memfd to hand to the client, or negative errno to send
+ *          back as DISPLAY_ERROR.
+*/
+static int server_surface_create(struct server *s, int client, const struct display_msg *req, struct server_surface **out)
+{
+	if (req->w <= 0 || req->h <= 0 || req->w > SERVER_MAX_SIZE || req->h > SERVER_MAX_SIZE)
+		return -EINVAL;
+
+	struct server_surface *sf = NULL;
+	for (int i = 0; i < SERVER_MAX_SURFACES && sf == NULL; ++i)
+		if (s->surfaces[i].id == 0)
+			sf = &s->surfaces[i];
+
+	if (sf == NULL)
+		return -ENOSPC;
+
+	/** rows on a cache line, like the compositor's own layers **/
+	uint32_t stride = (req->w + 15) & ~15u;
+	size_t size = (size_t)stride * req->h * 4;
+
+	int fd = syscall(SYS_memfd_create, "card-surface", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return -errno;
+
+	/** sealed, a client shrinking it can not make the daemon fault **/
+	if (ftruncate(fd, size) < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+	{
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	memset(sf, 0, sizeof(*sf));
+	sf->id = s->next_id++;
+	sf->client = client;
+	sf->pixels = map;
+	sf->width = req->w;
+	sf->height = req->h;
+	sf->stride = stride;
+	sf->size = size;
+	sf->x = req->x;
+	sf->y = req->y;
+	sf->z = req->z < 0 ? 0 : req->z > SERVER_MAX_Z ? SERVER_MAX_Z : req->z;
+	sf->opaque = req->flags & DISPLAY_OPAQUE;
+
+	/** a new memfd reads as zeros, transparent **/
+	if (sf->opaque)
+		pixel_fill_rect32((uint8_t*)sf->pixels, stride * 4, 0, 0, sf->width, sf->height, 0xFF000000);
+
+	for (int h = 0; h < s->head_count; ++h)
+		if (s->heads[h])
+			server_attach(s, sf, h);
+
+	*out = sf;
+	return fd;
+}
+
+static void server_surface_damage(struct server *s, struct server_surface *sf, const struct display_msg *req)
+{
+	uint32_t heads = 0;
+
+	for (int h = 0; h < s->head_count; ++h)
+	{
+		if (s->heads[h] == NULL || sf->layers[h] == NULL)
+			continue;
+
+		/** showing it damages all of it **/
+		if (!sf->shown)
+			compositor_layer_set_visible(s->heads[h], sf->layers[h], true);
+		else
+			compositor_layer_damage(s->heads[h], sf->layers[h], req->x, req->y, req->w, req->h);
+
+		heads |= 1u << h;
+	}
+
+	sf->shown = true;
+	sf->pending |= heads;
+	sf->want_frame |= (req->flags & DISPLAY_WANT_FRAME) != 0;
+	s->stats.damage_rects++;
+
+	/** nothing to wait for without heads **/
+	if (heads == 0 && sf->want_frame)
+		server_composited(s, -1);
+}
+
+static void server_disconnect(struct server *s, int client)
+{
+	for (int i = 0; i < SERVER_MAX_SURFACES; ++i)
+		if (s->surfaces[i].id && s->surfaces[i].client == client)
+			server_surface_destroy(s, &s->surfaces[i]);
+
+	epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, s->clients[client], NULL);
+	close(s->clients[client]);
+	s->clients[client] = -1;
+}
+
+/*
+ * server_request()
+ *
+ * Handles one message of `client`.
+ * returns: 0, negative errno if the client has to go: a reply it can not
+ *          take is never dropped, the client would wait for it forever.
+*/
+static int server_request(struct server *s, int client, const struct display_msg *req)
+{
+	int fd = s->clients[client];
+	struct server_surface *sf = NULL;
+	s->stats.requests++;
+
+	switch (req->type)
+	{
+		case DISPLAY_HELLO:
+		{
+			struct compositor *c = s->head_count ? s->heads[0] : NULL;
+			struct display_msg reply = { .type = DISPLAY_INFO, .w = c ? c->width : 0, .h = c ? c->height : 0 };
+			return display_send(fd, &reply, -1);
+		}
+
+		case DISPLAY_CREATE:
+		{
+			int memfd = server_surface_create(s, client, req, &sf);
+			if (memfd < 0)
+			{
+				struct display_msg reply = { .type = DISPLAY_ERROR, .error = memfd };
+				return display_send(fd, &reply, -1);
+			}
+
+			/** on failure the disconnect destroys the surface with the others **/
+			struct display_msg reply = { .type = DISPLAY_SURFACE, .surface = sf->id, .w = sf->width, .h = sf->height, .stride = sf->stride * 4 };
+			int ret = display_send(fd, &reply, memfd);
+			close(memfd);
+
+			if (ret == 0)
+				s->stats.surfaces++;
+
+			return ret;
+		}
+
+		case DISPLAY_DAMAGE:
+			if ((sf = server_surface_find(s, client, req->surface)) != NULL)
+				server_surface_damage(s, sf, req);
+			return 0;
+
+		case DISPLAY_MOVE:
+			if ((sf = server_surface_find(s, client, req->surface)) == NULL)
+				return 0;
+
+			sf->x = req->x;
+			sf->y = req->y;
+			sf->z = req->z < 0 ? 0 : req->z > SERVER_MAX_Z ? SERVER_MAX_Z : req->z;
+
+			for (int h = 0; h < s->head_count; ++h)
+				if (s->heads[h] && sf->layers[h])
+				{
+					compositor_layer_move(s->heads[h], sf->layers[h], sf->x, sf->y);
+					compositor_layer_set_z(s->heads[h], sf->layers[h], sf->z);
+				}
+			return 0;
+
+		case DISPLAY_DESTROY:
+			if ((sf = server_surface_find(s, client, req->surface)) != NULL)
+				server_surface_destroy(s, sf);
+			return 0;
+
+		default:
+			return -EPROTO;
+	}
+}
+
+static void server_accept(struct server *s)
+{
+	for (;;)
+	{
+		int fd = accept(s->listen_fd, NULL, NULL);
+		if (fd < 0)
+			return;
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+		int client = 0;
+		while (client < SERVER_MAX_CLIENTS && s->clients[client] >= 0)
+			++client;
+
+		struct epoll_event ev = { .events = EPOLLIN, .data.u32 = client };
+		if (client == SERVER_MAX_CLIENTS || epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			WARN("Display: client refused, %d connected", SERVER_MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+
+		s->clients[client] = fd;
+		s->stats.clients++;
+	}
+}
+
+int server_dispatch(struct server *s, int timeout_ms)
+{
+	struct epoll_event events[SERVER_MAX_CLIENTS + 1];
+
+	int ready = epoll_wait(s->epoll_fd, events, SERVER_MAX_CLIENTS + 1, timeout_ms);
+	if (ready < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	int handled = 0;
+	for (int i = 0; i < ready; ++i)
+	{
+		uint32_t client = events[i].data.u32;
+		if (client == SERVER_LISTEN)
+		{
+			server_accept(s);
+			continue;
+		}
+
+		if (client >= SERVER_MAX_CLIENTS || s->clients[client] < 0)
+			continue;
+
+		/** all it sent, a client can not stall the frame for long: its socket is non blocking **/
+		struct display_msg req;
+		int ret, failed = 0;
+		while (failed == 0 && (ret = display_recv(s->clients[client], &req, NULL)) == 0)
+		{
+			/** an EAGAIN from a reply is its socket full, not its queue empty **/
+			failed = server_request(s, client, &req);
+			handled++;
+		}
+
+		if (failed < 0 || ret != -EAGAIN)
+			server_disconnect(s, client);
+	}
+
+	return handled;
+}
+
+void server_composited(struct server *s, int index)
+{
+	uint64_t now = timing_now();
+
+	for (int i = 0; i < SERVER_MAX_SURFACES; ++i)
+	{
+		struct server_surface *sf = &s->surfaces[i];
+		if (sf->id == 0)
+			continue;
+
+		if (index >= 0)
+			sf->pending &= ~(1u << index);
+
+		if (sf->pending || !sf->want_frame)
+			continue;
+
+		struct display_msg msg = { .type = DISPLAY_FRAME, .surface = sf->id, .time_ns = now };
+		sf->want_frame = false;
+
+		/** a client which does not read its socket is not waited for **/
+		if (display_send(s->clients[sf->client], &msg, -1) < 0)
+			continue;
+
+		s->stats.frames_sent++;
+	}
+}
+
+void server_destroy(struct server *s)
+{
+	for (int i = 0; i < SERVER_MAX_CLIENTS; ++i)
+		if (s->clients[i] >= 0)
+			server_disconnect(s, i);
+
+	if (s->epoll_fd >= 0)
+		close(s->epoll_fd);
+
+	if (s->listen_fd >= 0)
+	{
+		close(s->listen_fd);
+		unlink(s->path);
+	}
+
+	s->epoll_fd = s->listen_fd = -1;
+}
+
+#endif // SERVER_H
@@ -0,0 +1,459 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pixel.h"
+#include "damage.h"
+
+/** laid out lines kept around, enough for a full 4K screen of 8x8 text, power of 2 **/
+#ifndef TEXT_CACHE_LINES
+	#define TEXT_CACHE_LINES 1024
+#endif // TEXT_CACHE_LINES
+
+/** a line can only live in one set of this many slots, picked by its hash **/
+#define TEXT_CACHE_WAYS 8
+
+#define TEXT_FIRST_GLYPH 0x20
+#define TEXT_GLYPH_COUNT 95	/* printable ASCII, anything else is drawn as '?' */
+
+/*
+ * A laid out line is a 1 bit per pixel mask of the whole string,
+ * glyph rows copied side by side out of the atlas.
+ */
+struct text_line
+{
+	char *str;
+	uint32_t length;
+	uint64_t hash;
+	uint64_t last_used;		/* 0 = free */
+
+	uint32_t width;				/* pixels */
+	uint32_t stride;			/* bytes per mask row */
+	uint8_t *bits;				/* cell_h rows, LSB is the leftmost pixel */
+};
+
+struct text_stats
+{
+	uint64_t hits;
+	uint64_t misses;
+};
+
+struct text
+{
+	uint32_t scale;
+	uint32_t cell_w;			/* always a multiple of 8 */
+	uint32_t cell_h;
+
+	/** glyph g row y is `scale` bytes at atlas + (g * cell_h + y) * scale **/
+	uint8_t *atlas;
+
+	struct text_line lines[TEXT_CACHE_LINES];
+	uint64_t tick;
+	struct text_stats stats;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: text_init(struct text *t, uint32_t scale)
+ * -----------------------
+ *  Rasterises the built-in 8x8 font at `scale` times its size into the atlas.
+ *
+ * t: Text renderer (struct text *)
+ * scale: Integer magnification, 1 = 8x8 pixel cells (uint32_t)
+ *
+ * returns: 0 on success, negative errno on failure (int)
+ */
+int text_init(struct text *t, uint32_t scale);
+
+/*
+ * Function: text_width(const struct text *t, const char *str)
+ * -----------------------
+ *  returns: Width in pixels of the longest line of `str` (uint32_t)
+ */
+uint32_t text_width(const struct text *t, const char *str);
+
+/*
+ * Function: text_draw(struct text *t, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height, int32_t x, int32_t y, const char *str, uint32_t color, const struct damage *clip)
+ * -----------------------
+ *  Draws `str` with its top left corner at (`x`, `y`), '\n' starts a new line
+ *  cell_h pixels lower. Only the set pixels of the glyphs are written,
+ *  whatever is behind the text stays.
+ *
+ * map: Destination XRGB8888 buffer (uint8_t *)
+ * pitch: Bytes per row of the destination (uint32_t)
+ * clip: Only pixels inside these rectangles are written, NULL for the whole buffer (const struct damage *)
+ *
+ * returns: 0 on success, -ENOMEM if a line could not be laid out (int)
+ */
+int text_draw(struct text *t, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height,
+		int32_t x, int32_t y, const char *str, uint32_t color, const struct damage *clip);
+
+/*
+ * Function: text_mask(struct text *t, const char *str, uint32_t length, uint32_t *width, uint32_t *pitch)
+ * -----------------------
+ *  Lays out the first `length` characters of `str` as one line, '\n' is not
+ *  special here, for callers drawing the mask themselves (raster_mask()).
+ *  The mask is cell_h rows and stays valid until the line is evicted, by
+ *  any later text_draw() or text_mask().
+ *
+ * width: Set to the width of the line in pixels (uint32_t *)
+ * pitch: Set to the bytes per mask row (uint32_t *)
+ *
+ * returns: The mask, NULL if out of memory (const uint8_t *)
+ */
+const uint8_t *text_mask(struct text *t, const char *str, uint32_t length, uint32_t *width, uint32_t *pitch);
+
+/*
+ * Function: text_destroy(struct text *t)
+ * -----------------------
+ *  Frees the atlas and the line cache.
+ */
+void text_destroy(struct text *t);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+
+/*
+ * font8x8_basic by Daniel Hepper, public domain.
+ * One byte per row, the LSB is the leftmost pixel.
+ */
+static const uint8_t text_font8x8[TEXT_GLYPH_COUNT][8] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* ' ' */
+	{ 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },	/* '!' */
+	{ 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '"' */
+	{ 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },	/* '#' */
+	{ 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },	/* '$' */
+	{ 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },	/* '%' */
+	{ 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },	/* '&' */
+	{ 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* ''' */
+	{ 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },	/* '(' */
+	{ 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },	/* ')' */
+	{ 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },	/* '*' */
+	{ 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },	/* '+' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },	/* ',' */
+	{ 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },	/* '-' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },	/* '.' */
+	{ 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },	/* '/' */
+	{ 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },	/* '0' */
+	{ 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },	/* '1' */
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },	/* '2' */
+	{ 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },	/* '3' */
+	{ 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },	/* '4' */
+	{ 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },	/* '5' */
+	{ 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },	/* '6' */
+	{ 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },	/* '7' */
+	{ 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },	/* '8' */
+	{ 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },	/* '9' */
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },	/* ':' */
+	{ 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },	/* ';' */
+	{ 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },	/* '<' */
+	{ 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },	/* '=' */
+	{ 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },	/* '>' */
+	{ 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },	/* '?' */
+	{ 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },	/* '@' */
+	{ 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },	/* 'A' */
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },	/* 'B' */
+	{ 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },	/* 'C' */
+	{ 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },	/* 'D' */
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },	/* 'E' */
+	{ 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },	/* 'F' */
+	{ 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },	/* 'G' */
+	{ 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },	/* 'H' */
+	{ 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },	/* 'I' */
+	{ 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },	/* 'J' */
+	{ 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },	/* 'K' */
+	{ 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },	/* 'L' */
+	{ 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },	/* 'M' */
+	{ 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },	/* 'N' */
+	{ 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },	/* 'O' */
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },	/* 'P' */
+	{ 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },	/* 'Q' */
+	{ 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },	/* 'R' */
+	{ 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },	/* 'S' */
+	{ 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },	/* 'T' */
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },	/* 'U' */
+	{ 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },	/* 'V' */
+	{ 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },	/* 'W' */
+	{ 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },	/* 'X' */
+	{ 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },	/* 'Y' */
+	{ 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },	/* 'Z' */
+	{ 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },	/* '[' */
+	{ 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },	/* '\' */
+	{ 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },	/* ']' */
+	{ 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },	/* '^' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },	/* '_' */
+	{ 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '`' */
+	{ 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },	/* 'a' */
+	{ 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },	/* 'b' */
+	{ 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },	/* 'c' */
+	{ 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },	/* 'd' */
+	{ 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },	/* 'e' */
+	{ 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },	/* 'f' */
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },	/* 'g' */
+	{ 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },	/* 'h' */
+	{ 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },	/* 'i' */
+	{ 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },	/* 'j' */
+	{ 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },	/* 'k' */
+	{ 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },	/* 'l' */
+	{ 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },	/* 'm' */
+	{ 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },	/* 'n' */
+	{ 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },	/* 'o' */
+	{ 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },	/* 'p' */
+	{ 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },	/* 'q' */
+	{ 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },	/* 'r' */
+	{ 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },	/* 's' */
+	{ 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },	/* 't' */
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },	/* 'u' */
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },	/* 'v' */
+	{ 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },	/* 'w' */
+	{ 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },	/* 'x' */
+	{ 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },	/* 'y' */
+	{ 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },	/* 'z' */
+	{ 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },	/* '{' */
+	{ 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },	/* '|' */
+	{ 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },	/* '}' */
+	{ 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '~' */
+};
+
+static inline uint32_t text_glyph(char c)
+{
+	uint8_t g = (uint8_t)c - TEXT_FIRST_GLYPH;
+	return g < TEXT_GLYPH_COUNT ? g : '?' - TEXT_FIRST_GLYPH;
+}
+
+int text_init(struct text *t, uint32_t scale)
+{
+	memset(t, 0, sizeof(*t));
+
+	if (scale == 0)
+		return -EINVAL;
+
+	t->scale = scale;
+	t->cell_w = 8 * scale;
+	t->cell_h = 8 * scale;
+
+	t->atlas = calloc((size_t)TEXT_GLYPH_COUNT * t->cell_h, scale);
+	if (t->atlas == NULL)
+		return -ENOMEM;
+
+	/** every font pixel becomes a scale x scale block **/
+	for (uint32_t g = 0; g < TEXT_GLYPH_COUNT; ++g)
+		for (uint32_t y = 0; y < t->cell_h; ++y)
+		{
+			uint8_t src = text_font8x8[g][y / scale];
+			uint8_t *dst = t->atlas + ((size_t)g * t->cell_h + y) * scale;
+
+			for (uint32_t x = 0; x < t->cell_w; ++x)
+				if (src & (1u << (x / scale)))
+					dst[x / 8] |= 1u << (x % 8);
+		}
+
+	return 0;
+}
+
+uint32_t text_width(const struct text *t, const char *str)
+{
+	uint32_t widest = 0, length = 0;
+
+	for (;; ++str)
+	{
+		if (*str == '\n' || *str == '\0')
+		{
+			if (length > widest)
+				widest = length;
+			length = 0;
+
+			if (*str == '\0')
+				break;
+		}
+		else
+			length++;
+	}
+
+	return widest * t->cell_w;
+}
+
+static uint64_t text_hash(const char *str, uint32_t length)
+{
+	/** FNV-1a **/
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (uint32_t i = 0; i < length; ++i)
+		h = (h ^ (uint8_t)str[i]) * 0x100000001b3ull;
+
+	return h;
+}
+
+static void text_line_free(struct text_line *l)
+{
+	free(l->str);
+	free(l->bits);
+	memset(l, 0, sizeof(*l));
+}
+
+/*
+ * text_layout()
+ *
+ * Finds the mask of a line in the cache or builds it,
+ * replacing the least recently drawn line of its set when the set is full.
+ * returns: The line, NULL if out of memory.
+*/
+static struct text_line *text_layout(struct text *t, const char *str, uint32_t length)
+{
+	uint64_t hash = text_hash(str, length);
+	struct text_line *set = &t->lines[(hash & (TEXT_CACHE_LINES / TEXT_CACHE_WAYS - 1)) * TEXT_CACHE_WAYS];
+	struct text_line *victim = &set[0];
+
+	t->tick++;
+
+	for (int i = 0; i < TEXT_CACHE_WAYS; ++i)
+	{
+		struct text_line *l = &set[i];
+
+		if (l->last_used && l->hash == hash && l->length == length && !memcmp(l->str, str, length))
+		{
+			l->last_used = t->tick;
+			t->stats.hits++;
+			return l;
+		}
+
+		if (l->last_used < victim->last_used)
+			victim = l;
+	}
+
+	t->stats.misses++;
+	text_line_free(victim);
+
+	victim->str = malloc(length + 1);
+	victim->stride = length * t->scale;
+	victim->bits = malloc((size_t)victim->stride * t->cell_h);
+
+	if (victim->str == NULL || victim->bits == NULL)
+	{
+		text_line_free(victim);
+		return NULL;
+	}
+
+	memcpy(victim->str, str, length);
+	victim->str[length] = '\0';
+	victim->length = length;
+	victim->hash = hash;
+	victim->width = length * t->cell_w;
+	victim->last_used = t->tick;
+
+	/** cells are whole bytes wide, so a line row is its glyph rows one after the other **/
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		const uint8_t *glyph = t->atlas + (size_t)text_glyph(str[i]) * t->cell_h * t->scale;
+		uint8_t *cell = victim->bits + (size_t)i * t->scale;
+
+		for (uint32_t y = 0; y < t->cell_h; ++y, glyph += t->scale, cell += victim->stride)
+			for (uint32_t b = 0; b < t->scale; ++b)
+				cell[b] = glyph[b];
+	}
+
+	return victim;
+}
+
+/*
+ * text_blit()
+ *
+ * Draws the part of the line mask inside the rectangle x1, y1, x2, y2 (exclusive),
+ * which is already clipped to the buffer.
+*/
+static void text_blit(const struct text *t, const struct text_line *l, uint8_t *map, uint32_t pitch,
+		int32_t x, int32_t y, int32_t x1, int32_t y1, int32_t x2, int32_t y2, uint32_t color)
+{
+	if (x > x1) x1 = x;
+	if (y > y1) y1 = y;
+	if (x + (int32_t)l->width < x2) x2 = x + l->width;
+	if (y + (int32_t)t->cell_h < y2) y2 = y + t->cell_h;
+
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	uint32_t first = x1 - x;
+	uint32_t count = x2 - x1;
+
+	for (int32_t row = y1; row < y2; ++row)
+	{
+		const uint8_t *bits = l->bits + (size_t)(row - y) * l->stride;
+		uint32_t *dst = (uint32_t*)(map + (size_t)row * pitch) + x1;
+		uint32_t bit = first, left = count;
+
+		/** a clip edge inside a byte, step bit by bit up to the next byte **/
+		for (; (bit & 7) && left; ++bit, --left, ++dst)
+			if (bits[bit / 8] & (1u << (bit & 7)))
+				*dst = color;
+
+		if (left)
+			pixel_mask_row32(dst, bits + bit / 8, left, color);
+	}
+}
+
+int text_draw(struct text *t, uint8_t *map, uint32_t pitch, uint32_t width, uint32_t height,
+		int32_t x, int32_t y, const char *str, uint32_t color, const struct damage *clip)
+{
+	for (int32_t line_y = y; ; line_y += t->cell_h)
+	{
+		const char *end = strchr(str, '\n');
+		uint32_t length = end ? (uint32_t)(end - str) : (uint32_t)strlen(str);
+
+		/** lines above or below the buffer are not even laid out **/
+		if (length && line_y < (int32_t)height && line_y + (int32_t)t->cell_h > 0 && x < (int32_t)width)
+		{
+			struct text_line *l = text_layout(t, str, length);
+			if (l == NULL)
+				return -ENOMEM;
+
+			if (clip == NULL)
+				text_blit(t, l, map, pitch, x, line_y, 0, 0, width, height, color);
+			else
+				for (int i = 0; i < clip->count; ++i)
+				{
+					const struct damage_rect *r = &clip->rects[i];
+					text_blit(t, l, map, pitch, x, line_y,
+							r->x1 > 0 ? r->x1 : 0, r->y1 > 0 ? r->y1 : 0,
+							r->x2 < (int32_t)width ? r->x2 : (int32_t)width,
+							r->y2 < (int32_t)height ? r->y2 : (int32_t)height, color);
+				}
+		}
+
+		if (end == NULL)
+			break;
+
+		str = end + 1;
+	}
+
+	return 0;
+}
+
+const uint8_t *text_mask(struct text *t, const char *str, uint32_t length, uint32_t *width, uint32_t *pitch)
+{
+	struct text_line *l = length ? text_layout(t, str, length) : NULL;
+	if (l == NULL)
+		return NULL;
+
+	*width = l->width;
+	*pitch = l->stride;
+	return l->bits;
+}
+
+void text_destroy(struct text *t)
+{
+	for (int i = 0; i < TEXT_CACHE_LINES; ++i)
+		text_line_free(&t->lines[i]);
+
+	free(t->atlas);
+	t->atlas = NULL;
+}
+
+#endif // TEXT_H
@@ -0,0 +1,374 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "log.h"
+
+/** completed frames not yet folded into the histograms, power of 2 **/
+#ifndef TIMING_RING_SIZE
+	#define TIMING_RING_SIZE 256
+#endif // TIMING_RING_SIZE
+
+/*
+ * Histograms are log-linear like HdrHistogram: every power of 2 is split
+ * into 16 linear buckets, so any value is known within 1/16 (~6%)
+ * and 40 powers of 2 (up to ~18 minutes in ns) fit in 5 KiB.
+ */
+#define TIMING_HIST_SUB_BITS 5
+#define TIMING_HIST_HALF (1u << (TIMING_HIST_SUB_BITS - 1))
+#define TIMING_HIST_MAX_SHIFT 36
+#define TIMING_HIST_BUCKETS ((TIMING_HIST_MAX_SHIFT + 2) * TIMING_HIST_HALF)
+
+typedef enum {
+	TIMING_RENDER = 0,	/* render start -> render end */
+	TIMING_SUBMIT,			/* render end -> commit / page flip queued */
+	TIMING_FLIP,				/* queued -> flip completion event */
+	TIMING_FRAME,				/* flip -> next flip */
+	TIMING_INPUT,				/* evdev timestamp of the input shown -> flip completion */
+	TIMING_STAGE_COUNT
+} TIMING_STAGE;
+
+struct timing_hist
+{
+	uint64_t buckets[TIMING_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+struct timing_frame
+{
+	uint64_t render_start_ns;
+	uint64_t render_end_ns;
+	uint64_t submit_ns;
+	uint64_t flip_ns;
+	uint64_t interval_ns;	/* since the previous flip, 0 for the first one */
+	uint32_t vblanks;			/* refresh periods since the previous flip, 1 = none missed */
+	uint64_t input_ns;		/* oldest input the frame responds to, 0 = none */
+};
+
+struct timing
+{
+	uint64_t refresh_ns;
+
+	/** producer side, only touched by the thread presenting **/
+	struct timing_frame building;		/* being rendered */
+	struct timing_frame queued;			/* submitted, waiting for its flip */
+	bool have_queued;
+	uint64_t last_flip_ns;
+
+	/** single producer single consumer ring, the consumer can be any thread **/
+	struct timing_frame ring[TIMING_RING_SIZE];
+	_Atomic uint64_t head;		/* next slot written */
+	_Atomic uint64_t tail;		/* next slot read */
+	_Atomic uint64_t dropped;	/* frames lost to a full ring */
+
+	/** consumer side, filled by timing_collect() **/
+	struct timing_hist hist[TIMING_STAGE_COUNT];
+	uint64_t frames;
+	uint64_t missed_vblanks;
+};
+
+/********************************************
+ * 							DECLARATION
+********************************************/
+
+/*
+ * Function: timing_init(struct timing *t, uint64_t refresh_ns)
+ * -----------------------
+ *  Resets every counter.
+ *
+ * t: Timing state (struct timing *)
+ * refresh_ns: Length of a refresh period, to count missed vblanks (uint64_t)
+ */
+void timing_init(struct timing *t, uint64_t refresh_ns);
+
+/*
+ * Function: timing_now()
+ * -----------------------
+ *  returns: CLOCK_MONOTONIC in ns, the clock of the flip events (uint64_t)
+ */
+uint64_t timing_now();
+
+/*
+ * Function: timing_render_start(struct timing *t)
+ * -----------------------
+ *  A new frame starts rendering.
+ */
+void timing_render_start(struct timing *t);
+
+/*
+ * Function: timing_render_end(struct timing *t)
+ * -----------------------
+ *  The frame is drawn.
+ */
+void timing_render_end(struct timing *t);
+
+/*
+ * Function: timing_input(struct timing *t, uint64_t input_ns)
+ * -----------------------
+ *  The frame being rendered shows the response to an input event stamped
+ *  `input_ns` (CLOCK_MONOTONIC), its flip completes the input-to-photon time.
+ *  Of several events the oldest counts.
+ */
+void timing_input(struct timing *t, uint64_t input_ns);
+
+/*
+ * Function: timing_submit(struct timing *t)
+ * -----------------------
+ *  The frame was queued for scanout.
+ */
+void timing_submit(struct timing *t);
+
+/*
+ * Function: timing_flip(struct timing *t, uint64_t flip_ns)
+ * -----------------------
+ *  The queued frame reached the screen at `flip_ns` (CLOCK_MONOTONIC),
+ *  the frame is complete and pushed to the ring.
+ */
+void timing_flip(struct timing *t, uint64_t flip_ns);
+
+/*
+ * Function: timing_collect(struct timing *t)
+ * -----------------------
+ *  Folds the completed frames into the histograms.
+ *  May run on another thread than the producer, one consumer at a time.
+ *
+ * returns: Number of frames collected (int)
+ */
+int timing_collect(struct timing *t);
+
+/*
+ * Function: timing_percentile(const struct timing *t, TIMING_STAGE stage, double q)
+ * -----------------------
+ *  returns: Upper bound of the `q` (0 - 1) quantile of `stage` in ns, 0 if empty (uint64_t)
+ */
+uint64_t timing_percentile(const struct timing *t, TIMING_STAGE stage, double q);
+
+/*
+ * Function: timing_stage_name(TIMING_STAGE stage)
+ * -----------------------
+ *  returns: Printable name (const char *)
+ */
+const char *timing_stage_name(TIMING_STAGE stage);
+
+/*
+ * Function: timing_report(struct timing *t, const char *name)
+ * -----------------------
+ *  Collects and prints p50 / p99 / p999 of every stage and the missed vblanks.
+ */
+void timing_report(struct timing *t, const char *name);
+
+/********************************************
+ * 						   DEFINITION
+********************************************/
+static inline uint32_t timing_bucket(uint64_t v)
+{
+	if (v < 2 * TIMING_HIST_HALF)
+		return v;
+
+	uint32_t shift = (63 - __builtin_clzll(v)) - TIMING_HIST_SUB_BITS + 1;
+	if (shift > TIMING_HIST_MAX_SHIFT)
+		return TIMING_HIST_BUCKETS - 1;
+
+	return shift * TIMING_HIST_HALF + (v >> shift);
+}
+
+static inline uint64_t timing_bucket_upper(uint32_t index)
+{
+	if (index < 2 * TIMING_HIST_HALF)
+		return index;
+
+	uint32_t shift = index / TIMING_HIST_HALF - 1;
+	uint64_t mantissa = index - shift * TIMING_HIST_HALF;
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+static void timing_hist_add(struct timing_hist *h, uint64_t v)
+{
+	h->buckets[timing_bucket(v)]++;
+
+	if (h->count == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+
+	h->count++;
+	h->sum += v;
+}
+
+void timing_init(struct timing *t, uint64_t refresh_ns)
+{
+	memset(t, 0, sizeof(*t));
+	t->refresh_ns = refresh_ns;
+}
+
+uint64_t timing_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void timing_render_start(struct timing *t)
+{
+	memset(&t->building, 0, sizeof(t->building));
+	t->building.render_start_ns = timing_now();
+}
+
+void timing_render_end(struct timing *t)
+{
+	t->building.render_end_ns = timing_now();
+}
+
+void timing_input(struct timing *t, uint64_t input_ns)
+{
+	if (t->building.input_ns == 0 || input_ns < t->building.input_ns)
+		t->building.input_ns = input_ns;
+}
+
+void timing_submit(struct timing *t)
+{
+	/** a frame queued without flip event (the legacy mode set) is dropped here **/
+	t->building.submit_ns = timing_now();
+	t->queued = t->building;
+	t->have_queued = true;
+}
+
+void timing_flip(struct timing *t, uint64_t flip_ns)
+{
+	uint64_t interval = t->last_flip_ns && flip_ns > t->last_flip_ns ? flip_ns - t->last_flip_ns : 0;
+	uint32_t vblanks = 1;
+
+	/** rounded, the timestamps of a late flip jitter around the vblank **/
+	if (interval && t->refresh_ns)
+		vblanks = (interval + t->refresh_ns / 2) / t->refresh_ns;
+
+	t->last_flip_ns = flip_ns;
+
+	if (!t->have_queued)
+		return;
+
+	t->have_queued = false;
+	t->queued.flip_ns = flip_ns;
+	t->queued.interval_ns = interval;
+	t->queued.vblanks = vblanks;
+
+	uint64_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&t->tail, memory_order_acquire);
+
+	if (head - tail >= TIMING_RING_SIZE)
+	{
+		atomic_fetch_add_explicit(&t->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	t->ring[head & (TIMING_RING_SIZE - 1)] = t->queued;
+	atomic_store_explicit(&t->head, head + 1, memory_order_release);
+}
+
+int timing_collect(struct timing *t)
+{
+	uint64_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+	int collected = 0;
+
+	for (; tail != head; ++tail, ++collected)
+	{
+		const struct timing_frame *f = &t->ring[tail & (TIMING_RING_SIZE - 1)];
+
+		/** frames rendered outside of timing_render_start() only have their flip **/
+		if (f->render_start_ns && f->render_end_ns >= f->render_start_ns)
+			timing_hist_add(&t->hist[TIMING_RENDER], f->render_end_ns - f->render_start_ns);
+
+		if (f->render_end_ns && f->submit_ns >= f->render_end_ns)
+			timing_hist_add(&t->hist[TIMING_SUBMIT], f->submit_ns - f->render_end_ns);
+
+		if (f->flip_ns >= f->submit_ns)
+			timing_hist_add(&t->hist[TIMING_FLIP], f->flip_ns - f->submit_ns);
+
+		if (f->interval_ns)
+			timing_hist_add(&t->hist[TIMING_FRAME], f->interval_ns);
+
+		if (f->input_ns && f->flip_ns >= f->input_ns)
+			timing_hist_add(&t->hist[TIMING_INPUT], f->flip_ns - f->input_ns);
+
+		if (f->vblanks > 1)
+			t->missed_vblanks += f->vblanks - 1;
+
+		t->frames++;
+	}
+
+	atomic_store_explicit(&t->tail, tail, memory_order_release);
+
+	return collected;
+}
+
+uint64_t timing_percentile(const struct timing *t, TIMING_STAGE stage, double q)
+{
+	const struct timing_hist *h = &t->hist[stage];
+
+	if (h->count == 0)
+		return 0;
+
+	uint64_t target = (uint64_t)(q * h->count + 0.5);
+	if (target == 0)
+		target = 1;
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < TIMING_HIST_BUCKETS; ++i)
+	{
+		seen += h->buckets[i];
+		if (seen >= target)
+		{
+			uint64_t upper = timing_bucket_upper(i);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+
+	return h->max;
+}
+
+const char *timing_stage_name(TIMING_STAGE stage)
+{
+	switch (stage)
+	{
+		case TIMING_RENDER: return "render";
+		case TIMING_SUBMIT: return "submit";
+		case TIMING_FLIP: return "flip";
+		case TIMING_FRAME: return "frame";
+		case TIMING_INPUT: return "input";
+		default: return "unknown";
+	}
+}
+
+void timing_report(struct timing *t, const char *name)
+{
+	timing_collect(t);
+
+	for (int s = 0; s < TIMING_STAGE_COUNT; ++s)
+	{
+		const struct timing_hist *h = &t->hist[s];
+		if (h->count == 0)
+			continue;
+
+		INFO("%s %-6s p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms  max %8.3f ms",
+				name, timing_stage_name((TIMING_STAGE)s),
+				timing_percentile(t, (TIMING_STAGE)s, 0.5) / 1e6,
+				timing_percentile(t, (TIMING_STAGE)s, 0.99) / 1e6,
+				timing_percentile(t, (TIMING_STAGE)s, 0.999) / 1e6,
+				h->max / 1e6);
+	}
+
+	INFO("%s missed %lu vblanks in %lu frames (%lu samples dropped)",
+			name, t->missed_vblanks, t->frames, atomic_load(&t->dropped));
+}
+
+#endif // TIMING_H